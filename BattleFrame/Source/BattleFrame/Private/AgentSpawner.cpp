@@ -26,6 +26,7 @@
 #include "AnimToTextureDataAsset.h"
 #include "NiagaraSubjectRenderer.h"
 #include "BattleFrameFunctionLibraryRT.h"
+#include "BattleFrameRandom.h"
 #include "Traits/Activated.h"
 #include "SubjectHandle.h"
 
@@ -172,15 +173,17 @@ TArray<FSubjectHandle> AAgentSpawner::SpawnAgentsRectangular
         auto& Moving = Config.GetTraitRef<FMoving>();
         auto& Patrol = Config.GetTraitRef<FPatrol>();
 
-        float RandomX = FMath::RandRange(-Region.X / 2, Region.X / 2);
-        float RandomY = FMath::RandRange(-Region.Y / 2, Region.Y / 2);
+        FRandomStream& Stream = FBattleFrameRandom::GameThreadStream();
+
+        float RandomX = Stream.FRandRange(-Region.X / 2, Region.X / 2);
+        float RandomY = Stream.FRandRange(-Region.Y / 2, Region.Y / 2);
 
         FVector SpawnPoint2D = Origin + FVector(RandomX, RandomY, 0);
         FVector SpawnPoint3D;
 
         if (Move.bCanFly)
         {
-            Moving.FlyingHeight = FMath::RandRange(Move.FlyHeightRange.X, Move.FlyHeightRange.Y);
+            Moving.FlyingHeight = Stream.FRandRange(Move.FlyHeightRange.X, Move.FlyHeightRange.Y);
             SpawnPoint3D = FVector(SpawnPoint2D.X, SpawnPoint2D.Y, Moving.FlyingHeight + GetActorLocation().Z);
         }
         else
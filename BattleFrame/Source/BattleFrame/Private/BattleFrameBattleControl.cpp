@@ -8,6 +8,9 @@
 #include "Kismet/GameplayStatics.h"
 #include "HAL/ThreadManager.h"
 #include "EngineUtils.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
 
 // Niagara 插件
 #include "NiagaraDataInterfaceArrayFunctionLibrary.h"
@@ -17,10 +20,26 @@
 
 // FlowFieldCanvas 插件
 #include "FlowField.h"
+#include "FlowFieldCache.h"
 
 // BattleFrame 插件
 #include "NeighborGridActor.h"
 #include "NeighborGridComponent.h"
+#include "BattleFrameFrameArena.h"
+#include "BattleFrameScheduler.h"
+#include "BattleFrameSystemGraph.h"
+#include "BattleFrameProfiler.h"
+#include "Traits/Avoiding.h"
+#include "Traits/BoxObstacle.h"
+#include "Traits/RegisterMultiple.h"
+
+// 系统作用域：性能追踪 + 帧内存统计 + 自适应分块
+#define BATTLEFRAME_SYSTEM_SCOPE(Name) \
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR(Name); \
+	static const int32 PREPROCESSOR_JOIN(SystemIndex, __LINE__) = FBattleFrameFrameArena::RegisterSystem(TEXT(Name)); \
+	FFrameArenaSystemScope PREPROCESSOR_JOIN(ArenaSystemScope, __LINE__)(PREPROCESSOR_JOIN(SystemIndex, __LINE__)); \
+	FSchedulerSystemScope PREPROCESSOR_JOIN(SchedulerSystemScope, __LINE__)(PREPROCESSOR_JOIN(SystemIndex, __LINE__), TEXT(Name)); \
+	const int32 BattleFrameSystemIndex = PREPROCESSOR_JOIN(SystemIndex, __LINE__)
 
 
 ABattleFrameBattleControl* ABattleFrameBattleControl::Instance = nullptr;
@@ -45,6 +64,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 	if (UNLIKELY(CurrentWorld))
 	{
 		Mechanism = UMachine::ObtainMechanism(CurrentWorld);
+		FlowFieldCache = bUseFlowFieldCache ? CurrentWorld->GetSubsystem<UFlowFieldCache>() : nullptr;
 
 		NeighborGrids.Reset(); // to do : add in multiple grid support
 
@@ -61,39 +81,58 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 	if (UNLIKELY(bGamePaused || !CurrentWorld || !Mechanism || NeighborGrids.IsEmpty())) return;
 
+	// 帧内存统计按帧滚动
+	FBattleFrameFrameArena::BeginFrame();
+	FBattleFrameScheduler::Configure(bAdaptiveBatching, AdaptiveChunkMicros, AdaptiveMinChunkSize, bCollectSchedulerMetrics);
+	FBattleFrameProfiler::SetEnabled(bEnableProfiler);
+	FBattleFrameProfiler::BeginFrame();
+	FBattleFrameRandom::BeginFrame();
+
 	float SafeDeltaTime = FMath::Clamp(DeltaTime, 0, 0.0333f);
 
+	// 各系统声明读写的Trait，由依赖图决定执行顺序 | Systems declare the traits they touch, the graph orders them
+	SystemGraph.Reset();
 
 	//--------------------数据统计 | Statistics----------------------
 
 	// 统计Agent数量 | Agent Counter
 	#pragma region
+	SystemGraph.AddSystem(TEXT("Agent Count"), FSystemAccess()
+		.Read<FAgent>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("Agent Count");
+		BATTLEFRAME_SYSTEM_SCOPE("Agent Count");
 
 		auto Chain = Mechanism->Enchain(AgentCountFilter);
 		AgentCount = Chain->IterableNum();
 		Chain->Reset(true);
-	}
+	});
 	#pragma endregion
 
 	// 统计游戏时长 | Game Time Counter
 	#pragma region
+	SystemGraph.AddSystem(TEXT("Agent Age"), FSystemAccess()
+		.Write<FStatistics>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("Agent Age");
+		BATTLEFRAME_SYSTEM_SCOPE("Agent Age");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentAgeFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
 
 		Chain->OperateConcurrently([&](FStatistics& Stats)
 		{
+			BATTLEFRAME_WORKER_PROBE();
 			if (Stats.bEnable)
 			{
 				Stats.totalTime += SafeDeltaTime;
 			}
 
 		}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 
@@ -101,8 +140,16 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 	// 出生总 | Appear Main
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentAppearMain"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FLocated, FDirected>()
+		.Write<FAppear, FAppearing, FAnimation, FAppearAnim, FAppearDissolve>()
+		.Append<FActorSpawnConfig, FFxConfig, FSoundConfig>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentAppearMain");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentAppearMain");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentAppeaFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -115,6 +162,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FAppearing& Appearing,
 				FAnimation& Animation)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				// Initial execute
 				if (Appearing.time == 0)
 				{
@@ -172,13 +220,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				Appearing.time += SafeDeltaTime;
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 出生动画 | Birth Anim
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentAppearAnim"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FAppear>()
+		.Write<FAnimation, FAppearAnim>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentAppearAnim");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentAppearAnim");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentAppearAnimFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -189,6 +244,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FAppear& Appear,
 				FAppearAnim& AppearAnim)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				if (AppearAnim.animTime == 0)
 				{
 					// 状态机
@@ -204,13 +260,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				AppearAnim.animTime += SafeDeltaTime;
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 出生淡入 | Dissolve In
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentAppearDissolve"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FCurves>()
+		.Write<FAnimation, FAppearDissolve>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentAppearDissolve");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentAppearDissolve");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentAppearDissolveFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -221,6 +284,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FAppearDissolve& AppearDissolve,
 				FCurves& Curves)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				const auto Curve = Curves.DissolveIn.GetRichCurve();
 				const auto EndTime = Curve->GetLastKey().Time;
 				Animation.Dissolve = 1 - Curve->Eval(FMath::Clamp(AppearDissolve.dissolveTime, 0, EndTime));
@@ -233,7 +297,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				AppearDissolve.dissolveTime += SafeDeltaTime;
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 
@@ -241,8 +305,17 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 	// 索敌 | Trace
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentTrace"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FLocated, FDirected, FCollider, FAppearing, FAttacking, FDying>()
+		.Write<FTrace, FSleep, FPatrol, FSleeping, FPatrolling>()
+		.ReadResource(TEXT("NeighborGrid"))
+		.SyncPoint(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentTrace");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentTrace");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		// Trace Player 0
 		bool bPlayerIsValid = false;
@@ -279,6 +352,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 		// A workaround. Apparatus does not expose the array of iterables, so we have to gather manually
 		Chain->OperateConcurrently([&](FSolidSubjectHandle Subject, FTrace& Trace)
 		{
+			BATTLEFRAME_WORKER_PROBE();
 			if (!Trace.bEnable)
 			{
 				Trace.TraceResult = FSubjectHandle();
@@ -319,6 +393,33 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 			ValidSubjects.Append(CurrentArray.Subjects);
 		}
 
+		// 批量扇形检测：先收集查询，检测完再写回结果
+		TArray<FSectorTraceQuery> SectorQueries;
+		TArray<UNeighborGridComponent*> SectorQueryGrids;
+
+		if (bBatchSectorTrace)
+		{
+			SectorQueries.SetNum(ValidSubjects.Num());
+			SectorQueryGrids.SetNumZeroed(ValidSubjects.Num());
+		}
+
+		// 找到目标后结束睡眠和巡逻
+		auto WakeOnTarget = [](FSolidSubjectHandle Subject, const FTrace& Trace)
+		{
+			if (Trace.TraceResult.IsValid())
+			{
+				if (Subject.HasTrait<FSleeping>())
+				{
+					Subject.RemoveTraitDeferred<FSleeping>();
+				}
+
+				if (Subject.HasTrait<FPatrolling>())
+				{
+					Subject.RemoveTraitDeferred<FPatrolling>();
+				}
+			}
+		};
+
 		// 并行处理筛选结果
 		ParallelFor(ValidSubjects.Num(), [&](int32 Index)
 		{
@@ -414,10 +515,35 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 						TargetFilter.Include(Trace.IncludeTraits);
 						TargetFilter.Exclude(Trace.ExcludeTraits);
 
+						// 目标限定的队伍，邻居网格开启 bTeamLayers 时只遍历这些层
+						const uint16 TargetTeamMask = UBattleFrameFunctionLibraryRT::GetTeamMaskFromTraits(Trace.IncludeTraits);
+
 						// 使用扇形检测替换球体检测
 						const FVector TraceDirection = Directed.Direction.GetSafeNormal2D();
 						const float TraceHeight = Collider.Radius * 2.0f; // 根据实际需求调整高度
 
+						if (bBatchSectorTrace)
+						{
+							FSectorTraceQuery& Query = SectorQueries[Index];
+							Query.Origin = Located.Location;
+							Query.Radius = FinalRange;
+							Query.Height = TraceHeight;
+							Query.Direction = TraceDirection;
+							Query.Angle = FinalAngle;
+							Query.bCheckVisibility = FinalCheckVisibility;
+							Query.CheckOrigin = Located.Location;
+							Query.CheckRadius = Collider.Radius;
+							Query.SortMode = ESortMode::NearToFar;
+							Query.SortOrigin = Located.Location;
+							Query.KeepCount = 1;
+							Query.IgnoreSubject = FSubjectHandle(Subject);
+							Query.Filter = TargetFilter;
+							Query.TeamMask = TargetTeamMask;
+
+							SectorQueryGrids[Index] = Trace.NeighborGrid;
+							return;
+						}
+
 						// ignore self
 						FSubjectArray IgnoreList;
 						IgnoreList.Subjects.Add(FSubjectHandle(Subject));
@@ -438,7 +564,8 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 							IgnoreList,
 							TargetFilter,       // 过滤条件
 							Hit,
-							Results              // 输出结果
+							Results,             // 输出结果
+							TargetTeamMask
 						);
 
 						// 直接使用结果（扇形检测已包含角度验证）
@@ -452,28 +579,67 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 			}
 
 			// if we have a valid target, we stop sleeping or patrolling
-			if (Trace.TraceResult.IsValid())
+			WakeOnTarget(Subject, Trace);
+		});
+
+		if (bBatchSectorTrace)
+		{
+			// 按邻居网格分组，通常只有一个
+			TMap<UNeighborGridComponent*, TArray<int32>> QueriesByGrid;
+
+			for (int32 Index = 0; Index < SectorQueryGrids.Num(); ++Index)
 			{
-				if (bIsSleeping)
+				if (SectorQueryGrids[Index])
 				{
-					Subject.RemoveTraitDeferred<FSleeping>();
+					QueriesByGrid.FindOrAdd(SectorQueryGrids[Index]).Add(Index);
 				}
+			}
 
-				if (bIsPatrolling)
+			for (const TPair<UNeighborGridComponent*, TArray<int32>>& Pair : QueriesByGrid)
+			{
+				const TArray<int32>& SubjectIndices = Pair.Value;
+
+				TArray<FSectorTraceQuery> GridQueries;
+				GridQueries.Reserve(SubjectIndices.Num());
+
+				for (const int32 Index : SubjectIndices)
 				{
-					Subject.RemoveTraitDeferred<FPatrolling>();
+					GridQueries.Add(SectorQueries[Index]);
 				}
+
+				TArray<FTraceResult> Results;
+				TArray<int32> Offsets;
+				Pair.Key->SectorTraceForSubjectsBatch(GridQueries, Results, Offsets);
+
+				ParallelFor(SubjectIndices.Num(), [&](int32 k)
+				{
+					FSolidSubjectHandle Subject = ValidSubjects[SubjectIndices[k]];
+					FTrace& Trace = Subject.GetTraitRef<FTrace>();
+
+					// 扇形检测已包含角度验证
+					const bool bHit = Offsets[k + 1] > Offsets[k];
+					Trace.TraceResult = bHit ? Results[Offsets[k]].Subject : FSubjectHandle();
+
+					WakeOnTarget(Subject, Trace);
+				});
 			}
-		});
+		}
 
 		Mechanism->ApplyDeferreds();
-	}
+	});
 	#pragma endregion
 
 	// 攻击触发 | Trigger Attack
-	#pragma region 
+	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentAttackMain"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FLocated, FDirected, FAttack, FTrace, FCollider, FHealth, FAppearing, FSleeping, FPatrolling, FDying>()
+		.Write<FAttacking>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentAttackMain");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentAttackMain");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentAttackFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -486,6 +652,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FTrace& Trace,
 				FCollider& Collider)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				if (!Attack.bEnable) return;
 
 				if (Trace.TraceResult.IsValid())
@@ -510,13 +677,22 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 攻击过程 | Do Attack
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentAttacking"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FLocated, FAttack, FDirected, FDebuff, FDamage, FDefence, FMove, FCollider, FTextPopUp, FAppearing, FSleeping, FPatrolling, FDying>()
+		.Write<FAnimation, FAttacking, FMoving, FTrace, FHealth, FBurning, FFreezing, FSleep, FHit, FHitGlow, FJiggle>()
+		.Append<FActorSpawnConfig, FFxConfig, FSoundConfig, FPoppingText, FTemporalDamaging>()
+		.AppendResource(TEXT("DamageResultQueue")),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentAttacking");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentAttacking");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentAttackingFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -535,6 +711,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FDamage& Damage,
 				FDefence& Defence)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				// First Execute
 				if (UNLIKELY(Attacking.Time == 0))
 				{
@@ -642,7 +819,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 
@@ -650,8 +827,15 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 	// 受击发光 | Glow
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentHitGlow"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FCurves>()
+		.Write<FAnimation, FHitGlow>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentHitGlow");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentHitGlow");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentHitGlowFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -662,6 +846,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FHitGlow& HitGlow,
 				FCurves& Curves)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				// 获取曲线
 				auto Curve = Curves.HitEmission.GetRichCurve();
 
@@ -704,13 +889,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 怪物受击形变 | Squeeze Squash
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentJiggle"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FCurves, FHit>()
+		.Write<FScaled, FJiggle>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentJiggle");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentJiggle");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentJiggleFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -722,6 +914,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FHit& Hit,
 				FCurves& Curves)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				// 获取曲线
 				auto Curve = Curves.HitJiggle.GetRichCurve();
 
@@ -772,13 +965,21 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 灼烧持续掉血 | Burn Temporal Damage
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentBurning"), FSystemAccess()
+		.Read<FTextPopUp, FCollider, FLocated>()
+		.Write<FTemporalDamaging, FAnimation, FBurning, FHealth>()
+		.Append<FPoppingText>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentBurning");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentBurning");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentBurningFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -786,6 +987,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 		Chain->OperateConcurrently(
 			[&](FSolidSubjectHandle Subject, FTemporalDamaging& Temporal)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				// 持续伤害结束或玩家退出，终止执行
 				if (Temporal.RemainingTemporalDamage <= 0)
 				{
@@ -904,13 +1106,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 					}
 				}
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 冰冻减速 | Freeze Slowing
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentFrozen"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FDying>()
+		.Write<FAnimation, FFreezing>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentFrozen");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentFrozen");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentFrozenFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -920,6 +1129,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FAnimation& Animation,
 				FFreezing& Freezing)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				// 更新计时器
 				if (Freezing.FreezeTimeout > 0.f)
 				{
@@ -938,13 +1148,21 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 结算伤害 | Settle Damage
 	#pragma region
+	SystemGraph.AddSystem(TEXT("DecideDamage"), FSystemAccess()
+		.Read<FAgent, FLocated>()
+		.Write<FHealth, FStatistics, FMove, FDying>()
+		.Append<FActorSpawnConfig, FFxConfig, FSoundConfig, FPoppingText>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("DecideDamage");
+		BATTLEFRAME_SYSTEM_SCOPE("DecideDamage");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(DecideDamageFilter);// it processes hero and prop type too
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -954,6 +1172,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FHealth& Health,
 				FLocated& Located)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				while (!Health.DamageToTake.IsEmpty() && !Health.DamageInstigator.IsEmpty())
 				{
 					// 如果怪物死了，跳出循环
@@ -1024,13 +1243,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 					Health.Current -= FMath::Min(damageToTake, Health.Current);
 				}
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 更新血条 | Update HealthBar
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentHealthBar"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FHealth>()
+		.Write<FHealthBar>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentHealthBar");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentHealthBar");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentHealthBarFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -1040,6 +1266,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FHealth Health,
 				FHealthBar& HealthBar)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				if (HealthBar.bShowHealthBar)
 				{
 					HealthBar.TargetRatio = FMath::Clamp(Health.Current / Health.Maximum, 0, 1);
@@ -1071,7 +1298,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 					HealthBar.Opacity = 0;
 				}
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 
@@ -1079,8 +1306,16 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 	// 死亡总 | Death Main
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentDeathMain"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FDeath, FLocated, FDirected, FTrace, FMove, FMoving>()
+		.Write<FDying, FAttacking, FCorpse, FDeathAnim, FDeathDissolve>()
+		.Append<FActorSpawnConfig, FFxConfig, FSoundConfig>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentDeathMain");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentDeathMain");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentDeathFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -1095,6 +1330,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FMove& Move,
 				FMoving& Moving)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				if (!Death.bEnable) return;
 
 				if (Dying.Time == 0)
@@ -1153,13 +1389,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				Dying.Time += SafeDeltaTime;
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 死亡消融 | Death Dissolve
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentDeathDissolve"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FDying, FDeath, FCurves>()
+		.Write<FAnimation, FDeathDissolve>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentDeathDissolve");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentDeathDissolve");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentDeathDissolveFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -1171,6 +1414,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FDeath& Death,
 				FCurves& Curves)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				// 获取曲线
 				auto Curve = Curves.DissolveOut.GetRichCurve();
 
@@ -1203,13 +1447,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				DeathDissolve.dissolveTime += SafeDeltaTime;
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 死亡动画 | Death Anim
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentDeathAnim"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FDying>()
+		.Write<FAnimation, FDeathAnim>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentDeathAnim");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentDeathAnim");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentDeathAnimFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -1219,6 +1470,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FAnimation& Animation,
 				FDeathAnim& DeathAnim)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				if (DeathAnim.animTime == 0)
 				{
 					Animation.SubjectState = ESubjectState::Dying;
@@ -1228,7 +1480,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				DeathAnim.animTime += SafeDeltaTime;
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 
@@ -1236,8 +1488,16 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 	// 速度覆盖 | Override Max Speed
 	#pragma region
+	SystemGraph.AddSystem(TEXT("SpeedLimitOverride"), FSystemAccess()
+		.Read<FCollider, FLocated>()
+		.Write<FSphereObstacle, FMoving>()
+		.ReadResource(TEXT("NeighborGrid")),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SpeedLimitOverride");
+		BATTLEFRAME_SYSTEM_SCOPE("SpeedLimitOverride");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(SpeedLimitOverrideFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -1247,6 +1507,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FLocated Located,
 				FSphereObstacle& SphereObstacle)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				if (UNLIKELY(!IsValid(SphereObstacle.NeighborGrid))) return;
 
 				if (!SphereObstacle.bOverrideSpeedLimit) return;
@@ -1306,13 +1567,21 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 巡逻 | Patrol
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentPatrol"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FCollider, FLocated, FTrace, FAppearing, FSleeping, FAttacking, FDying>()
+		.Write<FPatrol, FMove, FPatrolling>()
+		.ReadResource(TEXT("NeighborGrid")),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentPatrol");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentPatrol");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentPatrolFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -1343,6 +1612,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FCollider& Collider,
 				FMove& Move)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				if (!Patrol.bEnable) return;
 
 				// 巡逻逻辑
@@ -1392,13 +1662,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 加载流场 | Load Flow Field
 	#pragma region
+	SystemGraph.AddSystem(TEXT("LoadFlowfield"), FSystemAccess()
+		.Write<FNavigation, FBindFlowField>()
+		.GameThread(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("LoadFlowfield");
+		BATTLEFRAME_SYSTEM_SCOPE("LoadFlowfield");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		FFilter Filter1 = FFilter::Make<FNavigation>();
 		auto Chain1 = Mechanism->EnchainSolid(Filter1);
@@ -1409,6 +1686,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 			[&](FSolidSubjectHandle Subject,
 				FNavigation& Navigation)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				Subject.SetFlag(ReloadFlowFieldFlag, false);
 
 				if (UNLIKELY(Navigation.FlowFieldToUse != Navigation.PreviousFlowFieldToUse))
@@ -1439,6 +1717,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 			[&](FSolidSubjectHandle Subject,
 				FBindFlowField& BindFlowField)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				Subject.SetFlag(ReloadFlowFieldFlag, false);
 
 				if (UNLIKELY(BindFlowField.FlowFieldToBind != BindFlowField.PreviousFlowFieldToBind))
@@ -1460,13 +1739,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				BindFlowField.FlowField = BindFlowField.FlowFieldToBind.LoadSynchronous();
 			});
 
-	}
+	});
 	#pragma endregion
 
 	// 移动 | Move
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentMove"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FAnimation, FAttack, FTrace, FNavigation, FAvoidance, FCollider, FDefence, FPatrol, FAttacking, FBindFlowField, FFreezing, FAppearing, FSleeping, FPatrolling, FDying>()
+		.Write<FMove, FMoving, FDirected, FLocated>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentMove");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentMove");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentMoveFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -1486,6 +1772,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FDefence& Defence,
 				FPatrol& Patrol)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				//if (!Move.bEnable) return;
 
 				// 死亡区域检测
@@ -1517,9 +1804,9 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				Moving.ActiveSpeedMult = 1;
 				Moving.PassiveSpeedMult = 1;
 
-				// 默认流场, 必须获取因为之后要用到地面高度
-				FCellStruct Cell_BaseFF = FCellStruct{};
-				bool bInside_BaseFF = Navigation.FlowField->GetCellAtLocation(AgentLocation, Cell_BaseFF);
+				// 默认流场, 必须获取因为之后要用到地面高度（只取格子下标，各通道按需读取）
+				int32 CellIndex_BaseFF = INDEX_NONE;
+				bool bInside_BaseFF = Navigation.FlowField->GetCellIndexAtLocation(AgentLocation, CellIndex_BaseFF);
 
 
 				//----------------------------- 寻路 ----------------------------//
@@ -1537,7 +1824,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 							if (bInside_BaseFF)
 							{
 								Move.Goal = Navigation.FlowField->goalLocation;
-								DesiredMoveDirection = Cell_BaseFF.dir.GetSafeNormal2D();
+								DesiredMoveDirection = Navigation.FlowField->SampleDirection(AgentLocation);
 							}
 							else
 							{
@@ -1571,13 +1858,13 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 								if (IsValid(BindFlowField)) // 从目标获取指向目标的流场
 								{
-									FCellStruct Cell_TargetFF = FCellStruct{};
-									bool bInside_TargetFF = BindFlowField->GetCellAtLocation(AgentLocation, Cell_TargetFF);
+									int32 CellIndex_TargetFF = INDEX_NONE;
+									bool bInside_TargetFF = BindFlowField->GetCellIndexAtLocation(AgentLocation, CellIndex_TargetFF);
 
 									if (bInside_TargetFF)
 									{
 										Move.Goal = BindFlowField->goalLocation;
-										DesiredMoveDirection = Cell_TargetFF.dir.GetSafeNormal2D();
+										DesiredMoveDirection = BindFlowField->SampleDirection(AgentLocation);
 									}
 									else
 									{
@@ -1589,6 +1876,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 									ApproachTraceResultDirectly();
 								}
 							}
+							else if (FlowFieldCache && bIsTraceResultHasLocated && bInside_BaseFF) // 向缓存请求指向目标的流场，未就绪时直接靠近
+							{
+								const FFlowFieldGoalField* TargetField = FlowFieldCache->RequestField(Navigation.FlowField, GetTypeHash(Trace.TraceResult), Move.Goal);
+								const FVector TargetDir = TargetField ? TargetField->GetCellDir(CellIndex_BaseFF) : FVector::ZeroVector;
+
+								if (!TargetDir.IsNearlyZero())
+								{
+									DesiredMoveDirection = TargetDir.GetSafeNormal2D();
+								}
+								else
+								{
+									ApproachTraceResultDirectly();
+								}
+							}
 							else
 							{
 								ApproachTraceResultDirectly();
@@ -1720,37 +2021,11 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 				if (bIsValidFF)// 没有流场则跳过，因为不知道地面高度，所以不考虑垂直运动
 				{
-					// 寻找最高地面
-					bool bIsSet = false;
+					// 寻找碰撞半径内的最高地面
 					FVector HighestGroundLocation = FVector::ZeroVector;
 					FVector HighestGroundNormal = FVector::UpVector;
 
-					// Center Point
-					if (bInside_BaseFF)
-					{
-						bIsSet = true;
-						HighestGroundLocation = Cell_BaseFF.worldLoc;
-						HighestGroundNormal = Cell_BaseFF.normal;
-					}
-
-					// 8 Directions
-					for (int32 i = 0; i < 8; ++i)
-					{
-						FVector BoundSamplePoint = Located.Location + FVector(Collider.Radius, 0, 0).RotateAngleAxis(i * 45.f, FVector::UpVector);
-
-						FCellStruct Cell = FCellStruct{};
-						bool bInside = Navigation.FlowField->GetCellAtLocation(BoundSamplePoint, Cell);
-
-						if (bInside)
-						{
-							if (Cell.worldLoc.Z > HighestGroundLocation.Z)
-							{
-								bIsSet = true;
-								HighestGroundLocation = Cell.worldLoc;
-								HighestGroundNormal = Cell.normal;
-							}
-						}
-					}
+					const bool bIsSet = Navigation.FlowField->SampleGround(Located.Location, Collider.Radius, HighestGroundLocation, HighestGroundNormal);
 
 					//--------------------------- 运动状态 --------------------------//
 
@@ -1841,13 +2116,18 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 避障 | Avoidance
 	#pragma region
+	SystemGraph.AddSystem(TEXT("Avoidance"), FSystemAccess()
+		.Read<FActivated, FMove, FCollider, FRegisterMultiple, FBoxObstacle>()
+		.Write<FLocated, FMoving, FAvoidance, FAvoiding, FSphereObstacle, FTrace>()
+		.WriteResource(TEXT("NeighborGrid")),// Update写入Trace.NeighborGrid并重建格子与打包数组
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("Avoidance");// agent only do avoidance in xy, not z
+		BATTLEFRAME_SYSTEM_SCOPE("Avoidance");// agent only do avoidance in xy, not z
 
 		for (UNeighborGridComponent* Grid : NeighborGrids)
 		{
@@ -1856,7 +2136,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				Grid->Evaluate();
 			}
 		}
-	}
+	});
 	#pragma endregion
 
 	
@@ -1864,8 +2144,15 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 	// 待机-移动切换 | Idle-Move Switch
 	#pragma region
+	SystemGraph.AddSystem(TEXT("IdleToMoveAnim"), FSystemAccess()
+		.Read<FAgent, FActivated, FMove, FMoving, FDeath, FAttacking, FAppearing, FDying>()
+		.Write<FAnimation>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("IdleToMoveAnim");
+		BATTLEFRAME_SYSTEM_SCOPE("IdleToMoveAnim");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(IdleToMoveAnimFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, 1, ThreadsCount, BatchSize);
@@ -1877,6 +2164,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FMoving& Moving,
 				FDeath& Death)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				const bool bIsAttacking = Subject.HasTrait<FAttacking>();
 
 				if (bIsAttacking)
@@ -1896,13 +2184,20 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 动画状态机 | Anim State Machine
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentStateMachine"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FAppear, FAttack, FDeath, FMoving, FFreezing>()
+		.Write<FAnimation>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentStateMachine");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentStateMachine");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentStateMachineFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -1915,6 +2210,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FDeath& Death,
 				FMoving& Moving)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				if (Anim.SubjectState != Anim.PreviousSubjectState && Anim.AnimLerp == 1)
 				{
 					switch (Anim.SubjectState)
@@ -2017,13 +2313,19 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				Anim.AnimLerp = FMath::Clamp(Anim.AnimLerp + SafeDeltaTime * Anim.LerpSpeed, 0, 1);
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 池初始化 | Init Pooling Info
 	#pragma region
+	SystemGraph.AddSystem(TEXT("ClearValidTransforms"), FSystemAccess()
+		.Write<FRenderBatchData>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("ClearValidTransforms");
+		BATTLEFRAME_SYSTEM_SCOPE("ClearValidTransforms");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(RenderBatchFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -2032,19 +2334,27 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 			[&](FSolidSubjectHandle Subject,
 				FRenderBatchData& Data)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				Data.ValidTransforms.Reset();
 
 				Data.Text_Location_Array.Reset();
 				Data.Text_Value_Style_Scale_Offset_Array.Reset();
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 收集渲染数据 | Gather Render Data
 	#pragma region
+	SystemGraph.AddSystem(TEXT("AgentRender"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated, FDirected, FScaled, FLocated, FAnimation, FHealth, FHealthBar, FCollider>()
+		.Write<FRenderBatchData>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("AgentRender");
+		BATTLEFRAME_SYSTEM_SCOPE("AgentRender");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(AgentRenderFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -2060,6 +2370,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FHealthBar& HealthBar,
 				FCollider& Collider)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				FRenderBatchData& Data = Rendering.Renderer.GetTraitRef<FRenderBatchData, EParadigm::Unsafe>();
 
 				FQuat Rotation{ FQuat::Identity };
@@ -2103,12 +2414,19 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				Data.Unlock();
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	#pragma region
+	SystemGraph.AddSystem(TEXT("TextRender"), FSystemAccess()
+		.Read<FAgent, FRendering, FActivated>()
+		.Write<FRenderBatchData, FPoppingText>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("TextRender");
+		BATTLEFRAME_SYSTEM_SCOPE("TextRender");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(TextRenderFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -2118,6 +2436,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				FRendering Rendering,
 				FPoppingText PoppingText)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				FRenderBatchData& Data = Rendering.Renderer.GetTraitRef<FRenderBatchData, EParadigm::Unsafe>();
 
 				TArray<FVector> LocationArray = PoppingText.TextLocationArray;
@@ -2131,13 +2450,19 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				Subject.RemoveTraitDeferred<FPoppingText>();
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 池写入 | Write Pooling Info
 	#pragma region
+	SystemGraph.AddSystem(TEXT("WritePoolingInfo"), FSystemAccess()
+		.Write<FRenderBatchData>(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("WritePoolingInfo");
+		BATTLEFRAME_SYSTEM_SCOPE("WritePoolingInfo");
+
+		int32 ThreadsCount = 1;
+		int32 BatchSize = 1;
 
 		auto Chain = Mechanism->EnchainSolid(RenderBatchFilter);
 		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
@@ -2146,6 +2471,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 			[&](FSolidSubjectHandle Subject,
 				FRenderBatchData& Data)
 			{
+				BATTLEFRAME_WORKER_PROBE();
 				// 重置和隐藏限制数组成员
 				Data.FreeTransforms.Reset();
 
@@ -2158,13 +2484,17 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 				}
 
 			}, ThreadsCount, BatchSize);
-	}
+	});
 	#pragma endregion
 
 	// 发送至Niagara | Send Data to Niagara
 	#pragma region
+	SystemGraph.AddSystem(TEXT("SendDataToNiagara"), FSystemAccess()
+		.Read<FRenderBatchData>()
+		.GameThread(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SendDataToNiagara");
+		BATTLEFRAME_SYSTEM_SCOPE("SendDataToNiagara");
 
 		Mechanism->Operate<FUnsafeChain>(RenderBatchFilter,
 			[&](FSubjectHandle Subject,
@@ -2248,7 +2578,7 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 					Data.InsidePool_Array
 				);
 			});
-	}
+	});
 	#pragma endregion
 
 
@@ -2256,8 +2586,12 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 
 	// 生成Actor | Spawn Actors
 	#pragma region
+	SystemGraph.AddSystem(TEXT("SpawnActors"), FSystemAccess()
+		.Write<FActorSpawnConfig>()
+		.SyncPoint(),// 以下三个系统在遍历中直接Despawn，会改动Chunk，不能与遍历实体链的系统并行
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SpawnActors");
+		BATTLEFRAME_SYSTEM_SCOPE("SpawnActors");
 
 		Mechanism->Operate<FUnsafeChain>(SpawnActorsFilter,
 			[&](FSubjectHandle Subject,
@@ -2287,13 +2621,18 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 					Config.Delay -= SafeDeltaTime;
 				}
 			});
-	}
+	});
 	#pragma endregion
 
 	// 生成粒子特效 | Spawn Fx
 	#pragma region
+	SystemGraph.AddSystem(TEXT("SpawnFx"), FSystemAccess()
+		.Write<FFxConfig>()
+		.Append<FSpawningFx>()
+		.SyncPoint(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SpawnFx");
+		BATTLEFRAME_SYSTEM_SCOPE("SpawnFx");
 
 		Mechanism->Operate<FUnsafeChain>(SpawnFxFilter,
 			[&](FSubjectHandle Subject,
@@ -2362,13 +2701,17 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 					Config.Delay -= SafeDeltaTime;
 				}
 			});
-	}
+	});
 	#pragma endregion
 
 	// 播放声音 | Play Sound
 	#pragma region
+	SystemGraph.AddSystem(TEXT("PlaySound"), FSystemAccess()
+		.Write<FSoundConfig>()
+		.SyncPoint(),
+		[&]()
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("PlaySound");
+		BATTLEFRAME_SYSTEM_SCOPE("PlaySound");
 
 		Mechanism->Operate<FUnsafeChain>(PlaySoundFilter,
 			[&](FSubjectHandle Subject,
@@ -2408,9 +2751,13 @@ void ABattleFrameBattleControl::Tick(float DeltaTime)
 					UGameplayStatics::PlaySound2D(GetWorld(), Sound.Get(), SoundVolume);
 				}));
 		}
-	}
+	});
 	#pragma endregion
 
+	// 执行所有系统 | Run Systems
+	SystemGraph.Build();
+	SystemGraph.Execute(bParallelSystems);
+
 	// 伤害结果蓝图接口 | DmgResult Interface
 	#pragma region
 	{
@@ -2446,11 +2793,15 @@ void ABattleFrameBattleControl::ApplyDamageToSubjects(const FSubjectArray& Subje
 	// Record for deferred spawning of TemporalDamager
 	FTemporalDamaging TemporalDamaging;
 
+	// 临时容器使用当前线程的帧内存
+	FFrameArenaScope ArenaScope;
+
 	// 使用TSet存储唯一敌人句柄
-	TSet<FSubjectHandle> UniqueHandles;
+	TFrameSet<FSubjectHandle> UniqueHandles;
 
 	// 将IgnoreSubjects转换为TSet以提高查找效率
-	const TSet<FSubjectHandle> IgnoreSet(IgnoreSubjects.Subjects);
+	TFrameSet<FSubjectHandle> IgnoreSet;
+	IgnoreSet.Append(IgnoreSubjects.Subjects);
 
 	for (const auto& Overlapper : Subjects.Subjects)
 	{
@@ -2532,7 +2883,7 @@ void ABattleFrameBattleControl::ApplyDamageToSubjects(const FSubjectArray& Subje
 			float CombinedDamage = BaseDamage + PercentageDamage;
 
 			// 考虑暴击后伤害
-			auto [bIsCrit, PostCritDamage] = ProcessCritDamage(CombinedDamage, DmgSphere.CritMult, DmgSphere.CritProbability);
+			auto [bIsCrit, PostCritDamage] = ProcessCritDamage(CombinedDamage, DmgSphere.CritMult, DmgSphere.CritProbability, HashCombine(GetTypeHash(DmgInstigator), GetTypeHash(Overlapper)));
 
 			// 限制伤害以不大于剩余血量
 			float ClampedDamage = FMath::Min(PostCritDamage, Health.Current);
@@ -2777,10 +3128,13 @@ void ABattleFrameBattleControl::ApplyDamageToSubjects(const FSubjectArray& Subje
 FVector ABattleFrameBattleControl::FindNewPatrolGoalLocation(const FPatrol& Patrol, const FCollider& Collider, const FTrace& Trace, const FLocated& Located, int32 MaxAttempts)
 {
 	// Early out if no neighbor grid available
+	// 以当前位置为键，设置种子后每个Agent的巡逻点可复现
+	FRandomStream Stream(FBattleFrameRandom::StreamSeed(GetTypeHash(Located.Location)));
+
 	if (!IsValid(Trace.NeighborGrid))
 	{
-		const float Angle = FMath::FRandRange(0.f, 2.f * PI);
-		const float Distance = FMath::FRandRange(Patrol.PatrolRadiusMin, Patrol.PatrolRadiusMax);
+		const float Angle = Stream.FRandRange(0.f, 2.f * PI);
+		const float Distance = Stream.FRandRange(Patrol.PatrolRadiusMin, Patrol.PatrolRadiusMax);
 		return Patrol.Origin + FVector(FMath::Cos(Angle) * Distance, FMath::Sin(Angle) * Distance, 0.f);
 	}
 
@@ -2790,8 +3144,8 @@ FVector ABattleFrameBattleControl::FindNewPatrolGoalLocation(const FPatrol& Patr
 	for (int32 Attempt = 0; Attempt < MaxAttempts; ++Attempt)
 	{
 		// Generate random position in patrol ring
-		const float Angle = FMath::FRandRange(0.f, 2.f * PI);
-		const float Distance = FMath::FRandRange(Patrol.PatrolRadiusMin, Patrol.PatrolRadiusMax);
+		const float Angle = Stream.FRandRange(0.f, 2.f * PI);
+		const float Distance = Stream.FRandRange(Patrol.PatrolRadiusMin, Patrol.PatrolRadiusMax);
 		const FVector Candidate = Patrol.Origin + FVector(FMath::Cos(Angle) * Distance, FMath::Sin(Angle) * Distance, 0.f);
 
 		// Skip visibility check if not required
@@ -2857,4 +3211,33 @@ void ABattleFrameBattleControl::DefineFilters()
 	SpawnActorsFilter = FFilter::Make<FActorSpawnConfig>();
 	SpawnFxFilter = FFilter::Make<FFxConfig>();
 	PlaySoundFilter = FFilter::Make<FSoundConfig>();
-}
\ No newline at end of file
+}
+
+static FAutoConsoleCommand GDumpSystemGraphCommand(
+	TEXT("BattleFrame.DumpSystemGraph"),
+	TEXT("Log the BattleControl system schedule. Pass 'dot' to also write Saved/BattleFrame/SystemGraph.dot."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const ABattleFrameBattleControl* BattleControl = ABattleFrameBattleControl::Instance;
+
+		if (!BattleControl || BattleControl->SystemGraph.Num() == 0)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("BattleFrame.DumpSystemGraph: no BattleControl has ticked yet."));
+			return;
+		}
+
+		TArray<FString> Lines;
+		BattleControl->SystemGraph.Dump().ParseIntoArrayLines(Lines);
+
+		for (const FString& Line : Lines)
+		{
+			UE_LOG(LogTemp, Log, TEXT("%s"), *Line);
+		}
+
+		if (Args.Contains(TEXT("dot")))
+		{
+			const FString Path = FPaths::ProjectSavedDir() / TEXT("BattleFrame") / TEXT("SystemGraph.dot");
+			FFileHelper::SaveStringToFile(BattleControl->SystemGraph.DumpDot(), *Path);
+			UE_LOG(LogTemp, Log, TEXT("BattleFrame.DumpSystemGraph: wrote %s"), *Path);
+		}
+	}));
@@ -0,0 +1,267 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#include "BattleFrameFrameArena.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/ScopeLock.h"
+
+namespace
+{
+	// 每个系统的帧内存计数器，槽位固定避免工作线程访问时发生重分配
+	struct FFrameArenaSystemCounters
+	{
+		FName Name;
+		std::atomic<int64> Bytes{ 0 };
+		std::atomic<int64> HighWater{ 0 };
+		int64 LastBytes = 0;
+		int64 LastHighWater = 0;
+		int64 PeakHighWater = 0;
+	};
+
+	constexpr int32 MaxTrackedSystems = 64;
+
+	FFrameArenaSystemCounters GSystemCounters[MaxTrackedSystems];
+	std::atomic<int32> GNumSystems{ 0 };
+	FCriticalSection GSystemsLock;
+
+	thread_local FBattleFrameFrameArena GThreadArena;
+
+	// 每个线程各自记录正在为哪个系统分配，依赖图并行执行时互不干扰
+	thread_local int32 GCurrentArenaSystem = 0;
+}
+
+FBattleFrameFrameArena::~FBattleFrameFrameArena()
+{
+	for (const FBlock& Block : Blocks)
+	{
+		FMemory::Free(Block.Data);
+	}
+}
+
+FBattleFrameFrameArena* FBattleFrameFrameArena::GetActive()
+{
+	return GThreadArena.ScopeDepth > 0 ? &GThreadArena : nullptr;
+}
+
+void* FBattleFrameFrameArena::Allocate(const SIZE_T Size, const uint32 Alignment)
+{
+	if (CurrentBlock != INDEX_NONE)
+	{
+		const FBlock& Block = Blocks[CurrentBlock];
+		const SIZE_T Aligned = Align(Offset, Alignment);
+
+		if (Aligned + Size <= Block.Size)
+		{
+			Used += Aligned + Size - Offset;
+			Offset = Aligned + Size;
+			RecordAllocation(Size);
+			return Block.Data + Aligned;
+		}
+	}
+
+	// 当前块放不下，切换到下一个足够大的块
+	while (++CurrentBlock < Blocks.Num())
+	{
+		if (Blocks[CurrentBlock].Size >= Size)
+		{
+			break;
+		}
+	}
+
+	if (CurrentBlock >= Blocks.Num())
+	{
+		AddBlock(Size);
+		CurrentBlock = Blocks.Num() - 1;
+	}
+
+	Offset = Size;
+	Used += Size;
+	RecordAllocation(Size);
+	return Blocks[CurrentBlock].Data;
+}
+
+bool FBattleFrameFrameArena::TryResizeInPlace(const void* Ptr, const SIZE_T OldSize, const SIZE_T NewSize)
+{
+	if (CurrentBlock == INDEX_NONE) return false;
+
+	const FBlock& Block = Blocks[CurrentBlock];
+
+	// 只有最后一次分配可以原地伸缩
+	if (static_cast<const uint8*>(Ptr) + OldSize != Block.Data + Offset) return false;
+
+	const SIZE_T Start = Offset - OldSize;
+	if (Start + NewSize > Block.Size) return false;
+
+	Offset = Start + NewSize;
+	Used = Used - OldSize + NewSize;
+
+	if (NewSize > OldSize)
+	{
+		RecordAllocation(NewSize - OldSize);
+	}
+
+	return true;
+}
+
+void FBattleFrameFrameArena::AddBlock(const SIZE_T MinSize)
+{
+	FBlock Block;
+	Block.Size = FMath::Max<SIZE_T>(DefaultBlockSize, FMath::RoundUpToPowerOfTwo64(MinSize));
+	Block.Data = static_cast<uint8*>(FMemory::Malloc(Block.Size, 64));
+	Blocks.Add(Block);
+}
+
+void FBattleFrameFrameArena::Coalesce()
+{
+	// 多个块合并成一个大块，之后同样的负载不会再切块
+	SIZE_T TotalSize = 0;
+
+	for (const FBlock& Block : Blocks)
+	{
+		TotalSize += Block.Size;
+		FMemory::Free(Block.Data);
+	}
+
+	Blocks.Reset();
+	AddBlock(TotalSize);
+	CurrentBlock = INDEX_NONE;
+	Offset = 0;
+	Used = 0;
+}
+
+void FBattleFrameFrameArena::RecordAllocation(const SIZE_T Size) const
+{
+	FFrameArenaSystemCounters& Counters = GSystemCounters[GCurrentArenaSystem];
+
+	Counters.Bytes.fetch_add(static_cast<int64>(Size), std::memory_order_relaxed);
+
+	const int64 InUse = static_cast<int64>(Used);
+	int64 Previous = Counters.HighWater.load(std::memory_order_relaxed);
+
+	while (Previous < InUse && !Counters.HighWater.compare_exchange_weak(Previous, InUse, std::memory_order_relaxed));
+}
+
+void FBattleFrameFrameArena::BeginFrame()
+{
+	const int32 NumSystems = GNumSystems.load(std::memory_order_acquire);
+
+	for (int32 i = 0; i < NumSystems; ++i)
+	{
+		FFrameArenaSystemCounters& Counters = GSystemCounters[i];
+		Counters.LastBytes = Counters.Bytes.exchange(0, std::memory_order_relaxed);
+		Counters.LastHighWater = Counters.HighWater.exchange(0, std::memory_order_relaxed);
+		Counters.PeakHighWater = FMath::Max(Counters.PeakHighWater, Counters.LastHighWater);
+	}
+}
+
+int32 FBattleFrameFrameArena::GetCurrentSystem()
+{
+	return GCurrentArenaSystem;
+}
+
+void FBattleFrameFrameArena::SetCurrentSystem(const int32 SystemIndex)
+{
+	GCurrentArenaSystem = SystemIndex;
+}
+
+int32 FBattleFrameFrameArena::RegisterSystem(const TCHAR* Name)
+{
+	FScopeLock Lock(&GSystemsLock);
+
+	// 0号槽位记录不在任何系统内的分配
+	if (GNumSystems.load(std::memory_order_relaxed) == 0)
+	{
+		GSystemCounters[0].Name = FName(TEXT("Untracked"));
+		GNumSystems.store(1, std::memory_order_release);
+	}
+
+	const FName SystemName(Name);
+	const int32 NumSystems = GNumSystems.load(std::memory_order_relaxed);
+
+	for (int32 i = 0; i < NumSystems; ++i)
+	{
+		if (GSystemCounters[i].Name == SystemName) return i;
+	}
+
+	if (NumSystems >= MaxTrackedSystems) return 0;
+
+	GSystemCounters[NumSystems].Name = SystemName;
+	GNumSystems.store(NumSystems + 1, std::memory_order_release);
+	return NumSystems;
+}
+
+void FBattleFrameFrameArena::GetSystemStats(TArray<FFrameArenaSystemStat>& OutStats)
+{
+	const int32 NumSystems = GNumSystems.load(std::memory_order_acquire);
+
+	OutStats.Reset(NumSystems);
+
+	for (int32 i = 0; i < NumSystems; ++i)
+	{
+		const FFrameArenaSystemCounters& Counters = GSystemCounters[i];
+
+		FFrameArenaSystemStat& Stat = OutStats.AddDefaulted_GetRef();
+		Stat.Name = Counters.Name;
+		Stat.Bytes = Counters.LastBytes;
+		Stat.HighWater = Counters.LastHighWater;
+		Stat.PeakHighWater = Counters.PeakHighWater;
+	}
+}
+
+//------------------------------------------------------------------------------------------------------------------
+
+FFrameArenaScope::FFrameArenaScope()
+	: Arena(GThreadArena)
+	, MarkBlock(GThreadArena.CurrentBlock)
+	, MarkOffset(GThreadArena.Offset)
+	, MarkUsed(GThreadArena.Used)
+{
+	++Arena.ScopeDepth;
+}
+
+FFrameArenaScope::~FFrameArenaScope()
+{
+	--Arena.ScopeDepth;
+
+	if (Arena.ScopeDepth == 0 && Arena.Blocks.Num() > 1)
+	{
+		Arena.Coalesce();
+		return;
+	}
+
+	Arena.CurrentBlock = MarkBlock;
+	Arena.Offset = MarkOffset;
+	Arena.Used = MarkUsed;
+}
+
+FFrameArenaSystemScope::FFrameArenaSystemScope(const int32 SystemIndex)
+	: PreviousSystem(GCurrentArenaSystem)
+{
+	GCurrentArenaSystem = SystemIndex;
+}
+
+FFrameArenaSystemScope::~FFrameArenaSystemScope()
+{
+	GCurrentArenaSystem = PreviousSystem;
+}
+
+//------------------------------------------------------------------------------------------------------------------
+
+static FAutoConsoleCommand GDumpFrameArenaStatsCommand(
+	TEXT("BattleFrame.DumpFrameArenaStats"),
+	TEXT("Log the frame arena bytes and high-water mark of every BattleFrame system for the last frame."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		TArray<FFrameArenaSystemStat> Stats;
+		FBattleFrameFrameArena::GetSystemStats(Stats);
+
+		UE_LOG(LogTemp, Log, TEXT("%-28s %14s %14s %14s"), TEXT("System"), TEXT("Bytes"), TEXT("HighWater"), TEXT("PeakHighWater"));
+
+		for (const FFrameArenaSystemStat& Stat : Stats)
+		{
+			UE_LOG(LogTemp, Log, TEXT("%-28s %14lld %14lld %14lld"), *Stat.Name.ToString(), Stat.Bytes, Stat.HighWater, Stat.PeakHighWater);
+		}
+	}));
@@ -10,6 +10,8 @@
 #include "NeighborGridComponent.h"
 #include "Async/Async.h"
 #include "Engine/Engine.h"
+#include "BattleFrameScheduler.h"
+#include "BattleFrameProfiler.h"
 
 //-------------------------------Sync Traces-------------------------------
 
@@ -299,9 +301,24 @@ void USphereSweepForSubjectsAsyncAction::Activate()
 		{
 			TArray<FIntVector> CellCoords = NeighborGrid->SphereSweepForCells(Start, End, Radius);
 
+			const bool bPacked = NeighborGrid->HasPackedGrid();
+
 			for (const FIntVector& CellCoord : CellCoords)
 			{
-				ValidCells.Add(NeighborGrid->At(CellCoord));
+				FNeighborGridCell& CellCopy = ValidCells.Add_GetRef(NeighborGrid->At(CellCoord));
+
+				// 打包模式下Subjects只存在于打包数组中
+				if (bPacked)
+				{
+					int32 Begin, End;
+					NeighborGrid->GetPackedRange(CellCoord, Begin, End);
+					CellCopy.Subjects.Reset();
+
+					for (int32 i = Begin; i < End; ++i)
+					{
+						CellCopy.Subjects.Add(NeighborGrid->PackedGrid.MakeAvoiding(i));
+					}
+				}
 			}
 
 			AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [this]()
@@ -1686,6 +1703,13 @@ void UBattleFrameFunctionLibraryRT::IncludeSubTypeTraitByIndex(int32 Index, FFil
 
 void UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(int32 IterableNum, int32 MaxThreadsAllowed, int32 MinBatchSizeAllowed, int32& ThreadsCount, int32& BatchSize)
 {
+	// 自适应模式下由调度器按上一帧耗时切成小块
+	if (FBattleFrameScheduler::CalculateAdaptiveBatch(IterableNum, MaxThreadsAllowed, ThreadsCount, BatchSize))
+	{
+		FBattleFrameScheduler::RecordDispatch(IterableNum, FMath::Min(ThreadsCount, MaxThreadsAllowed));
+		return;
+	}
+
 	// 计算最大可能线程数（考虑最小批次限制）
 	const int32 MaxPossibleThreads = FMath::Clamp(IterableNum / FMath::Max(1, MinBatchSizeAllowed), 1, MaxThreadsAllowed);
 
@@ -1702,6 +1726,26 @@ void UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(int32 Iter
 
 	// 最终限制批次大小范围
 	BatchSize = FMath::Clamp(BatchSize, 1, FLT_MAX);
+
+	FBattleFrameScheduler::RecordDispatch(IterableNum, ThreadsCount);
+}
+
+
+//-------------------------------Profiler-------------------------------
+
+void UBattleFrameFunctionLibraryRT::GetSystemProfile(TArray<FSystemProfileSummary>& Summaries)
+{
+	FBattleFrameProfiler::GetSummaries(Summaries);
+}
+
+FString UBattleFrameFunctionLibraryRT::ExportSystemProfile(bool bJson, bool bRawFrames)
+{
+	return bJson ? FBattleFrameProfiler::ExportJSON(bRawFrames) : FBattleFrameProfiler::ExportCSV(bRawFrames);
+}
+
+void UBattleFrameFunctionLibraryRT::ResetSystemProfile()
+{
+	FBattleFrameProfiler::Reset();
 }
 
 
@@ -0,0 +1,284 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#include "BattleFrameProfiler.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/DateTime.h"
+#include "Misc/ScopeLock.h"
+
+namespace
+{
+	struct FProfileSample
+	{
+		uint32 Frame = 0;
+		float WallMs = 0;
+		int32 Entities = 0;
+		int32 Threads = 0;
+	};
+
+	// 每个系统一个环形缓冲，写满后覆盖最旧的帧
+	// 系统在各自线程写入，导出在游戏线程读取，每个缓冲各一把锁，系统之间不争用
+	struct FProfileRing
+	{
+		mutable FCriticalSection Lock;
+		FName Name;
+		TArray<FProfileSample> Samples;
+		int32 Head = 0;
+		int32 Count = 0;
+
+		void Add(const FName InName, const FProfileSample& Sample)
+		{
+			FScopeLock ScopeLock(&Lock);
+
+			Name = InName;
+
+			if (Samples.Num() == 0)
+			{
+				Samples.SetNumZeroed(FBattleFrameProfiler::HistoryFrames);
+			}
+
+			Samples[Head] = Sample;
+			Head = (Head + 1) % FBattleFrameProfiler::HistoryFrames;
+			Count = FMath::Min(Count + 1, FBattleFrameProfiler::HistoryFrames);
+		}
+
+		void Reset()
+		{
+			FScopeLock ScopeLock(&Lock);
+
+			Head = 0;
+			Count = 0;
+		}
+
+		/* Copy the buffered frames, oldest to newest, so readers never see a half written ring. */
+		void Snapshot(FName& OutName, TArray<FProfileSample>& OutSamples) const
+		{
+			FScopeLock ScopeLock(&Lock);
+
+			OutName = Name;
+			OutSamples.Reset(Count);
+
+			const int32 Start = (Head - Count + FBattleFrameProfiler::HistoryFrames) % FBattleFrameProfiler::HistoryFrames;
+
+			for (int32 i = 0; i < Count; ++i)
+			{
+				OutSamples.Add(Samples[(Start + i) % FBattleFrameProfiler::HistoryFrames]);
+			}
+		}
+	};
+
+	FProfileRing GRings[FBattleFrameProfiler::MaxTrackedSystems];
+	std::atomic<uint32> GFrame{ 0 };
+	bool bGEnabled = true;
+}
+
+void FBattleFrameProfiler::SetEnabled(const bool bInEnabled)
+{
+	bGEnabled = bInEnabled;
+}
+
+bool FBattleFrameProfiler::IsEnabled()
+{
+	return bGEnabled;
+}
+
+void FBattleFrameProfiler::BeginFrame()
+{
+	GFrame.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FBattleFrameProfiler::Record(const int32 SystemIndex, const FName Name, const float WallMs, const int32 Entities, const int32 Threads)
+{
+	if (!bGEnabled || SystemIndex <= 0 || SystemIndex >= MaxTrackedSystems) return;
+
+	FProfileSample Sample;
+	Sample.Frame = GFrame.load(std::memory_order_relaxed);
+	Sample.WallMs = WallMs;
+	Sample.Entities = Entities;
+	Sample.Threads = Threads;
+	GRings[SystemIndex].Add(Name, Sample);
+}
+
+void FBattleFrameProfiler::Reset()
+{
+	for (FProfileRing& Ring : GRings)
+	{
+		Ring.Reset();
+	}
+}
+
+void FBattleFrameProfiler::GetSummaries(TArray<FSystemProfileSummary>& OutSummaries)
+{
+	OutSummaries.Reset();
+
+	TArray<float> Times;
+	Times.Reserve(HistoryFrames);
+
+	FName Name;
+	TArray<FProfileSample> Samples;
+
+	for (const FProfileRing& Ring : GRings)
+	{
+		Ring.Snapshot(Name, Samples);
+
+		if (Samples.IsEmpty()) continue;
+
+		FSystemProfileSummary& Summary = OutSummaries.AddDefaulted_GetRef();
+		Summary.System = Name;
+		Summary.Samples = Samples.Num();
+
+		double TotalMs = 0;
+		double TotalEntities = 0;
+		Times.Reset();
+
+		for (const FProfileSample& Sample : Samples)
+		{
+			Times.Add(Sample.WallMs);
+			TotalMs += Sample.WallMs;
+			TotalEntities += Sample.Entities;
+			Summary.MaxThreads = FMath::Max(Summary.MaxThreads, Sample.Threads);
+		}
+
+		Times.Sort();
+
+		const int32 P99Index = FMath::Clamp(FMath::CeilToInt(Times.Num() * 0.99f) - 1, 0, Times.Num() - 1);
+
+		Summary.MinMs = Times[0];
+		Summary.MaxMs = Times.Last();
+		Summary.P99Ms = Times[P99Index];
+		Summary.AvgMs = TotalMs / Samples.Num();
+		Summary.AvgEntities = TotalEntities / Samples.Num();
+	}
+}
+
+FString FBattleFrameProfiler::ExportCSV(const bool bRawFrames)
+{
+	FString Out;
+
+	if (bRawFrames)
+	{
+		Out += TEXT("Frame,System,WallMs,Entities,Threads\n");
+
+		FName RingName;
+		TArray<FProfileSample> Samples;
+
+		for (const FProfileRing& Ring : GRings)
+		{
+			Ring.Snapshot(RingName, Samples);
+			const FString Name = RingName.ToString();
+
+			for (const FProfileSample& Sample : Samples)
+			{
+				Out += FString::Printf(TEXT("%u,%s,%.4f,%d,%d\n"), Sample.Frame, *Name, Sample.WallMs, Sample.Entities, Sample.Threads);
+			}
+		}
+
+		return Out;
+	}
+
+	TArray<FSystemProfileSummary> Summaries;
+	GetSummaries(Summaries);
+
+	Out += TEXT("System,Samples,MinMs,AvgMs,P99Ms,MaxMs,AvgEntities,MaxThreads\n");
+
+	for (const FSystemProfileSummary& Summary : Summaries)
+	{
+		Out += FString::Printf(TEXT("%s,%d,%.4f,%.4f,%.4f,%.4f,%.1f,%d\n"),
+			*Summary.System.ToString(), Summary.Samples, Summary.MinMs, Summary.AvgMs, Summary.P99Ms, Summary.MaxMs, Summary.AvgEntities, Summary.MaxThreads);
+	}
+
+	return Out;
+}
+
+FString FBattleFrameProfiler::ExportJSON(const bool bRawFrames)
+{
+	FString Out = TEXT("{\n");
+
+	if (bRawFrames)
+	{
+		Out += TEXT("\t\"frames\": [");
+
+		bool bFirst = true;
+
+		FName RingName;
+		TArray<FProfileSample> Samples;
+
+		for (const FProfileRing& Ring : GRings)
+		{
+			Ring.Snapshot(RingName, Samples);
+			const FString Name = RingName.ToString();
+
+			for (const FProfileSample& Sample : Samples)
+			{
+				Out += FString::Printf(TEXT("%s\n\t\t{ \"frame\": %u, \"system\": \"%s\", \"wallMs\": %.4f, \"entities\": %d, \"threads\": %d }"),
+					bFirst ? TEXT("") : TEXT(","), Sample.Frame, *Name, Sample.WallMs, Sample.Entities, Sample.Threads);
+				bFirst = false;
+			}
+		}
+
+		Out += TEXT("\n\t]\n}\n");
+		return Out;
+	}
+
+	TArray<FSystemProfileSummary> Summaries;
+	GetSummaries(Summaries);
+
+	Out += TEXT("\t\"systems\": [");
+
+	for (int32 i = 0; i < Summaries.Num(); ++i)
+	{
+		const FSystemProfileSummary& Summary = Summaries[i];
+
+		Out += FString::Printf(TEXT("%s\n\t\t{ \"system\": \"%s\", \"samples\": %d, \"minMs\": %.4f, \"avgMs\": %.4f, \"p99Ms\": %.4f, \"maxMs\": %.4f, \"avgEntities\": %.1f, \"maxThreads\": %d }"),
+			i == 0 ? TEXT("") : TEXT(","), *Summary.System.ToString(), Summary.Samples, Summary.MinMs, Summary.AvgMs, Summary.P99Ms, Summary.MaxMs, Summary.AvgEntities, Summary.MaxThreads);
+	}
+
+	Out += TEXT("\n\t]\n}\n");
+	return Out;
+}
+
+//------------------------------------------------------------------------------------------------------------------
+
+static FAutoConsoleCommand GDumpProfileCommand(
+	TEXT("BattleFrame.DumpProfile"),
+	TEXT("Export the per-system frame profile. Args: [csv|json] [raw] [log]. Writes Saved/BattleFrame/Profile_<time>.<ext> unless 'log' is given."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const bool bJson = Args.Contains(TEXT("json"));
+		const bool bRaw = Args.Contains(TEXT("raw"));
+		const FString Text = bJson ? FBattleFrameProfiler::ExportJSON(bRaw) : FBattleFrameProfiler::ExportCSV(bRaw);
+
+		if (Args.Contains(TEXT("log")))
+		{
+			TArray<FString> Lines;
+			Text.ParseIntoArrayLines(Lines);
+
+			for (const FString& Line : Lines)
+			{
+				UE_LOG(LogTemp, Log, TEXT("%s"), *Line);
+			}
+			return;
+		}
+
+		const FString FileName = FString::Printf(TEXT("Profile_%s.%s"), *FDateTime::Now().ToString(), bJson ? TEXT("json") : TEXT("csv"));
+		const FString Path = FPaths::ProjectSavedDir() / TEXT("BattleFrame") / FileName;
+
+		if (FFileHelper::SaveStringToFile(Text, *Path))
+		{
+			UE_LOG(LogTemp, Log, TEXT("BattleFrame.DumpProfile: wrote %s"), *Path);
+		}
+		else
+		{
+			UE_LOG(LogTemp, Warning, TEXT("BattleFrame.DumpProfile: failed to write %s"), *Path);
+		}
+	}));
+
+static FAutoConsoleCommand GResetProfileCommand(
+	TEXT("BattleFrame.ResetProfile"),
+	TEXT("Clear the per-system frame profile."),
+	FConsoleCommandDelegate::CreateStatic(&FBattleFrameProfiler::Reset));
@@ -0,0 +1,61 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#include "BattleFrameRandom.h"
+#include "HAL/IConsoleManager.h"
+
+int32 FBattleFrameRandom::Seed = 0;
+uint32 FBattleFrameRandom::Frame = 0;
+
+namespace
+{
+	FRandomStream GGameThreadStream(FPlatformTime::Cycles());
+}
+
+void FBattleFrameRandom::SetSeed(const int32 InSeed)
+{
+	Seed = InSeed;
+	Frame = 0;
+
+	if (IsSeeded())
+	{
+		GGameThreadStream.Initialize(InSeed);
+	}
+	else
+	{
+		GGameThreadStream.GenerateNewSeed();
+	}
+}
+
+int32 FBattleFrameRandom::GetSeed()
+{
+	return Seed;
+}
+
+void FBattleFrameRandom::BeginFrame()
+{
+	++Frame;
+}
+
+FRandomStream& FBattleFrameRandom::GameThreadStream()
+{
+	return GGameThreadStream;
+}
+
+//------------------------------------------------------------------------------------------------------------------
+
+static FAutoConsoleCommand GSeedCommand(
+	TEXT("BattleFrame.Seed"),
+	TEXT("Seed the BattleFrame simulation RNG so runs are reproducible. Args: <Seed>, 0 restores the engine RNG. No args logs the current seed."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		if (Args.Num() > 0)
+		{
+			FBattleFrameRandom::SetSeed(FCString::Atoi(*Args[0]));
+		}
+
+		UE_LOG(LogTemp, Log, TEXT("BattleFrame.Seed: %d"), FBattleFrameRandom::GetSeed());
+	}));
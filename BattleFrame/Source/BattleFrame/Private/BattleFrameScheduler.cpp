@@ -0,0 +1,230 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#include "BattleFrameScheduler.h"
+#include "BattleFrameProfiler.h"
+#include "BattleFrameFrameArena.h"
+#include "HAL/IConsoleManager.h"
+
+namespace
+{
+	struct FSchedulerSystemState
+	{
+		FName Name;
+
+		// 上一帧测得的单个元素耗时（微秒），用于推算下一帧的块大小
+		double CostMicrosPerItem = 0;
+		int32 ChunkSize = 0;
+
+		// 本次运行的累计量
+		uint64 StartCycles = 0;
+		int32 Items = 0;
+		int32 Chunks = 0;
+		int32 Parallelism = 0;
+
+		FSchedulerSystemStat Last;
+	};
+
+	// 每个工作线程一行、每个系统一列，并行运行的系统只读写自己的一列
+	struct alignas(64) FWorkerSlot
+	{
+		std::atomic<uint64> Cycles[FBattleFrameScheduler::MaxTrackedSystems] = {};
+	};
+
+	FSchedulerSystemState GSystems[FBattleFrameScheduler::MaxTrackedSystems];
+	FWorkerSlot GWorkerSlots[FBattleFrameScheduler::MaxWorkerSlots];
+	std::atomic<int32> GNumWorkerSlots{ 0 };
+	thread_local int32 GWorkerSlot = INDEX_NONE;
+
+	// 每个线程各自记录正在运行的系统，依赖图并行执行时互不干扰
+	thread_local int32 GCurrentSystem = 0;
+	bool bGAdaptive = false;
+	float GTargetChunkMicros = 50.f;
+	int32 GMinChunkSize = 16;
+}
+
+std::atomic<bool> FBattleFrameScheduler::bCollectWorkerTimes{ false };
+
+void FBattleFrameScheduler::Configure(const bool bInAdaptive, const float InTargetChunkMicros, const int32 InMinChunkSize, const bool bInCollectWorkerTimes)
+{
+	bGAdaptive = bInAdaptive;
+	GTargetChunkMicros = FMath::Max(InTargetChunkMicros, 1.f);
+	GMinChunkSize = FMath::Max(InMinChunkSize, 1);
+	bCollectWorkerTimes.store(bInCollectWorkerTimes, std::memory_order_relaxed);
+}
+
+bool FBattleFrameScheduler::CalculateAdaptiveBatch(const int32 IterableNum, const int32 MaxThreadsAllowed, int32& ThreadsCount, int32& BatchSize)
+{
+	if (!bGAdaptive || GCurrentSystem <= 0) return false;
+
+	FSchedulerSystemState& State = GSystems[GCurrentSystem];
+
+	// 第一帧还没有耗时数据，沿用静态切分
+	if (IterableNum <= 0 || State.ChunkSize <= 0) return false;
+
+	int32 Chunk = State.ChunkSize;
+	int32 NumChunks = FMath::DivideAndRoundUp(IterableNum, Chunk);
+	const int32 MaxChunks = FMath::Max(MaxThreadsAllowed, 1) * MaxChunksPerThread;
+
+	if (NumChunks > MaxChunks)
+	{
+		NumChunks = MaxChunks;
+		Chunk = FMath::DivideAndRoundUp(IterableNum, NumChunks);
+	}
+
+	// 任务数远多于线程数，由ParallelFor的共享游标按块分发给空闲线程
+	ThreadsCount = NumChunks;
+	BatchSize = Chunk;
+
+	State.Chunks += NumChunks;
+	return true;
+}
+
+void FBattleFrameScheduler::RecordDispatch(const int32 IterableNum, const int32 Threads)
+{
+	if (GCurrentSystem <= 0) return;
+
+	FSchedulerSystemState& State = GSystems[GCurrentSystem];
+	State.Items += IterableNum;
+	State.Parallelism = FMath::Max(State.Parallelism, Threads);
+}
+
+void FBattleFrameScheduler::BeginSystem(const int32 SystemIndex, const TCHAR* Name)
+{
+	if (SystemIndex <= 0 || SystemIndex >= MaxTrackedSystems) return;
+
+	FSchedulerSystemState& State = GSystems[SystemIndex];
+
+	if (State.Name.IsNone())
+	{
+		State.Name = FName(Name);
+	}
+
+	State.StartCycles = FPlatformTime::Cycles64();
+	State.Items = 0;
+	State.Chunks = 0;
+	State.Parallelism = 0;
+
+	// 丢弃本系统上次运行之外残留的工作线程计时
+	const int32 NumSlots = GNumWorkerSlots.load(std::memory_order_acquire);
+	for (int32 i = 0; i < NumSlots; ++i)
+	{
+		GWorkerSlots[i].Cycles[SystemIndex].store(0, std::memory_order_relaxed);
+	}
+
+	GCurrentSystem = SystemIndex;
+}
+
+int32 FBattleFrameScheduler::GetCurrentSystem()
+{
+	return GCurrentSystem;
+}
+
+int32 FBattleFrameScheduler::EnterWorkerSystem(const int32 SystemIndex)
+{
+	const int32 PreviousSystem = GCurrentSystem;
+	GCurrentSystem = SystemIndex;
+	FBattleFrameFrameArena::SetCurrentSystem(SystemIndex);
+	return PreviousSystem;
+}
+
+void FBattleFrameScheduler::LeaveWorkerSystem(const int32 PreviousSystem)
+{
+	GCurrentSystem = PreviousSystem;
+	FBattleFrameFrameArena::SetCurrentSystem(PreviousSystem);
+}
+
+void FBattleFrameScheduler::EndSystem()
+{
+	if (GCurrentSystem <= 0) return;
+
+	const int32 SystemIndex = GCurrentSystem;
+	FSchedulerSystemState& State = GSystems[SystemIndex];
+	GCurrentSystem = 0;
+
+	const double WallMicros = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - State.StartCycles) * 1000.0;
+
+	double BusyMicros = 0;
+	int32 ThreadsUsed = 0;
+
+	const int32 NumSlots = GNumWorkerSlots.load(std::memory_order_acquire);
+	for (int32 i = 0; i < NumSlots; ++i)
+	{
+		const uint64 Cycles = GWorkerSlots[i].Cycles[SystemIndex].exchange(0, std::memory_order_relaxed);
+
+		if (Cycles > 0)
+		{
+			BusyMicros += FPlatformTime::ToMilliseconds64(Cycles) * 1000.0;
+			++ThreadsUsed;
+		}
+	}
+
+	FSchedulerSystemStat& Stat = State.Last;
+	Stat.Name = State.Name;
+	Stat.Items = State.Items;
+	Stat.ChunkSize = State.Chunks > 0 ? State.ChunkSize : 0;
+	Stat.Chunks = State.Chunks;
+	Stat.ThreadsUsed = ThreadsUsed;
+	Stat.WallMs = WallMicros / 1000.0;
+	Stat.BusyMs = BusyMicros / 1000.0;
+	Stat.IdleMs = FMath::Max(0.0, ThreadsUsed * WallMicros - BusyMicros) / 1000.0;
+
+	FBattleFrameProfiler::Record(SystemIndex, State.Name, Stat.WallMs, State.Items, FMath::Max(ThreadsUsed > 0 ? ThreadsUsed : State.Parallelism, 1));
+
+	if (!bGAdaptive || State.Items <= 0) return;
+
+	// 没有采集工作线程耗时时，用墙钟时间乘以并行度估算
+	const double MeasuredMicros = BusyMicros > 0 ? BusyMicros : WallMicros * FMath::Max(State.Parallelism, 1);
+	const double NewCost = MeasuredMicros / State.Items;
+
+	State.CostMicrosPerItem = State.CostMicrosPerItem > 0 ? FMath::Lerp(State.CostMicrosPerItem, NewCost, 0.3) : NewCost;
+
+	const double IdealChunk = GTargetChunkMicros / FMath::Max(State.CostMicrosPerItem, 1e-4);
+	State.ChunkSize = FMath::Clamp(FMath::RoundToInt(IdealChunk), GMinChunkSize, FMath::Max(GMinChunkSize, State.Items));
+}
+
+void FBattleFrameScheduler::AddWorkerTime(const int32 SystemIndex, const uint64 Cycles)
+{
+	if (SystemIndex <= 0 || SystemIndex >= MaxTrackedSystems) return;
+
+	if (UNLIKELY(GWorkerSlot == INDEX_NONE))
+	{
+		GWorkerSlot = FMath::Min(GNumWorkerSlots.fetch_add(1, std::memory_order_acq_rel), MaxWorkerSlots - 1);
+	}
+
+	GWorkerSlots[GWorkerSlot].Cycles[SystemIndex].fetch_add(Cycles, std::memory_order_relaxed);
+}
+
+void FBattleFrameScheduler::GetSystemStats(TArray<FSchedulerSystemStat>& OutStats)
+{
+	OutStats.Reset();
+
+	for (int32 i = 1; i < MaxTrackedSystems; ++i)
+	{
+		if (!GSystems[i].Name.IsNone())
+		{
+			OutStats.Add(GSystems[i].Last);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------------------------------------------
+
+static FAutoConsoleCommand GDumpSchedulerStatsCommand(
+	TEXT("BattleFrame.DumpSchedulerStats"),
+	TEXT("Log chunking and worker idle time of every BattleFrame system for the last frame. Idle time needs bCollectSchedulerMetrics."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		TArray<FSchedulerSystemStat> Stats;
+		FBattleFrameScheduler::GetSystemStats(Stats);
+
+		UE_LOG(LogTemp, Log, TEXT("%-28s %8s %8s %8s %8s %10s %10s %10s"), TEXT("System"), TEXT("Items"), TEXT("Chunk"), TEXT("Chunks"), TEXT("Threads"), TEXT("WallMs"), TEXT("BusyMs"), TEXT("IdleMs"));
+
+		for (const FSchedulerSystemStat& Stat : Stats)
+		{
+			UE_LOG(LogTemp, Log, TEXT("%-28s %8d %8d %8d %8d %10.3f %10.3f %10.3f"), *Stat.Name.ToString(), Stat.Items, Stat.ChunkSize, Stat.Chunks, Stat.ThreadsUsed, Stat.WallMs, Stat.BusyMs, Stat.IdleMs);
+		}
+	}));
@@ -0,0 +1,192 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#include "BattleFrameSystemGraph.h"
+#include "Async/TaskGraphInterfaces.h"
+
+namespace
+{
+	template<typename ArrayA, typename ArrayB>
+	FORCEINLINE bool Intersects(const ArrayA& A, const ArrayB& B)
+	{
+		for (const FName& Name : A)
+		{
+			if (B.Contains(Name)) return true;
+		}
+		return false;
+	}
+}
+
+bool FSystemAccess::ConflictsWith(const FSystemAccess& Other) const
+{
+	if (bSyncPoint || Other.bSyncPoint) return true;
+
+	// 写与对方的任何访问冲突，追加之间互不冲突
+	return Intersects(Writes, Other.Writes)
+		|| Intersects(Writes, Other.Reads)
+		|| Intersects(Writes, Other.Appends)
+		|| Intersects(Reads, Other.Writes)
+		|| Intersects(Appends, Other.Writes)
+		|| Intersects(Reads, Other.Appends)
+		|| Intersects(Appends, Other.Reads);
+}
+
+void FBattleFrameSystemGraph::Reset()
+{
+	Nodes.Reset();
+	NumWaves = 0;
+}
+
+void FBattleFrameSystemGraph::AddSystem(const TCHAR* Name, const FSystemAccess& Access, TFunction<void()>&& Run)
+{
+	FNode& Node = Nodes.AddDefaulted_GetRef();
+	Node.Name = FName(Name);
+	Node.Access = Access;
+	Node.Run = MoveTemp(Run);
+}
+
+void FBattleFrameSystemGraph::Build()
+{
+	const int32 NumNodes = Nodes.Num();
+
+	// 每个系统的所有前驱（传递闭包），用于去掉冗余边
+	TArray<TBitArray<>> Ancestors;
+	Ancestors.SetNum(NumNodes);
+
+	NumWaves = 0;
+
+	for (int32 i = 0; i < NumNodes; ++i)
+	{
+		FNode& Node = Nodes[i];
+		Node.Dependencies.Reset();
+		Node.Wave = 0;
+
+		Ancestors[i].Init(false, NumNodes);
+
+		// 从近到远找冲突的前序系统，已被间接依赖覆盖的跳过
+		for (int32 j = i - 1; j >= 0; --j)
+		{
+			if (Ancestors[i][j]) continue;
+			if (!Node.Access.ConflictsWith(Nodes[j].Access)) continue;
+
+			Node.Dependencies.Add(j);
+			Node.Wave = FMath::Max(Node.Wave, Nodes[j].Wave + 1);
+
+			Ancestors[i][j] = true;
+			Ancestors[i].CombineWithBitwiseOR(Ancestors[j], EBitwiseOperatorFlags::MaintainSize);
+		}
+
+		NumWaves = FMath::Max(NumWaves, Node.Wave + 1);
+	}
+}
+
+void FBattleFrameSystemGraph::Execute(const bool bParallel)
+{
+	if (!bParallel)
+	{
+		for (FNode& Node : Nodes)
+		{
+			Node.Run();
+		}
+	}
+	else
+	{
+		ExecuteOnTaskGraph();
+	}
+
+	// 闭包引用了本帧的局部变量，执行完即释放，只保留结构供Dump
+	for (FNode& Node : Nodes)
+	{
+		Node.Run.Reset();
+	}
+}
+
+void FBattleFrameSystemGraph::ExecuteOnTaskGraph()
+{
+	TArray<FGraphEventRef> Events;
+	Events.SetNum(Nodes.Num());
+
+	for (int32 i = 0; i < Nodes.Num(); ++i)
+	{
+		FNode& Node = Nodes[i];
+
+		FGraphEventArray Prerequisites;
+		for (const int32 Dependency : Node.Dependencies)
+		{
+			Prerequisites.Add(Events[Dependency]);
+		}
+
+		const ENamedThreads::Type Thread = (Node.Access.bGameThread || Node.Access.bSyncPoint) ? ENamedThreads::GameThread : ENamedThreads::AnyHiPriThreadHiPriTask;
+
+		Events[i] = FFunctionGraphTask::CreateAndDispatchWhenReady([&Node]()
+		{
+			Node.Run();
+
+		}, TStatId(), &Prerequisites, Thread);
+	}
+
+	// 等待期间游戏线程会处理分派给它的系统
+	FGraphEventArray AllEvents(Events);
+	FTaskGraphInterface::Get().WaitUntilTasksComplete(AllEvents, ENamedThreads::GameThread);
+}
+
+FString FBattleFrameSystemGraph::Dump() const
+{
+	FString Out;
+
+	for (int32 Wave = 0; Wave < NumWaves; ++Wave)
+	{
+		Out += FString::Printf(TEXT("Wave %d:"), Wave);
+
+		for (const FNode& Node : Nodes)
+		{
+			if (Node.Wave == Wave)
+			{
+				Out += FString::Printf(TEXT(" [%s]"), *Node.Name.ToString());
+			}
+		}
+
+		Out += TEXT("\n");
+	}
+
+	for (const FNode& Node : Nodes)
+	{
+		TArray<FString> DependencyNames;
+		for (const int32 Dependency : Node.Dependencies)
+		{
+			DependencyNames.Add(Nodes[Dependency].Name.ToString());
+		}
+
+		Out += FString::Printf(TEXT("%s%s%s <- %s\n"),
+			*Node.Name.ToString(),
+			Node.Access.bGameThread ? TEXT(" (GameThread)") : TEXT(""),
+			Node.Access.bSyncPoint ? TEXT(" (SyncPoint)") : TEXT(""),
+			DependencyNames.IsEmpty() ? TEXT("none") : *FString::Join(DependencyNames, TEXT(", ")));
+	}
+
+	return Out;
+}
+
+FString FBattleFrameSystemGraph::DumpDot() const
+{
+	FString Out = TEXT("digraph BattleFrameSystems {\n\trankdir=LR;\n");
+
+	for (int32 i = 0; i < Nodes.Num(); ++i)
+	{
+		const FNode& Node = Nodes[i];
+		const TCHAR* Shape = Node.Access.bSyncPoint ? TEXT("doubleoctagon") : (Node.Access.bGameThread ? TEXT("box") : TEXT("ellipse"));
+
+		Out += FString::Printf(TEXT("\tn%d [label=\"%s\\nwave %d\", shape=%s];\n"), i, *Node.Name.ToString(), Node.Wave, Shape);
+
+		for (const int32 Dependency : Node.Dependencies)
+		{
+			Out += FString::Printf(TEXT("\tn%d -> n%d;\n"), Dependency, i);
+		}
+	}
+
+	Out += TEXT("}\n");
+	return Out;
+}
@@ -37,6 +37,11 @@
 #include "Traits/Located.h"
 #include "BattleFrameFunctionLibraryRT.h"
 #include "Kismet/BlueprintAsyncActionBase.h"
+#include "HAL/IConsoleManager.h"
+#include "Algo/Sort.h"
+#include "BattleFrameFrameArena.h"
+#include "BattleFrameScheduler.h"
+#include "BattleFrameRandom.h"
 
 UNeighborGridComponent::UNeighborGridComponent()
 {
@@ -58,6 +63,275 @@ void UNeighborGridComponent::InitializeComponent()
 
 //--------------------------------------------Tracing----------------------------------------------------------------
 
+namespace
+{
+	// 从检测原点向目标球面最近点扫球，被障碍物挡住则视为不可见
+	FORCEINLINE bool IsSubjectOccluded(const UNeighborGridComponent& Grid, const FVector& CheckOrigin, const float CheckRadius, const FVector& SubjectPos, const float SubjectRadius)
+	{
+		bool bVisibilityHit = false;
+		FTraceResult VisibilityResult;
+
+		const FVector ToSubjectDir = (SubjectPos - CheckOrigin).GetSafeNormal();
+		const FVector SubjectSurfacePoint = SubjectPos - (ToSubjectDir * SubjectRadius);
+
+		Grid.SphereSweepForObstacle(CheckOrigin, SubjectSurfacePoint, CheckRadius, bVisibilityHit, VisibilityResult);
+
+		return bVisibilityHit;
+	}
+
+	/**
+	 * Shared by the sphere and sector traces: once a subject passes the shape test, applies the ignore list,
+	 * the filter and the optional visibility check, then keeps the best result or collects it,
+	 * maintaining the early-out distance threshold as results come in.
+	 */
+	struct FTraceCandidateCollector
+	{
+		const UNeighborGridComponent& Grid;
+		const TFrameSet<FSubjectHandle>& IgnoreSet;
+		const FFilter& Filter;
+		FArchetypeMatchCache MatchCache;
+
+		const int32 KeepCount;
+		const bool bCheckVisibility;
+		const FVector CheckOrigin;
+		const float CheckRadius;
+		const ESortMode SortMode;
+		const FVector SortOrigin;
+
+		// 特殊处理标志
+		const bool bSingleResult;
+		const bool bNoCountLimit;
+
+		// 跟踪最佳结果（用于KeepCount=1的情况）
+		FTraceResult BestResult;
+		float BestDistSq;
+
+		// 临时存储所有结果（用于需要排序或随机的情况）
+		TFrameArray<FTraceResult> TempResults;
+
+		// 提前终止阈值
+		float ThresholdDistanceSq = FLT_MAX;
+
+		FTraceCandidateCollector(const UNeighborGridComponent& InGrid, const TFrameSet<FSubjectHandle>& InIgnoreSet, const FFilter& InFilter,
+			const int32 InKeepCount, const bool bInCheckVisibility, const FVector& InCheckOrigin, const float InCheckRadius,
+			const ESortMode InSortMode, const FVector& InSortOrigin)
+			: Grid(InGrid)
+			, IgnoreSet(InIgnoreSet)
+			, Filter(InFilter)
+			, MatchCache(InGrid.ArchetypeFingerprints)
+			, KeepCount(InKeepCount)
+			, bCheckVisibility(bInCheckVisibility)
+			, CheckOrigin(InCheckOrigin)
+			, CheckRadius(InCheckRadius)
+			, SortMode(InSortMode)
+			, SortOrigin(InSortOrigin)
+			, bSingleResult(InKeepCount == 1)
+			, bNoCountLimit(InKeepCount == -1)
+			, BestDistSq((InSortMode == ESortMode::NearToFar) ? FLT_MAX : -FLT_MAX)
+		{
+			if (!bNoCountLimit && KeepCount > 0 && SortMode != ESortMode::None)
+			{
+				// 计算阈值：当前最远结果的距离 + 2倍格子对角线距离（使用最大轴尺寸）
+				UpdateThreshold(BestDistSq);
+			}
+		}
+
+		FORCEINLINE void UpdateThreshold(const float FarthestKeptDistSq)
+		{
+			const float ThresholdDistance = FMath::Sqrt(FarthestKeptDistSq) + 2.0f * Grid.GetCellSize().GetMax() * FMath::Sqrt(2.0f);
+			ThresholdDistanceSq = FMath::Square(ThresholdDistance);
+		}
+
+		// 按格子中心到排序原点的距离判断后续格子是否已不可能更优
+		FORCEINLINE bool IsBeyondThreshold(const float CellDistSq) const
+		{
+			if (bNoCountLimit || KeepCount <= 0 || SortMode == ESortMode::None) return false;
+
+			return (SortMode == ESortMode::NearToFar && CellDistSq > ThresholdDistanceSq) ||
+				(SortMode == ESortMode::FarToNear && CellDistSq < ThresholdDistanceSq);
+		}
+
+		void Accept(const FSubjectHandle Subject, const FVector& SubjectPos, const float SubjectRadius, const uint16 Archetype)
+		{
+			if (IgnoreSet.Contains(Subject)) return;
+			if (!MatchCache.Matches(Subject, Archetype, Filter)) return;
+
+			if (bCheckVisibility && IsSubjectOccluded(Grid, CheckOrigin, CheckRadius, SubjectPos, SubjectRadius)) return;
+
+			const float CurrentDistSq = FVector::DistSquared(SortOrigin, SubjectPos);
+
+			if (bSingleResult)
+			{
+				bool bIsBetter = false;
+				if (SortMode == ESortMode::NearToFar)
+				{
+					bIsBetter = (CurrentDistSq < BestDistSq);
+				}
+				else if (SortMode == ESortMode::FarToNear)
+				{
+					bIsBetter = (CurrentDistSq > BestDistSq);
+				}
+				else // ESortMode::None
+				{
+					bIsBetter = true;
+				}
+
+				if (bIsBetter)
+				{
+					BestResult.Subject = Subject;
+					BestResult.Location = SubjectPos;
+					BestResult.CachedDistSq = CurrentDistSq;
+					BestDistSq = CurrentDistSq;
+
+					// 更新阈值
+					if (!bNoCountLimit && KeepCount > 0)
+					{
+						UpdateThreshold(BestDistSq);
+					}
+				}
+			}
+			else
+			{
+				FTraceResult Result;
+				Result.Subject = Subject;
+				Result.Location = SubjectPos;
+				Result.CachedDistSq = CurrentDistSq;
+				TempResults.Add(Result);
+
+				// 当收集到足够结果时更新阈值
+				if (!bNoCountLimit && KeepCount > 0 && SortMode != ESortMode::None && TempResults.Num() >= KeepCount)
+				{
+					// 找到当前第KeepCount个最佳结果的距离
+					const float CurrentThresholdDistSq = (SortMode == ESortMode::NearToFar)
+						? TempResults[KeepCount - 1].CachedDistSq
+						: TempResults.Last().CachedDistSq;
+
+					UpdateThreshold(CurrentThresholdDistSq);
+				}
+			}
+		}
+
+		bool HasBestResult() const
+		{
+			return BestDistSq != FLT_MAX && BestDistSq != -FLT_MAX;
+		}
+	};
+}
+
+// Ring Search For The K Nearest Subjects
+template<typename CellTestType, typename SubjectTestType>
+void UNeighborGridComponent::TraceNearestInRings
+(
+	const int32 KeepCount,
+	const FIntVector& CagePosMin,
+	const FIntVector& CagePosMax,
+	const bool bCheckVisibility,
+	const FVector& CheckOrigin,
+	const float CheckRadius,
+	const FVector& SortOrigin,
+	const FSubjectArray& IgnoreSubjects,
+	const FFilter& Filter,
+	const uint16 TeamMask,
+	CellTestType&& CellTest,
+	SubjectTestType&& SubjectTest,
+	TArray<FTraceResult>& Results
+) const
+{
+	Results.Reset();
+
+	const int32 MinX = FMath::Max(CagePosMin.X, 0);
+	const int32 MinY = FMath::Max(CagePosMin.Y, 0);
+	const int32 MinZ = FMath::Max(CagePosMin.Z, 0);
+	const int32 MaxX = FMath::Min(CagePosMax.X, GridSize.X - 1);
+	const int32 MaxY = FMath::Min(CagePosMax.Y, GridSize.Y - 1);
+	const int32 MaxZ = FMath::Min(CagePosMax.Z, GridSize.Z - 1);
+
+	if (MinX > MaxX || MinY > MaxY || MinZ > MaxZ) return;
+
+	// 以排序原点所在格子为中心，第 Ring 圈的格子到原点的距离至少为 (Ring - 1) 个格子
+	const FIntVector Center = WorldToCage(SortOrigin);
+	const float MinCellSizeXY = FMath::Min(CellSize.X, CellSize.Y);
+	const int32 MaxRing = FMath::Max(FMath::Max(Center.X - MinX, MaxX - Center.X), FMath::Max(Center.Y - MinY, MaxY - Center.Y));
+
+	TFixedKNearest<MaxNeighborsCapacity> Nearest(KeepCount);
+	FArchetypeMatchCache MatchCache(ArchetypeFingerprints);
+
+	// 形状检测通过后：先看能否进入堆，再做忽略、过滤和可见性检测
+	auto Consider = [&](const FSubjectHandle Subject, const FVector& SubjectPos, const float SubjectRadius, const uint32 SubjectHash, const uint16 Archetype)
+	{
+		if (!SubjectTest(SubjectPos, SubjectRadius)) return;
+
+		const float DistSq = FVector::DistSquared(SortOrigin, SubjectPos);
+
+		if (!Nearest.WouldAccept(DistSq)) return;
+		if (Nearest.Contains(SubjectHash)) return;
+		if (IgnoreSubjects.Subjects.Contains(Subject)) return;
+		if (!MatchCache.Matches(Subject, Archetype, Filter)) return;
+
+		if (bCheckVisibility && IsSubjectOccluded(*this, CheckOrigin, CheckRadius, SubjectPos, SubjectRadius)) return;
+
+		FAvoiding Candidate;
+		Candidate.Location = SubjectPos;
+		Candidate.Radius = SubjectRadius;
+		Candidate.SubjectHandle = Subject;
+		Candidate.SubjectHash = SubjectHash;
+
+		Nearest.Push(Candidate, DistSq);
+	};
+
+	for (int32 Ring = 0; Ring <= MaxRing; ++Ring)
+	{
+		// 堆已满且整圈都比第K个结果远，后面的圈只会更远
+		if (Nearest.IsFull() && FMath::Square(FMath::Max(Ring - 1, 0) * MinCellSizeXY) > Nearest.TopDistSqr()) break;
+
+		for (int32 x = Center.X - Ring; x <= Center.X + Ring; ++x)
+		{
+			if (x < MinX || x > MaxX) continue;
+
+			// 圈的左右两列取整列，其余只取上下两端
+			const bool bEdgeColumn = FMath::Abs(x - Center.X) == Ring;
+			const int32 StepY = bEdgeColumn ? 1 : 2 * Ring;
+
+			for (int32 y = Center.Y - Ring; y <= Center.Y + Ring; y += StepY)
+			{
+				if (y < MinY || y > MaxY) continue;
+
+				for (int32 z = MinZ; z <= MaxZ; ++z)
+				{
+					const FIntVector CellPos(x, y, z);
+					if (!CellTest(CellPos)) continue;
+
+					if (Nearest.IsFull())
+					{
+						const FVector CellMin = CageToWorld(CellPos);
+						if (FBox(CellMin, CellMin + CellSize).ComputeSquaredDistanceToPoint(SortOrigin) > Nearest.TopDistSqr()) continue;
+					}
+
+					ForEachSubjectInCell(CellPos, TeamMask, Consider);
+				}
+			}
+		}
+	}
+
+	// 堆内最多 MaxNeighborsCapacity 个，直接排序
+	TArray<TPair<float, FAvoiding>, TInlineAllocator<MaxNeighborsCapacity>> Sorted;
+
+	for (const FAvoiding& Kept : Nearest.GetView())
+	{
+		Sorted.Add(TPair<float, FAvoiding>(FVector::DistSquared(SortOrigin, Kept.Location), Kept));
+	}
+
+	Sorted.Sort([](const TPair<float, FAvoiding>& A, const TPair<float, FAvoiding>& B) { return A.Key < B.Key; });
+
+	for (const TPair<float, FAvoiding>& Entry : Sorted)
+	{
+		FTraceResult& Result = Results.AddDefaulted_GetRef();
+		Result.Subject = Entry.Value.SubjectHandle;
+		Result.Location = Entry.Value.Location;
+		Result.CachedDistSq = Entry.Key;
+	}
+}
+
 // Multi Trace For Subjects
 void UNeighborGridComponent::SphereTraceForSubjects
 (
@@ -72,18 +346,41 @@ void UNeighborGridComponent::SphereTraceForSubjects
 	const FSubjectArray& IgnoreSubjects,
 	const FFilter& Filter,
 	bool& Hit,
-	TArray<FTraceResult>& Results
+	TArray<FTraceResult>& Results,
+	const uint16 TeamMask
 ) const
 {
 	//TRACE_CPUPROFILER_EVENT_SCOPE_STR("SphereTraceForSubjects");
-	Results.Reset();
 
-	// 特殊处理标志
-	const bool bSingleResult = (KeepCount == 1);
-	const bool bNoCountLimit = (KeepCount == -1);
+	// 最近的少量目标：逐圈搜索，不排序格子也不收集全部结果
+	if (SortMode == ESortMode::NearToFar && KeepCount >= 1 && KeepCount <= MaxNeighborsCapacity)
+	{
+		const float ExpandedRadius = Radius + FMath::Max3(CellSize.X, CellSize.Y, CellSize.Z) * 0.5f * FMath::Sqrt(2.0f);
+
+		TraceNearestInRings(KeepCount, WorldToCage(Origin - FVector(ExpandedRadius)), WorldToCage(Origin + FVector(ExpandedRadius)),
+			bCheckVisibility, CheckOrigin, CheckRadius, SortOrigin, IgnoreSubjects, Filter, TeamMask,
+			[&](const FIntVector& CellPos)
+			{
+				const FVector CellMin = CageToWorld(CellPos);
+				return FBox(CellMin, CellMin + CellSize).ComputeSquaredDistanceToPoint(Origin) <= FMath::Square(ExpandedRadius);
+			},
+			[&](const FVector& SubjectPos, const float SubjectRadius)
+			{
+				return FVector::DistSquared(SubjectPos, Origin) <= FMath::Square(Radius + SubjectRadius);
+			},
+			Results);
+
+		Hit = !Results.IsEmpty();
+		return;
+	}
+
+	FFrameArenaScope ArenaScope;
+
+	Results.Reset();
 
 	// 将忽略列表转换为集合以便快速查找
-	const TSet<FSubjectHandle> IgnoreSet(IgnoreSubjects.Subjects);
+	TFrameSet<FSubjectHandle> IgnoreSet;
+	IgnoreSet.Append(IgnoreSubjects.Subjects);
 
 	// 扩展搜索范围 - 使用各轴独立的CellSize
 	const FVector CellRadius = CellSize * 0.5f;
@@ -94,15 +391,8 @@ void UNeighborGridComponent::SphereTraceForSubjects
 	const FIntVector CagePosMin = WorldToCage(Origin - Range);
 	const FIntVector CagePosMax = WorldToCage(Origin + Range);
 
-	// 跟踪最佳结果（用于KeepCount=1的情况）
-	FTraceResult BestResult;
-	float BestDistSq = (SortMode == ESortMode::NearToFar) ? FLT_MAX : -FLT_MAX;
-
-	// 临时存储所有结果（用于需要排序或随机的情况）
-	TArray<FTraceResult> TempResults;
-
 	// 预收集候选格子并按距离排序
-	TArray<FIntVector> CandidateCells;
+	TFrameArray<FIntVector> CandidateCells;
 
 	for (int32 z = CagePosMin.Z; z <= CagePosMax.Z; ++z)
 	{
@@ -133,131 +423,35 @@ void UNeighborGridComponent::SphereTraceForSubjects
 			});
 	}
 
-	// 计算提前终止阈值
-	float ThresholdDistanceSq = FLT_MAX;
-	if (!bNoCountLimit && KeepCount > 0 && SortMode != ESortMode::None)
-	{
-		// 计算阈值：当前最远结果的距离 + 2倍格子对角线距离（使用最大轴尺寸）
-		const float MaxCellSize = CellSize.GetMax();
-		const float ThresholdDistance = FMath::Sqrt(BestDistSq) + 2.0f * MaxCellSize * FMath::Sqrt(2.0f);
-		ThresholdDistanceSq = FMath::Square(ThresholdDistance);
-	}
+	// 形状检测通过后的处理：忽略列表、过滤、可见性、收集结果
+	FTraceCandidateCollector Collector(*this, IgnoreSet, Filter, KeepCount, bCheckVisibility, CheckOrigin, CheckRadius, SortMode, SortOrigin);
 
 	// 遍历检测
 	for (const FIntVector& CellPos : CandidateCells)
 	{
 		// 提前终止检查
-		if (!bNoCountLimit && KeepCount > 0 && SortMode != ESortMode::None)
-		{
-			const float CellDistSq = FVector::DistSquared(CageToWorld(CellPos), SortOrigin);
-			if ((SortMode == ESortMode::NearToFar && CellDistSq > ThresholdDistanceSq) ||
-				(SortMode == ESortMode::FarToNear && CellDistSq < ThresholdDistanceSq))
-			{
-				break;
-			}
-		}
-
-		const auto& CellData = At(CellPos);
+		if (Collector.IsBeyondThreshold(FVector::DistSquared(CageToWorld(CellPos), SortOrigin))) break;
 
-		for (const FAvoiding& SubjectData : CellData.Subjects)
+		ForEachSubjectInCell(CellPos, TeamMask, [&](const FSubjectHandle Subject, const FVector& SubjectPos, const float SubjectRadius, const uint32 SubjectHash, const uint16 Archetype)
 		{
-			const FSubjectHandle Subject = SubjectData.SubjectHandle;
-			if (IgnoreSet.Contains(Subject)) continue;
-			if (!Subject.Matches(Filter)) continue;
-
-			const FVector SubjectPos = SubjectData.Location;
-			const float SubjectRadius = SubjectData.Radius;
-
 			// 距离检查
 			const FVector Delta = SubjectPos - Origin;
 			const float DistSq = Delta.SizeSquared();
 			const float CombinedRadius = Radius + SubjectRadius;
-			if (DistSq > FMath::Square(CombinedRadius)) continue;
-
-			if (bCheckVisibility)
-			{
-				bool bVisibilityHit = false;
-				FTraceResult VisibilityResult;
-
-				const FVector ToSubjectDir = (SubjectPos - CheckOrigin).GetSafeNormal();
-				const FVector SubjectSurfacePoint = SubjectPos - (ToSubjectDir * SubjectRadius);
-
-				SphereSweepForObstacle(CheckOrigin, SubjectSurfacePoint, CheckRadius, bVisibilityHit, VisibilityResult);
-
-				if (bVisibilityHit) continue;
-			}
-
-			const float CurrentDistSq = FVector::DistSquared(SortOrigin, SubjectPos);
-
-			if (bSingleResult)
-			{
-				bool bIsBetter = false;
-				if (SortMode == ESortMode::NearToFar)
-				{
-					bIsBetter = (CurrentDistSq < BestDistSq);
-				}
-				else if (SortMode == ESortMode::FarToNear)
-				{
-					bIsBetter = (CurrentDistSq > BestDistSq);
-				}
-				else // ESortMode::None
-				{
-					bIsBetter = true;
-				}
-
-				if (bIsBetter)
-				{
-					BestResult.Subject = Subject;
-					BestResult.Location = SubjectPos;
-					BestResult.CachedDistSq = CurrentDistSq;
-					BestDistSq = CurrentDistSq;
-
-					// 更新阈值
-					if (!bNoCountLimit && KeepCount > 0)
-					{
-						const float MaxCellSize = CellSize.GetMax();
-						const float ThresholdDistance = FMath::Sqrt(BestDistSq) + 2.0f * MaxCellSize * FMath::Sqrt(2.0f);
-						ThresholdDistanceSq = FMath::Square(ThresholdDistance);
-					}
-				}
-			}
-			else
-			{
-				FTraceResult Result;
-				Result.Subject = Subject;
-				Result.Location = SubjectPos;
-				Result.CachedDistSq = CurrentDistSq;
-				TempResults.Add(Result);
-
-				// 当收集到足够结果时更新阈值
-				if (!bNoCountLimit && KeepCount > 0 && SortMode != ESortMode::None && TempResults.Num() >= KeepCount)
-				{
-					// 找到当前第KeepCount个最佳结果的距离
-					float CurrentThresholdDistSq = 0.0f;
-					if (SortMode == ESortMode::NearToFar)
-					{
-						CurrentThresholdDistSq = TempResults[KeepCount - 1].CachedDistSq;
-					}
-					else // FarToNear
-					{
-						CurrentThresholdDistSq = TempResults.Last().CachedDistSq;
-					}
+			if (DistSq > FMath::Square(CombinedRadius)) return;
 
-					// 更新阈值
-					const float MaxCellSize = CellSize.GetMax();
-					const float ThresholdDistance = FMath::Sqrt(CurrentThresholdDistSq) + 2.0f * MaxCellSize * FMath::Sqrt(2.0f);
-					ThresholdDistanceSq = FMath::Square(ThresholdDistance);
-				}
-			}
-		}
+			Collector.Accept(Subject, SubjectPos, SubjectRadius, Archetype);
+		});
 	}
 
 	// 处理结果
-	if (bSingleResult)
+	TFrameArray<FTraceResult>& TempResults = Collector.TempResults;
+
+	if (Collector.bSingleResult)
 	{
-		if (BestDistSq != FLT_MAX && BestDistSq != -FLT_MAX)
+		if (Collector.HasBestResult())
 		{
-			Results.Add(BestResult);
+			Results.Add(Collector.BestResult);
 		}
 	}
 	else if (TempResults.Num() > 0)
@@ -277,16 +471,18 @@ void UNeighborGridComponent::SphereTraceForSubjects
 			// 随机打乱结果
 			if (TempResults.Num() > 1)
 			{
+				FRandomStream Stream(FBattleFrameRandom::StreamSeed(GetTypeHash(Origin)));
+
 				for (int32 i = TempResults.Num() - 1; i > 0; --i)
 				{
-					const int32 j = FMath::Rand() % (i + 1);
+					const int32 j = Stream.RandHelper(i + 1);
 					TempResults.Swap(i, j);
 				}
 			}
 		}
 
 		// 应用数量限制（只有当KeepCount>0时）
-		if (!bNoCountLimit && KeepCount > 0 && TempResults.Num() > KeepCount)
+		if (!Collector.bNoCountLimit && KeepCount > 0 && TempResults.Num() > KeepCount)
 		{
 			TempResults.SetNum(KeepCount);
 		}
@@ -316,10 +512,13 @@ void UNeighborGridComponent::SphereSweepForSubjects
 ) const
 {
 	//TRACE_CPUPROFILER_EVENT_SCOPE_STR("SphereSweepForSubjects");
+	FFrameArenaScope ArenaScope;
+
 	Results.Reset(); // Clear result array
 
 	// Convert ignore list to set for fast lookup
-	const TSet<FSubjectHandle> IgnoreSet(IgnoreSubjects.Subjects);
+	TFrameSet<FSubjectHandle> IgnoreSet;
+	IgnoreSet.Append(IgnoreSubjects.Subjects);
 
 	// Get cells along the sweep path (already handles FVector CellSize)
 	TArray<FIntVector> GridCells = SphereSweepForCells(Start, End, Radius);
@@ -328,66 +527,53 @@ void UNeighborGridComponent::SphereSweepForSubjects
 	const float TraceLength = FVector::Distance(Start, End);
 
 	// Temporary array to store unsorted results
-	TArray<FTraceResult> TempResults;
+	TFrameArray<FTraceResult> TempResults;
 
-	// Check subjects in each cell
-	for (const FIntVector& CellIndex : GridCells)
-	{
-		if (!IsInside(CellIndex)) continue;
-
-		const auto& CageCell = At(CellIndex.X, CellIndex.Y, CellIndex.Z);
-
-		for (const FAvoiding& Data : CageCell.Subjects)
-		{
-			const FSubjectHandle Subject = Data.SubjectHandle;
-
-			// Check if in ignore list
-			if (IgnoreSet.Contains(Subject)) continue;
+	// Matches results memoized per archetype
+	FArchetypeMatchCache MatchCache(ArchetypeFingerprints);
 
-			// Validity checks
-			if (!Subject.IsValid() || !Subject.Matches(Filter)) continue;
-
-			const FVector SubjectPos = Data.Location;
-			float SubjectRadius = Data.Radius;
-
-			// Distance calculations
-			const FVector ToSubject = SubjectPos - Start;
-			const float ProjOnTrace = FVector::DotProduct(ToSubject, TraceDir);
+	// Precise check and result collection for a subject inside the sweep capsule
+	auto AcceptCandidate = [&](const FSubjectHandle Subject, const FVector& SubjectPos, const float SubjectRadius, const uint32 SubjectHash, const uint16 Archetype)
+	{
+		// Check if in ignore list
+		if (IgnoreSet.Contains(Subject)) return;
 
-			// Initial filtering
-			const float ProjThreshold = SubjectRadius + Radius;
-			if (ProjOnTrace < -ProjThreshold || ProjOnTrace > TraceLength + ProjThreshold) continue;
+		// Validity checks
+		if (!Subject.IsValid() || !MatchCache.Matches(Subject, Archetype, Filter)) return;
 
-			// Precise distance check (still spherical)
-			const float ClampedProj = FMath::Clamp(ProjOnTrace, 0.0f, TraceLength);
-			const FVector NearestPoint = Start + ClampedProj * TraceDir;
-			const float CombinedRadSq = FMath::Square(Radius + SubjectRadius);
+		// Distance calculations
+		const FVector ToSubject = SubjectPos - Start;
+		const float ProjOnTrace = FVector::DotProduct(ToSubject, TraceDir);
 
-			if (FVector::DistSquared(NearestPoint, SubjectPos) < CombinedRadSq)
-			{
-				if (bCheckVisibility)
-				{
-					// Perform visibility check
-					bool bHit = false;
-					FTraceResult VisibilityResult;
+		// Initial filtering
+		const float ProjThreshold = SubjectRadius + Radius;
+		if (ProjOnTrace < -ProjThreshold || ProjOnTrace > TraceLength + ProjThreshold) return;
 
-					// Calculate the surface point on the subject's sphere
-					const FVector ToSubjectDir = (SubjectPos - CheckOrigin).GetSafeNormal();
-					const FVector SubjectSurfacePoint = SubjectPos - (ToSubjectDir * SubjectRadius);
+		// Precise distance check (still spherical)
+		const float ClampedProj = FMath::Clamp(ProjOnTrace, 0.0f, TraceLength);
+		const FVector NearestPoint = Start + ClampedProj * TraceDir;
+		const float CombinedRadSq = FMath::Square(Radius + SubjectRadius);
 
-					SphereSweepForObstacle(CheckOrigin, SubjectSurfacePoint, CheckRadius, bHit, VisibilityResult);
+		if (FVector::DistSquared(NearestPoint, SubjectPos) < CombinedRadSq)
+		{
+			// Path is blocked, skip this subject
+			if (bCheckVisibility && IsSubjectOccluded(*this, CheckOrigin, CheckRadius, SubjectPos, SubjectRadius)) return;
+
+			// Create FTraceResult and add to temp results array
+			FTraceResult Result;
+			Result.Subject = Subject;
+			Result.Location = SubjectPos;
+			Result.CachedDistSq = FVector::DistSquared(SortOrigin, SubjectPos);
+			TempResults.Add(Result);
+		}
+	};
 
-					if (bHit) continue; // Path is blocked, skip this subject
-				}
+	// Check subjects in each cell
+	for (const FIntVector& CellIndex : GridCells)
+	{
+		if (!IsInside(CellIndex)) continue;
 
-				// Create FTraceResult and add to temp results array
-				FTraceResult Result;
-				Result.Subject = Subject;
-				Result.Location = SubjectPos;
-				Result.CachedDistSq = FVector::DistSquared(SortOrigin, SubjectPos);
-				TempResults.Add(Result);
-			}
-		}
+		ForEachSubjectInCell(CellIndex, 0, AcceptCandidate);
 	}
 
 	// Sorting logic
@@ -441,19 +627,55 @@ void UNeighborGridComponent::SectorTraceForSubjects
 	const FSubjectArray& IgnoreSubjects,
 	const FFilter& Filter,
 	bool& Hit,
-	TArray<FTraceResult>& Results
+	TArray<FTraceResult>& Results,
+	const uint16 TeamMask
 ) const
 {
 	//TRACE_CPUPROFILER_EVENT_SCOPE_STR("SectorTraceForSubjects");
+
+	// 最近的少量目标：逐圈搜索，不排序格子也不收集全部结果
+	if (SortMode == ESortMode::NearToFar && KeepCount >= 1 && KeepCount <= MaxNeighborsCapacity)
+	{
+		const bool bFullCircle = FMath::IsNearlyEqual(Angle, 360.0f, KINDA_SMALL_NUMBER);
+		const FVector NormalizedDir = Direction.GetSafeNormal2D();
+		const float CosHalfAngle = FMath::Cos(FMath::DegreesToRadians(Angle * 0.5f));
+		const FVector CellRadius = CellSize * 0.5f;
+		const float ExpandedRadiusXY = Radius + FMath::Max(CellRadius.X, CellRadius.Y) * FMath::Sqrt(2.0f);
+		const FVector Range(ExpandedRadiusXY, ExpandedRadiusXY, Height / 2.0f + CellRadius.Z);
+
+		TraceNearestInRings(KeepCount, WorldToCage(Origin - Range), WorldToCage(Origin + Range),
+			bCheckVisibility, CheckOrigin, CheckRadius, SortOrigin, IgnoreSubjects, Filter, TeamMask,
+			[&](const FIntVector& CellPos)
+			{
+				const FVector CellMin = CageToWorld(CellPos);
+				return FBox(CellMin, CellMin + CellSize).ComputeSquaredDistanceToPoint(FVector(Origin.X, Origin.Y, CellMin.Z)) <= FMath::Square(ExpandedRadiusXY);
+			},
+			[&](const FVector& SubjectPos, const float SubjectRadius)
+			{
+				// 高度、距离、角度检查
+				if (FMath::Abs(SubjectPos.Z - Origin.Z) > (Height / 2.0f + SubjectRadius)) return false;
+
+				const FVector DeltaXY = (SubjectPos - Origin) * FVector(1, 1, 0);
+				const float DistSqXY = DeltaXY.SizeSquared();
+				if (DistSqXY > FMath::Square(Radius + SubjectRadius)) return false;
+
+				return bFullCircle || DistSqXY <= SMALL_NUMBER || FVector::DotProduct(NormalizedDir, DeltaXY.GetSafeNormal()) >= CosHalfAngle;
+			},
+			Results);
+
+		Hit = !Results.IsEmpty();
+		return;
+	}
+
+	FFrameArenaScope ArenaScope;
+
 	Results.Reset();
 
-	// 特殊处理标志
 	const bool bFullCircle = FMath::IsNearlyEqual(Angle, 360.0f, KINDA_SMALL_NUMBER);
-	const bool bSingleResult = (KeepCount == 1);
-	const bool bNoCountLimit = (KeepCount == -1);
 
 	// 将忽略列表转换为集合以便快速查找
-	const TSet<FSubjectHandle> IgnoreSet(IgnoreSubjects.Subjects);
+	TFrameSet<FSubjectHandle> IgnoreSet;
+	IgnoreSet.Append(IgnoreSubjects.Subjects);
 
 	const FVector NormalizedDir = Direction.GetSafeNormal2D();
 	const float HalfAngleRad = FMath::DegreesToRadians(Angle * 0.5f);
@@ -476,15 +698,8 @@ void UNeighborGridComponent::SectorTraceForSubjects
 	const FIntVector CagePosMin = WorldToCage(Origin - Range);
 	const FIntVector CagePosMax = WorldToCage(Origin + Range);
 
-	// 跟踪最佳结果（用于KeepCount=1的情况）
-	FTraceResult BestResult;
-	float BestDistSq = (SortMode == ESortMode::NearToFar) ? FLT_MAX : -FLT_MAX;
-
-	// 临时存储所有结果（用于需要排序或随机的情况）
-	TArray<FTraceResult> TempResults;
-
 	// 预收集候选格子并按距离排序
-	TArray<FIntVector> CandidateCells;
+	TFrameArray<FIntVector> CandidateCells;
 
 	for (int32 z = CagePosMin.Z; z <= CagePosMax.Z; ++z)
 	{
@@ -544,143 +759,47 @@ void UNeighborGridComponent::SectorTraceForSubjects
 			});
 	}
 
-	// 计算提前终止阈值
-	float ThresholdDistanceSq = FLT_MAX;
-	if (!bNoCountLimit && KeepCount > 0 && SortMode != ESortMode::None)
-	{
-		// 计算阈值：当前最远结果的距离 + 2倍格子对角线距离（使用最大轴尺寸）
-		const float MaxCellSize = CellSize.GetMax();
-		const float ThresholdDistance = FMath::Sqrt(BestDistSq) + 2.0f * MaxCellSize * FMath::Sqrt(2.0f);
-		ThresholdDistanceSq = FMath::Square(ThresholdDistance);
-	}
+	// 形状检测通过后的处理：忽略列表、过滤、可见性、收集结果
+	FTraceCandidateCollector Collector(*this, IgnoreSet, Filter, KeepCount, bCheckVisibility, CheckOrigin, CheckRadius, SortMode, SortOrigin);
 
 	// 遍历检测
 	for (const FIntVector& CellPos : CandidateCells)
 	{
 		// 提前终止检查
-		if (!bNoCountLimit && KeepCount > 0 && SortMode != ESortMode::None)
-		{
-			const float CellDistSq = FVector::DistSquared(CageToWorld(CellPos), SortOrigin);
-			if ((SortMode == ESortMode::NearToFar && CellDistSq > ThresholdDistanceSq) ||
-				(SortMode == ESortMode::FarToNear && CellDistSq < ThresholdDistanceSq))
-			{
-				break;
-			}
-		}
+		if (Collector.IsBeyondThreshold(FVector::DistSquared(CageToWorld(CellPos), SortOrigin))) break;
 
-		const auto& CellData = At(CellPos);
-
-		for (const FAvoiding& SubjectData : CellData.Subjects)
+		ForEachSubjectInCell(CellPos, TeamMask, [&](const FSubjectHandle Subject, const FVector& SubjectPos, const float SubjectRadius, const uint32 SubjectHash, const uint16 Archetype)
 		{
-			const FSubjectHandle Subject = SubjectData.SubjectHandle;
-			if (IgnoreSet.Contains(Subject)) continue;
-			if (!Subject.Matches(Filter)) continue;
-
-			const FVector SubjectPos = SubjectData.Location;
-			const float SubjectRadius = SubjectData.Radius;
-
 			// 高度检查
 			const float VerticalDist = FMath::Abs(SubjectPos.Z - Origin.Z);
-			if (VerticalDist > (Height / 2.0f + SubjectRadius)) continue;
+			if (VerticalDist > (Height / 2.0f + SubjectRadius)) return;
 
 			// 距离检查
 			const FVector DeltaXY = (SubjectPos - Origin) * FVector(1, 1, 0);
 			const float DistSqXY = DeltaXY.SizeSquared();
 			const float CombinedRadius = Radius + SubjectRadius;
-			if (DistSqXY > FMath::Square(CombinedRadius)) continue;
+			if (DistSqXY > FMath::Square(CombinedRadius)) return;
 
 			// 角度检查
 			if (!bFullCircle && DistSqXY > SMALL_NUMBER)
 			{
 				const FVector ToSubjectDirXY = DeltaXY.GetSafeNormal();
 				const float DotProduct = FVector::DotProduct(NormalizedDir, ToSubjectDirXY);
-				if (DotProduct < CosHalfAngle) continue;
-			}
-
-			if (bCheckVisibility)
-			{
-				bool bVisibilityHit = false;
-				FTraceResult VisibilityResult;
-
-				const FVector ToSubjectDir = (SubjectPos - CheckOrigin).GetSafeNormal();
-				const FVector SubjectSurfacePoint = SubjectPos - (ToSubjectDir * SubjectRadius);
-
-				SphereSweepForObstacle(CheckOrigin, SubjectSurfacePoint, CheckRadius, bVisibilityHit, VisibilityResult);
-
-				if (bVisibilityHit) continue;
+				if (DotProduct < CosHalfAngle) return;
 			}
 
-			const float CurrentDistSq = FVector::DistSquared(SortOrigin, SubjectPos);
-
-			if (bSingleResult)
-			{
-				bool bIsBetter = false;
-				if (SortMode == ESortMode::NearToFar)
-				{
-					bIsBetter = (CurrentDistSq < BestDistSq);
-				}
-				else if (SortMode == ESortMode::FarToNear)
-				{
-					bIsBetter = (CurrentDistSq > BestDistSq);
-				}
-				else // ESortMode::None
-				{
-					bIsBetter = true;
-				}
-
-				if (bIsBetter)
-				{
-					BestResult.Subject = Subject;
-					BestResult.Location = SubjectPos;
-					BestResult.CachedDistSq = CurrentDistSq;
-					BestDistSq = CurrentDistSq;
-
-					// 更新阈值
-					if (!bNoCountLimit && KeepCount > 0)
-					{
-						const float MaxCellSize = CellSize.GetMax();
-						const float ThresholdDistance = FMath::Sqrt(BestDistSq) + 2.0f * MaxCellSize * FMath::Sqrt(2.0f);
-						ThresholdDistanceSq = FMath::Square(ThresholdDistance);
-					}
-				}
-			}
-			else
-			{
-				FTraceResult Result;
-				Result.Subject = Subject;
-				Result.Location = SubjectPos;
-				Result.CachedDistSq = CurrentDistSq;
-				TempResults.Add(Result);
-
-				// 当收集到足够结果时更新阈值
-				if (!bNoCountLimit && KeepCount > 0 && SortMode != ESortMode::None && TempResults.Num() >= KeepCount)
-				{
-					// 找到当前第KeepCount个最佳结果的距离
-					float CurrentThresholdDistSq = 0.0f;
-					if (SortMode == ESortMode::NearToFar)
-					{
-						CurrentThresholdDistSq = TempResults[KeepCount - 1].CachedDistSq;
-					}
-					else // FarToNear
-					{
-						CurrentThresholdDistSq = TempResults.Last().CachedDistSq;
-					}
-
-					// 更新阈值
-					const float MaxCellSize = CellSize.GetMax();
-					const float ThresholdDistance = FMath::Sqrt(CurrentThresholdDistSq) + 2.0f * MaxCellSize * FMath::Sqrt(2.0f);
-					ThresholdDistanceSq = FMath::Square(ThresholdDistance);
-				}
-			}
-		}
+			Collector.Accept(Subject, SubjectPos, SubjectRadius, Archetype);
+		});
 	}
 
 	// 处理结果
-	if (bSingleResult)
+	TFrameArray<FTraceResult>& TempResults = Collector.TempResults;
+
+	if (Collector.bSingleResult)
 	{
-		if (BestDistSq != FLT_MAX && BestDistSq != -FLT_MAX)
+		if (Collector.HasBestResult())
 		{
-			Results.Add(BestResult);
+			Results.Add(Collector.BestResult);
 		}
 	}
 	else if (TempResults.Num() > 0)
@@ -700,16 +819,18 @@ void UNeighborGridComponent::SectorTraceForSubjects
 			// 随机打乱结果
 			if (TempResults.Num() > 1)
 			{
+				FRandomStream Stream(FBattleFrameRandom::StreamSeed(GetTypeHash(Origin)));
+
 				for (int32 i = TempResults.Num() - 1; i > 0; --i)
 				{
-					const int32 j = FMath::Rand() % (i + 1);
+					const int32 j = Stream.RandHelper(i + 1);
 					TempResults.Swap(i, j);
 				}
 			}
 		}
 
 		// 应用数量限制（只有当KeepCount>0时）
-		if (!bNoCountLimit && KeepCount > 0 && TempResults.Num() > KeepCount)
+		if (!Collector.bNoCountLimit && KeepCount > 0 && TempResults.Num() > KeepCount)
 		{
 			TempResults.SetNum(KeepCount);
 		}
@@ -720,6 +841,299 @@ void UNeighborGridComponent::SectorTraceForSubjects
 	Hit = !Results.IsEmpty();
 }
 
+void UNeighborGridComponent::SectorTraceForSubjectsBatch
+(
+	TConstArrayView<FSectorTraceQuery> Queries,
+	TArray<FTraceResult>& OutResults,
+	TArray<int32>& OutOffsets
+) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SectorTraceForSubjectsBatch");
+
+	const int32 NumQueries = Queries.Num();
+
+	OutResults.Reset();
+	OutOffsets.SetNumZeroed(NumQueries + 1);
+
+	if (NumQueries == 0) return;
+
+	// 按原点所在格子分组，同组查询的搜索范围基本重合，格子内的Subjects只读一次
+	static constexpr int32 MaxQueriesPerGroup = 64;
+
+	TArray<TPair<int32, int32>> Keyed;// 格子下标, 查询下标
+	Keyed.SetNumUninitialized(NumQueries);
+
+	for (int32 i = 0; i < NumQueries; ++i)
+	{
+		Keyed[i] = TPair<int32, int32>(GetIndexAt(Queries[i].Origin), i);
+	}
+
+	Keyed.Sort([](const TPair<int32, int32>& A, const TPair<int32, int32>& B)
+	{
+		return A.Key != B.Key ? A.Key < B.Key : A.Value < B.Value;
+	});
+
+	TArray<int32> GroupStart;
+
+	for (int32 k = 0; k < NumQueries; ++k)
+	{
+		if (k == 0 || Keyed[k].Key != Keyed[k - 1].Key || k - GroupStart.Last() >= MaxQueriesPerGroup)
+		{
+			GroupStart.Add(k);
+		}
+	}
+
+	GroupStart.Add(NumQueries);
+
+	const int32 NumGroups = GroupStart.Num() - 1;
+
+	// 每组的结果先写入组内数组，QueryBegin 记录查询在组内的起点
+	TArray<TArray<FTraceResult>> GroupResults;
+	GroupResults.SetNum(NumGroups);
+
+	TArray<int32> QueryGroup;
+	TArray<int32> QueryBegin;
+	QueryGroup.SetNumUninitialized(NumQueries);
+	QueryBegin.SetNumUninitialized(NumQueries);
+
+	const FVector CellRadius = CellSize * 0.5f;
+	const float MaxCellRadius = FMath::Max(CellRadius.X, CellRadius.Y);
+
+	ParallelFor(NumGroups, [&](int32 GroupIndex)
+	{
+		FFrameArenaScope ArenaScope;
+
+		const int32 First = GroupStart[GroupIndex];
+		const int32 NumInGroup = GroupStart[GroupIndex + 1] - First;
+
+		struct FPrepared
+		{
+			FVector NormalizedDir;
+			float CosHalfAngle;
+			float ExpandedRadiusXY;
+			bool bFullCircle;
+			bool bKeepBestOnly;
+			FIntVector CageMin;
+			FIntVector CageMax;
+			FArchetypeMatchCache MatchCache;
+		};
+
+		TFrameArray<FPrepared> Prepared;
+		Prepared.SetNumUninitialized(NumInGroup);
+
+		FIntVector UnionMin(MAX_int32, MAX_int32, MAX_int32);
+		FIntVector UnionMax(MIN_int32, MIN_int32, MIN_int32);
+
+		for (int32 q = 0; q < NumInGroup; ++q)
+		{
+			const FSectorTraceQuery& Query = Queries[Keyed[First + q].Value];
+			FPrepared& P = Prepared[q];
+
+			P.NormalizedDir = Query.Direction.GetSafeNormal2D();
+			P.CosHalfAngle = FMath::Cos(FMath::DegreesToRadians(Query.Angle * 0.5f));
+			P.bFullCircle = FMath::IsNearlyEqual(Query.Angle, 360.0f, KINDA_SMALL_NUMBER);
+			P.bKeepBestOnly = Query.KeepCount == 1 && !Query.bCheckVisibility && Query.SortMode != ESortMode::None;
+			P.MatchCache = FArchetypeMatchCache(ArchetypeFingerprints);
+			P.ExpandedRadiusXY = Query.Radius + MaxCellRadius * FMath::Sqrt(2.0f);
+
+			const FVector Range(P.ExpandedRadiusXY, P.ExpandedRadiusXY, Query.Height / 2.0f + CellRadius.Z);
+			const FIntVector Min = WorldToCage(Query.Origin - Range);
+			const FIntVector Max = WorldToCage(Query.Origin + Range);
+
+			P.CageMin = FIntVector(FMath::Max(Min.X, 0), FMath::Max(Min.Y, 0), FMath::Max(Min.Z, 0));
+			P.CageMax = FIntVector(FMath::Min(Max.X, GridSize.X - 1), FMath::Min(Max.Y, GridSize.Y - 1), FMath::Min(Max.Z, GridSize.Z - 1));
+
+			UnionMin = FIntVector(FMath::Min(UnionMin.X, P.CageMin.X), FMath::Min(UnionMin.Y, P.CageMin.Y), FMath::Min(UnionMin.Z, P.CageMin.Z));
+			UnionMax = FIntVector(FMath::Max(UnionMax.X, P.CageMax.X), FMath::Max(UnionMax.Y, P.CageMax.Y), FMath::Max(UnionMax.Z, P.CageMax.Z));
+		}
+
+		// KeepCount 为1且不检查可见性时只保留最佳结果，其余查询收集候选后再排序和检查可见性
+		TFrameArray<FTraceResult> Best;
+		Best.SetNum(NumInGroup);
+
+		struct FCandidate
+		{
+			int32 Query;
+			float Radius;
+			FTraceResult Result;
+		};
+
+		TFrameArray<FCandidate> Candidates;
+		TFrameArray<int32> CellQueries;
+
+		auto TestSubject = [&](const FSubjectHandle Subject, const FVector& SubjectPos, const float SubjectRadius, const uint16 Archetype)
+		{
+			for (const int32 q : CellQueries)
+			{
+				const FSectorTraceQuery& Query = Queries[Keyed[First + q].Value];
+				FPrepared& P = Prepared[q];
+
+				// 高度检查
+				if (FMath::Abs(SubjectPos.Z - Query.Origin.Z) > (Query.Height / 2.0f + SubjectRadius)) continue;
+
+				// 距离检查
+				const FVector DeltaXY = (SubjectPos - Query.Origin) * FVector(1, 1, 0);
+				const float DistSqXY = DeltaXY.SizeSquared();
+				if (DistSqXY > FMath::Square(Query.Radius + SubjectRadius)) continue;
+
+				// 角度检查
+				if (!P.bFullCircle && DistSqXY > SMALL_NUMBER)
+				{
+					if (FVector::DotProduct(P.NormalizedDir, DeltaXY.GetSafeNormal()) < P.CosHalfAngle) continue;
+				}
+
+				if (Subject == Query.IgnoreSubject) continue;
+				if (!P.MatchCache.Matches(Subject, Archetype, Query.Filter)) continue;
+
+				FTraceResult Result;
+				Result.Subject = Subject;
+				Result.Location = SubjectPos;
+				Result.CachedDistSq = FVector::DistSquared(Query.SortOrigin, SubjectPos);
+
+				if (P.bKeepBestOnly)
+				{
+					FTraceResult& Current = Best[q];
+					const bool bIsBetter = !Current.Subject.IsValid()
+						|| (Query.SortMode == ESortMode::NearToFar ? Result.CachedDistSq < Current.CachedDistSq : Result.CachedDistSq > Current.CachedDistSq);
+
+					if (bIsBetter)
+					{
+						Current = Result;
+					}
+				}
+				else
+				{
+					Candidates.Add({ q, SubjectRadius, Result });
+				}
+			}
+		};
+
+		for (int32 z = UnionMin.Z; z <= UnionMax.Z; ++z)
+		{
+			for (int32 x = UnionMin.X; x <= UnionMax.X; ++x)
+			{
+				for (int32 y = UnionMin.Y; y <= UnionMax.Y; ++y)
+				{
+					const FIntVector CellPos(x, y, z);
+					const FVector CellCenter = CageToWorld(CellPos) + CellRadius;
+
+					// 覆盖该格子的查询，以及它们需要遍历的队伍层
+					CellQueries.Reset();
+					uint16 CellTeamMask = 0;
+					bool bAnyTeam = false;
+
+					for (int32 q = 0; q < NumInGroup; ++q)
+					{
+						const FPrepared& P = Prepared[q];
+
+						if (x < P.CageMin.X || x > P.CageMax.X || y < P.CageMin.Y || y > P.CageMax.Y || z < P.CageMin.Z || z > P.CageMax.Z) continue;
+
+						const FVector& Origin = Queries[Keyed[First + q].Value].Origin;
+						if (FVector::DistSquaredXY(CellCenter, Origin) > FMath::Square(P.ExpandedRadiusXY)) continue;
+
+						CellQueries.Add(q);
+
+						const uint16 QueryTeamMask = Queries[Keyed[First + q].Value].TeamMask;
+						bAnyTeam |= QueryTeamMask == 0;
+						CellTeamMask |= QueryTeamMask;
+					}
+
+					if (CellQueries.IsEmpty()) continue;
+
+					ForEachSubjectInCell(CellPos, bAnyTeam ? 0 : CellTeamMask, [&](const FSubjectHandle Subject, const FVector& SubjectPos, const float SubjectRadius, const uint32 SubjectHash, const uint16 Archetype)
+					{
+						TestSubject(Subject, SubjectPos, SubjectRadius, Archetype);
+					});
+				}
+			}
+		}
+
+		// 按查询分段，段内按各自的排序方式排列
+		Candidates.Sort([&](const FCandidate& A, const FCandidate& B)
+		{
+			if (A.Query != B.Query) return A.Query < B.Query;
+
+			const ESortMode SortMode = Queries[Keyed[First + A.Query].Value].SortMode;
+			if (SortMode == ESortMode::NearToFar) return A.Result.CachedDistSq < B.Result.CachedDistSq;
+			if (SortMode == ESortMode::FarToNear) return A.Result.CachedDistSq > B.Result.CachedDistSq;
+			return false;
+		});
+
+		TArray<FTraceResult>& Results = GroupResults[GroupIndex];
+		int32 Cursor = 0;
+
+		for (int32 q = 0; q < NumInGroup; ++q)
+		{
+			const int32 QueryIndex = Keyed[First + q].Value;
+			const FSectorTraceQuery& Query = Queries[QueryIndex];
+
+			QueryGroup[QueryIndex] = GroupIndex;
+			QueryBegin[QueryIndex] = Results.Num();
+
+			if (Prepared[q].bKeepBestOnly)
+			{
+				if (Best[q].Subject.IsValid())
+				{
+					Results.Add(Best[q]);
+				}
+
+				OutOffsets[QueryIndex + 1] = Results.Num() - QueryBegin[QueryIndex];
+				continue;
+			}
+
+			int32 RunEnd = Cursor;
+			while (RunEnd < Candidates.Num() && Candidates[RunEnd].Query == q) ++RunEnd;
+
+			// 不排序时随机打乱
+			if (Query.SortMode == ESortMode::None && RunEnd - Cursor > 1)
+			{
+				FRandomStream Stream(FBattleFrameRandom::StreamSeed(GetTypeHash(Query.Origin)));
+
+				for (int32 i = RunEnd - 1; i > Cursor; --i)
+				{
+					Candidates.Swap(i, Cursor + Stream.RandHelper(i - Cursor + 1));
+				}
+			}
+
+			// 按顺序检查可见性，够数后停止，只对可能被保留的候选做扫掠
+			const bool bHasLimit = Query.KeepCount > 0;
+			int32 Kept = 0;
+
+			for (int32 i = Cursor; i < RunEnd && !(bHasLimit && Kept >= Query.KeepCount); ++i)
+			{
+				const FTraceResult& Candidate = Candidates[i].Result;
+
+				if (Query.bCheckVisibility && IsSubjectOccluded(*this, Query.CheckOrigin, Query.CheckRadius, Candidate.Location, Candidates[i].Radius)) continue;
+
+				Results.Add(Candidate);
+				++Kept;
+			}
+
+			OutOffsets[QueryIndex + 1] = Kept;
+			Cursor = RunEnd;
+		}
+	});
+
+	// 前缀和得到每个查询在输出中的区间，再按查询顺序拷贝
+	for (int32 i = 0; i < NumQueries; ++i)
+	{
+		OutOffsets[i + 1] += OutOffsets[i];
+	}
+
+	OutResults.SetNum(OutOffsets[NumQueries]);
+
+	ParallelFor(NumQueries, [&](int32 QueryIndex)
+	{
+		const int32 Count = OutOffsets[QueryIndex + 1] - OutOffsets[QueryIndex];
+		const TArray<FTraceResult>& Source = GroupResults[QueryGroup[QueryIndex]];
+
+		for (int32 i = 0; i < Count; ++i)
+		{
+			OutResults[OutOffsets[QueryIndex] + i] = Source[QueryBegin[QueryIndex] + i];
+		}
+	});
+}
+
 // Single Sweep Trace For Nearest Obstacle
 void UNeighborGridComponent::SphereSweepForObstacle
 (
@@ -734,10 +1148,18 @@ void UNeighborGridComponent::SphereSweepForObstacle
 	Result = FTraceResult();
 	float ClosestHitDistSq = FLT_MAX;
 
-	TArray<FIntVector> PathCells = SphereSweepForCells(Start, End, Radius);
 	const FVector CellExtent = CellSize * 0.5f;
 	const float CellMaxRadius = CellExtent.GetMax(); // 最长半轴作为单元包围球半径
 
+	// 格子里的障碍物到线段距离的下界，与原先的提前退出条件相同
+	auto CellMinDistSq = [&](const FIntVector& CellPos)
+		{
+			const FVector CellCenter = CageToWorld(CellPos);
+			const float MinPossibleDist = FMath::Sqrt(FMath::PointDistToSegmentSquared(CellCenter, Start, End)) - CellMaxRadius;
+
+			return MinPossibleDist > 0 ? MinPossibleDist * MinPossibleDist : 0.f;
+		};
+
 	auto ProcessObstacle = [&](const FAvoiding& Obstacle, float DistSqr)
 		{
 			if (DistSqr < ClosestHitDistSq)
@@ -750,7 +1172,8 @@ void UNeighborGridComponent::SphereSweepForObstacle
 			}
 		};
 
-	for (const FIntVector& CellPos : PathCells)
+	// 沿扫掠路径逐层访问格子，结果取距离最近的命中：命中后跳过不可能更近的格子，整层都不可能更近时停止
+	auto ProcessCell = [&](const FIntVector& CellPos)
 	{
 		const auto& Cell = At(CellPos);
 
@@ -940,20 +1363,32 @@ void UNeighborGridComponent::SphereSweepForObstacle
 		// 检查静态/动态盒体障碍物
 		CheckBoxCollision(Cell.BoxObstacles);
 		CheckBoxCollision(Cell.BoxObstaclesStatic);
+	};
 
-		// ============== 新增提前退出判断 ==============
-		if (Hit) // 只有发现过障碍物才需要判断
-		{
-			const FVector CellCenter = CageToWorld(CellPos);
-			const float DistToSegmentSq = FMath::PointDistToSegmentSquared(CellCenter, Start, End);
-			const float MinPossibleDist = FMath::Sqrt(DistToSegmentSq) - CellMaxRadius;
+	ForEachSweptSlab(Start, End, Radius, [&](const FIntVector& SlabMin, const FIntVector& SlabMax)
+	{
+		float SlabMinDistSq = FLT_MAX;
 
-			if (MinPossibleDist > 0 && (MinPossibleDist * MinPossibleDist) > ClosestHitDistSq)
+		for (int32 z = SlabMin.Z; z <= SlabMax.Z; ++z)
+		{
+			for (int32 y = SlabMin.Y; y <= SlabMax.Y; ++y)
 			{
-				break; // 后续单元不可能更近，提前退出循环
+				for (int32 x = SlabMin.X; x <= SlabMax.X; ++x)
+				{
+					const FIntVector CellPos(x, y, z);
+					const float MinDistSq = CellMinDistSq(CellPos);
+
+					SlabMinDistSq = FMath::Min(SlabMinDistSq, MinDistSq);
+
+					if (Hit && MinDistSq > ClosestHitDistSq) continue;
+
+					ProcessCell(CellPos);
+				}
 			}
 		}
-	}
+
+		return !Hit || SlabMinDistSq <= ClosestHitDistSq;
+	});
 }
 
 
@@ -967,26 +1402,46 @@ void UNeighborGridComponent::SphereSweepForObstacle
 void UNeighborGridComponent::Update()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_STR("RVO2 Update");
+	BATTLEFRAME_CAPTURE_SYSTEM();
 
 	{
 		TRACE_CPUPROFILER_EVENT_SCOPE_STR("ResetCells");
 
 		ParallelFor(OccupiedCellsQueues.Num(), [&](int32 Index)
 		{
-			int32 CellIndex;
-
-			while (OccupiedCellsQueues[Index].Dequeue(CellIndex))
+			auto ResetCell = [&](int32 CellIndex)
 			{
 				auto& Cell = Cells[CellIndex];
 				Cell.Lock();
 				Cell.Reset();
 				Cell.Unlock();
+			};
+
+			for (int32 CellIndex : OccupiedCellsDrained[Index])
+			{
+				ResetCell(CellIndex);
+			}
+
+			OccupiedCellsDrained[Index].Reset();
+
+			int32 CellIndex;
+
+			while (OccupiedCellsQueues[Index].Dequeue(CellIndex))
+			{
+				ResetCell(CellIndex);
 			}			
 		});
 	}
 
+	ResetArchetypeIds();
+
 	AMechanism* Mechanism = GetMechanism();
 
+	if (bTeamLayers && !bLockFreeUpdate)
+	{
+		TagTeamLayers();// 注册时FAvoiding被复制进格子，队伍需要先写好
+	}
+
 	{
 		TRACE_CPUPROFILER_EVENT_SCOPE_STR("RegisterNeighborGrid_Trace");
 
@@ -995,6 +1450,7 @@ void UNeighborGridComponent::Update()
 
 		Chain->OperateConcurrently([&](FLocated& Located, FTrace& Trace)
 		{
+			BATTLEFRAME_WORKER_PROBE();
 			const auto Location = Located.Location;
 
 			if (UNLIKELY(!IsInside(Location))) return;
@@ -1014,6 +1470,7 @@ void UNeighborGridComponent::Update()
 
 		Chain->OperateConcurrently([&](FLocated& Located, FSphereObstacle& SphereObstacle)
 		{
+			BATTLEFRAME_WORKER_PROBE();
 			if (UNLIKELY(!IsInside(Located.Location))) return;
 
 			SphereObstacle.Lock();
@@ -1023,6 +1480,12 @@ void UNeighborGridComponent::Update()
 		}, ThreadsCount, BatchSize);
 	}
 
+	if (bLockFreeUpdate)
+	{
+		RebuildSubjectsLockFree();
+	}
+
+	if (!bLockFreeUpdate)
 	{
 		TRACE_CPUPROFILER_EVENT_SCOPE_STR("RegisterSubjectSingle");// agents are allowed to register themselves only in the cell where their origins are in, this helps to improve performance
 
@@ -1031,12 +1494,14 @@ void UNeighborGridComponent::Update()
 
 		Chain->OperateConcurrently([&](FSolidSubjectHandle Subject, FLocated& Located, FCollider& Collider, FAvoiding& Avoiding)
 		{
+			BATTLEFRAME_WORKER_PROBE();
 			const auto Location = Located.Location;
 
 			if (UNLIKELY(!IsInside(Location))) return;
 
 			Avoiding.Location = Location;
 			Avoiding.Radius = Collider.Radius;
+			Avoiding.Archetype = GetArchetypeId(Subject.GetFingerprint());
 
 			bool bShouldRegister = false;
 
@@ -1063,6 +1528,7 @@ void UNeighborGridComponent::Update()
 		}, ThreadsCount, BatchSize);
 	}
 
+	if (!bLockFreeUpdate)
 	{
 		TRACE_CPUPROFILER_EVENT_SCOPE_STR("RegisterSubjectMultiple");// agents can also register themselves into all overlapping cells, thus improve avoidance precision
 
@@ -1071,12 +1537,14 @@ void UNeighborGridComponent::Update()
 
 		Chain->OperateConcurrently([&](FSolidSubjectHandle Subject, FLocated& Located, FCollider& Collider, FAvoiding& Avoiding)
 		{
+			BATTLEFRAME_WORKER_PROBE();
 			const auto Location = Located.Location;
 
 			if (UNLIKELY(!IsInside(Location))) return;
 
 			Avoiding.Location = Location;
 			Avoiding.Radius = Collider.Radius;
+			Avoiding.Archetype = GetArchetypeId(Subject.GetFingerprint());
 
 			const FVector Range = FVector(Collider.Radius);
 
@@ -1130,6 +1598,7 @@ void UNeighborGridComponent::Update()
 
 		Chain->OperateConcurrently([&](FSolidSubjectHandle Subject, FSphereObstacle& SphereObstacle, FLocated& Located, FCollider& Collider, FAvoiding& Avoiding)
 		{
+			BATTLEFRAME_WORKER_PROBE();
 			if (SphereObstacle.bStatic && SphereObstacle.bRegistered) return; // if static, we only register once
 
 			const auto Location = Located.Location;
@@ -1187,105 +1656,532 @@ void UNeighborGridComponent::Update()
 				}
 			}
 
-			SphereObstacle.bRegistered = true;
+			SphereObstacle.bRegistered = true;
+
+		}, ThreadsCount, BatchSize);
+	}
+
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("RegisterBoxObstacles");
+
+		auto Chain = Mechanism->EnchainSolid(RegisterBoxObstaclesFilter);
+		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, 1, ThreadsCount, BatchSize);
+
+		Chain->OperateConcurrently([&](FSolidSubjectHandle Subject, FBoxObstacle& BoxObstacle, FAvoiding& Avoiding)
+		{
+			BATTLEFRAME_WORKER_PROBE();
+			if (BoxObstacle.bStatic && BoxObstacle.bRegistered) return; // if static, we only register once
+
+			const auto& Location = BoxObstacle.point3d_;
+			Avoiding.Location = Location;
+
+			const FBoxObstacle* PreObstaclePtr = BoxObstacle.prevObstacle_.GetTraitPtr<FBoxObstacle, EParadigm::Unsafe>();
+			const FBoxObstacle* NextObstaclePtr = BoxObstacle.nextObstacle_.GetTraitPtr<FBoxObstacle, EParadigm::Unsafe>();
+
+			if (NextObstaclePtr == nullptr || PreObstaclePtr == nullptr) return;
+
+			const FVector& NextLocation = NextObstaclePtr->point3d_;
+			const float ObstacleHeight = BoxObstacle.height_;
+
+			const float StartZ = Location.Z;
+			const float EndZ = StartZ + ObstacleHeight;
+			TSet<FIntVector> AllGridCells;
+			TArray<FIntVector> AllGridCellsArray;
+
+			float CurrentLayerZ = StartZ;
+
+			// 使用CellSize.Z作为Z轴步长
+			while (CurrentLayerZ < EndZ)
+			{
+				const FVector LayerCurrentPoint = FVector(Location.X, Location.Y, CurrentLayerZ);
+				const FVector LayerNextPoint = FVector(NextLocation.X, NextLocation.Y, CurrentLayerZ);
+
+				// 使用最大轴尺寸的2倍作为扫描半径
+				const float SweepRadius = CellSize.GetMax() * 2.0f;
+				auto LayerCells = SphereSweepForCells(LayerCurrentPoint, LayerNextPoint, SweepRadius);
+
+				for (const auto& CellPos : LayerCells)
+				{
+					AllGridCells.Add(CellPos);
+				}
+
+				CurrentLayerZ += CellSize.Z; // 使用Z轴尺寸作为步长
+			}
+
+			AllGridCellsArray = AllGridCells.Array();
+
+			ParallelFor(AllGridCellsArray.Num(), [&](int32 Index)
+				{
+					const FIntVector& CellPos = AllGridCellsArray[Index];
+
+					//if (!LIKELY(IsInside(CellPos))) return;
+
+					bool bShouldRegister = false;
+
+					auto& Cell = At(CellPos);
+
+					Cell.Lock();
+
+					if (!Cell.Registered)
+					{
+						bShouldRegister = true;
+						Cell.Registered = true;
+					}
+
+					if (BoxObstacle.bStatic)
+					{
+						Cell.BoxObstaclesStatic.Add(Avoiding);
+					}
+					else
+					{
+						Cell.BoxObstacles.Add(Avoiding);
+					}
+
+					Cell.Unlock();
+
+					if (bShouldRegister)
+					{
+						int32 CellIndex = GetIndexAt(CellPos);
+						OccupiedCellsQueues[CellIndex % MaxThreadsAllowed].Enqueue(CellIndex);
+					}
+				});
+
+			BoxObstacle.bRegistered = true;
+
+		}, ThreadsCount, BatchSize);
+	}
+
+	if (bTeamLayers && !bLockFreeUpdate)
+	{
+		SortCellsByTeam();
+	}
+
+	if (!bLockFreeUpdate)// the lock-free path writes the packed arrays directly
+	{
+		if (bUsePackedGrid)
+		{
+			BuildPackedGrid();
+		}
+		else
+		{
+			PackedGrid.Empty();
+		}
+	}
+}
+
+void UNeighborGridComponent::ResetArchetypeIds()
+{
+	// 每帧重新编号，编号只覆盖本帧注册的原型，不会随游戏时间耗尽
+	ArchetypeIds.Reset();
+	ArchetypeFingerprints.Reset();
+	++ArchetypeEpoch;
+}
+
+uint16 UNeighborGridComponent::GetArchetypeId(const FFingerprint& Fingerprint)
+{
+	if (!bCacheFilterMatches) return MAX_uint16;
+
+	// 同一Chunk的Subject连续出现，每个线程记住上一次的结果，一个Chunk只查一次表
+	struct FLastArchetype
+	{
+		const UNeighborGridComponent* Grid = nullptr;
+		uint32 Epoch = 0;
+		FFingerprint Fingerprint;
+		uint16 Id = MAX_uint16;
+	};
+
+	static thread_local FLastArchetype Last;
+
+	if (Last.Grid == this && Last.Epoch == ArchetypeEpoch && Last.Fingerprint == Fingerprint)
+	{
+		return Last.Id;
+	}
+
+	uint16 Id = MAX_uint16;
+
+	{
+		FReadScopeLock ReadLock(ArchetypeLock);
+
+		if (const uint16* Found = ArchetypeIds.Find(Fingerprint))
+		{
+			Id = *Found;
+		}
+	}
+
+	if (Id == MAX_uint16)
+	{
+		FWriteScopeLock WriteLock(ArchetypeLock);
+
+		if (const uint16* Found = ArchetypeIds.Find(Fingerprint))
+		{
+			Id = *Found;
+		}
+		else if (ArchetypeIds.Num() < MAX_uint16)// 编号用完后新的原型不再缓存，退回逐个Matches
+		{
+			Id = static_cast<uint16>(ArchetypeFingerprints.Add(Fingerprint));
+			ArchetypeIds.Add(Fingerprint, Id);
+		}
+	}
+
+	Last.Grid = this;
+	Last.Epoch = ArchetypeEpoch;
+	Last.Fingerprint = Fingerprint;
+	Last.Id = Id;
+
+	return Id;
+}
+
+void UNeighborGridComponent::TagTeamLayers()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("TagTeamLayers");
+
+	AMechanism* Mechanism = GetMechanism();
+
+	{
+		auto Chain = Mechanism->EnchainSolid(AvoidingFilter);
+		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
+
+		Chain->OperateConcurrently([&](FAvoiding& Avoiding)
+		{
+			Avoiding.Team = 0xFF;
+			Avoiding.AvoGroup = 0xFF;
+
+		}, ThreadsCount, BatchSize);
+	}
+
+	// 每个队伍/避让组各一条链，只写入匹配的Subject
+	for (int32 Layer = 0; Layer < FNeighborGridCell::NumTeamLayers; ++Layer)
+	{
+		{
+			auto Chain = Mechanism->EnchainSolid(TeamLayerFilters[Layer]);
+			UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
+
+			Chain->OperateConcurrently([&](FAvoiding& Avoiding)
+			{
+				Avoiding.Team = static_cast<uint8>(Layer);
+
+			}, ThreadsCount, BatchSize);
+		}
+
+		{
+			auto Chain = Mechanism->EnchainSolid(AvoGroupLayerFilters[Layer]);
+			UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
+
+			Chain->OperateConcurrently([&](FAvoiding& Avoiding)
+			{
+				Avoiding.AvoGroup = static_cast<uint8>(Layer);
+
+			}, ThreadsCount, BatchSize);
+		}
+	}
+}
+
+void UNeighborGridComponent::SortCellsByTeam()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SortCellsByTeam");
+
+	constexpr int32 NumLayers = FNeighborGridCell::NumTeamLayers + 1;// 最后一层放没有队伍的Subject
+
+	// 只排本帧注册过的格子：每个队列只有这里一个消费者，取出的下标留给下一帧的 ResetCells
+	auto SortCell = [&](int32 CellIndex)
+	{
+		FNeighborGridCell& Cell = Cells[CellIndex];
+
+		if (Cell.Subjects.IsEmpty()) return;// ResetCells 已经清掉了 bTeamSorted
+
+		if (!ensure(Cell.Subjects.Num() <= MAX_uint16)) return;
+
+		auto LayerOf = [](const FAvoiding& Avoiding)
+		{
+			return Avoiding.Team < FNeighborGridCell::NumTeamLayers ? int32(Avoiding.Team) : FNeighborGridCell::NumTeamLayers;
+		};
+
+		int32 Counts[NumLayers] = {};
+
+		for (const FAvoiding& Avoiding : Cell.Subjects)
+		{
+			++Counts[LayerOf(Avoiding)];
+		}
+
+		Cell.TeamStart[0] = 0;
+
+		for (int32 Layer = 0; Layer < NumLayers; ++Layer)
+		{
+			Cell.TeamStart[Layer + 1] = static_cast<uint16>(Cell.TeamStart[Layer] + Counts[Layer]);
+		}
+
+		// 只有一层有Subject时顺序已经正确
+		if (Counts[LayerOf(Cell.Subjects[0])] != Cell.Subjects.Num())
+		{
+			FFrameArenaScope ArenaScope;
+			TFrameArray<FAvoiding> Sorted;
+			Sorted.SetNumUninitialized(Cell.Subjects.Num());
+
+			int32 Cursor[NumLayers];
+
+			for (int32 Layer = 0; Layer < NumLayers; ++Layer)
+			{
+				Cursor[Layer] = Cell.TeamStart[Layer];
+			}
+
+			for (const FAvoiding& Avoiding : Cell.Subjects)
+			{
+				Sorted[Cursor[LayerOf(Avoiding)]++] = Avoiding;
+			}
+
+			FMemory::Memcpy(Cell.Subjects.GetData(), Sorted.GetData(), Sorted.Num() * sizeof(FAvoiding));
+		}
+
+		Cell.bTeamSorted = true;
+	};
+
+	// 每个格子做一次计数排序，同一层内保持注册顺序
+	ParallelFor(OccupiedCellsQueues.Num(), [&](int32 Index)
+	{
+		TArray<int32>& Drained = OccupiedCellsDrained[Index];
+		int32 CellIndex;
+
+		while (OccupiedCellsQueues[Index].Dequeue(CellIndex))
+		{
+			Drained.Add(CellIndex);
+			SortCell(CellIndex);
+		}
+	});
+}
+
+void UNeighborGridComponent::BuildPackedGrid()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("BuildPackedGrid");
+
+	const int32 NumCells = Cells.Num();
+	TArray<int32>& CellStart = PackedGrid.CellStart;
+	CellStart.SetNumUninitialized(NumCells + 1, false);
+
+	// 计数 + 前缀和，得到每个格子在打包数组中的起始位置
+	CellStart[0] = 0;
+
+	for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+	{
+		CellStart[CellIndex + 1] = CellStart[CellIndex] + Cells[CellIndex].Subjects.Num();
+	}
+
+	PackedGrid.SetNumUninitialized(CellStart[NumCells]);
+
+	// 按格子写入，各格子的区间互不重叠，无需加锁
+	ParallelFor(NumCells, [&](int32 CellIndex)
+	{
+		int32 Offset = CellStart[CellIndex];
+
+		for (const FAvoiding& Avoiding : Cells[CellIndex].Subjects)
+		{
+			PackedGrid.Write(Offset++, Avoiding);
+		}
+	});
+}
+
+void UNeighborGridComponent::RebuildSubjectsLockFree()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("RebuildSubjectsLockFree");
+
+	AMechanism* Mechanism = GetMechanism();
+	const int32 NumCells = Cells.Num();
+
+	TArray<int32>& CellStart = PackedGrid.CellStart;
+	TArray<int32>& CellCursor = PackedCellCursor;
+
+	// 对Subject所占的每个格子调用Func，单格注册只取原点所在格子
+	auto ForEachSubjectCell = [this](const FVector& Location, const float Radius, const bool bMultiple, auto&& Func)
+	{
+		if (!bMultiple)
+		{
+			Func(GetIndexAt(Location));
+			return;
+		}
+
+		const FVector Range = FVector(Radius);
+		const FIntVector CagePosMin = WorldToCage(Location - Range);
+		const FIntVector CagePosMax = WorldToCage(Location + Range);
+
+		for (int32 i = CagePosMin.Z; i <= CagePosMax.Z; ++i)
+		{
+			for (int32 j = CagePosMin.Y; j <= CagePosMax.Y; ++j)
+			{
+				for (int32 k = CagePosMin.X; k <= CagePosMax.X; ++k)
+				{
+					const FIntVector CurrentCellPos(k, j, i);
+
+					if (!IsInside(CurrentCellPos)) continue;
+
+					Func(GetIndexAt(CurrentCellPos));
+				}
+			}
+		}
+	};
+
+	// 对单格注册与多格注册两类Subject各运行一次
+	auto ForEachSubject = [&](auto&& Func)
+	{
+		for (const bool bMultiple : { false, true })
+		{
+			auto Chain = Mechanism->EnchainSolid(bMultiple ? RegisterSubjectMultipleFilter : RegisterSubjectSingleFilter);
+			UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
 
-		}, ThreadsCount, BatchSize);
-	}
+			Chain->OperateConcurrently([&](FSolidSubjectHandle Subject, FLocated& Located, FCollider& Collider, FAvoiding& Avoiding)
+			{
+				Func(Subject, Located, Collider, Avoiding, bMultiple);
+
+			}, ThreadsCount, BatchSize);
+		}
+	};
 
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("RegisterBoxObstacles");
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("Histogram");
 
-		auto Chain = Mechanism->EnchainSolid(RegisterBoxObstaclesFilter);
-		UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, 1, ThreadsCount, BatchSize);
+		CellCursor.Reset();
+		CellCursor.SetNumZeroed(NumCells);
 
-		Chain->OperateConcurrently([&](FSolidSubjectHandle Subject, FBoxObstacle& BoxObstacle, FAvoiding& Avoiding)
+		ForEachSubject([&](FSolidSubjectHandle Subject, FLocated& Located, FCollider& Collider, FAvoiding& Avoiding, const bool bMultiple)
 		{
-			if (BoxObstacle.bStatic && BoxObstacle.bRegistered) return; // if static, we only register once
+			const auto Location = Located.Location;
+
+			if (UNLIKELY(!IsInside(Location))) return;
 
-			const auto& Location = BoxObstacle.point3d_;
 			Avoiding.Location = Location;
+			Avoiding.Radius = Collider.Radius;
+			Avoiding.Archetype = GetArchetypeId(Subject.GetFingerprint());
 
-			const FBoxObstacle* PreObstaclePtr = BoxObstacle.prevObstacle_.GetTraitPtr<FBoxObstacle, EParadigm::Unsafe>();
-			const FBoxObstacle* NextObstaclePtr = BoxObstacle.nextObstacle_.GetTraitPtr<FBoxObstacle, EParadigm::Unsafe>();
+			ForEachSubjectCell(Location, Collider.Radius, bMultiple, [&](const int32 CellIndex)
+			{
+				FPlatformAtomics::InterlockedIncrement(&CellCursor[CellIndex]);
+			});
+		});
+	}
 
-			if (NextObstaclePtr == nullptr || PreObstaclePtr == nullptr) return;
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("PrefixSum");
 
-			const FVector& NextLocation = NextObstaclePtr->point3d_;
-			const float ObstacleHeight = BoxObstacle.height_;
+		CellStart.SetNumUninitialized(NumCells + 1, false);
 
-			const float StartZ = Location.Z;
-			const float EndZ = StartZ + ObstacleHeight;
-			TSet<FIntVector> AllGridCells;
-			TArray<FIntVector> AllGridCellsArray;
+		// 分块并行前缀和：块内局部扫描 -> 块偏移串行扫描 -> 块内加偏移
+		const int32 NumBlocks = FMath::Clamp(MaxThreadsAllowed, 1, FMath::Max(NumCells, 1));
+		const int32 BlockSize = FMath::DivideAndRoundUp(NumCells, NumBlocks);
 
-			float CurrentLayerZ = StartZ;
+		TArray<int32, TInlineAllocator<32>> BlockOffsets;
+		BlockOffsets.SetNumZeroed(NumBlocks);
 
-			// 使用CellSize.Z作为Z轴步长
-			while (CurrentLayerZ < EndZ)
+		ParallelFor(NumBlocks, [&](int32 Block)
+		{
+			const int32 Begin = Block * BlockSize;
+			const int32 End = FMath::Min(Begin + BlockSize, NumCells);
+			int32 Sum = 0;
+
+			for (int32 CellIndex = Begin; CellIndex < End; ++CellIndex)
 			{
-				const FVector LayerCurrentPoint = FVector(Location.X, Location.Y, CurrentLayerZ);
-				const FVector LayerNextPoint = FVector(NextLocation.X, NextLocation.Y, CurrentLayerZ);
+				CellStart[CellIndex] = Sum;
+				Sum += CellCursor[CellIndex];
+			}
 
-				// 使用最大轴尺寸的2倍作为扫描半径
-				const float SweepRadius = CellSize.GetMax() * 2.0f;
-				auto LayerCells = SphereSweepForCells(LayerCurrentPoint, LayerNextPoint, SweepRadius);
+			BlockOffsets[Block] = Sum;
+		});
 
-				for (const auto& CellPos : LayerCells)
-				{
-					AllGridCells.Add(CellPos);
-				}
+		int32 Total = 0;
 
-				CurrentLayerZ += CellSize.Z; // 使用Z轴尺寸作为步长
+		for (int32& Offset : BlockOffsets)
+		{
+			const int32 BlockSum = Offset;
+			Offset = Total;
+			Total += BlockSum;
+		}
+
+		ParallelFor(NumBlocks, [&](int32 Block)
+		{
+			const int32 Begin = Block * BlockSize;
+			const int32 End = FMath::Min(Begin + BlockSize, NumCells);
+			const int32 Offset = BlockOffsets[Block];
+
+			for (int32 CellIndex = Begin; CellIndex < End; ++CellIndex)
+			{
+				CellStart[CellIndex] += Offset;
+				CellCursor[CellIndex] = CellStart[CellIndex];// 分散写入时的游标
 			}
+		});
 
-			AllGridCellsArray = AllGridCells.Array();
+		CellStart[NumCells] = Total;
+		PackedGrid.SetNumUninitialized(Total);
+	}
 
-			ParallelFor(AllGridCellsArray.Num(), [&](int32 Index)
-				{
-					const FIntVector& CellPos = AllGridCellsArray[Index];
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("Scatter");
 
-					//if (!LIKELY(IsInside(CellPos))) return;
+		ForEachSubject([&](FSolidSubjectHandle Subject, FLocated& Located, FCollider& Collider, FAvoiding& Avoiding, const bool bMultiple)
+		{
+			if (UNLIKELY(!IsInside(Located.Location))) return;
 
-					bool bShouldRegister = false;
+			ForEachSubjectCell(Avoiding.Location, Avoiding.Radius, bMultiple, [&](const int32 CellIndex)
+			{
+				const int32 Offset = FPlatformAtomics::InterlockedIncrement(&CellCursor[CellIndex]) - 1;
+				PackedGrid.Write(Offset, Avoiding);
+			});
+		});
+	}
 
-					auto& Cell = At(CellPos);
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SortCells");
 
-					Cell.Lock();
+		// 格子内按Hash排序，使布局与线程调度无关：先排序下标，再对每列整体搬运一次
+		ParallelFor(NumCells, [&](int32 CellIndex)
+		{
+			const int32 Begin = CellStart[CellIndex];
+			const int32 End = CellStart[CellIndex + 1];
+			const int32 Count = End - Begin;
 
-					if (!Cell.Registered)
-					{
-						bShouldRegister = true;
-						Cell.Registered = true;
-					}
+			if (Count < 2) return;
 
-					if (BoxObstacle.bStatic)
-					{
-						Cell.BoxObstaclesStatic.Add(Avoiding);
-					}
-					else
-					{
-						Cell.BoxObstacles.Add(Avoiding);
-					}
+			bool bSorted = true;
 
-					Cell.Unlock();
+			for (int32 i = Begin + 1; i < End && bSorted; ++i)
+			{
+				bSorted = PackedGrid.Hash[i - 1] <= PackedGrid.Hash[i];
+			}
 
-					if (bShouldRegister)
-					{
-						int32 CellIndex = GetIndexAt(CellPos);
-						OccupiedCellsQueues[CellIndex % MaxThreadsAllowed].Enqueue(CellIndex);
-					}
-				});
+			if (bSorted) return;
 
-			BoxObstacle.bRegistered = true;
+			FFrameArenaScope ArenaScope;
+			TFrameArray<TPair<uint32, int32>> Order;
+			Order.SetNumUninitialized(Count);
 
-		}, ThreadsCount, BatchSize);
-	}
+			for (int32 i = 0; i < Count; ++i)
+			{
+				Order[i] = TPair<uint32, int32>(PackedGrid.Hash[Begin + i], Begin + i);
+			}
+
+			Algo::Sort(Order, [](const TPair<uint32, int32>& A, const TPair<uint32, int32>& B) { return A.Key < B.Key; });
+
+			PackedGrid.ForEachColumn([&](auto& Column)
+			{
+				using ElementType = typename TDecay<decltype(Column[0])>::Type;
+
+				TFrameArray<ElementType> Gathered;
+				Gathered.Reserve(Count);
+
+				for (const TPair<uint32, int32>& Entry : Order)
+				{
+					Gathered.Add(Column[Entry.Value]);
+				}
 
+				for (int32 i = 0; i < Count; ++i)
+				{
+					Column[Begin + i] = Gathered[i];
+				}
+			});
+		});
+	}
 }
 
 void UNeighborGridComponent::Decouple()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_STR("RVO2 Decouple");
+	BATTLEFRAME_CAPTURE_SYSTEM();
 
 	const float DeltaTime = FMath::Clamp(GetWorld()->GetDeltaSeconds(),0,0.0333f);
 
@@ -1293,8 +2189,11 @@ void UNeighborGridComponent::Decouple()
 	auto Chain = Mechanism->EnchainSolid(DecoupleFilter);
 	UBattleFrameFunctionLibraryRT::CalculateThreadsCountAndBatchSize(Chain->IterableNum(), MaxThreadsAllowed, MinBatchSizeAllowed, ThreadsCount, BatchSize);
 
+	const bool bPacked = HasPackedGrid();
+
 	Chain->OperateConcurrently([&](FSolidSubjectHandle Subject, FMove& Move, FLocated& Located, FCollider& Collider, FMoving& Moving, FAvoidance& Avoidance, FAvoiding& Avoiding)
 	{
+		BATTLEFRAME_WORKER_PROBE();
 		if (LIKELY(Avoidance.bEnable))
 		{
 			const auto& SelfLocation = Located.Location;
@@ -1304,14 +2203,26 @@ void UNeighborGridComponent::Decouple()
 			Avoidance.Radius = SelfRadius;
 
 			const auto NeighborDist = Avoidance.NeighborDist;
-			const float TotalRangeSqr = FMath::Square(SelfRadius + NeighborDist);
-			const int32 MaxNeighbors = Avoidance.MaxNeighbors;
+			// ClampMax 只在编辑器里生效，运行时或蓝图写入的更大值会被定长堆截断，这里显式钳制并提示一次
+			if (UNLIKELY(Avoidance.MaxNeighbors > MaxNeighborsCapacity))
+			{
+				static std::atomic<bool> bWarnedMaxNeighbors{ false };
+
+				if (!bWarnedMaxNeighbors.exchange(true, std::memory_order_relaxed))
+				{
+					UE_LOG(LogTemp, Warning, TEXT("NeighborGrid: MaxNeighbors %d exceeds the capacity %d and is clamped."), Avoidance.MaxNeighbors, MaxNeighborsCapacity);
+				}
+			}
+
+			const int32 MaxNeighbors = FMath::Clamp(Avoidance.MaxNeighbors, 1, MaxNeighborsCapacity);
 
 			//--------------------------Collect Subject Neighbors--------------------------------
 
 			FFilter SubjectFilter = SubjectFilterBase;
 
 			// 碰撞组
+			uint16 IgnoreGroupMask = 0;
+
 			if (!Avoidance.IgnoreGroups.IsEmpty())
 			{
 				const int32 ClampedGroups = FMath::Clamp(Avoidance.IgnoreGroups.Num(), 0, 9);
@@ -1319,6 +2230,11 @@ void UNeighborGridComponent::Decouple()
 				for (int32 i = 0; i < ClampedGroups; ++i)
 				{
 					UBattleFrameFunctionLibraryRT::ExcludeAvoGroupTraitByIndex(Avoidance.IgnoreGroups[i], SubjectFilter);
+
+					if (bTeamLayers && Avoidance.IgnoreGroups[i] >= 0 && Avoidance.IgnoreGroups[i] < FNeighborGridCell::NumTeamLayers)
+					{
+						IgnoreGroupMask |= 1 << Avoidance.IgnoreGroups[i];
+					}
 				}
 			}
 
@@ -1327,66 +2243,10 @@ void UNeighborGridComponent::Decouple()
 				SubjectFilter.Include<FDying>();// dying subject only collide with dying subjects
 			}
 
-			const FVector SubjectRange3D(NeighborDist + SelfRadius, NeighborDist + SelfRadius, SelfRadius);
-			TArray<FIntVector> NeighbourCellCoords = GetNeighborCells(SelfLocation, SubjectRange3D);
-
-			// 使用最大堆收集最近的SubjectNeighbors
-			auto SubjectCompare = [&](const FAvoiding& A, const FAvoiding& B)
-			{
-				return FVector::DistSquared(SelfLocation, A.Location) > FVector::DistSquared(SelfLocation, B.Location);
-			};
-
-			TArray<FAvoiding> SubjectNeighbors;
-			SubjectNeighbors.Reserve(MaxNeighbors);
-
-			TSet<uint32> SeenHashes;
-			SeenHashes.Reserve(MaxNeighbors);
-
-			// this for loop is the most expensive code of all
-			for (const auto& Coord : NeighbourCellCoords)
-			{
-				const auto& Subjects = At(Coord).Subjects;
-
-				for (const auto& AvoData : Subjects)
-				{
-					// these check are arranged so for cache optimization
-					// 距离检查
-					const float DistSqr = FVector::DistSquared(SelfLocation, AvoData.Location);
-					const float RadiusSqr = FMath::Square(AvoData.Radius) + TotalRangeSqr;
-
-					if (DistSqr > RadiusSqr) continue;
-
-					// 排除自身
-					if (UNLIKELY(AvoData.SubjectHash == Avoiding.SubjectHash)) continue;
-
-					// 去重
-					if (UNLIKELY(SeenHashes.Contains(AvoData.SubjectHash))) continue;
-
-					// Filter By Traits
-					if (UNLIKELY(!AvoData.SubjectHandle.Matches(SubjectFilter))) continue;
-
-					SeenHashes.Add(AvoData.SubjectHash);
-
-					// we limit the amount of subjects. we keep the nearest MaxNeighbors amount of neighbors
-					// 动态维护堆
-					if (LIKELY(SubjectNeighbors.Num() < MaxNeighbors))
-					{
-						SubjectNeighbors.HeapPush(AvoData, SubjectCompare);
-					}
-					else
-					{
-						const float HeapTopDist = FVector::DistSquared(SelfLocation, SubjectNeighbors.HeapTop().Location);
+			// 使用定长最大堆收集最近的SubjectNeighbors，栈上存储，内置去重
+			TFixedKNearest<MaxNeighborsCapacity> SubjectNeighbors(MaxNeighbors);
 
-						if (UNLIKELY(DistSqr < HeapTopDist))
-						{
-							// 弹出时同步移除哈希记录
-							SeenHashes.Remove(SubjectNeighbors.HeapTop().SubjectHash);
-							SubjectNeighbors.HeapPopDiscard(SubjectCompare);
-							SubjectNeighbors.HeapPush(AvoData, SubjectCompare);
-						}
-					}
-				}
-			}
+			CollectSubjectNeighbors(SelfLocation, SelfRadius, NeighborDist, Avoiding.SubjectHash, SubjectFilter, IgnoreGroupMask, bPacked, SubjectNeighbors);
 
 			//----------------------------Try Avoid SubjectNeighbors---------------------------------
 
@@ -1394,9 +2254,7 @@ void UNeighborGridComponent::Decouple()
 			Avoidance.DesiredVelocity = RVO::Vector2(Moving.DesiredVelocity.X, Moving.DesiredVelocity.Y);//copy into rvo trait
 			Avoidance.CurrentVelocity = RVO::Vector2(Moving.CurrentVelocity.X, Moving.CurrentVelocity.Y);//copy into rvo trait
 
-			TArray<FAvoiding> EmptyArray;
-
-			ComputeNewVelocity(Avoidance, SubjectNeighbors, EmptyArray, DeltaTime);
+			ComputeNewVelocity(Avoidance, SubjectNeighbors.GetView(), TArrayView<const FAvoiding>(), DeltaTime);
 
 			if (!Moving.bFalling && !(Moving.LaunchTimer > 0))
 			{
@@ -1410,21 +2268,22 @@ void UNeighborGridComponent::Decouple()
 
 			const float ObstacleRange = Avoidance.RVO_TimeHorizon_Obstacle * Avoidance.MaxSpeed + Avoidance.Radius;
 			const FVector ObstacleRange3D(ObstacleRange, ObstacleRange, Avoidance.Radius);
-			TArray<FIntVector> ObstacleCellCoords = GetNeighborCells(SelfLocation, ObstacleRange3D);
 
-			TSet<FAvoiding> ValidSphereObstacleNeighbors;
-			TSet<FAvoiding> ValidBoxObstacleNeighbors;
-			ValidSphereObstacleNeighbors.Reserve(MaxNeighbors);
-			ValidBoxObstacleNeighbors.Reserve(MaxNeighbors);
+			// 障碍物数量很少，用内联数组线性去重代替TSet
+			TArray<FAvoiding, TInlineAllocator<MaxNeighborsCapacity>> SphereObstacleNeighbors;
+			TArray<FAvoiding, TInlineAllocator<MaxNeighborsCapacity>> BoxObstacleNeighbors;
 
-			for (const FIntVector& Coord : ObstacleCellCoords)
+			ForEachNeighborCell(SelfLocation, ObstacleRange3D, [&](const FIntVector& Coord)
 			{
 				const auto& Cell = At(Coord);
 
 				// 定义处理 SphereObstacles 的 Lambda 函数
 				auto ProcessSphereObstacles = [&](const TArray<FAvoiding, TInlineAllocator<8>>& Obstacles)
 				{
-					ValidSphereObstacleNeighbors.Append(Obstacles);
+					for (const FAvoiding& AvoData : Obstacles)
+					{
+						SphereObstacleNeighbors.AddUnique(AvoData);
+					}
 				};
 
 				ProcessSphereObstacles(Cell.SphereObstacles);
@@ -1465,17 +2324,14 @@ void UNeighborGridComponent::Decouple()
 
 							if (leftOfValue < 0.0f)
 							{
-								ValidBoxObstacleNeighbors.Add(AvoData);
+								BoxObstacleNeighbors.AddUnique(AvoData);
 							}
 						}
 				};
 
 				ProcessBoxObstacles(Cell.BoxObstacles);
 				ProcessBoxObstacles(Cell.BoxObstaclesStatic);
-			}
-
-			TArray<FAvoiding> SphereObstacleNeighbors = ValidSphereObstacleNeighbors.Array();
-			TArray<FAvoiding> BoxObstacleNeighbors = ValidBoxObstacleNeighbors.Array();
+			});
 
 			//-------------------------------Blocked By Obstacles------------------------------------
 
@@ -1494,6 +2350,91 @@ void UNeighborGridComponent::Decouple()
 	}, ThreadsCount, BatchSize);
 }
 
+void UNeighborGridComponent::CollectSubjectNeighbors
+(
+	const FVector& SelfLocation,
+	const float SelfRadius,
+	const float NeighborDist,
+	const uint32 SelfHash,
+	const FFilter& SubjectFilter,
+	const uint16 IgnoreGroupMask,
+	const bool bPacked,
+	TFixedKNearest<MaxNeighborsCapacity>& SubjectNeighbors
+) const
+{
+	const float TotalRangeSqr = FMath::Square(SelfRadius + NeighborDist);
+	const FVector SubjectRange3D(NeighborDist + SelfRadius, NeighborDist + SelfRadius, SelfRadius);
+
+	// 距离筛选通过后的处理：排除自身、堆剪枝、去重、过滤、入堆
+	FArchetypeMatchCache MatchCache(ArchetypeFingerprints);
+
+	auto ConsiderNeighbor = [&](const float DistSqr, const uint32 SubjectHash, const uint8 SubjectAvoGroup, const uint16 SubjectArchetype, const FSubjectHandle& SubjectHandle, auto&& MakeAvoiding)
+	{
+		// 排除自身
+		if (UNLIKELY(SubjectHash == SelfHash)) return;
+
+		// 开启 bTeamLayers 时避让组已写入FAvoiding，被忽略的组不必再做Matches
+		if (SubjectAvoGroup < FNeighborGridCell::NumTeamLayers && (IgnoreGroupMask & (1 << SubjectAvoGroup))) return;
+
+		// we limit the amount of subjects. we keep the nearest MaxNeighbors amount of neighbors
+		if (!SubjectNeighbors.WouldAccept(DistSqr)) return;
+
+		// 去重
+		if (UNLIKELY(SubjectNeighbors.Contains(SubjectHash))) return;
+
+		// Filter By Traits
+		if (UNLIKELY(!MatchCache.Matches(SubjectHandle, SubjectArchetype, SubjectFilter))) return;
+
+		SubjectNeighbors.Push(MakeAvoiding(), DistSqr);
+	};
+
+	// this for loop is the most expensive code of all
+	if (bPacked)
+	{
+		// 在连续的浮点数组上做距离筛选，只有通过的才读取句柄
+		const FVector3f SelfLocation3f(SelfLocation);
+
+		auto OnCandidate = [&](const int32 i, const float DistSqr)
+		{
+			ConsiderNeighbor(DistSqr, PackedGrid.Hash[i], PackedGrid.AvoGroup[i], PackedGrid.Archetype[i], PackedGrid.Handles[i], [&]() { return PackedGrid.MakeAvoiding(i); });
+		};
+
+		ForEachNeighborCell(SelfLocation, SubjectRange3D, [&](const FIntVector& Coord)
+		{
+			int32 Begin, End;
+			GetPackedRange(Coord, Begin, End);
+
+			if (bUseSimdFilter)
+			{
+				PackedGrid.ForEachInRangeSimd(Begin, End, SelfLocation3f, TotalRangeSqr, OnCandidate);
+			}
+			else
+			{
+				PackedGrid.ForEachInRangeScalar(Begin, End, SelfLocation3f, TotalRangeSqr, OnCandidate);
+			}
+		});
+	}
+	else
+	{
+		ForEachNeighborCell(SelfLocation, SubjectRange3D, [&](const FIntVector& Coord)
+		{
+			const auto& Subjects = At(Coord).Subjects;
+
+			for (const auto& AvoData : Subjects)
+			{
+				// these check are arranged so for cache optimization
+				// 距离检查
+				const float DistSqr = FVector::DistSquared(SelfLocation, AvoData.Location);
+				const float RadiusSqr = FMath::Square(AvoData.Radius) + TotalRangeSqr;
+
+				if (DistSqr > RadiusSqr) continue;
+
+				ConsiderNeighbor(DistSqr, AvoData.SubjectHash, AvoData.AvoGroup, AvoData.Archetype, AvoData.SubjectHandle, [&]() -> const FAvoiding& { return AvoData; });
+			}
+		});
+	}
+}
+
 void UNeighborGridComponent::Evaluate()
 {
 	Update();
@@ -1512,14 +2453,30 @@ void UNeighborGridComponent::DefineFilters()
 	SphereObstacleFilter = FFilter::Make<FSphereObstacle, FAvoiding, FAvoidance, FLocated, FCollider>();
 	BoxObstacleFilter = FFilter::Make<FBoxObstacle, FAvoiding, FLocated>();
 	DecoupleFilter = FFilter::Make<FAgent, FLocated, FCollider, FMove, FMoving, FAvoidance, FAvoiding, FActivated>().Exclude<FAppearing>();
+	AvoidingFilter = FFilter::Make<FAvoiding, FActivated>();
+
+	for (int32 Layer = 0; Layer < FNeighborGridCell::NumTeamLayers; ++Layer)
+	{
+		TeamLayerFilters[Layer] = AvoidingFilter;
+		UBattleFrameFunctionLibraryRT::IncludeTeamTraitByIndex(Layer, TeamLayerFilters[Layer]);
+
+		AvoGroupLayerFilters[Layer] = AvoidingFilter;
+		UBattleFrameFunctionLibraryRT::IncludeAvoGroupTraitByIndex(Layer, AvoGroupLayerFilters[Layer]);
+	}
 }
 
 
 //-------------------------------RVO2D Copyright 2023, EastFoxStudio. All Rights Reserved-------------------------------
 
-void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TArray<FAvoiding>& SubjectNeighbors, const TArray<FAvoiding>& ObstacleNeighbors, float TimeStep_)
+void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, TArrayView<const FAvoiding> SubjectNeighbors, TArrayView<const FAvoiding> ObstacleNeighbors, float TimeStep_)
 {
-	Avoidance.OrcaLines.clear();
+	// ORCA线与投影线都放在栈上的定长缓冲里，容量按邻居数 + 障碍物数确定（每个邻居最多产生一条线）
+	const int32 MaxLines = SubjectNeighbors.Num() + ObstacleNeighbors.Num();
+
+	TArray<RVO::Line, TInlineAllocator<MaxOrcaLinesInline>> OrcaLines;
+	TArray<RVO::Line, TInlineAllocator<MaxOrcaLinesInline>> ProjLines;
+	OrcaLines.Reserve(MaxLines);
+	ProjLines.SetNumUninitialized(MaxLines);
 
 	/* Create obstacle ORCA lines. */
 	if (!ObstacleNeighbors.IsEmpty())
@@ -1540,8 +2497,8 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 			 */
 			bool alreadyCovered = false;
 
-			for (size_t j = 0; j < Avoidance.OrcaLines.size(); ++j) {
-				if (RVO::det(invTimeHorizonObst * relativePosition1 - Avoidance.OrcaLines[j].point, Avoidance.OrcaLines[j].direction) - invTimeHorizonObst * Avoidance.Radius >= -RVO_EPSILON && det(invTimeHorizonObst * relativePosition2 - Avoidance.OrcaLines[j].point, Avoidance.OrcaLines[j].direction) - invTimeHorizonObst * Avoidance.Radius >= -RVO_EPSILON) {
+			for (size_t j = 0; j < static_cast<size_t>(OrcaLines.Num()); ++j) {
+				if (RVO::det(invTimeHorizonObst * relativePosition1 - OrcaLines[j].point, OrcaLines[j].direction) - invTimeHorizonObst * Avoidance.Radius >= -RVO_EPSILON && det(invTimeHorizonObst * relativePosition2 - OrcaLines[j].point, OrcaLines[j].direction) - invTimeHorizonObst * Avoidance.Radius >= -RVO_EPSILON) {
 					alreadyCovered = true;
 					break;
 				}
@@ -1569,7 +2526,7 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 				if (obstacle1->isConvex_) {
 					line.point = RVO::Vector2(0.0f, 0.0f);
 					line.direction = normalize(RVO::Vector2(-relativePosition1.y(), relativePosition1.x()));
-					Avoidance.OrcaLines.push_back(line);
+					OrcaLines.Add(line);
 				}
 				continue;
 			}
@@ -1579,7 +2536,7 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 				if (obstacle2->isConvex_ && det(relativePosition2, obstacle2->unitDir_) >= 0.0f) {
 					line.point = RVO::Vector2(0.0f, 0.0f);
 					line.direction = normalize(RVO::Vector2(-relativePosition2.y(), relativePosition2.x()));
-					Avoidance.OrcaLines.push_back(line);
+					OrcaLines.Add(line);
 				}
 				continue;
 			}
@@ -1587,7 +2544,7 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 				/* Collision with obstacle segment. */
 				line.point = RVO::Vector2(0.0f, 0.0f);
 				line.direction = -obstacle1->unitDir_;
-				Avoidance.OrcaLines.push_back(line);
+				OrcaLines.Add(line);
 				continue;
 			}
 
@@ -1693,7 +2650,7 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 
 				line.direction = RVO::Vector2(unitW.y(), -unitW.x());
 				line.point = leftCutoff + Avoidance.Radius * invTimeHorizonObst * unitW;
-				Avoidance.OrcaLines.push_back(line);
+				OrcaLines.Add(line);
 				continue;
 			}
 			else if (t > 1.0f && tRight < 0.0f) {
@@ -1702,7 +2659,7 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 
 				line.direction = RVO::Vector2(unitW.y(), -unitW.x());
 				line.point = rightCutoff + Avoidance.Radius * invTimeHorizonObst * unitW;
-				Avoidance.OrcaLines.push_back(line);
+				OrcaLines.Add(line);
 				continue;
 			}
 
@@ -1718,7 +2675,7 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 				/* Project on cut-off line. */
 				line.direction = -obstacle1->unitDir_;
 				line.point = leftCutoff + Avoidance.Radius * invTimeHorizonObst * RVO::Vector2(-line.direction.y(), line.direction.x());
-				Avoidance.OrcaLines.push_back(line);
+				OrcaLines.Add(line);
 				continue;
 			}
 			else if (distSqLeft <= distSqRight) {
@@ -1729,7 +2686,7 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 
 				line.direction = leftLegDirection;
 				line.point = leftCutoff + Avoidance.Radius * invTimeHorizonObst * RVO::Vector2(-line.direction.y(), line.direction.x());
-				Avoidance.OrcaLines.push_back(line);
+				OrcaLines.Add(line);
 				continue;
 			}
 			else {
@@ -1740,13 +2697,13 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 
 				line.direction = -rightLegDirection;
 				line.point = rightCutoff + Avoidance.Radius * invTimeHorizonObst * RVO::Vector2(-line.direction.y(), line.direction.x());
-				Avoidance.OrcaLines.push_back(line);
+				OrcaLines.Add(line);
 				continue;
 			}
 		}
 	}
 
-	const size_t numObstLines = Avoidance.OrcaLines.size();
+	const size_t numObstLines = static_cast<size_t>(OrcaLines.Num());
 
 	/* Create agent ORCA lines. */
 	if (!SubjectNeighbors.IsEmpty())
@@ -1814,13 +2771,155 @@ void UNeighborGridComponent::ComputeNewVelocity(FAvoidance& Avoidance, const TAr
 			}
 
 			line.point = Avoidance.CurrentVelocity + 0.5f * u;
-			Avoidance.OrcaLines.push_back(line);
+			OrcaLines.Add(line);
 		}
 	}
 
-	size_t lineFail = LinearProgram2(Avoidance.OrcaLines, Avoidance.MaxSpeed, Avoidance.DesiredVelocity, false, Avoidance.AvoidingVelocity);
+	const size_t numLines = static_cast<size_t>(OrcaLines.Num());
+	size_t lineFail = LinearProgram2(OrcaLines.GetData(), numLines, Avoidance.MaxSpeed, Avoidance.DesiredVelocity, false, Avoidance.AvoidingVelocity);
 
-	if (lineFail < Avoidance.OrcaLines.size()) {
-		LinearProgram3(Avoidance.OrcaLines, numObstLines, lineFail, Avoidance.MaxSpeed, Avoidance.AvoidingVelocity);
+	if (lineFail < numLines) {
+		LinearProgram3(OrcaLines.GetData(), numLines, numObstLines, lineFail, Avoidance.MaxSpeed, ProjLines.GetData(), Avoidance.AvoidingVelocity);
 	}
-}
\ No newline at end of file
+}
+
+//-------------------------------------------Benchmark----------------------------------------------------------------
+
+// BattleFrame.BenchmarkNeighborFilter [AgentCount...]
+// 在同一批合成人群上对比Decouple距离筛选：逐格FAvoiding数组（AoS基准）、打包数组的标量与SIMD实现，默认规模为10k/50k/100k
+static FAutoConsoleCommand BenchmarkNeighborFilterCommand
+(
+	TEXT("BattleFrame.BenchmarkNeighborFilter"),
+	TEXT("Compare the per-cell AoS neighbor filter with the scalar and SIMD filters of the packed neighbor grid. Args: [AgentCount...]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		TArray<int32> AgentCounts;
+
+		for (const FString& Arg : Args)
+		{
+			AgentCounts.Add(FMath::Max(FCString::Atoi(*Arg), 1));
+		}
+
+		if (AgentCounts.IsEmpty())
+		{
+			AgentCounts = { 10000, 50000, 100000 };
+		}
+
+		constexpr float CellSize = 300.f;
+		constexpr float AgentRadius = 40.f;
+		constexpr float NeighborDist = 200.f;
+		constexpr int32 AgentsPerCell = 16;
+
+		for (const int32 AgentCount : AgentCounts)
+		{
+			// 合成一个密集人群：每格约AgentsPerCell个，按格子顺序写入
+			const int32 GridDim = FMath::Max(FMath::CeilToInt(FMath::Sqrt(static_cast<float>(AgentCount) / AgentsPerCell)), 1);
+			const int32 NumCells = GridDim * GridDim;
+
+			FRandomStream Stream(AgentCount);
+			TArray<int32> CellOfAgent;
+			CellOfAgent.SetNumUninitialized(AgentCount);
+
+			FNeighborGridPacked Packed;
+			Packed.CellStart.SetNumZeroed(NumCells + 1);
+
+			// 基准：与打包前相同的每格FAvoiding数组
+			TArray<FNeighborGridCell> Cells;
+			Cells.SetNum(NumCells);
+
+			for (int32 i = 0; i < AgentCount; ++i)
+			{
+				CellOfAgent[i] = Stream.RandHelper(NumCells);
+				++Packed.CellStart[CellOfAgent[i] + 1];
+			}
+
+			for (int32 CellIndex = 0; CellIndex < NumCells; ++CellIndex)
+			{
+				Packed.CellStart[CellIndex + 1] += Packed.CellStart[CellIndex];
+			}
+
+			Packed.SetNumUninitialized(AgentCount);
+			TArray<int32> Cursor(Packed.CellStart.GetData(), NumCells);
+
+			for (int32 i = 0; i < AgentCount; ++i)
+			{
+				const int32 CellIndex = CellOfAgent[i];
+				const FIntPoint Cell(CellIndex % GridDim, CellIndex / GridDim);
+
+				FAvoiding Avoiding;
+				Avoiding.Location = FVector((Cell.X + Stream.FRand()) * CellSize, (Cell.Y + Stream.FRand()) * CellSize, 0.f);
+				Avoiding.Radius = AgentRadius;
+				Avoiding.SubjectHash = i;
+				Packed.Write(Cursor[CellIndex]++, Avoiding);
+				Cells[CellIndex].Subjects.Add(Avoiding);
+			}
+
+			// 按格子顺序取回坐标，保证三种方式查询同一批中心点
+			TArray<FVector> Centers;
+			Centers.SetNumUninitialized(AgentCount);
+
+			for (int32 i = 0; i < AgentCount; ++i)
+			{
+				Centers[i] = FVector(Packed.X[i], Packed.Y[i], Packed.Z[i]);
+			}
+
+			const float TotalRangeSqr = FMath::Square(AgentRadius + NeighborDist);
+
+			enum class EFilterPath { AoS, Scalar, Simd };
+
+			auto Run = [&](const EFilterPath Path, int64& OutCandidates) -> double
+			{
+				int64 Candidates = 0;
+				const double StartTime = FPlatformTime::Seconds();
+
+				for (int32 Agent = 0; Agent < AgentCount; ++Agent)
+				{
+					const FVector3f Center(Centers[Agent]);
+					const int32 CX = FMath::FloorToInt(Center.X / CellSize);
+					const int32 CY = FMath::FloorToInt(Center.Y / CellSize);
+
+					auto OnCandidate = [&](const int32 Index, const float DistSqr) { ++Candidates; };
+
+					for (int32 Y = FMath::Max(CY - 1, 0); Y <= FMath::Min(CY + 1, GridDim - 1); ++Y)
+					{
+						for (int32 X = FMath::Max(CX - 1, 0); X <= FMath::Min(CX + 1, GridDim - 1); ++X)
+						{
+							const int32 CellIndex = X + Y * GridDim;
+							const int32 Begin = Packed.CellStart[CellIndex];
+							const int32 End = Packed.CellStart[CellIndex + 1];
+
+							if (Path == EFilterPath::AoS)
+							{
+								for (const FAvoiding& Other : Cells[CellIndex].Subjects)
+								{
+									if (FVector::DistSquared(Centers[Agent], Other.Location) <= TotalRangeSqr) ++Candidates;
+								}
+							}
+							else if (Path == EFilterPath::Simd)
+							{
+								Packed.ForEachInRangeSimd(Begin, End, Center, TotalRangeSqr, OnCandidate);
+							}
+							else
+							{
+								Packed.ForEachInRangeScalar(Begin, End, Center, TotalRangeSqr, OnCandidate);
+							}
+						}
+					}
+				}
+
+				OutCandidates = Candidates;
+				return (FPlatformTime::Seconds() - StartTime) * 1000.0;
+			};
+
+			int64 AoSCandidates = 0;
+			int64 ScalarCandidates = 0;
+			int64 SimdCandidates = 0;
+			const double AoSMs = Run(EFilterPath::AoS, AoSCandidates);
+			const double ScalarMs = Run(EFilterPath::Scalar, ScalarCandidates);
+			const double SimdMs = Run(EFilterPath::Simd, SimdCandidates);
+
+			UE_LOG(LogTemp, Log, TEXT("BenchmarkNeighborFilter Agents=%d AoS=%.3fms Scalar=%.3fms Simd=%.3fms Speedup(AoS/Simd)=%.2fx Speedup(Scalar/Simd)=%.2fx Candidates=%lld/%lld/%lld"),
+				AgentCount, AoSMs, ScalarMs, SimdMs, AoSMs / FMath::Max(SimdMs, 1e-6), ScalarMs / FMath::Max(SimdMs, 1e-6), AoSCandidates, ScalarCandidates, SimdCandidates);
+		}
+	})
+);
@@ -0,0 +1,75 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "UObject/Package.h"
+#include "Machine.h"
+#include "NeighborGridCell.h"
+#include "NeighborGridComponent.h"
+#include "Traits/Avoiding.h"
+#include "Traits/Located.h"
+#include "Traits/Dying.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FArchetypeMatchCacheTest, "BattleFrame.NeighborGrid.ArchetypeMatchCache", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FArchetypeMatchCacheTest::RunTest(const FString& Parameters)
+{
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false, TEXT("ArchetypeMatchCacheTest"));
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+
+	AMechanism* Mechanism = UMachine::ObtainMechanism(World);
+	UNeighborGridComponent* Grid = NewObject<UNeighborGridComponent>(GetTransientPackage());
+
+	// 两个同原型的Subject，注册时指纹相同
+	FSubjectRecord Record;
+	Record.SetTrait(FLocated());
+	Record.SetTrait(FAvoiding());
+
+	const FSubjectHandle Alive = Mechanism->SpawnSubject(Record);
+	const FSubjectHandle Dying = Mechanism->SpawnSubject(Record);
+
+	Grid->ResetArchetypeIds();
+	const uint16 AliveId = Grid->GetArchetypeId(Alive.GetFingerprint());
+	const uint16 DyingId = Grid->GetArchetypeId(Dying.GetFingerprint());
+
+	TestEqual(TEXT("Subjects of one archetype share an id"), AliveId, DyingId);
+	TestTrue(TEXT("The id has a registered fingerprint"), Grid->ArchetypeFingerprints.IsValidIndex(AliveId));
+
+	// 注册之后其中一个进入死亡状态，编号仍是注册时的
+	Dying.SetTrait(FDying());
+
+	const FFilter Filter = FFilter::Make<FLocated, FAvoiding>().Exclude<FDying>();
+
+	// 两种访问顺序都要得到与实时Matches一致的结果
+	{
+		FArchetypeMatchCache MatchCache(Grid->ArchetypeFingerprints);
+		TestTrue(TEXT("Alive first: alive subject accepted"), MatchCache.Matches(Alive, AliveId, Filter));
+		TestFalse(TEXT("Alive first: dying subject rejected"), MatchCache.Matches(Dying, DyingId, Filter));
+	}
+
+	{
+		FArchetypeMatchCache MatchCache(Grid->ArchetypeFingerprints);
+		TestFalse(TEXT("Dying first: dying subject rejected"), MatchCache.Matches(Dying, DyingId, Filter));
+		TestTrue(TEXT("Dying first: alive subject accepted"), MatchCache.Matches(Alive, AliveId, Filter));
+	}
+
+	// 下一帧重新编号，旧编号不再有效
+	Grid->ResetArchetypeIds();
+	TestEqual(TEXT("Ids are reset every frame"), Grid->ArchetypeFingerprints.Num(), 0);
+
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+
+	return true;
+}
+
+#endif
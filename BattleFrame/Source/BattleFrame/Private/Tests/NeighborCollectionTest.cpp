@@ -0,0 +1,275 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "HAL/MemoryBase.h"
+#include "HAL/PlatformTLS.h"
+#include "Math/RandomStream.h"
+#include "Machine.h"
+#include "FixedKNearest.h"
+#include "NeighborGridComponent.h"
+#include "Traits/Activated.h"
+#include "Traits/Avoidance.h"
+#include "Traits/Avoiding.h"
+#include "Traits/Collider.h"
+#include "Traits/Located.h"
+
+namespace
+{
+	/** Forwards everything to the allocator it wraps and counts the allocations made on the thread that installed it. */
+	class FCountingMalloc final : public FMalloc
+	{
+	public:
+
+		FMalloc* Inner = nullptr;
+		uint32 ThreadId = 0;
+		std::atomic<int32> NumAllocations{ 0 };
+
+		virtual void* Malloc(SIZE_T Size, uint32 Alignment) override
+		{
+			Count();
+			return Inner->Malloc(Size, Alignment);
+		}
+
+		virtual void* TryMalloc(SIZE_T Size, uint32 Alignment) override
+		{
+			Count();
+			return Inner->TryMalloc(Size, Alignment);
+		}
+
+		virtual void* Realloc(void* Original, SIZE_T Size, uint32 Alignment) override
+		{
+			Count();
+			return Inner->Realloc(Original, Size, Alignment);
+		}
+
+		virtual void* TryRealloc(void* Original, SIZE_T Size, uint32 Alignment) override
+		{
+			Count();
+			return Inner->TryRealloc(Original, Size, Alignment);
+		}
+
+		virtual void Free(void* Original) override
+		{
+			Inner->Free(Original);
+		}
+
+		virtual SIZE_T QuantizeSize(SIZE_T Size, uint32 Alignment) override
+		{
+			return Inner->QuantizeSize(Size, Alignment);
+		}
+
+		virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override
+		{
+			return Inner->GetAllocationSize(Original, SizeOut);
+		}
+
+		virtual void Trim(bool bTrimThreadCaches) override
+		{
+			Inner->Trim(bTrimThreadCaches);
+		}
+
+		virtual void SetupTLSCachesOnCurrentThread() override
+		{
+			Inner->SetupTLSCachesOnCurrentThread();
+		}
+
+		virtual void ClearAndDisableTLSCachesOnCurrentThread() override
+		{
+			Inner->ClearAndDisableTLSCachesOnCurrentThread();
+		}
+
+		virtual bool IsInternallyThreadSafe() const override
+		{
+			return Inner->IsInternallyThreadSafe();
+		}
+
+		virtual bool ValidateHeap() override
+		{
+			return Inner->ValidateHeap();
+		}
+
+		virtual const TCHAR* GetDescriptiveName() override
+		{
+			return TEXT("NeighborCollectionTestCounter");
+		}
+
+	private:
+
+		FORCEINLINE void Count()
+		{
+			if (FPlatformTLS::GetCurrentThreadId() == ThreadId)
+			{
+				NumAllocations.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	/** Installs the counter as GMalloc for the lifetime of the scope. The counter itself is never freed, since other threads may still be inside it right after the swap back. */
+	struct FScopedAllocationCounter
+	{
+		FCountingMalloc& Counter;
+
+		FScopedAllocationCounter()
+			: Counter(Get())
+		{
+			Counter.Inner = GMalloc;
+			Counter.ThreadId = FPlatformTLS::GetCurrentThreadId();
+			Counter.NumAllocations = 0;
+			GMalloc = &Counter;
+		}
+
+		~FScopedAllocationCounter()
+		{
+			GMalloc = Counter.Inner;
+		}
+
+		int32 Num() const
+		{
+			return Counter.NumAllocations.load(std::memory_order_relaxed);
+		}
+
+		static FCountingMalloc& Get()
+		{
+			static FCountingMalloc* Instance = new FCountingMalloc();
+			return *Instance;
+		}
+	};
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FNeighborCollectionTest, "BattleFrame.NeighborGrid.NeighborCollection", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FNeighborCollectionTest::RunTest(const FString& Parameters)
+{
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false, TEXT("NeighborCollectionTest"));
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+
+	AMechanism* Mechanism = UMachine::ObtainMechanism(World);
+
+	// 网格以原点为中心，16x16个格子
+	AActor* Owner = World->SpawnActor<AActor>();
+	UNeighborGridComponent* Grid = NewObject<UNeighborGridComponent>(Owner);
+	Grid->CellSize = FVector(300.f);
+	Grid->GridSize = FIntVector(16, 16, 1);
+	Grid->DoInitializeCells();
+	Grid->GetBounds();
+	Grid->DefineFilters();
+
+	constexpr int32 NumClustered = 12;
+	constexpr int32 NumFar = 3;
+	constexpr int32 MaxNeighbors = 4;
+	constexpr float Radius = 20.f;
+	constexpr float NeighborDist = 500.f;
+
+	// 一簇互为邻居的Agent加上几个远在范围外的，坐标取整数以便打包后的单精度位置与原位置完全一致
+	FRandomStream Stream(17);
+	TArray<FSubjectHandle> Agents;
+	TArray<FVector> Locations;
+
+	for (int32 i = 0; i < NumClustered + NumFar; ++i)
+	{
+		const FVector Location = i < NumClustered
+			? FVector(Stream.RandRange(-150, 150), Stream.RandRange(-150, 150), 0)
+			: FVector(1500 + (i - NumClustered) * 200, -1500, 0);
+
+		FLocated Located;
+		Located.Location = Location;
+
+		FCollider Collider;
+		Collider.Radius = Radius;
+
+		FSubjectRecord Record;
+		Record.SetTrait(Located);
+		Record.SetTrait(Collider);
+		Record.SetTrait(FAvoidance());
+		Record.SetTrait(FActivated());
+
+		const FSubjectHandle Agent = Mechanism->SpawnSubject(Record);
+		Agent.SetTrait(FAvoiding{ Location, Radius, Agent, Agent.CalcHash() });
+
+		Agents.Add(Agent);
+		Locations.Add(Location);
+	}
+
+	const float TotalRangeSqr = FMath::Square(Radius + NeighborDist);
+
+	for (const bool bUsePackedGrid : { false, true })
+	{
+		const FString Path = bUsePackedGrid ? TEXT("Packed") : TEXT("Cells");
+
+		Grid->bUsePackedGrid = bUsePackedGrid;
+		Grid->Update();
+
+		const bool bPacked = Grid->HasPackedGrid();
+		TestTrue(*FString::Printf(TEXT("%s: packed grid built as configured"), *Path), bPacked == bUsePackedGrid);
+
+		for (int32 Self = 0; Self < Agents.Num(); ++Self)
+		{
+			const uint32 SelfHash = Agents[Self].CalcHash();
+			const FFilter SubjectFilter = Grid->SubjectFilterBase;
+
+			TFixedKNearest<UNeighborGridComponent::MaxNeighborsCapacity> Nearest(MaxNeighbors);
+			int32 NumAllocations = 0;
+
+			{
+				FScopedAllocationCounter Counter;
+				Grid->CollectSubjectNeighbors(Locations[Self], Radius, NeighborDist, SelfHash, SubjectFilter, 0, bPacked, Nearest);
+				NumAllocations = Counter.Num();
+			}
+
+			TestEqual(*FString::Printf(TEXT("%s: agent %d collects neighbors without heap allocations"), *Path, Self), NumAllocations, 0);
+
+			// 暴力解：范围内的其他Agent按距离排序取前MaxNeighbors个
+			TArray<float> Expected;
+
+			for (int32 Other = 0; Other < Agents.Num(); ++Other)
+			{
+				const float DistSqr = FVector::DistSquared(Locations[Self], Locations[Other]);
+
+				if (Other != Self && DistSqr <= TotalRangeSqr)
+				{
+					Expected.Add(DistSqr);
+				}
+			}
+
+			Expected.Sort();
+			Expected.SetNum(FMath::Min(Expected.Num(), MaxNeighbors));
+
+			// 距离可能并列，按距离序列比较，同时确认每个保留的邻居确实是范围内的其他Agent
+			TArray<float> Kept;
+
+			for (const FAvoiding& Neighbor : Nearest.GetView())
+			{
+				const int32 Other = Agents.IndexOfByKey(Neighbor.SubjectHandle);
+
+				TestTrue(*FString::Printf(TEXT("%s: agent %d keeps another agent"), *Path, Self), Other != INDEX_NONE && Other != Self);
+
+				if (Other != INDEX_NONE)
+				{
+					Kept.Add(FVector::DistSquared(Locations[Self], Locations[Other]));
+				}
+			}
+
+			Kept.Sort();
+
+			TestTrue(*FString::Printf(TEXT("%s: agent %d keeps the K nearest"), *Path, Self), Kept == Expected);
+		}
+	}
+
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+
+	return true;
+}
+
+#endif
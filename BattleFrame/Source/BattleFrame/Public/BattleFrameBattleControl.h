@@ -23,6 +23,8 @@
 
 // BattleFrame
 #include "BattleFrameFunctionLibraryRT.h"
+#include "BattleFrameSystemGraph.h"
+#include "BattleFrameRandom.h"
 
 #include "Traits/Debuff.h"
 #include "Traits/DmgSphere.h"
@@ -85,6 +87,7 @@
 
 // Forward Declearation
 class UNeighborGridComponent;
+class UFlowFieldCache;
 
 UCLASS()
 class BATTLEFRAME_API ABattleFrameBattleControl : public AActor
@@ -99,8 +102,37 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = BattleFrame)
 	int32 MinBatchSizeAllowed = 100;
 
-	int32 ThreadsCount = 1;
-	int32 BatchSize = 1;
+	// 自适应分块：按上一帧耗时把系统切成小块，由空闲线程逐块领取，减少尾部空等
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bAdaptiveBatching = false;
+
+	// 自适应分块时每块的目标耗时（微秒）
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance, meta = (EditCondition = "bAdaptiveBatching", ClampMin = "1"))
+	float AdaptiveChunkMicros = 50.f;
+
+	// 自适应分块时的最小块大小
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance, meta = (EditCondition = "bAdaptiveBatching", ClampMin = "1"))
+	int32 AdaptiveMinChunkSize = 16;
+
+	// 采集每个工作线程的忙碌时间，用于统计各系统的线程空闲时间
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bCollectSchedulerMetrics = false;
+
+	// 按依赖图在任务图上并行执行互不冲突的系统；并行时各系统的空闲时间和帧内存统计为近似值
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bParallelSystems = false;
+
+	// 记录每个系统每帧的耗时、实体数和线程数，可用 BattleFrame.DumpProfile 导出
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bEnableProfiler = true;
+
+	// 攻击目标没有绑定流场时，向 UFlowFieldCache 请求一张指向该目标的流场，基于单位自身流场的代价网格
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bUseFlowFieldCache = false;
+
+	// 扇形索敌收集所有单位的查询后一次性批量执行，同一格子附近的查询共享格子遍历。与逐个查询的结果对照验证之前默认关闭
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bBatchSectorTrace = false;
 
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = BattleFrame)
 	int32 NumSoundsPerFrame = 10;
@@ -118,12 +150,14 @@ public:
 	FStreamableManager StreamableManager;
 	UWorld* CurrentWorld = nullptr;
 	AMechanism* Mechanism = nullptr;
+	UFlowFieldCache* FlowFieldCache = nullptr;
 	TArray<UNeighborGridComponent*> NeighborGrids;
 	TQueue<TSoftObjectPtr<USoundBase>, EQueueMode::Mpsc> SoundsToPlay;
 	TQueue<float> VolumesToPlay;
 	EFlagmarkBit ReloadFlowFieldFlag = EFlagmarkBit::R;
 	TQueue<FDmgResult, EQueueMode::Mpsc> DamageResultQueue;
 	TSet<int32> ExistingRenderers;
+	FBattleFrameSystemGraph SystemGraph;
 
 private:
 
@@ -193,14 +227,15 @@ public:
 	void DefineFilters();
 
 	// 计算实际伤害，并返回一个pair，第一个元素是是否暴击，第二个元素是实际伤害
-	FORCEINLINE std::pair<bool, float> ProcessCritDamage(float BaseDamage, float damageMult, float Probability)
+	// RandomKey 标识这一次判定，设置种子后结果可复现
+	FORCEINLINE std::pair<bool, float> ProcessCritDamage(float BaseDamage, float damageMult, float Probability, uint32 RandomKey)
 	{
 		//TRACE_CPUPROFILER_EVENT_SCOPE_STR("ProcessCrit");
 		float ActualDamage = BaseDamage;
 		bool IsCritical = false;  // 是否暴击
 
 		// 生成一个[0, 1]范围内的随机数
-		float CritChance = FMath::FRand();
+		float CritChance = FBattleFrameRandom::FRand(RandomKey);
 
 		// 判断是否触发暴击
 		if (CritChance < Probability)
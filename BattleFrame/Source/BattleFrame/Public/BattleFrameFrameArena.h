@@ -0,0 +1,286 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/ContainerAllocationPolicies.h"
+#include <atomic>
+
+/* Per-system arena usage of the last finished frame. */
+struct FFrameArenaSystemStat
+{
+	FName Name;
+	int64 Bytes = 0;
+	int64 HighWater = 0;
+	int64 PeakHighWater = 0;
+};
+
+/**
+ * Per-thread linear arena for the temporary containers of BattleFrame systems.
+ * Memory is only handed out inside an FFrameArenaScope and is rewound when that scope exits,
+ * so worker threads never touch the global allocator once their blocks have grown large enough.
+ */
+class BATTLEFRAME_API FBattleFrameFrameArena
+{
+public:
+
+	static constexpr SIZE_T DefaultBlockSize = 64 * 1024;
+
+	FBattleFrameFrameArena() = default;
+	FBattleFrameFrameArena(const FBattleFrameFrameArena&) = delete;
+	FBattleFrameFrameArena& operator=(const FBattleFrameFrameArena&) = delete;
+	~FBattleFrameFrameArena();
+
+	/* Arena of the calling thread, or nullptr if the thread is not inside an FFrameArenaScope. */
+	static FBattleFrameFrameArena* GetActive();
+
+	void* Allocate(SIZE_T Size, uint32 Alignment);
+
+	/* Grow or shrink the most recent allocation without moving it. */
+	bool TryResizeInPlace(const void* Ptr, SIZE_T OldSize, SIZE_T NewSize);
+
+	/* Called once per BattleControl Tick: rolls the per-system counters over to the finished frame. */
+	static void BeginFrame();
+
+	static int32 RegisterSystem(const TCHAR* Name);
+	static void GetSystemStats(TArray<FFrameArenaSystemStat>& OutStats);
+
+	/* System that allocations on the calling thread are charged to. Thread local, so concurrently running systems do not steal each other's bytes. */
+	static int32 GetCurrentSystem();
+	static void SetCurrentSystem(int32 SystemIndex);
+
+private:
+
+	friend class FFrameArenaScope;
+	friend class FFrameArenaSystemScope;
+
+	struct FBlock
+	{
+		uint8* Data = nullptr;
+		SIZE_T Size = 0;
+	};
+
+	void AddBlock(SIZE_T MinSize);
+	void Coalesce();
+	void RecordAllocation(SIZE_T Size) const;
+
+	TArray<FBlock, TInlineAllocator<4>> Blocks;
+	int32 CurrentBlock = INDEX_NONE;
+	SIZE_T Offset = 0;
+	SIZE_T Used = 0;
+	int32 ScopeDepth = 0;
+};
+
+/**
+ * Activates the calling thread's arena. Declare it before the arena backed containers,
+ * everything allocated inside is released when the scope exits.
+ */
+class BATTLEFRAME_API FFrameArenaScope
+{
+public:
+
+	FFrameArenaScope();
+	~FFrameArenaScope();
+
+	FFrameArenaScope(const FFrameArenaScope&) = delete;
+	FFrameArenaScope& operator=(const FFrameArenaScope&) = delete;
+
+private:
+
+	FBattleFrameFrameArena& Arena;
+	int32 MarkBlock;
+	SIZE_T MarkOffset;
+	SIZE_T MarkUsed;
+};
+
+/* Attributes arena usage on the calling thread to a system while it is running. Workers inherit it through BATTLEFRAME_WORKER_PROBE. */
+class BATTLEFRAME_API FFrameArenaSystemScope
+{
+public:
+
+	explicit FFrameArenaSystemScope(int32 SystemIndex);
+	~FFrameArenaSystemScope();
+
+	FFrameArenaSystemScope(const FFrameArenaSystemScope&) = delete;
+	FFrameArenaSystemScope& operator=(const FFrameArenaSystemScope&) = delete;
+
+private:
+
+	int32 PreviousSystem;
+};
+
+/**
+ * Container allocator backed by the frame arena. Falls back to the heap when no FFrameArenaScope is active.
+ * Containers using it must not outlive the scope they were filled in.
+ */
+class FFrameArenaAllocator
+{
+public:
+
+	using SizeType = int32;
+
+	enum { NeedsElementType = false };
+	enum { RequireRangeCheck = true };
+
+	class ForAnyElementType
+	{
+	public:
+
+		ForAnyElementType() = default;
+		ForAnyElementType(const ForAnyElementType&) = delete;
+		ForAnyElementType& operator=(const ForAnyElementType&) = delete;
+
+		FORCEINLINE ~ForAnyElementType()
+		{
+			if (Data && bHeap) FMemory::Free(Data);
+		}
+
+		FORCEINLINE void MoveToEmpty(ForAnyElementType& Other)
+		{
+			check(this != &Other);
+
+			if (Data && bHeap) FMemory::Free(Data);
+
+			Data = Other.Data;
+			AllocatedBytes = Other.AllocatedBytes;
+			bHeap = Other.bHeap;
+
+			Other.Data = nullptr;
+			Other.AllocatedBytes = 0;
+			Other.bHeap = false;
+		}
+
+		FORCEINLINE FScriptContainerElement* GetAllocation() const
+		{
+			return Data;
+		}
+
+		FORCEINLINE void ResizeAllocation(SizeType PreviousNumElements, SizeType NumElements, SIZE_T NumBytesPerElement)
+		{
+			ResizeAllocation(PreviousNumElements, NumElements, NumBytesPerElement, DEFAULT_ALIGNMENT);
+		}
+
+		void ResizeAllocation(SizeType PreviousNumElements, SizeType NumElements, SIZE_T NumBytesPerElement, uint32 AlignmentOfElement)
+		{
+			const SIZE_T NewBytes = (SIZE_T)NumElements * NumBytesPerElement;
+			const uint32 Alignment = FMath::Max<uint32>(AlignmentOfElement, 16);
+
+			if (NumElements == 0)
+			{
+				if (Data && bHeap) FMemory::Free(Data);
+				Data = nullptr;
+				AllocatedBytes = 0;
+				bHeap = false;
+				return;
+			}
+
+			if (bHeap)
+			{
+				Data = (FScriptContainerElement*)FMemory::Realloc(Data, NewBytes, Alignment);
+				AllocatedBytes = NewBytes;
+				return;
+			}
+
+			FBattleFrameFrameArena* Arena = FBattleFrameFrameArena::GetActive();
+
+			if (Arena && Data && Arena->TryResizeInPlace(Data, AllocatedBytes, NewBytes))
+			{
+				AllocatedBytes = NewBytes;
+				return;
+			}
+
+			void* NewData = Arena ? Arena->Allocate(NewBytes, Alignment) : FMemory::Malloc(NewBytes, Alignment);
+
+			if (Data && PreviousNumElements > 0)
+			{
+				FMemory::Memcpy(NewData, Data, (SIZE_T)FMath::Min(PreviousNumElements, NumElements) * NumBytesPerElement);
+			}
+
+			Data = (FScriptContainerElement*)NewData;
+			AllocatedBytes = NewBytes;
+			bHeap = (Arena == nullptr);
+		}
+
+		FORCEINLINE SizeType CalculateSlackReserve(SizeType NumElements, SIZE_T NumBytesPerElement) const
+		{
+			return DefaultCalculateSlackReserve(NumElements, NumBytesPerElement, false);
+		}
+
+		FORCEINLINE SizeType CalculateSlackReserve(SizeType NumElements, SIZE_T NumBytesPerElement, uint32 AlignmentOfElement) const
+		{
+			return DefaultCalculateSlackReserve(NumElements, NumBytesPerElement, false, AlignmentOfElement);
+		}
+
+		FORCEINLINE SizeType CalculateSlackShrink(SizeType NumElements, SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const
+		{
+			return DefaultCalculateSlackShrink(NumElements, NumAllocatedElements, NumBytesPerElement, false);
+		}
+
+		FORCEINLINE SizeType CalculateSlackShrink(SizeType NumElements, SizeType NumAllocatedElements, SIZE_T NumBytesPerElement, uint32 AlignmentOfElement) const
+		{
+			return DefaultCalculateSlackShrink(NumElements, NumAllocatedElements, NumBytesPerElement, false, AlignmentOfElement);
+		}
+
+		FORCEINLINE SizeType CalculateSlackGrow(SizeType NumElements, SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const
+		{
+			return DefaultCalculateSlackGrow(NumElements, NumAllocatedElements, NumBytesPerElement, false);
+		}
+
+		FORCEINLINE SizeType CalculateSlackGrow(SizeType NumElements, SizeType NumAllocatedElements, SIZE_T NumBytesPerElement, uint32 AlignmentOfElement) const
+		{
+			return DefaultCalculateSlackGrow(NumElements, NumAllocatedElements, NumBytesPerElement, false, AlignmentOfElement);
+		}
+
+		FORCEINLINE SIZE_T GetAllocatedSize(SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const
+		{
+			return (SIZE_T)NumAllocatedElements * NumBytesPerElement;
+		}
+
+		FORCEINLINE bool HasAllocation() const
+		{
+			return !!Data;
+		}
+
+		FORCEINLINE SizeType GetInitialCapacity() const
+		{
+			return 0;
+		}
+
+	private:
+
+		FScriptContainerElement* Data = nullptr;
+		SIZE_T AllocatedBytes = 0;
+		bool bHeap = false;
+	};
+
+	template<typename ElementType>
+	class ForElementType : public ForAnyElementType
+	{
+	public:
+
+		FORCEINLINE ElementType* GetAllocation() const
+		{
+			return (ElementType*)ForAnyElementType::GetAllocation();
+		}
+	};
+};
+
+template <>
+struct TAllocatorTraits<FFrameArenaAllocator> : TAllocatorTraitsBase<FFrameArenaAllocator>
+{
+	enum { SupportsMove = true };
+	enum { IsZeroConstruct = true };
+	enum { SupportsElementAlignment = true };
+};
+
+using FFrameArenaSetAllocator = TSetAllocator<TSparseArrayAllocator<FFrameArenaAllocator, FFrameArenaAllocator>, FFrameArenaAllocator>;
+
+template<typename ElementType>
+using TFrameArray = TArray<ElementType, FFrameArenaAllocator>;
+
+template<typename ElementType>
+using TFrameSet = TSet<ElementType, DefaultKeyFuncs<ElementType>, FFrameArenaSetAllocator>;
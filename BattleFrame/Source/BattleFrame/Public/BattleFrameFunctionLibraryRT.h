@@ -133,6 +133,15 @@ public:
     UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "Convert to SubjectArray", CompactNodeTitle = "->", BlueprintAutocast), Category = "BattleFrame")
     static FSubjectArray ConvertSubjectHandlesToSubjectArray(const TArray<FSubjectHandle>& SubjectHandles);
 
+    UFUNCTION(BlueprintCallable, Category = "BattleFrame | Profiler")
+    static void GetSystemProfile(TArray<FSystemProfileSummary>& Summaries);
+
+    UFUNCTION(BlueprintCallable, Category = "BattleFrame | Profiler")
+    static FString ExportSystemProfile(bool bJson = false, bool bRawFrames = false);
+
+    UFUNCTION(BlueprintCallable, Category = "BattleFrame | Profiler")
+    static void ResetSystemProfile();
+
     static void CalculateThreadsCountAndBatchSize(int32 IterableNum, int32 MaxThreadsAllowed, int32 MinBatchSizeAllowed, int32& ThreadsCount, int32& BatchSize);
 
     static void SetRecordSubTypeTraitByIndex(int32 Index, FSubjectRecord& SubjectRecord);
@@ -300,6 +309,75 @@ public:
         }
     };
 
+    FORCEINLINE static void IncludeTeamTraitByIndex(int32 Index, FFilter& Filter)
+    {
+        switch (Index)
+        {
+            case 0:
+                Filter.Include<FTeam0>();
+                break;
+
+            case 1:
+                Filter.Include<FTeam1>();
+                break;
+
+            case 2:
+                Filter.Include<FTeam2>();
+                break;
+
+            case 3:
+                Filter.Include<FTeam3>();
+                break;
+
+            case 4:
+                Filter.Include<FTeam4>();
+                break;
+
+            case 5:
+                Filter.Include<FTeam5>();
+                break;
+
+            case 6:
+                Filter.Include<FTeam6>();
+                break;
+
+            case 7:
+                Filter.Include<FTeam7>();
+                break;
+
+            case 8:
+                Filter.Include<FTeam8>();
+                break;
+
+            case 9:
+                Filter.Include<FTeam9>();
+                break;
+        }
+    };
+
+    // 过滤条件包含的队伍，第 i 位对应 FTeam<i>，0 表示不限队伍
+    static uint16 GetTeamMaskFromTraits(const TArray<UScriptStruct*>& IncludeTraits)
+    {
+        const UScriptStruct* TeamTraits[] = {
+            FTeam0::StaticStruct(), FTeam1::StaticStruct(), FTeam2::StaticStruct(), FTeam3::StaticStruct(), FTeam4::StaticStruct(),
+            FTeam5::StaticStruct(), FTeam6::StaticStruct(), FTeam7::StaticStruct(), FTeam8::StaticStruct(), FTeam9::StaticStruct() };
+
+        uint16 TeamMask = 0;
+
+        for (const UScriptStruct* Trait : IncludeTraits)
+        {
+            for (int32 Index = 0; Index < UE_ARRAY_COUNT(TeamTraits); ++Index)
+            {
+                if (Trait == TeamTraits[Index])
+                {
+                    TeamMask |= 1 << Index;
+                }
+            }
+        }
+
+        return TeamMask;
+    };
+
     FORCEINLINE static void IncludeAvoGroupTraitByIndex(int32 Index, FFilter& Filter)
     {
         switch (Index)
@@ -0,0 +1,41 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "BattleFrameStructs.h"
+
+/**
+ * Always-on per-system frame profiler.
+ * Every system keeps a fixed ring buffer of its last frames (wall time, entity count, threads used),
+ * so soak runs can be inspected and exported without Unreal Insights attached.
+ */
+class BATTLEFRAME_API FBattleFrameProfiler
+{
+public:
+
+	static constexpr int32 MaxTrackedSystems = 64;
+	static constexpr int32 HistoryFrames = 1024;
+
+	static void SetEnabled(bool bInEnabled);
+	static bool IsEnabled();
+
+	/* Called once per BattleControl Tick. */
+	static void BeginFrame();
+
+	/* Store one frame of a system. Each system is only ever recorded by the thread running it. */
+	static void Record(int32 SystemIndex, FName Name, float WallMs, int32 Entities, int32 Threads);
+
+	static void Reset();
+
+	/* Min/avg/p99/max over the frames currently in the ring buffers. */
+	static void GetSummaries(TArray<FSystemProfileSummary>& OutSummaries);
+
+	/* bRawFrames exports every buffered frame instead of the per-system summary. */
+	static FString ExportCSV(bool bRawFrames);
+	static FString ExportJSON(bool bRawFrames);
+};
@@ -0,0 +1,76 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Math/RandomStream.h"
+
+/**
+ * Seedable random numbers for the simulation (crit rolls, patrol goals, trace shuffles, spawn positions).
+ * Seed 0 keeps the engine RNG. With a non-zero seed every draw is a hash of (seed, frame, key),
+ * so the result does not depend on which worker thread happens to run the agent.
+ */
+class BATTLEFRAME_API FBattleFrameRandom
+{
+public:
+
+	/* 0 = not seeded. Also reseeds the game thread stream. */
+	static void SetSeed(int32 InSeed);
+	static int32 GetSeed();
+
+	FORCEINLINE static bool IsSeeded()
+	{
+		return Seed != 0;
+	}
+
+	/* Called once per BattleControl Tick. */
+	static void BeginFrame();
+
+	/* [0, 1) for the given key. Draws sharing a key within one frame must pass different salts. */
+	FORCEINLINE static float FRand(const uint32 Key, const uint32 Salt = 0)
+	{
+		if (!IsSeeded()) return FMath::FRand();
+
+		return (Hash(Key, Salt) >> 8) * (1.f / 16777216.f);
+	}
+
+	FORCEINLINE static float FRandRange(const float Min, const float Max, const uint32 Key, const uint32 Salt = 0)
+	{
+		return Min + (Max - Min) * FRand(Key, Salt);
+	}
+
+	/* Seed for a local FRandomStream that has to make several draws, e.g. a shuffle. */
+	FORCEINLINE static int32 StreamSeed(const uint32 Key)
+	{
+		if (!IsSeeded()) return FMath::Rand();
+
+		return static_cast<int32>(Hash(Key, 0x5EED));
+	}
+
+	/* Sequential draws on the game thread only, e.g. spawning. */
+	static FRandomStream& GameThreadStream();
+
+private:
+
+	FORCEINLINE static uint32 Mix(uint32 X)
+	{
+		X ^= X >> 16;
+		X *= 0x7feb352dU;
+		X ^= X >> 15;
+		X *= 0x846ca68bU;
+		X ^= X >> 16;
+		return X;
+	}
+
+	FORCEINLINE static uint32 Hash(const uint32 Key, const uint32 Salt)
+	{
+		return Mix(Mix(Mix(static_cast<uint32>(Seed) ^ Frame) ^ Key) + Salt);
+	}
+
+	static int32 Seed;
+	static uint32 Frame;
+};
@@ -0,0 +1,131 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+/* Scheduling stats of one system for the last frame it ran. */
+struct FSchedulerSystemStat
+{
+	FName Name;
+	int32 Items = 0;
+	int32 ChunkSize = 0;
+	int32 Chunks = 0;
+	int32 ThreadsUsed = 0;
+	double WallMs = 0;
+	double BusyMs = 0;
+	double IdleMs = 0;
+};
+
+/**
+ * Adaptive batching for the concurrent systems.
+ * Static batching hands every thread one large slice, so a few expensive agents leave the other cores idle at the tail.
+ * In adaptive mode a system is split into many small chunks that the workers pull one by one,
+ * and the chunk size is retuned every frame from the measured per-item cost of the previous frame.
+ */
+class BATTLEFRAME_API FBattleFrameScheduler
+{
+public:
+
+	static constexpr int32 MaxTrackedSystems = 64;
+	static constexpr int32 MaxWorkerSlots = 128;
+	static constexpr int32 MaxChunksPerThread = 32;
+
+	/* Called once per BattleControl Tick with the actor settings. */
+	static void Configure(bool bInAdaptive, float InTargetChunkMicros, int32 InMinChunkSize, bool bInCollectWorkerTimes);
+
+	/* Fill ThreadsCount/BatchSize for the running system. Returns false when the static split should be used. */
+	static bool CalculateAdaptiveBatch(int32 IterableNum, int32 MaxThreadsAllowed, int32& ThreadsCount, int32& BatchSize);
+
+	/* Note the entities and threads of one dispatch, for the idle metrics and the frame profiler. */
+	static void RecordDispatch(int32 IterableNum, int32 Threads);
+
+	static void BeginSystem(int32 SystemIndex, const TCHAR* Name);
+	static void EndSystem();
+
+	/* System running on the calling thread, 0 outside of any system. */
+	static int32 GetCurrentSystem();
+
+	/* Make the calling worker run on behalf of SystemIndex and return the system it ran before. */
+	static int32 EnterWorkerSystem(int32 SystemIndex);
+	static void LeaveWorkerSystem(int32 PreviousSystem);
+
+	static void GetSystemStats(TArray<FSchedulerSystemStat>& OutStats);
+
+	FORCEINLINE static bool IsCollectingWorkerTimes()
+	{
+		return bCollectWorkerTimes.load(std::memory_order_relaxed);
+	}
+
+	/* Charge Cycles of the calling worker to SystemIndex. Slots are kept per system so concurrently running systems do not mix their times. */
+	static void AddWorkerTime(int32 SystemIndex, uint64 Cycles);
+
+private:
+
+	static std::atomic<bool> bCollectWorkerTimes;
+};
+
+/* Opens a system for adaptive batching and idle accounting on the calling thread. */
+class BATTLEFRAME_API FSchedulerSystemScope
+{
+public:
+
+	FSchedulerSystemScope(const int32 SystemIndex, const TCHAR* Name)
+	{
+		FBattleFrameScheduler::BeginSystem(SystemIndex, Name);
+	}
+
+	~FSchedulerSystemScope()
+	{
+		FBattleFrameScheduler::EndSystem();
+	}
+
+	FSchedulerSystemScope(const FSchedulerSystemScope&) = delete;
+	FSchedulerSystemScope& operator=(const FSchedulerSystemScope&) = delete;
+};
+
+/**
+ * Runs one item on the calling worker on behalf of the dispatching system: the system is propagated to the worker's
+ * scheduler and frame arena state, and the busy time is measured when worker times are collected.
+ */
+class FSchedulerWorkerProbe
+{
+public:
+
+	FORCEINLINE explicit FSchedulerWorkerProbe(const int32 InSystemIndex)
+		: SystemIndex(InSystemIndex)
+		, PreviousSystem(FBattleFrameScheduler::EnterWorkerSystem(InSystemIndex))
+		, StartCycles(FBattleFrameScheduler::IsCollectingWorkerTimes() ? FPlatformTime::Cycles64() : 0)
+	{
+	}
+
+	FORCEINLINE ~FSchedulerWorkerProbe()
+	{
+		if (StartCycles)
+		{
+			FBattleFrameScheduler::AddWorkerTime(SystemIndex, FPlatformTime::Cycles64() - StartCycles);
+		}
+
+		FBattleFrameScheduler::LeaveWorkerSystem(PreviousSystem);
+	}
+
+	FSchedulerWorkerProbe(const FSchedulerWorkerProbe&) = delete;
+	FSchedulerWorkerProbe& operator=(const FSchedulerWorkerProbe&) = delete;
+
+private:
+
+	int32 SystemIndex;
+	int32 PreviousSystem;
+	uint64 StartCycles;
+};
+
+/* Names the system that the worker lambdas of the enclosing function run for. BATTLEFRAME_SYSTEM_SCOPE declares it too. */
+#define BATTLEFRAME_CAPTURE_SYSTEM() const int32 BattleFrameSystemIndex = FBattleFrameScheduler::GetCurrentSystem()
+
+/* Place at the top of a worker lambda; BattleFrameSystemIndex is captured from the dispatching scope. */
+#define BATTLEFRAME_WORKER_PROBE() FSchedulerWorkerProbe PREPROCESSOR_JOIN(WorkerProbe, __LINE__)(BattleFrameSystemIndex)
@@ -52,4 +52,36 @@ public:
 
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	TArray<FSubjectHandle> Subjects = TArray<FSubjectHandle>();
-};
\ No newline at end of file
+};
+
+USTRUCT(BlueprintType)
+struct BATTLEFRAME_API FSystemProfileSummary
+{
+	GENERATED_BODY()
+
+public:
+
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere)
+	FName System = NAME_None;
+
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere)
+	int32 Samples = 0;
+
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere)
+	float MinMs = 0;
+
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere)
+	float AvgMs = 0;
+
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere)
+	float P99Ms = 0;
+
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere)
+	float MaxMs = 0;
+
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere)
+	float AvgEntities = 0;
+
+	UPROPERTY(BlueprintReadOnly, VisibleAnywhere)
+	int32 MaxThreads = 0;
+};
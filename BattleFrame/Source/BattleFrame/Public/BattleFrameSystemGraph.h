@@ -0,0 +1,127 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Traits a system touches. Two systems conflict if one writes a trait the other reads, writes or appends.
+ * Append is for deferred spawns and thread-safe queues: appenders never conflict with each other.
+ */
+struct BATTLEFRAME_API FSystemAccess
+{
+	TArray<FName, TInlineAllocator<16>> Reads;
+	TArray<FName, TInlineAllocator<16>> Writes;
+	TArray<FName, TInlineAllocator<8>> Appends;
+
+	// 必须在游戏线程执行（访问UObject、Niagara、音频等）
+	bool bGameThread = false;
+
+	// 同步点（如ApplyDeferreds），与前后所有系统串行
+	bool bSyncPoint = false;
+
+	template<typename... TraitTypes>
+	FSystemAccess& Read()
+	{
+		(Reads.AddUnique(TraitTypes::StaticStruct()->GetFName()), ...);
+		return *this;
+	}
+
+	template<typename... TraitTypes>
+	FSystemAccess& Write()
+	{
+		(Writes.AddUnique(TraitTypes::StaticStruct()->GetFName()), ...);
+		return *this;
+	}
+
+	template<typename... TraitTypes>
+	FSystemAccess& Append()
+	{
+		(Appends.AddUnique(TraitTypes::StaticStruct()->GetFName()), ...);
+		return *this;
+	}
+
+	/* Non-trait shared state, e.g. a queue on the BattleControl or the neighbor grid cells. */
+	FSystemAccess& ReadResource(const FName Resource)
+	{
+		Reads.AddUnique(Resource);
+		return *this;
+	}
+
+	FSystemAccess& WriteResource(const FName Resource)
+	{
+		Writes.AddUnique(Resource);
+		return *this;
+	}
+
+	FSystemAccess& AppendResource(const FName Resource)
+	{
+		Appends.AddUnique(Resource);
+		return *this;
+	}
+
+	FSystemAccess& GameThread()
+	{
+		bGameThread = true;
+		return *this;
+	}
+
+	FSystemAccess& SyncPoint()
+	{
+		bSyncPoint = true;
+		return *this;
+	}
+
+	bool ConflictsWith(const FSystemAccess& Other) const;
+};
+
+/**
+ * Declarative dependency graph of the BattleControl systems.
+ * Systems are added in their sequential order; a system depends on every earlier system it conflicts with,
+ * so running the graph concurrently gives the same result as running it in order.
+ */
+class BATTLEFRAME_API FBattleFrameSystemGraph
+{
+public:
+
+	void Reset();
+
+	void AddSystem(const TCHAR* Name, const FSystemAccess& Access, TFunction<void()>&& Run);
+
+	/* Compute dependencies and waves. */
+	void Build();
+
+	/* Run all systems, either in order or on the task graph following the dependencies. */
+	void Execute(bool bParallel);
+
+	/* Human readable schedule, one line per wave followed by every system and its dependencies. */
+	FString Dump() const;
+
+	/* Graphviz dot of the schedule. */
+	FString DumpDot() const;
+
+	FORCEINLINE int32 Num() const
+	{
+		return Nodes.Num();
+	}
+
+private:
+
+	void ExecuteOnTaskGraph();
+
+	struct FNode
+	{
+		FName Name;
+		FSystemAccess Access;
+		TFunction<void()> Run;
+		TArray<int32, TInlineAllocator<8>> Dependencies;
+		int32 Wave = 0;
+	};
+
+	TArray<FNode> Nodes;
+	int32 NumWaves = 0;
+};
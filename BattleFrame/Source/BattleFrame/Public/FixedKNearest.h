@@ -0,0 +1,128 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Traits/Avoiding.h"
+
+/**
+ * Bounded max-heap keeping the K nearest FAvoiding entries, stored inline without heap allocations.
+ * Entries are deduplicated by SubjectHash. The runtime limit can be lower than Capacity.
+ */
+template<int32 Capacity>
+class TFixedKNearest
+{
+	static_assert(Capacity > 0, "TFixedKNearest capacity must be positive.");
+
+public:
+
+	explicit TFixedKNearest(const int32 InLimit = Capacity)
+	{
+		SetLimit(InLimit);
+	}
+
+	FORCEINLINE void SetLimit(const int32 InLimit)
+	{
+		Limit = FMath::Clamp(InLimit, 1, Capacity);
+	}
+
+	FORCEINLINE void Reset()
+	{
+		Count = 0;
+	}
+
+	FORCEINLINE int32 Num() const { return Count; }
+	FORCEINLINE bool IsEmpty() const { return Count == 0; }
+	FORCEINLINE bool IsFull() const { return Count >= Limit; }
+
+	/* Squared distance of the farthest kept entry. */
+	FORCEINLINE float TopDistSqr() const
+	{
+		return Count > 0 ? DistSqrs[0] : FLT_MAX;
+	}
+
+	/* Whether an entry at this distance could still enter the heap. */
+	FORCEINLINE bool WouldAccept(const float DistSqr) const
+	{
+		return !IsFull() || DistSqr < DistSqrs[0];
+	}
+
+	FORCEINLINE bool Contains(const uint32 SubjectHash) const
+	{
+		for (int32 i = 0; i < Count; ++i)
+		{
+			if (Elements[i].SubjectHash == SubjectHash) return true;
+		}
+		return false;
+	}
+
+	/* Insert the entry, evicting the farthest one if full. Returns false if the entry was rejected. */
+	FORCEINLINE bool Push(const FAvoiding& Element, const float DistSqr)
+	{
+		if (!IsFull())
+		{
+			Elements[Count] = Element;
+			DistSqrs[Count] = DistSqr;
+			SiftUp(Count++);
+			return true;
+		}
+
+		if (DistSqr >= DistSqrs[0]) return false;
+
+		Elements[0] = Element;
+		DistSqrs[0] = DistSqr;
+		SiftDown(0);
+		return true;
+	}
+
+	/* The kept entries, in heap order. */
+	FORCEINLINE TArrayView<const FAvoiding> GetView() const
+	{
+		return TArrayView<const FAvoiding>(Elements, Count);
+	}
+
+private:
+
+	FORCEINLINE void Swap(const int32 A, const int32 B)
+	{
+		::Swap(Elements[A], Elements[B]);
+		::Swap(DistSqrs[A], DistSqrs[B]);
+	}
+
+	FORCEINLINE void SiftUp(int32 Index)
+	{
+		while (Index > 0)
+		{
+			const int32 Parent = (Index - 1) / 2;
+			if (DistSqrs[Parent] >= DistSqrs[Index]) break;
+			Swap(Parent, Index);
+			Index = Parent;
+		}
+	}
+
+	FORCEINLINE void SiftDown(int32 Index)
+	{
+		while (true)
+		{
+			const int32 Left = Index * 2 + 1;
+			const int32 Right = Left + 1;
+			int32 Largest = Index;
+
+			if (Left < Count && DistSqrs[Left] > DistSqrs[Largest]) Largest = Left;
+			if (Right < Count && DistSqrs[Right] > DistSqrs[Largest]) Largest = Right;
+			if (Largest == Index) break;
+
+			Swap(Index, Largest);
+			Index = Largest;
+		}
+	}
+
+	FAvoiding Elements[Capacity];
+	float DistSqrs[Capacity];
+	int32 Count = 0;
+	int32 Limit = Capacity;
+};
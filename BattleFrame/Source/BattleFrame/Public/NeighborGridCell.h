@@ -53,6 +53,13 @@ public:
 
 	bool Registered = false;
 
+	// FTeam0..FTeam9，第 NumTeamLayers 层放没有队伍的Subject
+	static constexpr int32 NumTeamLayers = 10;
+
+	// Subjects 按队伍分层后，第 t 层为 [TeamStart[t], TeamStart[t + 1])
+	bool bTeamSorted = false;
+	uint16 TeamStart[NumTeamLayers + 2] = {};
+
 	FNeighborGridCell(){}
 
 	FNeighborGridCell(const FNeighborGridCell& Cell)
@@ -60,6 +67,8 @@ public:
 		LockFlag.store(Cell.LockFlag.load());
 
 		Registered = Cell.Registered;
+		bTeamSorted = Cell.bTeamSorted;
+		FMemory::Memcpy(TeamStart, Cell.TeamStart, sizeof(TeamStart));
 		Subjects = Cell.Subjects;
 		SphereObstacles = Cell.SphereObstacles;
 		BoxObstacles = Cell.BoxObstacles;
@@ -70,6 +79,8 @@ public:
 	FNeighborGridCell& operator=(const FNeighborGridCell& Cell)
 	{
 		Registered = Cell.Registered;
+		bTeamSorted = Cell.bTeamSorted;
+		FMemory::Memcpy(TeamStart, Cell.TeamStart, sizeof(TeamStart));
 		Subjects = Cell.Subjects;
 		SphereObstacles = Cell.SphereObstacles;
 		BoxObstacles = Cell.BoxObstacles;
@@ -82,6 +93,7 @@ public:
 	void Reset()
 	{
 		Registered = false;
+		bTeamSorted = false;
 
 		// 清空所有存储的障碍物数据
 		Subjects.Empty();
@@ -89,3 +101,217 @@ public:
 		BoxObstacles.Empty();
 	}
 };
+
+/**
+ * Structure-of-arrays copy of all cell subjects.
+ * Subjects of cell i are stored contiguously in [CellStart[i], CellStart[i + 1]).
+ */
+struct BATTLEFRAME_API FNeighborGridPacked
+{
+	TArray<int32> CellStart;
+
+	TArray<float> X;
+	TArray<float> Y;
+	TArray<float> Z;
+	TArray<float> Radius;
+	TArray<uint32> Hash;
+	TArray<uint8> Team;
+	TArray<uint8> AvoGroup;
+	TArray<uint16> Archetype;
+	TArray<FSubjectHandle> Handles;
+
+	FORCEINLINE int32 Num() const
+	{
+		return Hash.Num();
+	}
+
+	FORCEINLINE int32 NumCells() const
+	{
+		return FMath::Max(CellStart.Num() - 1, 0);
+	}
+
+	void SetNumUninitialized(const int32 Num)
+	{
+		X.SetNumUninitialized(Num, false);
+		Y.SetNumUninitialized(Num, false);
+		Z.SetNumUninitialized(Num, false);
+		Radius.SetNumUninitialized(Num, false);
+		Hash.SetNumUninitialized(Num, false);
+		Team.SetNumUninitialized(Num, false);
+		AvoGroup.SetNumUninitialized(Num, false);
+		Archetype.SetNumUninitialized(Num, false);
+		Handles.SetNumUninitialized(Num, false);
+	}
+
+	void Empty()
+	{
+		CellStart.Empty();
+		SetNumUninitialized(0);
+	}
+
+	FORCEINLINE void Write(const int32 Index, const FAvoiding& Avoiding)
+	{
+		X[Index] = Avoiding.Location.X;
+		Y[Index] = Avoiding.Location.Y;
+		Z[Index] = Avoiding.Location.Z;
+		Radius[Index] = Avoiding.Radius;
+		Hash[Index] = Avoiding.SubjectHash;
+		Team[Index] = Avoiding.Team;
+		AvoGroup[Index] = Avoiding.AvoGroup;
+		Archetype[Index] = Avoiding.Archetype;
+		Handles[Index] = Avoiding.SubjectHandle;
+	}
+
+	/* Call Func(Column) for every per-subject array, e.g. to permute a range of all columns at once. */
+	template<typename FuncType>
+	FORCEINLINE void ForEachColumn(FuncType&& Func)
+	{
+		Func(X);
+		Func(Y);
+		Func(Z);
+		Func(Radius);
+		Func(Hash);
+		Func(Team);
+		Func(AvoGroup);
+		Func(Archetype);
+		Func(Handles);
+	}
+
+	FORCEINLINE void Swap(const int32 A, const int32 B)
+	{
+		X.Swap(A, B);
+		Y.Swap(A, B);
+		Z.Swap(A, B);
+		Radius.Swap(A, B);
+		Hash.Swap(A, B);
+		Team.Swap(A, B);
+		AvoGroup.Swap(A, B);
+		Archetype.Swap(A, B);
+		Handles.Swap(A, B);
+	}
+
+	FORCEINLINE FVector GetLocation(const int32 Index) const
+	{
+		return FVector(X[Index], Y[Index], Z[Index]);
+	}
+
+	FORCEINLINE FAvoiding MakeAvoiding(const int32 Index) const
+	{
+		FAvoiding Avoiding;
+		Avoiding.Location = GetLocation(Index);
+		Avoiding.Radius = Radius[Index];
+		Avoiding.SubjectHandle = Handles[Index];
+		Avoiding.SubjectHash = Hash[Index];
+		Avoiding.Team = Team[Index];
+		Avoiding.AvoGroup = AvoGroup[Index];
+		Avoiding.Archetype = Archetype[Index];
+		return Avoiding;
+	}
+
+	/* Call Func(Index, DistSqr) for every subject in [Begin, End) with DistSqr <= Radius² + RangeSqr. Scalar version. */
+	template<typename FuncType>
+	FORCEINLINE void ForEachInRangeScalar(const int32 Begin, const int32 End, const FVector3f& Center, const float RangeSqr, FuncType&& Func) const
+	{
+		const float* RESTRICT PX = X.GetData();
+		const float* RESTRICT PY = Y.GetData();
+		const float* RESTRICT PZ = Z.GetData();
+		const float* RESTRICT PR = Radius.GetData();
+
+		for (int32 i = Begin; i < End; ++i)
+		{
+			const float DX = PX[i] - Center.X;
+			const float DY = PY[i] - Center.Y;
+			const float DZ = PZ[i] - Center.Z;
+			const float DistSqr = DX * DX + DY * DY + DZ * DZ;
+
+			if (DistSqr > PR[i] * PR[i] + RangeSqr) continue;
+
+			Func(i, DistSqr);
+		}
+	}
+
+	/* Same as ForEachInRangeScalar, but tests 4 subjects at once and only visits the lanes set in the compare mask. */
+	template<typename FuncType>
+	FORCEINLINE void ForEachInRangeSimd(const int32 Begin, const int32 End, const FVector3f& Center, const float RangeSqr, FuncType&& Func) const
+	{
+		const VectorRegister4Float CenterX = VectorSetFloat1(Center.X);
+		const VectorRegister4Float CenterY = VectorSetFloat1(Center.Y);
+		const VectorRegister4Float CenterZ = VectorSetFloat1(Center.Z);
+		const VectorRegister4Float Range = VectorSetFloat1(RangeSqr);
+
+		int32 i = Begin;
+
+		for (; i + 4 <= End; i += 4)
+		{
+			const VectorRegister4Float DX = VectorSubtract(VectorLoad(X.GetData() + i), CenterX);
+			const VectorRegister4Float DY = VectorSubtract(VectorLoad(Y.GetData() + i), CenterY);
+			const VectorRegister4Float DZ = VectorSubtract(VectorLoad(Z.GetData() + i), CenterZ);
+
+			VectorRegister4Float DistSqr = VectorMultiply(DX, DX);
+			DistSqr = VectorMultiplyAdd(DY, DY, DistSqr);
+			DistSqr = VectorMultiplyAdd(DZ, DZ, DistSqr);
+
+			const VectorRegister4Float R = VectorLoad(Radius.GetData() + i);
+			const VectorRegister4Float Limit = VectorMultiplyAdd(R, R, Range);
+
+			uint32 Mask = static_cast<uint32>(VectorMaskBits(VectorCompareLE(DistSqr, Limit)));
+
+			if (LIKELY(Mask == 0)) continue;
+
+			alignas(16) float Dist[4];
+			VectorStoreAligned(DistSqr, Dist);
+
+			while (Mask)
+			{
+				const uint32 Lane = FMath::CountTrailingZeros(Mask);
+				Func(i + static_cast<int32>(Lane), Dist[Lane]);
+				Mask &= Mask - 1;
+			}
+		}
+
+		// 尾部不足4个的用标量处理
+		ForEachInRangeScalar(i, End, Center, RangeSqr, Func);
+	}
+};
+
+/**
+ * Per-query memo of the filter result for each archetype id stored in FAvoiding, direct mapped over a few slots.
+ * The result is evaluated on the fingerprint the id was registered with, so it does not depend on which subject came first.
+ * Traits can change after registration, so accepted subjects are confirmed with a live Matches; rejected ones never touch their chunk.
+ * Unregistered subjects, or a cache built without the grid's fingerprint table, fall back to Matches.
+ */
+struct FArchetypeMatchCache
+{
+	static constexpr int32 NumSlots = 16;
+
+	const TArray<FFingerprint>* Fingerprints = nullptr;
+	uint16 Ids[NumSlots];
+	bool Accepted[NumSlots];
+
+	FArchetypeMatchCache()
+	{
+		FMemory::Memset(Ids, 0xFF, sizeof(Ids));
+	}
+
+	explicit FArchetypeMatchCache(const TArray<FFingerprint>& InFingerprints)
+		: Fingerprints(&InFingerprints)
+	{
+		FMemory::Memset(Ids, 0xFF, sizeof(Ids));
+	}
+
+	FORCEINLINE bool Matches(const FSubjectHandle& Subject, const uint16 Archetype, const FFilter& Filter)
+	{
+		if (!Fingerprints || !Fingerprints->IsValidIndex(Archetype)) return Subject.Matches(Filter);
+
+		const int32 Slot = Archetype & (NumSlots - 1);
+
+		if (Ids[Slot] != Archetype)
+		{
+			Ids[Slot] = Archetype;
+			Accepted[Slot] = (*Fingerprints)[Archetype].Matches(Filter);
+		}
+
+		// 注册后Subject可能获得新特征（比如进入死亡状态），通过的再按实时指纹确认
+		return Accepted[Slot] && Subject.Matches(Filter);
+	}
+};
@@ -16,10 +16,12 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Misc/ScopeRWLock.h"
 #include "GameFramework/Actor.h"
 #include "MechanicalActorComponent.h"
 #include "Machine.h"
 #include "NeighborGridCell.h"
+#include "FixedKNearest.h"
 #include "Traits/Avoidance.h"
 #include "BattleFrameEnums.h"
 #include "BattleFrameStructs.h"
@@ -43,6 +45,25 @@ struct FCapsulePath
 	FCapsulePath(const FVector& InStart, const FVector& InEnd, float InRadius) : Start(InStart), End(InEnd), Radius(InRadius) {}
 };
 
+// 批量扇形检测中的一个查询，参数与 SectorTraceForSubjects 相同
+struct FSectorTraceQuery
+{
+	FVector Origin = FVector::ZeroVector;
+	float Radius = 0.f;
+	float Height = 0.f;
+	FVector Direction = FVector::ForwardVector;
+	float Angle = 360.f;
+	bool bCheckVisibility = false;
+	FVector CheckOrigin = FVector::ZeroVector;
+	float CheckRadius = 0.f;
+	ESortMode SortMode = ESortMode::NearToFar;
+	FVector SortOrigin = FVector::ZeroVector;
+	int32 KeepCount = 1;
+	FSubjectHandle IgnoreSubject;// 通常是发起检测的单位自身
+	FFilter Filter;
+	uint16 TeamMask = 0;// Filter 包含的队伍，开启 bTeamLayers 时只遍历这些层，0 表示全部
+};
+
 UCLASS(Category = "NeighborGrid")
 class BATTLEFRAME_API UNeighborGridComponent : public UMechanicalActorComponent
 {
@@ -56,6 +77,26 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
 	int32 MinBatchSizeAllowed = 100;
 
+	// 每帧Update后将格子内的Subjects按格子顺序打包为连续的SoA数组，Decouple与Trace在其上做距离筛选
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bUsePackedGrid = false;
+
+	// 无锁重建：原子计数直方图 + 并行前缀和 + 分散写入，Subjects直接写入打包数组而不再逐格加锁，用于与加锁路径做A/B对比
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bLockFreeUpdate = false;
+
+	// 打包模式下Decouple使用SIMD一次筛选4个邻居，关闭则使用标量循环
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bUseSimdFilter = true;
+
+	// 注册时按Fingerprint给Subject分配原型编号（每帧重新编号），检测与避障按(过滤条件, 原型)缓存注册时指纹的匹配结果，被拒绝的邻居不再访问各自的Chunk
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bCacheFilterMatches = true;
+
+	// 格子内的Subjects按FTeam0..9分层，过滤条件限定队伍的检测只遍历对应的层，不再对友军逐个做Matches；不支持无锁重建
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = Performance)
+	bool bTeamLayers = false;
+
 	int32 ThreadsCount = 1;
 	int32 BatchSize = 1;
 
@@ -76,6 +117,13 @@ public:
 	TArray<FNeighborGridCell> Cells;
 	FVector InvCellSizeCache = FVector(1 / 300.f, 1 / 300.f, 1 / 300.f);
 	TArray<TQueue<int32,EQueueMode::Mpsc>> OccupiedCellsQueues;
+	TArray<TArray<int32>> OccupiedCellsDrained;// SortCellsByTeam 从队列里取出的格子，下一帧由 ResetCells 清空
+	FNeighborGridPacked PackedGrid;
+	TArray<int32> PackedCellCursor;
+	TMap<FFingerprint, uint16> ArchetypeIds;
+	TArray<FFingerprint> ArchetypeFingerprints;// 按编号存放注册时的指纹，注册结束后只读
+	FRWLock ArchetypeLock;
+	uint32 ArchetypeEpoch = 0;
 
 	FFilter RegisterNeighborGrid_Trace_Filter;
 	FFilter RegisterNeighborGrid_SphereObstacle_Filter;
@@ -87,6 +135,15 @@ public:
 	FFilter SphereObstacleFilter;
 	FFilter BoxObstacleFilter;
 	FFilter DecoupleFilter;
+	FFilter TeamLayerFilters[FNeighborGridCell::NumTeamLayers];
+	FFilter AvoGroupLayerFilters[FNeighborGridCell::NumTeamLayers];
+	FFilter AvoidingFilter;
+
+	// Decouple中每个Agent可保留的最大邻居数量，超出的MaxNeighbors会被截断
+	static constexpr int32 MaxNeighborsCapacity = 32;
+
+	// ComputeNewVelocity中ORCA线缓冲的栈上容量，超出时才会退化为堆分配
+	static constexpr int32 MaxOrcaLinesInline = MaxNeighborsCapacity * 2;
 
 
 	//---------------------------------------------Init------------------------------------------------------------------
@@ -100,6 +157,9 @@ public:
 		Cells.Reset(); // Make sure there are no cells.
 		Cells.AddDefaulted(GridSize.X * GridSize.Y * GridSize.Z);
 		OccupiedCellsQueues.SetNum(MaxThreadsAllowed);
+		OccupiedCellsDrained.Reset();
+		OccupiedCellsDrained.SetNum(MaxThreadsAllowed);
+		PackedGrid.Empty();
 		InvCellSizeCache = FVector(1 / CellSize.X, 1 / CellSize.Y, 1 / CellSize.Z);
 	}
 
@@ -121,7 +181,8 @@ public:
 		const FSubjectArray& IgnoreSubjects,
 		const FFilter& Filter, 
 		bool& Hit, 
-		TArray<FTraceResult>& Results
+		TArray<FTraceResult>& Results,
+		const uint16 TeamMask = 0
 	) const;
 
 	void SphereSweepForSubjects
@@ -157,9 +218,37 @@ public:
 		const FSubjectArray& IgnoreSubjects,
 		const FFilter& Filter, 
 		bool& Hit, 
-		TArray<FTraceResult>& Results
+		TArray<FTraceResult>& Results,
+		const uint16 TeamMask = 0
 	) const;	
 
+	/* Nearest-first search in rings of cells around SortOrigin, keeping the KeepCount nearest hits in a bounded heap. Used by the traces for NearToFar with KeepCount up to MaxNeighborsCapacity. */
+	template<typename CellTestType, typename SubjectTestType>
+	void TraceNearestInRings
+	(
+		const int32 KeepCount,
+		const FIntVector& CagePosMin,
+		const FIntVector& CagePosMax,
+		const bool bCheckVisibility,
+		const FVector& CheckOrigin,
+		const float CheckRadius,
+		const FVector& SortOrigin,
+		const FSubjectArray& IgnoreSubjects,
+		const FFilter& Filter,
+		const uint16 TeamMask,
+		CellTestType&& CellTest,
+		SubjectTestType&& SubjectTest,
+		TArray<FTraceResult>& Results
+	) const;
+
+	/* Run many sector traces at once. Results of query i are OutResults[OutOffsets[i], OutOffsets[i + 1]). */
+	void SectorTraceForSubjectsBatch
+	(
+		TConstArrayView<FSectorTraceQuery> Queries,
+		TArray<FTraceResult>& OutResults,
+		TArray<int32>& OutOffsets
+	) const;
+
 	void SphereSweepForObstacle
 	(
 		const FVector& Start,
@@ -170,16 +259,36 @@ public:
 	) const;
 
 	void Update();
+	void ResetArchetypeIds();
+	uint16 GetArchetypeId(const FFingerprint& Fingerprint);
+	void TagTeamLayers();
+	void SortCellsByTeam();
+	void BuildPackedGrid();
+	void RebuildSubjectsLockFree();
 	void Decouple();
+
+	/* Collect the nearest subjects around one Decouple agent into the caller's bounded heap. Works entirely on the stack and the grid arrays. */
+	void CollectSubjectNeighbors
+	(
+		const FVector& SelfLocation,
+		const float SelfRadius,
+		const float NeighborDist,
+		const uint32 SelfHash,
+		const FFilter& SubjectFilter,
+		const uint16 IgnoreGroupMask,
+		const bool bPacked,
+		TFixedKNearest<MaxNeighborsCapacity>& SubjectNeighbors
+	) const;
+
 	void Evaluate();
 
 	void DefineFilters();
 
 	//---------------------------------------------RVO2------------------------------------------------------------------
 
-	void ComputeNewVelocity(FAvoidance& Avoidance, const TArray<FAvoiding>& SubjectNeighbors, const TArray<FAvoiding>& ObstacleNeighbors, float timeStep_);
+	void ComputeNewVelocity(FAvoidance& Avoidance, TArrayView<const FAvoiding> SubjectNeighbors, TArrayView<const FAvoiding> ObstacleNeighbors, float timeStep_);
 
-	FORCEINLINE bool LinearProgram1(const std::vector<RVO::Line>& lines, size_t lineNo, float radius, const RVO::Vector2& optVelocity, bool directionOpt, RVO::Vector2& result)
+	FORCEINLINE bool LinearProgram1(const RVO::Line* lines, size_t lineNo, float radius, const RVO::Vector2& optVelocity, bool directionOpt, RVO::Vector2& result)
 	{
 		//TRACE_CPUPROFILER_EVENT_SCOPE_STR("linearProgram1");
 		const float dotProduct = lines[lineNo].point * lines[lineNo].direction;
@@ -253,7 +362,7 @@ public:
 		return true;
 	}
 
-	FORCEINLINE size_t LinearProgram2(const std::vector<RVO::Line>& lines, float radius, const RVO::Vector2& optVelocity, bool directionOpt, RVO::Vector2& result)
+	FORCEINLINE size_t LinearProgram2(const RVO::Line* lines, size_t numLines, float radius, const RVO::Vector2& optVelocity, bool directionOpt, RVO::Vector2& result)
 	{
 		//TRACE_CPUPROFILER_EVENT_SCOPE_STR("linearProgram2");
 		if (directionOpt) {
@@ -272,7 +381,7 @@ public:
 			result = optVelocity;
 		}
 
-		for (size_t i = 0; i < lines.size(); ++i) {
+		for (size_t i = 0; i < numLines; ++i) {
 			if (det(lines[i].direction, lines[i].point - result) > 0.0f) {
 				/* Result does not satisfy constraint i. Compute new optimal result. */
 				const RVO::Vector2 tempResult = result;
@@ -284,18 +393,20 @@ public:
 			}
 		}
 
-		return lines.size();
+		return numLines;
 	}
 
-	FORCEINLINE void LinearProgram3(const std::vector<RVO::Line>& lines, size_t numObstLines, size_t beginLine, float radius, RVO::Vector2& result)
+	/* projLines is caller-supplied scratch space with room for numLines entries, so the solver never allocates. */
+	FORCEINLINE void LinearProgram3(const RVO::Line* lines, size_t numLines, size_t numObstLines, size_t beginLine, float radius, RVO::Line* projLines, RVO::Vector2& result)
 	{
 		//TRACE_CPUPROFILER_EVENT_SCOPE_STR("linearProgram3");
 		float distance = 0.0f;
 
-		for (size_t i = beginLine; i < lines.size(); ++i) {
+		for (size_t i = beginLine; i < numLines; ++i) {
 			if (det(lines[i].direction, lines[i].point - result) > distance) {
 				/* Result does not satisfy constraint of line i. */
-				std::vector<RVO::Line> projLines(lines.begin(), lines.begin() + static_cast<ptrdiff_t>(numObstLines));
+				FMemory::Memcpy(projLines, lines, numObstLines * sizeof(RVO::Line));
+				size_t numProjLines = numObstLines;
 
 				for (size_t j = numObstLines; j < i; ++j) {
 					RVO::Line line;
@@ -318,12 +429,12 @@ public:
 					}
 
 					line.direction = normalize(lines[j].direction - lines[i].direction);
-					projLines.push_back(line);
+					projLines[numProjLines++] = line;
 				}
 
 				const RVO::Vector2 tempResult = result;
 
-				if (LinearProgram2(projLines, radius, RVO::Vector2(-lines[i].direction.y(), lines[i].direction.x()), true, result) < projLines.size()) {
+				if (LinearProgram2(projLines, numProjLines, radius, RVO::Vector2(-lines[i].direction.y(), lines[i].direction.x()), true, result) < numProjLines) {
 					/* This should in principle not happen.  The result is by definition
 					 * already in the feasible region of this linear program. If it fails,
 					 * it is due to small floating point error, and the current result is
@@ -367,124 +478,142 @@ public:
 		return ValidCells;
 	}
 
-	FORCEINLINE TArray<FIntVector> SphereSweepForCells(const FVector& Start, const FVector& End, float Radius) const
+	/* Call Func(CellPoint) for every valid cell overlapping the box, without materializing the coordinates. */
+	template<typename FuncType>
+	FORCEINLINE void ForEachNeighborCell(const FVector& Center, const FVector& Range3D, FuncType&& Func) const
 	{
-		//TRACE_CPUPROFILER_EVENT_SCOPE_STR("SphereSweepForCells");
+		const FIntVector Min = WorldToCage(Center - Range3D);
+		const FIntVector Max = WorldToCage(Center + Range3D);
+
+		// 直接裁剪到网格范围内，省去逐格IsInside判断
+		const FIntVector ClampedMin(FMath::Max(Min.X, 0), FMath::Max(Min.Y, 0), FMath::Max(Min.Z, 0));
+		const FIntVector ClampedMax(FMath::Min(Max.X, GridSize.X - 1), FMath::Min(Max.Y, GridSize.Y - 1), FMath::Min(Max.Z, GridSize.Z - 1));
+
+		for (int32 z = ClampedMin.Z; z <= ClampedMax.Z; ++z)
+		{
+			for (int32 y = ClampedMin.Y; y <= ClampedMax.Y; ++y)
+			{
+				for (int32 x = ClampedMin.X; x <= ClampedMax.X; ++x)
+				{
+					Func(FIntVector(x, y, z));
+				}
+			}
+		}
+	}
+
+	/* Call Func(SlabMin, SlabMax) for every box of valid cells touched by a sphere swept from Start to End, in order along the sweep: the start section first, then one layer per step. Boxes never overlap. Return false from Func to stop early. */
+	template<typename FuncType>
+	FORCEINLINE void ForEachSweptSlab(const FVector& Start, const FVector& End, float Radius, FuncType&& Func) const
+	{
+		//TRACE_CPUPROFILER_EVENT_SCOPE_STR("ForEachSweptSlab");
+
+		// 在网格坐标中做 Amanatides-Woo DDA，扫掠球用每轴膨胀 RadiusInCells 个格子的走廊覆盖
+		const FVector P0 = (Start - Bounds.Min) * InvCellSizeCache;
+		const FVector P1 = (End - Bounds.Min) * InvCellSizeCache;
+		const FVector Dir = P1 - P0;
 
-		// 预计算关键参数 - 现在每个轴有自己的半径值
-		const FVector RadiusInCellsValue(Radius / CellSize.X, Radius / CellSize.Y, Radius / CellSize.Z);
 		const FIntVector RadiusInCells(
-			FMath::CeilToInt(RadiusInCellsValue.X),
-			FMath::CeilToInt(RadiusInCellsValue.Y),
-			FMath::CeilToInt(RadiusInCellsValue.Z));
-		const FVector RadiusSq(
-			FMath::Square(RadiusInCellsValue.X),
-			FMath::Square(RadiusInCellsValue.Y),
-			FMath::Square(RadiusInCellsValue.Z));
-
-		// 改用TArray+BitArray加速去重
-		TArray<FIntVector> GridCells;
-		TSet<FIntVector> GridCellsSet; // 保持TSet或根据性能测试调整
+			FMath::CeilToInt(FMath::Max(Radius, 0.f) * InvCellSizeCache.X),
+			FMath::CeilToInt(FMath::Max(Radius, 0.f) * InvCellSizeCache.Y),
+			FMath::CeilToInt(FMath::Max(Radius, 0.f) * InvCellSizeCache.Z));
 
-		FIntVector StartCell = WorldToCage(Start);
-		FIntVector EndCell = WorldToCage(End);
-		FIntVector Delta = EndCell - StartCell;
-		FIntVector AbsDelta(FMath::Abs(Delta.X), FMath::Abs(Delta.Y), FMath::Abs(Delta.Z));
+		FIntVector Cell = WorldToCage(Start);
+		const FIntVector EndCell = WorldToCage(End);
 
-		// Bresenham算法参数
-		FIntVector CurrentCell = StartCell;
-		const int32 XStep = Delta.X > 0 ? 1 : -1;
-		const int32 YStep = Delta.Y > 0 ? 1 : -1;
-		const int32 ZStep = Delta.Z > 0 ? 1 : -1;
+		// 裁剪到网格内，完全在网格外的层直接跳过
+		auto VisitBox = [&](const FIntVector& Min, const FIntVector& Max) -> bool
+		{
+			const FIntVector ClampedMin(FMath::Max(Min.X, 0), FMath::Max(Min.Y, 0), FMath::Max(Min.Z, 0));
+			const FIntVector ClampedMax(FMath::Min(Max.X, GridSize.X - 1), FMath::Min(Max.Y, GridSize.Y - 1), FMath::Min(Max.Z, GridSize.Z - 1));
 
-		// 主循环
-		if (AbsDelta.X >= AbsDelta.Y && AbsDelta.X >= AbsDelta.Z)
+			if (ClampedMin.X > ClampedMax.X || ClampedMin.Y > ClampedMax.Y || ClampedMin.Z > ClampedMax.Z) return true;
+
+			return Func(ClampedMin, ClampedMax);
+		};
+
+		// 起点格子的整个走廊截面
+		if (!VisitBox(Cell - RadiusInCells, Cell + RadiusInCells)) return;
+
+		FIntVector Step, Remaining;
+		FVector TMax, TDelta;
+
+		for (int32 Axis = 0; Axis < 3; ++Axis)
 		{
-			// X为主轴
-			int32 P1 = 2 * AbsDelta.Y - AbsDelta.X;
-			int32 P2 = 2 * AbsDelta.Z - AbsDelta.X;
+			Step[Axis] = EndCell[Axis] > Cell[Axis] ? 1 : (EndCell[Axis] < Cell[Axis] ? -1 : 0);
+			Remaining[Axis] = FMath::Abs(EndCell[Axis] - Cell[Axis]);
 
-			for (int32 i = 0; i < AbsDelta.X; ++i)
+			if (Step[Axis] == 0 || FMath::IsNearlyZero(Dir[Axis]))
 			{
-				AddSphereCells(CurrentCell, RadiusInCells, RadiusSq, GridCellsSet);
-				if (P1 >= 0) { CurrentCell.Y += YStep; P1 -= 2 * AbsDelta.X; }
-				if (P2 >= 0) { CurrentCell.Z += ZStep; P2 -= 2 * AbsDelta.X; }
-				P1 += 2 * AbsDelta.Y;
-				P2 += 2 * AbsDelta.Z;
-				CurrentCell.X += XStep;
+				TMax[Axis] = TDelta[Axis] = UE_BIG_NUMBER;
 			}
-		}
-		else if (AbsDelta.Y >= AbsDelta.Z)
-		{
-			// Y为主轴
-			int32 P1 = 2 * AbsDelta.X - AbsDelta.Y;
-			int32 P2 = 2 * AbsDelta.Z - AbsDelta.Y;
-			for (int32 i = 0; i < AbsDelta.Y; ++i)
+			else
 			{
-				AddSphereCells(CurrentCell, RadiusInCells, RadiusSq, GridCellsSet);
-				if (P1 >= 0) { CurrentCell.X += XStep; P1 -= 2 * AbsDelta.Y; }
-				if (P2 >= 0) { CurrentCell.Z += ZStep; P2 -= 2 * AbsDelta.Y; }
-				P1 += 2 * AbsDelta.X;
-				P2 += 2 * AbsDelta.Z;
-				CurrentCell.Y += YStep;
+				const float Boundary = Step[Axis] > 0 ? Cell[Axis] + 1 : Cell[Axis];
+				TMax[Axis] = (Boundary - P0[Axis]) / Dir[Axis];
+				TDelta[Axis] = FMath::Abs(1.f / Dir[Axis]);
 			}
 		}
-		else
+
+		// 每前进一格，坐标沿各轴单调变化，新格子的走廊只比上一格多出前进方向上的一层，与之前访问过的格子不重叠，无需去重
+		while (Remaining.X + Remaining.Y + Remaining.Z > 0)
 		{
-			// Z为主轴
-			int32 P1 = 2 * AbsDelta.X - AbsDelta.Z;
-			int32 P2 = 2 * AbsDelta.Y - AbsDelta.Z;
-			for (int32 i = 0; i < AbsDelta.Z; ++i)
+			int32 Axis = -1;
+
+			for (int32 i = 0; i < 3; ++i)
 			{
-				AddSphereCells(CurrentCell, RadiusInCells, RadiusSq, GridCellsSet);
-				if (P1 >= 0) { CurrentCell.X += XStep; P1 -= 2 * AbsDelta.Z; }
-				if (P2 >= 0) { CurrentCell.Y += YStep; P2 -= 2 * AbsDelta.Z; }
-				P1 += 2 * AbsDelta.X;
-				P2 += 2 * AbsDelta.Y;
-				CurrentCell.Z += ZStep;
+				if (Remaining[i] > 0 && (Axis < 0 || TMax[i] < TMax[Axis]))
+				{
+					Axis = i;
+				}
 			}
-		}
-
-		AddSphereCells(EndCell, RadiusInCells, RadiusSq, GridCellsSet);
 
-		// 转换为数组并排序
-		TArray<FIntVector> ResultArray = GridCellsSet.Array();
+			Cell[Axis] += Step[Axis];
+			TMax[Axis] += TDelta[Axis];
+			--Remaining[Axis];
 
-		// 按距离Start点的平方距离排序（避免开根号）
-		Algo::Sort(ResultArray, [this, Start](const FIntVector& A, const FIntVector& B)
-			{
-				const FVector WorldA = CageToWorld(A);
-				const FVector WorldB = CageToWorld(B);
-				return (WorldA - Start).SizeSquared() < (WorldB - Start).SizeSquared();
-			});
+			FIntVector SlabMin = Cell - RadiusInCells;
+			FIntVector SlabMax = Cell + RadiusInCells;
+			SlabMin[Axis] = SlabMax[Axis] = Cell[Axis] + Step[Axis] * RadiusInCells[Axis];
 
-		return ResultArray;
+			if (!VisitBox(SlabMin, SlabMax)) return;
+		}
 	}
 
-	FORCEINLINE void AddSphereCells(const FIntVector& CenterCell, const FIntVector& RadiusInCells, const FVector& RadiusSq, TSet<FIntVector>& GridCells) const
+	/* Call Func(CellPoint) for every valid cell touched by a sphere swept from Start to End, in order along the sweep. Return false from Func to stop early. */
+	template<typename FuncType>
+	FORCEINLINE void ForEachSweptCell(const FVector& Start, const FVector& End, float Radius, FuncType&& Func) const
 	{
-		//TRACE_CPUPROFILER_EVENT_SCOPE_STR("AddSphereCells");
-
-		// 分层遍历优化：减少无效循环
-		for (int32 x = -RadiusInCells.X; x <= RadiusInCells.X; ++x)
+		ForEachSweptSlab(Start, End, Radius, [&](const FIntVector& SlabMin, const FIntVector& SlabMax)
 		{
-			const float XNormSq = FMath::Square(static_cast<float>(x) / RadiusInCells.X);
-			if (XNormSq > 1.0f) continue;
-
-			for (int32 y = -RadiusInCells.Y; y <= RadiusInCells.Y; ++y)
+			for (int32 z = SlabMin.Z; z <= SlabMax.Z; ++z)
 			{
-				const float YNormSq = FMath::Square(static_cast<float>(y) / RadiusInCells.Y);
-				if (XNormSq + YNormSq > 1.0f) continue;
-
-				// 直接计算z范围，减少循环次数
-				const float RemainingNormSq = 1.0f - (XNormSq + YNormSq);
-				const int32 MaxZ = FMath::FloorToInt(RadiusInCells.Z * FMath::Sqrt(RemainingNormSq));
-				for (int32 z = -MaxZ; z <= MaxZ; ++z)
+				for (int32 y = SlabMin.Y; y <= SlabMax.Y; ++y)
 				{
-					GridCells.Add(CenterCell + FIntVector(x, y, z));
+					for (int32 x = SlabMin.X; x <= SlabMax.X; ++x)
+					{
+						if (!Func(FIntVector(x, y, z))) return false;
+					}
 				}
 			}
-		}
+
+			return true;
+		});
+	}
+
+	/* Cells touched by a sphere swept from Start to End, ordered along the sweep. */
+	FORCEINLINE TArray<FIntVector> SphereSweepForCells(const FVector& Start, const FVector& End, float Radius) const
+	{
+		//TRACE_CPUPROFILER_EVENT_SCOPE_STR("SphereSweepForCells");
+
+		TArray<FIntVector> GridCells;
+
+		ForEachSweptCell(Start, End, Radius, [&](const FIntVector& CellPos)
+		{
+			GridCells.Add(CellPos);
+			return true;
+		});
+
+		return GridCells;
 	}
 
 	/* Get the size of a single cell in global units.*/
@@ -620,6 +749,68 @@ public:
 		return At(WorldToCage(Point));
 	}
 
+	/* Check if the packed subject arrays are built and match the current cells. */
+	FORCEINLINE bool HasPackedGrid() const
+	{
+		return (bUsePackedGrid || bLockFreeUpdate) && PackedGrid.NumCells() == Cells.Num();
+	}
+
+	/* Get the range of a cell's subjects within the packed arrays. */
+	FORCEINLINE void GetPackedRange(const FIntVector& CellPoint, int32& Begin, int32& End) const
+	{
+		const int32 Index = GetIndexAt(CellPoint);
+		Begin = PackedGrid.CellStart[Index];
+		End = PackedGrid.CellStart[Index + 1];
+	}
+
+	/* Call Func(Handle, Location, Radius, Hash, Archetype) for the subjects of a cell. When the cell is split into team layers and TeamMask is set, only those layers are visited. */
+	template<typename FuncType>
+	FORCEINLINE void ForEachSubjectInCell(const FIntVector& CellPoint, const uint16 TeamMask, FuncType&& Func) const
+	{
+		const FNeighborGridCell& Cell = At(CellPoint);
+		const bool bPacked = HasPackedGrid();
+
+		int32 PackedBegin = 0, PackedEnd = 0;
+
+		if (bPacked)
+		{
+			GetPackedRange(CellPoint, PackedBegin, PackedEnd);
+		}
+
+		auto VisitRange = [&](const int32 Begin, const int32 End)
+		{
+			for (int32 i = Begin; i < End; ++i)
+			{
+				if (bPacked)
+				{
+					const int32 Index = PackedBegin + i;
+					Func(PackedGrid.Handles[Index], PackedGrid.GetLocation(Index), PackedGrid.Radius[Index], PackedGrid.Hash[Index], PackedGrid.Archetype[Index]);
+				}
+				else
+				{
+					const FAvoiding& Avoiding = Cell.Subjects[i];
+					Func(Avoiding.SubjectHandle, Avoiding.Location, Avoiding.Radius, Avoiding.SubjectHash, Avoiding.Archetype);
+				}
+			}
+		};
+
+		// 打包数组由分层后的格子按顺序复制而来，层的偏移同样适用
+		if (TeamMask != 0 && Cell.bTeamSorted && (!bPacked || PackedEnd - PackedBegin == Cell.Subjects.Num()))
+		{
+			for (int32 Layer = 0; Layer < FNeighborGridCell::NumTeamLayers; ++Layer)
+			{
+				if (TeamMask & (1 << Layer))
+				{
+					VisitRange(Cell.TeamStart[Layer], Cell.TeamStart[Layer + 1]);
+				}
+			}
+
+			return;
+		}
+
+		VisitRange(0, bPacked ? PackedEnd - PackedBegin : Cell.Subjects.Num());
+	}
+
 	/* Get a box shape representing a cell by position in the cage. */
 	FORCEINLINE FBox BoxAt(const FIntVector& CellPoint)
 	{
@@ -33,7 +33,7 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ToolTip = "视野距离", ClampMin = "0"))
     float NeighborDist = 150.0f;
 
-    UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ToolTip = "最大邻居数量", ClampMin = "1"))
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ToolTip = "最大邻居数量", ClampMin = "1", ClampMax = "32"))
     int32 MaxNeighbors = 8;
 
     UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ToolTip = "保底解耦速度", ClampMin = "0"))
@@ -50,7 +50,6 @@ public:
     float Radius = 100.0f;
     float MaxSpeed = 0.f;
     
-    std::vector<RVO::Line> OrcaLines;
     RVO::Vector2 Position = RVO::Vector2(0.0f, 0.0f);
     RVO::Vector2 CurrentVelocity = RVO::Vector2(0.0f, 0.0f);
     RVO::Vector2 DesiredVelocity = RVO::Vector2(0.0f, 0.0f);
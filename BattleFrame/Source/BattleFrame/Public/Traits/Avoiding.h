@@ -16,6 +16,13 @@ public:
     FSubjectHandle SubjectHandle = FSubjectHandle();
     uint32 SubjectHash = 0;
 
+    // 队伍和碰撞组下标，开启 bTeamLayers 时由 NeighborGrid 每帧写入，0xFF 表示未知
+    uint8 Team = 0xFF;
+    uint8 AvoGroup = 0xFF;
+
+    // 注册时由 NeighborGrid 按Fingerprint分配的原型编号，只代表注册时的指纹；之后特征可能变化，只用作Matches的预筛选
+    uint16 Archetype = MAX_uint16;
+
     // 匹配Handle
     bool operator==(const FAvoiding& Other) const
     {
@@ -20,7 +20,9 @@ public class BattleFrameEditor : ModuleRules
             "Engine",
             "UnrealEd",
             "AssetTools",
-            "BlueprintGraph" 
+            "BlueprintGraph",
+            "ApparatusRuntime",
+            "FlowFieldCanvas"
         });
     }
 }
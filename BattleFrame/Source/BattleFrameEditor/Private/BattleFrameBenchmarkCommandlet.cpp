@@ -0,0 +1,313 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#include "BattleFrameBenchmarkCommandlet.h"
+
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "Misc/App.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Components/BoxComponent.h"
+#include "Components/SphereComponent.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "UObject/UObjectGlobals.h"
+
+#include "AgentConfigDataAsset.h"
+#include "AgentSpawner.h"
+#include "BattleFrameBattleControl.h"
+#include "BattleFrameProfiler.h"
+#include "BattleFrameRandom.h"
+#include "NeighborGridActor.h"
+#include "NeighborGridComponent.h"
+#include "RVOSquareObstacle.h"
+#include "RVOSphereObstacle.h"
+#include "FlowField.h"
+
+namespace
+{
+	// 场地按人数缩放：每个Agent约占 AgentSpacing x AgentSpacing 的面积
+	constexpr float AgentSpacing = 120.f;
+	constexpr float GridCellSize = 300.f;
+	constexpr float FlowFieldCellSize = 200.f;
+	constexpr int32 MaxFlowFieldCellsPerSide = 256;
+
+	template<typename ActorType>
+	ActorType* BeginSpawn(UWorld* World, const FVector& Location)
+	{
+		return World->SpawnActorDeferred<ActorType>(ActorType::StaticClass(), FTransform(Location), nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+	}
+}
+
+UBattleFrameBenchmarkCommandlet::UBattleFrameBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UBattleFrameBenchmarkCommandlet::Main(const FString& Params)
+{
+	FString ConfigPath;
+	if (!FParse::Value(*Params, TEXT("Config="), ConfigPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("BattleFrameBenchmark: missing -Config=<AgentConfigDataAsset path>"));
+		return 1;
+	}
+
+	UAgentConfigDataAsset* SourceConfig = LoadObject<UAgentConfigDataAsset>(nullptr, *ConfigPath);
+	if (!IsValid(SourceConfig))
+	{
+		UE_LOG(LogTemp, Error, TEXT("BattleFrameBenchmark: failed to load %s"), *ConfigPath);
+		return 1;
+	}
+
+	TArray<int32> AgentCounts;
+	FString AgentsParam;
+	if (FParse::Value(*Params, TEXT("Agents="), AgentsParam, false))
+	{
+		TArray<FString> Tokens;
+		AgentsParam.ParseIntoArray(Tokens, TEXT(","));
+
+		for (const FString& Token : Tokens)
+		{
+			AgentCounts.Add(FMath::Max(FCString::Atoi(*Token), 1));
+		}
+	}
+
+	if (AgentCounts.IsEmpty())
+	{
+		AgentCounts = { 1000, 10000, 50000, 100000 };
+	}
+
+	FParse::Value(*Params, TEXT("Frames="), Frames);
+	FParse::Value(*Params, TEXT("Warmup="), WarmupFrames);
+	FParse::Value(*Params, TEXT("Seed="), Seed);
+	FParse::Value(*Params, TEXT("DeltaTime="), DeltaTime);
+	FParse::Value(*Params, TEXT("Obstacles="), NumObstacles);
+
+	Frames = FMath::Max(Frames, 1);
+	WarmupFrames = FMath::Max(WarmupFrames, 0);
+	DeltaTime = FMath::Max(DeltaTime, KINDA_SMALL_NUMBER);
+	NumObstacles = FMath::Max(NumObstacles, 0);
+
+	if (Frames > FBattleFrameProfiler::HistoryFrames)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("BattleFrameBenchmark: per-system stats only cover the last %d of %d frames"), FBattleFrameProfiler::HistoryFrames, Frames);
+	}
+
+	FString OutputPath;
+	if (!FParse::Value(*Params, TEXT("Output="), OutputPath))
+	{
+		OutputPath = FPaths::ProjectSavedDir() / TEXT("BattleFrame") / FString::Printf(TEXT("Benchmark_%s.json"), *FDateTime::Now().ToString());
+	}
+
+	TArray<FBenchmarkRun> Runs;
+	int32 Result = 0;
+
+	for (const int32 AgentCount : AgentCounts)
+	{
+		FBenchmarkRun& Run = Runs.AddDefaulted_GetRef();
+
+		if (!RunOnce(SourceConfig, AgentCount, Run))
+		{
+			Result = 2;
+		}
+
+		UE_LOG(LogTemp, Display, TEXT("BattleFrameBenchmark: %7d agents | avg %8.3f ms | p99 %8.3f ms | max %8.3f ms | %12.0f agents/s"),
+			Run.Agents, Run.AvgFrameMs, Run.P99FrameMs, Run.MaxFrameMs, Run.AgentsPerSecond);
+	}
+
+	if (FFileHelper::SaveStringToFile(ToJson(ConfigPath, Runs), *OutputPath))
+	{
+		UE_LOG(LogTemp, Display, TEXT("BattleFrameBenchmark: wrote %s"), *OutputPath);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Error, TEXT("BattleFrameBenchmark: failed to write %s"), *OutputPath);
+		Result = 1;
+	}
+
+	return Result;
+}
+
+bool UBattleFrameBenchmarkCommandlet::RunOnce(UAgentConfigDataAsset* SourceConfig, const int32 AgentCount, FBenchmarkRun& OutRun)
+{
+	OutRun.Agents = AgentCount;
+
+	// 每个规模都从同一个种子开始，单独复现任意一档
+	FBattleFrameRandom::SetSeed(Seed);
+	FRandomStream LayoutStream(Seed);
+
+	UWorld* World = UWorld::CreateWorld(EWorldType::Game, false, TEXT("BattleFrameBenchmark"));
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+
+	World->InitializeActorsForPlay(FURL());
+	World->BeginPlay();
+
+	//-------------------------------场地 | Arena-------------------------------
+
+	const float ArenaSize = FMath::Max(FMath::Sqrt(static_cast<float>(AgentCount)) * AgentSpacing * 2.f, 4000.f);
+	const float HalfArena = ArenaSize / 2.f;
+
+	ANeighborGridActor* GridActor = BeginSpawn<ANeighborGridActor>(World, FVector::ZeroVector);
+	const int32 GridCells = FMath::CeilToInt(ArenaSize * 1.2f / GridCellSize);
+	GridActor->GetComponent()->CellSize = FVector(GridCellSize);
+	GridActor->GetComponent()->GridSize = FIntVector(GridCells, GridCells, 1);
+	GridActor->FinishSpawning(FTransform::Identity);
+
+	AFlowField* FlowField = BeginSpawn<AFlowField>(World, FVector::ZeroVector);
+	FlowField->bEditorLiveUpdate = false;
+	FlowField->drawCellsInGame = false;
+	FlowField->drawArrowsInGame = false;
+	FlowField->cellSize = FMath::Max(FlowFieldCellSize, ArenaSize / MaxFlowFieldCellsPerSide);
+	FlowField->flowFieldSize = FVector(ArenaSize, ArenaSize, 300.f);
+	FlowField->goalLocation = FVector::ZeroVector;
+	FlowField->FinishSpawning(FTransform::Identity);
+	FlowField->UpdateFlowField();
+
+	// 障碍物散布在两军之间，方块与球体交替
+	for (int32 i = 0; i < NumObstacles; ++i)
+	{
+		const FVector Location(LayoutStream.FRandRange(-HalfArena, HalfArena) * 0.3f, LayoutStream.FRandRange(-HalfArena, HalfArena) * 0.8f, 0.f);
+
+		if (i % 2 == 0)
+		{
+			ARVOSquareObstacle* Box = BeginSpawn<ARVOSquareObstacle>(World, Location);
+			Box->bIsDynamicObstacle = false;
+			Box->BoxComponent->SetBoxExtent(FVector(LayoutStream.FRandRange(150.f, 600.f), LayoutStream.FRandRange(150.f, 600.f), 200.f));
+			Box->FinishSpawning(FTransform(Location));
+		}
+		else
+		{
+			ARVOSphereObstacle* Sphere = BeginSpawn<ARVOSphereObstacle>(World, Location);
+			Sphere->bIsDynamicObstacle = false;
+			Sphere->SphereComponent->SetSphereRadius(LayoutStream.FRandRange(100.f, 400.f));
+			Sphere->FinishSpawning(FTransform(Location));
+		}
+	}
+
+	World->SpawnActor<ABattleFrameBattleControl>();
+
+	//-------------------------------出兵 | Spawn-------------------------------
+
+	// 配置的副本指向本场地的流场，不改动原资产
+	UAgentConfigDataAsset* Config = DuplicateObject<UAgentConfigDataAsset>(SourceConfig, GetTransientPackage());
+	Config->Navigation.FlowFieldToUse = FlowField;
+
+	AAgentSpawner* Spawner = World->SpawnActor<AAgentSpawner>();
+	Spawner->AgentConfigAssets.Add(Config);
+
+	const int32 TeamSize[2] = { AgentCount / 2, AgentCount - AgentCount / 2 };
+	const FVector2D Region(HalfArena * 0.6f, ArenaSize * 0.8f);
+
+	const uint64 SpawnStart = FPlatformTime::Cycles64();
+
+	for (int32 Team = 0; Team < 2; ++Team)
+	{
+		const float Side = Team == 0 ? -1.f : 1.f;
+
+		OutRun.Spawned += Spawner->SpawnAgentsRectangular(true, 0, TeamSize[Team], Team, FVector(Side * HalfArena * 0.6f, 0.f, 0.f), Region,
+			FVector2D::ZeroVector, EInitialDirection::CustomDirection, FVector2D(-Side, 0.f), FSpawnerMult()).Num();
+	}
+
+	OutRun.SpawnMs = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - SpawnStart);
+
+	//-------------------------------运行 | Tick-------------------------------
+
+	TArray<double> FrameMs;
+	FrameMs.Reserve(Frames);
+
+	for (int32 Frame = 0; Frame < WarmupFrames + Frames; ++Frame)
+	{
+		if (Frame == WarmupFrames)
+		{
+			FBattleFrameProfiler::Reset();
+		}
+
+		FApp::SetDeltaTime(DeltaTime);
+		FApp::SetCurrentTime(FApp::GetCurrentTime() + DeltaTime);
+
+		const uint64 FrameStart = FPlatformTime::Cycles64();
+
+		World->Tick(LEVELTICK_All, DeltaTime);
+		FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+
+		const double Ms = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - FrameStart);
+		++GFrameCounter;
+
+		if (Frame >= WarmupFrames)
+		{
+			FrameMs.Add(Ms);
+		}
+	}
+
+	double TotalMs = 0;
+	for (const double Ms : FrameMs)
+	{
+		TotalMs += Ms;
+	}
+
+	FrameMs.Sort();
+
+	OutRun.AvgFrameMs = TotalMs / FrameMs.Num();
+	OutRun.P99FrameMs = FrameMs[FMath::Clamp(FMath::CeilToInt(FrameMs.Num() * 0.99f) - 1, 0, FrameMs.Num() - 1)];
+	OutRun.MaxFrameMs = FrameMs.Last();
+	OutRun.AgentsPerSecond = TotalMs > 0 ? OutRun.Spawned * static_cast<double>(FrameMs.Num()) / (TotalMs / 1000.0) : 0;
+
+	FBattleFrameProfiler::GetSummaries(OutRun.Systems);
+
+	//-------------------------------清理 | Teardown-------------------------------
+
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+	CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+	FBattleFrameProfiler::Reset();
+
+	if (OutRun.Spawned < AgentCount)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("BattleFrameBenchmark: spawned %d of %d agents"), OutRun.Spawned, AgentCount);
+		return false;
+	}
+
+	return true;
+}
+
+FString UBattleFrameBenchmarkCommandlet::ToJson(const FString& ConfigPath, const TArray<FBenchmarkRun>& Runs) const
+{
+	FString Out = TEXT("{\n");
+
+	Out += FString::Printf(TEXT("\t\"config\": \"%s\",\n\t\"seed\": %d,\n\t\"frames\": %d,\n\t\"warmup\": %d,\n\t\"deltaTime\": %.6f,\n\t\"obstacles\": %d,\n\t\"workerThreads\": %d,\n"),
+		*ConfigPath.ReplaceCharWithEscapedChar(), Seed, Frames, WarmupFrames, DeltaTime, NumObstacles, FTaskGraphInterface::Get().GetNumWorkerThreads());
+
+	Out += TEXT("\t\"runs\": [");
+
+	for (int32 i = 0; i < Runs.Num(); ++i)
+	{
+		const FBenchmarkRun& Run = Runs[i];
+
+		Out += FString::Printf(TEXT("%s\n\t\t{\n\t\t\t\"agents\": %d,\n\t\t\t\"spawned\": %d,\n\t\t\t\"spawnMs\": %.4f,\n\t\t\t\"avgFrameMs\": %.4f,\n\t\t\t\"p99FrameMs\": %.4f,\n\t\t\t\"maxFrameMs\": %.4f,\n\t\t\t\"agentsPerSecond\": %.1f,\n\t\t\t\"systems\": ["),
+			i == 0 ? TEXT("") : TEXT(","), Run.Agents, Run.Spawned, Run.SpawnMs, Run.AvgFrameMs, Run.P99FrameMs, Run.MaxFrameMs, Run.AgentsPerSecond);
+
+		for (int32 j = 0; j < Run.Systems.Num(); ++j)
+		{
+			const FSystemProfileSummary& Summary = Run.Systems[j];
+
+			Out += FString::Printf(TEXT("%s\n\t\t\t\t{ \"system\": \"%s\", \"samples\": %d, \"minMs\": %.4f, \"avgMs\": %.4f, \"p99Ms\": %.4f, \"maxMs\": %.4f, \"avgEntities\": %.1f, \"maxThreads\": %d }"),
+				j == 0 ? TEXT("") : TEXT(","), *Summary.System.ToString(), Summary.Samples, Summary.MinMs, Summary.AvgMs, Summary.P99Ms, Summary.MaxMs, Summary.AvgEntities, Summary.MaxThreads);
+		}
+
+		Out += TEXT("\n\t\t\t]\n\t\t}");
+	}
+
+	Out += TEXT("\n\t]\n}\n");
+	return Out;
+}
@@ -0,0 +1,58 @@
+/*
+* BattleFrame
+* Created: 2025
+* Author: Leroy Works, All Rights Reserved.
+*/
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "BattleFrameStructs.h"
+#include "BattleFrameBenchmarkCommandlet.generated.h"
+
+class UAgentConfigDataAsset;
+
+/**
+ * Headless crowd benchmark.
+ * Builds a scripted arena (neighbor grid, flow field, box and sphere obstacles), spawns two armies through AAgentSpawner,
+ * ticks the world for a fixed number of frames and writes per-system times and agents/second as JSON.
+ *
+ * UnrealEditor-Cmd.exe <Project> -run=BattleFrameBenchmark -nullrhi -Config=/Game/Path/DA_Agent.DA_Agent
+ *     [-Agents=1000,10000,50000,100000] [-Frames=300] [-Warmup=30] [-Seed=1337] [-DeltaTime=0.0166667] [-Obstacles=8] [-Output=Path.json]
+ */
+UCLASS()
+class BATTLEFRAMEEDITOR_API UBattleFrameBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+
+	UBattleFrameBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+
+	struct FBenchmarkRun
+	{
+		int32 Agents = 0;
+		int32 Spawned = 0;
+		double SpawnMs = 0;
+		double AvgFrameMs = 0;
+		double P99FrameMs = 0;
+		double MaxFrameMs = 0;
+		double AgentsPerSecond = 0;
+		TArray<FSystemProfileSummary> Systems;
+	};
+
+	bool RunOnce(UAgentConfigDataAsset* Config, int32 AgentCount, FBenchmarkRun& OutRun);
+
+	FString ToJson(const FString& ConfigPath, const TArray<FBenchmarkRun>& Runs) const;
+
+	int32 Frames = 300;
+	int32 WarmupFrames = 30;
+	int32 Seed = 1337;
+	float DeltaTime = 1.f / 60.f;
+	int32 NumObstacles = 8;
+};
@@ -41,6 +41,11 @@ public class FlowFieldCanvas : ModuleRules
 				// ... add private dependencies that you statically link with here ...	
 			}
 			);
+
+		if (Target.bBuildEditor)
+		{
+			PrivateDependencyModuleNames.Add("AssetRegistry");
+		}
 		
 		
 		DynamicallyLoadedModuleNames.AddRange(
@@ -1,10 +1,24 @@
 // LeroyWorks 2024 All Rights Reserved.
 
 #include "FlowField.h"
+#include "FlowFieldBakedGrid.h"
 #include <queue>
 #include <vector>
 #include "Async/Async.h"
 #include "Kismet/KismetSystemLibrary.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/UObjectIterator.h"
+
+#if WITH_EDITOR
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "Misc/PackageName.h"
+#include "UObject/Package.h"
+#endif
 
 AFlowField::AFlowField()
 {
@@ -59,7 +73,11 @@ void AFlowField::DrawDebug()
 
 		CurrentCellsArray = InitialCellsArray;
 
-		CalculateFlowField(CurrentCellsArray);
+		CalculateFlowField(CurrentCellsArray, Solve);
+
+		PackCells(CurrentCellsArray, Packed);
+
+		ActiveSectorSize = 0;
 
 		DrawCells(EInitMode::Construction);
 
@@ -69,21 +87,92 @@ void AFlowField::DrawDebug()
 	}
 }
 
+void AFlowField::BakeGrid()
+{
+#if WITH_EDITOR
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("BakeGrid");
+
+	InitFlowField(EInitMode::Construction);
+
+	// 忽略现有烘焙数据，重新追踪
+	UFlowFieldBakedGrid* PreviousBake = BakedGrid;
+	BakedGrid = nullptr;
+	bIsGridDirty = true;
+	CreateGrid();
+	BakedGrid = PreviousBake;
+
+	if (!IsValid(BakedGrid))
+	{
+		const FString LevelName = FPackageName::GetShortName(GetWorld()->GetOutermost()->GetName());
+		const FString PackageName = FString::Printf(TEXT("/Game/FlowFieldBakes/%s_%s"), *LevelName, *GetName());
+
+		UPackage* Package = CreatePackage(*PackageName);
+		BakedGrid = NewObject<UFlowFieldBakedGrid>(Package, *FPackageName::GetShortName(PackageName), RF_Public | RF_Standalone);
+		FAssetRegistryModule::AssetCreated(BakedGrid);
+	}
+
+	BakedGrid->Modify();
+	BakedGrid->Store(*this, InitialCellsArray);
+	BakedGrid->MarkPackageDirty();
+
+	Modify();
+
+	UE_LOG(LogTemp, Log, TEXT("FFCanvas: baked %dx%d grid of %s into %s (%lld bytes), save the asset to keep it"),
+		xNum, yNum, *GetName(), *BakedGrid->GetPathName(), BakedGrid->GetBakedBytes());
+#endif
+}
+
 void AFlowField::UpdateFlowField()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_STR("UpdateFlowField");
 
+	// 上一次后台求解还没发布，等它完成后再发起新的
+	if (bIsUpdatePending) return;
+
 	EInitMode InitMode = bIsBeginPlay ? EInitMode::BeginPlay : EInitMode::Runtime;
 
 	InitFlowField(InitMode);
 
 	GetGoalLocation();
 
+	const bool bGridRebuilt = bIsGridDirty;
+
 	CreateGrid();
 
+	// 分区模式在游戏线程上只计算被占用的分区
+	if (bHierarchical)
+	{
+		UpdateSectors(InitMode, bGridRebuilt);
+		bIsBeginPlay = false;
+		return;
+	}
+
+	// 网格、目标格和求解设置都没变时流场仍然有效，代价变化已由 SetCellCosts 局部修复
+	if (bIncrementalUpdate && !bIsBeginPlay && !bGridRebuilt
+		&& CurrentCellsArray.Num() == InitialCellsArray.Num()
+		&& Solve.SolvedGoalIndex == CoordToIndex(goalGridCoord)
+		&& Solve.SolvedStyle == Style
+		&& Solve.bSolvedEikonal == bEikonalSolver
+		&& Solve.bSolvedIgnoreInternalObstacleCells == bIgnoreInternalObstacleCells
+		&& Solve.SlopeMaskAngle == maxWalkableAngle)
+	{
+		return;
+	}
+
+	// 第一次同步求解，保证开局就有流场可用
+	if (bAsyncUpdate && !bIsBeginPlay)
+	{
+		LaunchAsyncSolve();
+		return;
+	}
+
 	CurrentCellsArray = InitialCellsArray;
 
-	CalculateFlowField(CurrentCellsArray);
+	CalculateFlowField(CurrentCellsArray, Solve);
+
+	PackCells(CurrentCellsArray, Packed);
+
+	ActiveSectorSize = 0;
 
 	DrawCells(InitMode);
 
@@ -94,10 +183,151 @@ void AFlowField::UpdateFlowField()
 	bIsBeginPlay = false;
 }
 
+void AFlowField::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	PublishPendingUpdate();
+}
+
+void AFlowField::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	// 后台任务引用了本对象，销毁前等它结束
+	if (PendingSolve.IsValid())
+	{
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(PendingSolve);
+		PendingSolve = nullptr;
+	}
+
+	bIsUpdatePending = false;
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AFlowField::LaunchAsyncSolve()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("LaunchAsyncSolve");
+
+	// 在游戏线程拍下快照，后台只写后台缓冲（格子、坡度掩码、分桶队列、求解条件），读者始终看到完整的前台数据
+	BackCellsArray = InitialCellsArray;
+	bIsUpdatePending = true;
+
+	PendingSolve = FFunctionGraphTask::CreateAndDispatchWhenReady([this]()
+		{
+			CalculateFlowField(BackCellsArray, BackSolve);
+			PackCells(BackCellsArray, BackPacked);
+
+		}, TStatId(), nullptr, ENamedThreads::AnyBackgroundThreadNormalTask);
+}
+
+bool AFlowField::PublishPendingUpdate()
+{
+	if (!bIsUpdatePending || !PendingSolve.IsValid() || !PendingSolve->IsComplete()) return false;
+
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("PublishPendingUpdate");
+
+	PendingSolve = nullptr;
+
+	// 只交换数组指针，在帧边界上一次性切换
+	Swap(CurrentCellsArray, BackCellsArray);
+	Swap(Packed, BackPacked);
+	Swap(Solve, BackSolve);
+
+	// 交换后后台缓冲里是上一版前台数据，下次求解会从 InitialCellsArray 重新拷贝，先释放；坡度掩码留着复用
+	BackCellsArray.Empty();
+	BackPacked.Empty();
+
+	bIsUpdatePending = false;
+
+	// 后台求解用的是旧快照，补上期间提交的代价修改
+	if (PendingRepairCells.Num() > 0)
+	{
+		TArray<int32> Changed = MoveTemp(PendingRepairCells);
+		PendingRepairCells.Reset();
+		RepairFlowField(Changed);
+		return true;
+	}
+
+	DrawCells(EInitMode::Runtime);
+	DrawArrows(EInitMode::Runtime);
+
+	return true;
+}
+
+void AFlowField::RequestSectorsAt(const TArray<FVector>& Locations)
+{
+	if (ActiveSectorSize <= 0) return;
+
+	for (const FVector& Location : Locations)
+	{
+		int32 index;
+
+		if (GetCellIndexAtLocation(Location, index))
+		{
+			MarkSectorOccupied(index);
+		}
+	}
+}
+
+bool AFlowField::SetCellCosts(const TArray<FIntPoint>& Coords, const TArray<uint8>& Costs)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SetCellCosts");
+
+	if (Coords.Num() != Costs.Num() || InitialCellsArray.Num() != xNum * yNum) return false;
+
+	TArray<int32> Changed;
+	Changed.Reserve(Coords.Num());
+
+	for (int32 i = 0; i < Coords.Num(); ++i)
+	{
+		const FIntPoint& Coord = Coords[i];
+
+		if (Coord.X < 0 || Coord.X >= xNum || Coord.Y < 0 || Coord.Y >= yNum) continue;
+
+		const int32 index = Coord.X * yNum + Coord.Y;
+		FCellStruct& cell = InitialCellsArray[index];
+
+		if (cell.cost == Costs[i]) continue;
+
+		cell.cost = Costs[i];
+
+		if (cell.type != ECellType::Empty)
+		{
+			cell.type = Costs[i] == 255 ? ECellType::Obstacle : ECellType::Ground;
+		}
+
+		Changed.Add(index);
+	}
+
+	if (Changed.Num() == 0) return true;
+
+	++CostVersion;
+
+	// 分区模式下门户可能随代价变化，下次更新时重建门户图
+	if (ActiveSectorSize > 0)
+	{
+		bIsSectorGraphDirty = true;
+		return true;
+	}
+
+	if (bIsUpdatePending)
+	{
+		PendingRepairCells.Append(Changed);
+	}
+	else
+	{
+		RepairFlowField(Changed);
+	}
+
+	return true;
+}
+
 void AFlowField::TickFlowField()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_STR("TickFlowField");
 
+	PublishPendingUpdate();
+
 	if (nextTickTimeLeft <= 0)
 	{
 		UpdateFlowField();
@@ -140,131 +370,1411 @@ void AFlowField::InitFlowField(EInitMode InitMode)
 
 	FVector halfSize = FVector(xNum * cellSize, yNum * cellSize, flowFieldSize.Z) / 2;
 
-	Volume->SetBoxExtent(halfSize);
-	Volume->SetRelativeLocation(FVector(0.f, 0.f, halfSize.Z));
+	Volume->SetBoxExtent(halfSize);
+	Volume->SetRelativeLocation(FVector(0.f, 0.f, halfSize.Z));
+
+	initialCost = FMath::Clamp(initialCost, 0, 255);
+
+	// decal
+	Decal_Cells->DecalSize = FVector(halfSize.Z, halfSize.Y, halfSize.X);
+	Decal_Cells->SetRelativeLocation(FVector(0.f, 0.f, halfSize.Z));
+
+	// dynamic materials
+	if ((InitMode == EInitMode::Construction) || InitMode == EInitMode::BeginPlay)
+	{
+		if (IsValid(CellBaseMat))// for cell decal
+		{
+			CellDMI = UMaterialInstanceDynamic::Create(CellBaseMat, this);
+
+			if (IsValid(CellDMI))
+			{
+				Decal_Cells->SetMaterial(0, CellDMI);
+			}
+		}
+
+		if (IsValid(ArrowBaseMat))// for arrow ism
+		{
+			ArrowDMI = UMaterialInstanceDynamic::Create(ArrowBaseMat, this);
+
+			if (IsValid(ArrowDMI))
+			{
+				ISM_Arrows->SetMaterial(0, ArrowDMI);
+			}
+		}
+
+		//if (IsValid(DigitBaseMat))// for digit ism
+		//{
+		//	DigitDMI = UMaterialInstanceDynamic::Create(DigitBaseMat, this);
+
+		//	if (IsValid(DigitDMI))
+		//	{
+		//		ISM_Digits->SetMaterial(0, DigitDMI);
+		//	}
+		//}
+	}
+
+	if (IsValid(CellDMI))
+	{
+		CellDMI->SetScalarParameterValue("XNum", xNum);
+		CellDMI->SetScalarParameterValue("YNum", yNum);
+		CellDMI->SetScalarParameterValue("CellSize", cellSize);
+		CellDMI->SetScalarParameterValue("OffsetX", offsetLoc.X);
+		CellDMI->SetScalarParameterValue("OffsetY", offsetLoc.Y);
+		CellDMI->SetScalarParameterValue("Yaw", actorRot.Yaw);
+	}
+
+	// toggle visibility of arrows, cells and digits
+	if ((InitMode == EInitMode::Construction && drawCellsInEditor) || (InitMode != EInitMode::Construction && drawCellsInGame))
+	{
+		Decal_Cells->SetVisibility(true);
+	}
+	else
+	{
+		Decal_Cells->SetVisibility(false);
+	}
+
+	if ((InitMode == EInitMode::Construction && drawArrowsInEditor) || (InitMode != EInitMode::Construction && drawArrowsInGame))
+	{
+		ISM_Arrows->SetVisibility(true);
+	}
+	else
+	{
+		ISM_Arrows->SetVisibility(false);
+	}
+
+	//if ((InitMode == EInitMode::Construction && drawDigitsInEditor) || (InitMode != EInitMode::Construction && drawDigitsInGame))
+	//{
+	//	ISM_Digits->SetVisibility(true);
+	//}
+	//else
+	//{
+	//	ISM_Digits->SetVisibility(false);
+	//}
+}
+
+void AFlowField::GetGoalLocation()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("GetGoalLocation");
+
+	if (IsValid(goalActor.Get()))
+	{
+		goalLocation = goalActor->GetActorLocation();
+		WorldToGrid(goalLocation, goalGridCoord);
+	}
+	else
+	{
+		WorldToGrid(goalLocation, goalGridCoord);
+	}
+}
+
+void AFlowField::CreateGrid()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("CreateGrid");
+
+	if (!bIsGridDirty) return;
+
+	InitialCellsArray.Empty();
+	CurrentCellsArray.Empty();
+
+	const bool bUseDiskCache = bCacheGridToDisk && GetWorld() && GetWorld()->IsGameWorld();
+
+	// 烘焙数据优先，其次磁盘缓存，最后才追踪
+	if (IsValid(BakedGrid) && BakedGrid->Unpack(*this, InitialCellsArray))
+	{
+		UE_LOG(LogTemp, Log, TEXT("FFCanvas: %s loaded %dx%d grid from %s"), *GetName(), xNum, yNum, *BakedGrid->GetName());
+	}
+	else if (!bUseDiskCache || !LoadGridCache())
+	{
+		PrepareEnvQuery();
+
+		const int32 numCells = xNum * yNum;
+		InitialCellsArray.SetNum(numCells);
+
+		// 场景查询是只读的，所有格子并行追踪
+		ParallelFor(numCells, [&](int32 index)
+			{
+				InitialCellsArray[index] = EnvQuery(FVector2D(index / yNum, index % yNum));
+			});
+
+		if (bUseDiskCache)
+		{
+			SaveGridCache();
+		}
+	}
+
+	bIsGridDirty = false;
+	++GridVersion;
+	++CostVersion;
+}
+
+void AFlowField::PrepareEnvQuery()
+{
+	// 与原先 UKismetSystemLibrary 的 ForObjects 追踪相同的设置：复杂碰撞、返回物理材质、忽略自身
+	GroundObjectParams = FCollisionObjectQueryParams();
+	ObstacleObjectParams = FCollisionObjectQueryParams();
+
+	for (const TEnumAsByte<EObjectTypeQuery>& ObjectType : groundObjectType)
+	{
+		GroundObjectParams.AddObjectTypesToQuery(UEngineTypes::ConvertToCollisionChannel(ObjectType.GetValue()));
+	}
+
+	for (const TEnumAsByte<EObjectTypeQuery>& ObjectType : obstacleObjectType)
+	{
+		ObstacleObjectParams.AddObjectTypesToQuery(UEngineTypes::ConvertToCollisionChannel(ObjectType.GetValue()));
+	}
+
+	EnvQueryParams = FCollisionQueryParams(SCENE_QUERY_STAT(FlowFieldEnvQuery), true, this);
+	EnvQueryParams.bReturnPhysicalMaterial = true;
+}
+
+uint32 AFlowField::GetGridSettingsHash() const
+{
+	// 变换和所有影响追踪结果的参数
+	uint32 Hash = GetTypeHash(actorLoc);
+	Hash = HashCombine(Hash, GetTypeHash(actorRot.Yaw));
+	Hash = HashCombine(Hash, GetTypeHash(flowFieldSize));
+	Hash = HashCombine(Hash, GetTypeHash(cellSize));
+	Hash = HashCombine(Hash, GetTypeHash(initialCost));
+	Hash = HashCombine(Hash, GetTypeHash(maxWalkableAngle));
+	Hash = HashCombine(Hash, GetTypeHash(uint8(traceGround) | uint8(traceObstacles) << 1));
+
+	for (const TEnumAsByte<EObjectTypeQuery>& ObjectType : groundObjectType)
+	{
+		Hash = HashCombine(Hash, GetTypeHash(ObjectType.GetIntValue()));
+	}
+
+	Hash = HashCombine(Hash, 0x0B57AC1E);
+
+	for (const TEnumAsByte<EObjectTypeQuery>& ObjectType : obstacleObjectType)
+	{
+		Hash = HashCombine(Hash, GetTypeHash(ObjectType.GetIntValue()));
+	}
+
+	return Hash;
+}
+
+FString AFlowField::GetGridCachePath() const
+{
+	uint32 Hash = GetTypeHash(UWorld::RemovePIEPrefix(GetWorld()->GetOutermost()->GetName()));
+	Hash = HashCombine(Hash, GetTypeHash(GetName()));
+	Hash = HashCombine(Hash, GetGridSettingsHash());
+
+	return FPaths::ProjectSavedDir() / TEXT("FlowFieldCache") / FString::Printf(TEXT("%s_%08x.ffgrid"), *GetName(), Hash);
+}
+
+namespace
+{
+	constexpr uint32 GridCacheMagic = 0x46464743; // FFGC
+	constexpr int32 GridCacheVersion = 1;
+}
+
+bool AFlowField::LoadGridCache()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("LoadGridCache");
+
+	TArray<uint8> Bytes;
+
+	if (!FFileHelper::LoadFileToArray(Bytes, *GetGridCachePath(), FILEREAD_Silent)) return false;
+
+	FMemoryReader Ar(Bytes);
+
+	uint32 magic = 0;
+	int32 version = 0;
+	int32 cachedXNum = 0;
+	int32 cachedYNum = 0;
+	Ar << magic << version << cachedXNum << cachedYNum;
+
+	if (magic != GridCacheMagic || version != GridCacheVersion || cachedXNum != xNum || cachedYNum != yNum) return false;
+
+	// 每格只存追踪得到的部分，平面位置和坐标按网格重新计算
+	const int32 numCells = xNum * yNum;
+	InitialCellsArray.SetNum(numCells);
+
+	for (int32 index = 0; index < numCells && !Ar.IsError(); ++index)
+	{
+		uint8 cost = 0;
+		uint8 type = 0;
+		double height = 0;
+		FVector3f normal;
+		Ar << cost << type << height << normal;
+
+		FCellStruct& cell = InitialCellsArray[index];
+		cell.gridCoord = FVector2D(index / yNum, index % yNum);
+		cell.worldLoc = GetGridCellCenter(cell.gridCoord);
+		cell.worldLoc.Z = height;
+		cell.normal = FVector(normal);
+		cell.cost = cost;
+		cell.type = static_cast<ECellType>(type);
+	}
+
+	if (Ar.IsError())
+	{
+		InitialCellsArray.Empty();
+		return false;
+	}
+
+	UE_LOG(LogTemp, Log, TEXT("FFCanvas: %s loaded %dx%d grid from cache"), *GetName(), xNum, yNum);
+
+	return true;
+}
+
+void AFlowField::SaveGridCache() const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SaveGridCache");
+
+	TArray<uint8> Bytes;
+	FMemoryWriter Ar(Bytes);
+
+	uint32 magic = GridCacheMagic;
+	int32 version = GridCacheVersion;
+	int32 cachedXNum = xNum;
+	int32 cachedYNum = yNum;
+	Ar << magic << version << cachedXNum << cachedYNum;
+
+	for (const FCellStruct& cell : InitialCellsArray)
+	{
+		uint8 cost = static_cast<uint8>(FMath::Clamp(cell.cost, 0, 255));
+		uint8 type = static_cast<uint8>(cell.type);
+		double height = cell.worldLoc.Z;
+		FVector3f normal(cell.normal);
+		Ar << cost << type << height << normal;
+	}
+
+	FFileHelper::SaveArrayToFile(Bytes, *GetGridCachePath());
+}
+
+namespace
+{
+	// 邻居顺序：0~3 为上下左右，4~7 为对角 | Neighbor order: 0-3 adjacent, 4-7 diagonal
+	constexpr int32 NeighborDX[8] = { 0, 1, 0, -1, 1, 1, -1, -1 };
+	constexpr int32 NeighborDY[8] = { -1, 0, 1, 0, -1, 1, 1, -1 };
+
+	// 对角邻居两侧的相邻格 | The two adjacent cells flanking each diagonal
+	constexpr int32 DiagonalSideA[8] = { 0, 0, 0, 0, 0, 1, 2, 3 };
+	constexpr int32 DiagonalSideB[8] = { 0, 0, 0, 0, 1, 2, 3, 0 };
+
+	// 反方向 | Opposite direction
+	constexpr int32 OppositeNeighbor[8] = { 2, 3, 0, 1, 6, 7, 4, 5 };
+
+	constexpr int32 NumBuckets = 256;
+}
+
+void AFlowField::CalculateFlowField(TArray<FCellStruct>& InCurrentCellsArray, FFlowFieldSolveState& InState)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("CalculateFlowField");
+
+	BuildSlopeMask(InCurrentCellsArray, InState);
+
+	InState.SolvedGoalIndex = CoordToIndex(goalGridCoord);
+	InState.SolvedStyle = Style;
+	InState.bSolvedIgnoreInternalObstacleCells = bIgnoreInternalObstacleCells;
+	InState.bSolvedEikonal = bEikonalSolver;
+
+	// 连续到达时间场，方向在求解时由梯度得出
+	if (bEikonalSolver)
+	{
+		SolveEikonalField(InCurrentCellsArray, InState);
+		return;
+	}
+
+	if (bUseBucketQueue)
+	{
+		SolveIntegrationField(InCurrentCellsArray, InState);
+	}
+	else
+	{
+		SolveIntegrationFieldLegacy(InCurrentCellsArray);
+	}
+
+	CalculateDirections(InCurrentCellsArray, InState);
+}
+
+void AFlowField::BuildSlopeMask(const TArray<FCellStruct>& InCellsArray, FFlowFieldSolveState& InState) const
+{
+	const int32 numCells = InCellsArray.Num();
+
+	if (InState.SlopeGridVersion == GridVersion && InState.SlopeMask.Num() == numCells && InState.SlopeMaskAngle == maxWalkableAngle) return;
+
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("BuildSlopeMask");
+
+	TArray<uint8>& SlopeMask = InState.SlopeMask;
+	SlopeMask.SetNumUninitialized(numCells);
+	InState.SlopeMaskAngle = maxWalkableAngle;
+	InState.SlopeGridVersion = GridVersion;
+
+	ParallelFor(numCells, [&](int32 currentIndex)
+		{
+			const int32 x = currentIndex / yNum;
+			const int32 y = currentIndex % yNum;
+			const FVector& currentLoc = InCellsArray[currentIndex].worldLoc;
+
+			uint8 mask = 0;
+
+			for (int32 i = 0; i < 8; ++i)
+			{
+				const int32 nx = x + NeighborDX[i];
+				const int32 ny = y + NeighborDY[i];
+
+				if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) continue;
+
+				const FVector& neighborLoc = InCellsArray[nx * yNum + ny].worldLoc;
+
+				// 与逐次计算的坡度判定完全一致，只是每个网格算一次
+				float heightDifference = FMath::Abs(currentLoc.Z - neighborLoc.Z);
+				float horizontalDistance = FVector2D::Distance(FVector2D(currentLoc.X, currentLoc.Y), FVector2D(neighborLoc.X, neighborLoc.Y));
+				float slopeAngle = FMath::RadiansToDegrees(FMath::Atan(heightDifference / horizontalDistance));
+
+				if (slopeAngle > maxWalkableAngle)
+				{
+					mask |= 1 << i;
+				}
+			}
+
+			SlopeMask[currentIndex] = mask;
+		});
+}
+
+bool AFlowField::IsBlockedDiagonal(const TArray<FCellStruct>& InCellsArray, int32 x, int32 y, int32 i) const
+{
+	for (const int32 side : { DiagonalSideA[i], DiagonalSideB[i] })
+	{
+		const int32 nx = x + NeighborDX[side];
+		const int32 ny = y + NeighborDY[side];
+
+		if (nx >= 0 && nx < xNum && ny >= 0 && ny < yNum && InCellsArray[nx * yNum + ny].cost == 255)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool AFlowField::CanStep(const TArray<FCellStruct>& InCellsArray, const FFlowFieldSolveState& InState, int32 currentIndex, int32 i, int32& OutNeighborIndex) const
+{
+	if (i >= 4 && Style != EStyle::AdjacentFirst) return false;
+
+	const int32 x = currentIndex / yNum;
+	const int32 y = currentIndex % yNum;
+	const int32 nx = x + NeighborDX[i];
+	const int32 ny = y + NeighborDY[i];
+
+	if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) return false;
+
+	OutNeighborIndex = nx * yNum + ny;
+
+	if (bIgnoreInternalObstacleCells && InCellsArray[OutNeighborIndex].cost == 255) return false;
+	if (i >= 4 && IsBlockedDiagonal(InCellsArray, x, y, i)) return false;
+	if (InCellsArray[currentIndex].cost != 255 && (InState.SlopeMask[currentIndex] & (1 << i))) return false;
+
+	return true;
+}
+
+void AFlowField::SolveIntegrationField(TArray<FCellStruct>& InCurrentCellsArray, FFlowFieldSolveState& InState) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("CreateIntegrationField");
+
+	const int32 goalIndex = CoordToIndex(goalGridCoord);
+	FCellStruct& targetCell = InCurrentCellsArray[goalIndex];
+	targetCell.cost = 0;
+	targetCell.dist = 0;
+
+	TArray<int32> Seeds = { goalIndex };
+	RunBucketQueue(InCurrentCellsArray, InState, Seeds, nullptr);
+}
+
+void AFlowField::RunBucketQueue(TArray<FCellStruct>& InCurrentCellsArray, FFlowFieldSolveState& InState, const TArray<int32>& Seeds, TArray<int32>* OutRelaxed) const
+{
+	// 代价是0~255的整数，用按 dist % 256 分桶的环形队列（Dial算法）代替优先队列，队列里只存格子下标
+	TArray<TArray<int32>>& BucketQueue = InState.BucketQueue;
+	BucketQueue.SetNum(NumBuckets);
+
+	for (TArray<int32>& Bucket : BucketQueue)
+	{
+		Bucket.Reset();
+	}
+
+	// 种子的距离可能相差超过一圈，按距离排序后在扫到对应距离时再放入
+	struct FSeed
+	{
+		int32 Index;
+		int32 Dist;
+	};
+
+	TArray<FSeed> SortedSeeds;
+	SortedSeeds.Reserve(Seeds.Num());
+
+	for (const int32 seedIndex : Seeds)
+	{
+		SortedSeeds.Add({ seedIndex, InCurrentCellsArray[seedIndex].dist });
+	}
+
+	SortedSeeds.Sort([](const FSeed& A, const FSeed& B) { return A.Dist < B.Dist; });
+
+	int32 nextSeed = 0;
+	int32 pending = 0;
+	int32 dist = SortedSeeds.Num() > 0 ? SortedSeeds[0].Dist : 0;
+
+	while (pending > 0 || nextSeed < SortedSeeds.Num())
+	{
+		// 队列已空，直接跳到下一个种子
+		if (pending == 0)
+		{
+			dist = FMath::Max(dist, SortedSeeds[nextSeed].Dist);
+		}
+
+		TArray<int32>& Bucket = BucketQueue[dist & (NumBuckets - 1)];
+
+		for (; nextSeed < SortedSeeds.Num() && SortedSeeds[nextSeed].Dist == dist; ++nextSeed)
+		{
+			Bucket.Add(SortedSeeds[nextSeed].Index);
+			++pending;
+		}
+
+		// 零代价的邻居会追加到当前桶，按下标遍历
+		for (int32 k = 0; k < Bucket.Num(); ++k)
+		{
+			const int32 currentIndex = Bucket[k];
+			--pending;
+
+			// 过期条目：该格已经以更小的距离出队
+			if (InCurrentCellsArray[currentIndex].dist != dist) continue;
+
+			for (int32 i = 0; i < 8; ++i)
+			{
+				int32 neighborIndex;
+				if (!CanStep(InCurrentCellsArray, InState, currentIndex, i, neighborIndex)) continue;
+
+				FCellStruct& neighborCell = InCurrentCellsArray[neighborIndex];
+				const int32 newDist = neighborCell.cost + dist;
+
+				if (newDist < neighborCell.dist)
+				{
+					neighborCell.dist = newDist;
+					BucketQueue[newDist & (NumBuckets - 1)].Add(neighborIndex);
+					++pending;
+
+					if (OutRelaxed)
+					{
+						OutRelaxed->Add(neighborIndex);
+					}
+				}
+			}
+		}
+
+		Bucket.Reset();
+		++dist;
+	}
+}
+
+void AFlowField::RepairFlowField(const TArray<int32>& ChangedIndices)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("RepairFlowField");
+
+	const int32 numCells = xNum * yNum;
+
+	// 没有可修复的完整解时退回完整求解，Eikonal 场没有前驱关系，也只能整体重算
+	if (Solve.bSolvedEikonal || CurrentCellsArray.Num() != numCells || InitialCellsArray.Num() != numCells || !CurrentCellsArray.IsValidIndex(Solve.SolvedGoalIndex))
+	{
+		CurrentCellsArray = InitialCellsArray;
+		CalculateFlowField(CurrentCellsArray, Solve);
+		PackCells(CurrentCellsArray, Packed);
+		DrawCells(EInitMode::Runtime);
+		DrawArrows(EInitMode::Runtime);
+		return;
+	}
+
+	BuildSlopeMask(CurrentCellsArray, Solve);
+
+	TArray<FCellStruct>& Cells = CurrentCellsArray;
+	const int32 SolvedGoalIndex = Solve.SolvedGoalIndex;
+
+	// 1. 写入新代价，目标格保持0
+	for (const int32 index : ChangedIndices)
+	{
+		if (index == SolvedGoalIndex) continue;
+
+		Cells[index].cost = InitialCellsArray[index].cost;
+		Cells[index].type = InitialCellsArray[index].type;
+	}
+
+	// 2. 代价变化会影响进入该格的边、从该格出发的坡度判断，以及以它为侧边的对角边，这些边的终点都在该格及其8邻域内
+	TBitArray<> Affected(false, numCells);
+	TArray<int32> AffectedList;
+
+	auto MarkAffected = [&](int32 index)
+		{
+			if (index != SolvedGoalIndex && !Affected[index])
+			{
+				Affected[index] = true;
+				AffectedList.Add(index);
+			}
+		};
+
+	for (const int32 index : ChangedIndices)
+	{
+		MarkAffected(index);
+
+		const int32 x = index / yNum;
+		const int32 y = index % yNum;
+
+		for (int32 i = 0; i < 8; ++i)
+		{
+			const int32 nx = x + NeighborDX[i];
+			const int32 ny = y + NeighborDY[i];
+
+			if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) continue;
+
+			MarkAffected(nx * yNum + ny);
+		}
+	}
+
+	// 3. 旧距离可能经过受影响格的下游格也要作废：沿“紧”边（dist[v] == dist[u] + cost[v]）向外扩散
+	const int32 unreachedDist = FCellStruct().dist;
+
+	for (int32 k = 0; k < AffectedList.Num(); ++k)
+	{
+		const int32 currentIndex = AffectedList[k];
+		const int32 currentDist = Cells[currentIndex].dist;
+
+		if (currentDist >= unreachedDist) continue;
+
+		const int32 x = currentIndex / yNum;
+		const int32 y = currentIndex % yNum;
+
+		for (int32 i = 0; i < 8; ++i)
+		{
+			const int32 nx = x + NeighborDX[i];
+			const int32 ny = y + NeighborDY[i];
+
+			if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) continue;
+
+			const int32 neighborIndex = nx * yNum + ny;
+
+			if (!Affected[neighborIndex] && Cells[neighborIndex].dist == currentDist + Cells[neighborIndex].cost)
+			{
+				MarkAffected(neighborIndex);
+			}
+		}
+	}
+
+	for (const int32 index : AffectedList)
+	{
+		Cells[index].dist = unreachedDist;
+	}
+
+	// 4. 受影响格从未受影响的邻居取新的初始距离，作为种子重新传播
+	TArray<int32> Seeds;
+
+	for (const int32 index : AffectedList)
+	{
+		const int32 x = index / yNum;
+		const int32 y = index % yNum;
+		int32 bestDist = unreachedDist;
+
+		for (int32 i = 0; i < 8; ++i)
+		{
+			const int32 nx = x + NeighborDX[i];
+			const int32 ny = y + NeighborDY[i];
+
+			if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) continue;
+
+			const int32 predIndex = nx * yNum + ny;
+
+			if (Affected[predIndex] || Cells[predIndex].dist >= unreachedDist) continue;
+
+			int32 stepIndex;
+			if (!CanStep(Cells, Solve, predIndex, OppositeNeighbor[i], stepIndex)) continue;
+
+			bestDist = FMath::Min(bestDist, Cells[predIndex].dist + Cells[index].cost);
+		}
+
+		if (bestDist < unreachedDist)
+		{
+			Cells[index].dist = bestDist;
+			Seeds.Add(index);
+		}
+	}
+
+	TArray<int32> Relaxed;
+	RunBucketQueue(Cells, Solve, Seeds, &Relaxed);
+
+	// 5. 只在被改动格子的包围盒内重算方向，外扩一格覆盖指向它们的邻居
+	int32 minX = xNum, minY = yNum, maxX = -1, maxY = -1;
+
+	auto Expand = [&](int32 index)
+		{
+			const int32 x = index / yNum;
+			const int32 y = index % yNum;
+			minX = FMath::Min(minX, x);
+			minY = FMath::Min(minY, y);
+			maxX = FMath::Max(maxX, x);
+			maxY = FMath::Max(maxY, y);
+		};
+
+	for (const int32 index : AffectedList) Expand(index);
+	for (const int32 index : Relaxed) Expand(index);
+
+	if (maxX < 0) return;
+
+	minX = FMath::Max(minX - 1, 0);
+	minY = FMath::Max(minY - 1, 0);
+	maxX = FMath::Min(maxX + 1, xNum - 1);
+	maxY = FMath::Min(maxY + 1, yNum - 1);
+
+	const int32 regionY = maxY - minY + 1;
+	const bool bPatchPacked = Packed.Num() == numCells;
+
+	ParallelFor((maxX - minX + 1) * regionY, [&](int32 regionIndex)
+		{
+			const int32 index = (minX + regionIndex / regionY) * yNum + minY + regionIndex % regionY;
+
+			UpdateCellDirection(Cells, Solve, index);
+
+			if (bPatchPacked)
+			{
+				Packed.SetCell(index, Cells[index]);
+			}
+		});
+
+	if (!bPatchPacked)
+	{
+		PackCells(Cells, Packed);
+	}
+
+	DrawCells(EInitMode::Runtime);
+	DrawArrows(EInitMode::Runtime);
+}
+
+void AFlowField::UpdateSectors(EInitMode InitMode, bool bGridRebuilt)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("UpdateSectors");
+
+	const int32 sectorSize = FMath::Clamp(SectorSize, 4, 256);
+	const bool bRebuild = bGridRebuilt || bIsSectorGraphDirty || ActiveSectorSize != sectorSize || CurrentCellsArray.Num() != InitialCellsArray.Num();
+
+	if (bRebuild)
+	{
+		CurrentCellsArray = InitialCellsArray;
+
+		BuildSlopeMask(CurrentCellsArray, Solve);
+		PackCells(CurrentCellsArray, Packed);
+		BuildSectors(sectorSize);
+	}
+
+	const int32 goalIndex = CoordToIndex(goalGridCoord);
+	const int32 goalSector = GetSectorIndex(goalIndex);
+	const int32 unreachedDist = FCellStruct().dist;
+
+	// 取出本周期被查询过的分区
+	TBitArray<> bOccupied(false, Sectors.Num());
+	TArray<int32> Occupied;
+
+	for (int32 sector = 0; sector < Sectors.Num(); ++sector)
+	{
+		if (SectorOccupied[sector])
+		{
+			bOccupied[sector] = true;
+			Occupied.Add(sector);
+		}
+	}
+
+	FMemory::Memzero(SectorOccupied.GetData(), SectorOccupied.Num());
+
+	// 门户图上的抽象搜索：从目标出发，每个分区第一个出队的门户就是它的出口，所有被占用分区都确定后提前结束
+	TArray<int32> SectorExit;
+	SectorExit.Init(INDEX_NONE, Sectors.Num());
+
+	int32 remaining = Occupied.Num() - (bOccupied[goalSector] ? 1 : 0);
+
+	if (remaining > 0)
+	{
+		struct FNodeEntry
+		{
+			int32 Dist;
+			int32 Node;
+
+			bool operator<(const FNodeEntry& Other) const { return Dist < Other.Dist; }
+		};
+
+		TArray<int32> NodeDist;
+		NodeDist.Init(MAX_int32, PortalNodes.Num());
+
+		TArray<FNodeEntry> Heap;
+
+		const FFlowFieldSector& GoalSector = Sectors[goalSector];
+		TArray<int32> LocalDist;
+		SolveSector(GoalSector, { goalIndex }, LocalDist);
+
+		for (const int32 node : GoalSector.Nodes)
+		{
+			const int32 cell = PortalNodes[node].Cell;
+			const int32 dist = LocalDist[GoalSector.LocalIndex(cell / yNum, cell % yNum)];
+
+			if (dist < unreachedDist)
+			{
+				NodeDist[node] = dist;
+				Heap.HeapPush({ dist, node });
+			}
+		}
+
+		while (remaining > 0 && Heap.Num() > 0)
+		{
+			FNodeEntry Entry;
+			Heap.HeapPop(Entry, EAllowShrinking::No);
+
+			if (Entry.Dist != NodeDist[Entry.Node]) continue;
+
+			const int32 sector = PortalNodes[Entry.Node].Sector;
+
+			if (sector != goalSector && SectorExit[sector] == INDEX_NONE)
+			{
+				SectorExit[sector] = Entry.Node;
+
+				if (bOccupied[sector])
+				{
+					--remaining;
+				}
+			}
+
+			auto Relax = [&](int32 node, int32 dist)
+				{
+					if (dist < NodeDist[node])
+					{
+						NodeDist[node] = dist;
+						Heap.HeapPush({ dist, node });
+					}
+				};
+
+			// 穿过门户
+			const int32 partner = Entry.Node ^ 1;
+			Relax(partner, Entry.Dist + CurrentCellsArray[PortalNodes[partner].Cell].cost);
+
+			// 分区内到其它门户
+			EnsureSectorNodeDist(sector);
+
+			const FFlowFieldSector& Sector = Sectors[sector];
+			const int32 numNodes = Sector.Nodes.Num();
+			const int32 slot = PortalNodes[Entry.Node].Slot;
+
+			for (int32 k = 0; k < numNodes; ++k)
+			{
+				const int32 localDist = Sector.NodeDist[slot * numNodes + k];
+
+				if (k != slot && localDist < unreachedDist)
+				{
+					Relax(Sector.Nodes[k], Entry.Dist + localDist);
+				}
+			}
+		}
+	}
+
+	// 预取：被占用分区出口门户另一侧的分区也一起计算，agent 穿过门户后立即有方向，不必等下一次更新。
+	// 另一侧的门户在抽象搜索中先于本分区出口出队，它所在分区的出口已经确定
+	const int32 numQueried = Occupied.Num();
+
+	for (int32 k = 0; k < numQueried; ++k)
+	{
+		const int32 exitNode = SectorExit[Occupied[k]];
+
+		if (exitNode == INDEX_NONE) continue;
+
+		const int32 nextSector = PortalNodes[exitNode ^ 1].Sector;
+
+		if (!bOccupied[nextSector] && (nextSector == goalSector || SectorExit[nextSector] != INDEX_NONE))
+		{
+			bOccupied[nextSector] = true;
+			Occupied.Add(nextSector);
+		}
+	}
+
+	// 按 (分区, 出口) 查缓存，缺的并行计算
+	++SectorUpdateSerial;
+
+	TArray<int32> SectorExitKey;
+	SectorExitKey.SetNum(Occupied.Num());
+
+	TArray<FIntPoint> Missing;
+
+	for (int32 k = 0; k < Occupied.Num(); ++k)
+	{
+		const int32 sector = Occupied[k];
+		const int32 exitKey = sector == goalSector ? -2 - goalIndex : SectorExit[sector];
+		SectorExitKey[k] = exitKey;
+
+		if (exitKey == INDEX_NONE) continue;
+
+		const FIntPoint Key(sector, exitKey);
+
+		if (FFlowFieldSectorField* Field = SectorFieldCache.Find(Key))
+		{
+			Field->LastUsed = SectorUpdateSerial;
+		}
+		else
+		{
+			SectorFieldCache.Add(Key).LastUsed = SectorUpdateSerial;
+			Missing.Add(Key);
+		}
+	}
+
+	if (Missing.Num() > 0)
+	{
+		TArray<FFlowFieldSectorField*> MissingFields;
+
+		for (const FIntPoint& Key : Missing)
+		{
+			MissingFields.Add(SectorFieldCache.Find(Key));
+		}
+
+		ParallelFor(Missing.Num(), [&](int32 k)
+			{
+				BuildSectorField(Sectors[Missing[k].X], Missing[k].Y >= 0 ? Missing[k].Y : INDEX_NONE, goalIndex, *MissingFields[k]);
+			});
+	}
+
+	// 只改写出口变化了的分区
+	bool bChanged = false;
+
+	for (int32 k = 0; k < Occupied.Num(); ++k)
+	{
+		FFlowFieldSector& Sector = Sectors[Occupied[k]];
+		const int32 exitKey = SectorExitKey[k];
+
+		if (Sector.AppliedExit == exitKey) continue;
+
+		Sector.AppliedExit = exitKey;
+		bChanged = true;
+
+		const FFlowFieldSectorField* Field = exitKey != INDEX_NONE ? SectorFieldCache.Find(FIntPoint(Occupied[k], exitKey)) : nullptr;
+
+		for (int32 x = Sector.MinX; x < Sector.MinX + Sector.SizeX; ++x)
+		{
+			for (int32 y = Sector.MinY; y < Sector.MinY + Sector.SizeY; ++y)
+			{
+				const int32 index = x * yNum + y;
+				const int32 next = Field ? Field->Next[Sector.LocalIndex(x, y)] : INDEX_NONE;
+				FCellStruct& cell = CurrentCellsArray[index];
+
+				cell.dir = next != INDEX_NONE ? UKismetMathLibrary::GetDirectionUnitVector(cell.worldLoc, CurrentCellsArray[next].worldLoc) : FVector::ZeroVector;
+				Packed.SetCell(index, cell);
+			}
+		}
+	}
+
+	if (SectorFieldCache.Num() > FMath::Max(MaxCachedSectorFields, 1))
+	{
+		for (auto It = SectorFieldCache.CreateIterator(); It; ++It)
+		{
+			if (It->Value.LastUsed != SectorUpdateSerial)
+			{
+				It.RemoveCurrent();
+			}
+		}
+	}
+
+	if (bRebuild || bChanged)
+	{
+		DrawCells(InitMode);
+		DrawArrows(InitMode);
+	}
+}
+
+void AFlowField::BuildSectors(int32 InSectorSize)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("BuildSectors");
+
+	ActiveSectorSize = InSectorSize;
+	bIsSectorGraphDirty = false;
+
+	const int32 sectorsX = FMath::DivideAndRoundUp(xNum, InSectorSize);
+	SectorsY = FMath::DivideAndRoundUp(yNum, InSectorSize);
+
+	Sectors.Reset();
+	Sectors.SetNum(sectorsX * SectorsY);
+	PortalNodes.Reset();
+	SectorFieldCache.Reset();
+
+	// 保留重建前的占用标记
+	if (SectorOccupied.Num() != Sectors.Num())
+	{
+		SectorOccupied.Init(0, Sectors.Num());
+	}
+
+	for (int32 sx = 0; sx < sectorsX; ++sx)
+	{
+		for (int32 sy = 0; sy < SectorsY; ++sy)
+		{
+			FFlowFieldSector& Sector = Sectors[sx * SectorsY + sy];
+			Sector.MinX = sx * InSectorSize;
+			Sector.MinY = sy * InSectorSize;
+			Sector.SizeX = FMath::Min(xNum, Sector.MinX + InSectorSize) - Sector.MinX;
+			Sector.SizeY = FMath::Min(yNum, Sector.MinY + InSectorSize) - Sector.MinY;
+		}
+	}
+
+	// 沿分区边界找两侧都能互相通行的连续格子对，每段生成一对门户
+	auto AddWindows = [&](int32 sectorA, int32 sectorB, int32 length, TFunctionRef<void(int32, int32&, int32&)> GetPair, int32 dirAB, int32 dirBA)
+		{
+			int32 runStart = INDEX_NONE;
+
+			for (int32 k = 0; k <= length; ++k)
+			{
+				bool bPassable = false;
+
+				if (k < length)
+				{
+					int32 a, b, stepIndex;
+					GetPair(k, a, b);
+					bPassable = CanStep(CurrentCellsArray, Solve, a, dirAB, stepIndex) && CanStep(CurrentCellsArray, Solve, b, dirBA, stepIndex);
+				}
+
+				if (bPassable && runStart == INDEX_NONE)
+				{
+					runStart = k;
+				}
+				else if (!bPassable && runStart != INDEX_NONE)
+				{
+					const int32 nodeA = PortalNodes.AddDefaulted();
+					const int32 nodeB = PortalNodes.AddDefaulted();
+
+					int32 bestCost = MAX_int32;
+					int32 bestOffset = MAX_int32;
+
+					for (int32 r = runStart; r < k; ++r)
+					{
+						int32 a, b;
+						GetPair(r, a, b);
+
+						PortalNodes[nodeA].Window.Add(a);
+						PortalNodes[nodeB].Window.Add(b);
+
+						// 取最便宜的一对，同价取最靠近中间的
+						const int32 crossCost = CurrentCellsArray[a].cost + CurrentCellsArray[b].cost;
+						const int32 offset = FMath::Abs(2 * r - (runStart + k - 1));
+
+						if (crossCost < bestCost || (crossCost == bestCost && offset < bestOffset))
+						{
+							bestCost = crossCost;
+							bestOffset = offset;
+							PortalNodes[nodeA].Cell = a;
+							PortalNodes[nodeB].Cell = b;
+						}
+					}
+
+					PortalNodes[nodeA].Sector = sectorA;
+					PortalNodes[nodeA].Slot = Sectors[sectorA].Nodes.Add(nodeA);
+					PortalNodes[nodeB].Sector = sectorB;
+					PortalNodes[nodeB].Slot = Sectors[sectorB].Nodes.Add(nodeB);
+
+					runStart = INDEX_NONE;
+				}
+			}
+		};
+
+	for (int32 sx = 0; sx < sectorsX; ++sx)
+	{
+		for (int32 sy = 0; sy < SectorsY; ++sy)
+		{
+			const int32 sectorA = sx * SectorsY + sy;
+			const FFlowFieldSector& Sector = Sectors[sectorA];
+			const int32 edgeX = Sector.MinX + Sector.SizeX - 1;
+			const int32 edgeY = Sector.MinY + Sector.SizeY - 1;
+
+			if (sx + 1 < sectorsX)
+			{
+				AddWindows(sectorA, sectorA + SectorsY, Sector.SizeY, [&](int32 k, int32& a, int32& b)
+					{
+						a = edgeX * yNum + Sector.MinY + k;
+						b = a + yNum;
+					}, 1, 3);
+			}
+
+			if (sy + 1 < SectorsY)
+			{
+				AddWindows(sectorA, sectorA + 1, Sector.SizeX, [&](int32 k, int32& a, int32& b)
+					{
+						a = (Sector.MinX + k) * yNum + edgeY;
+						b = a + 1;
+					}, 2, 0);
+			}
+		}
+	}
+}
+
+void AFlowField::EnsureSectorNodeDist(int32 SectorIndex)
+{
+	FFlowFieldSector& Sector = Sectors[SectorIndex];
+	const int32 numNodes = Sector.Nodes.Num();
+
+	if (Sector.NodeDist.Num() == numNodes * numNodes) return;
+
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("EnsureSectorNodeDist");
+
+	Sector.NodeDist.SetNum(numNodes * numNodes);
+
+	TArray<int32> LocalDist;
+
+	for (int32 i = 0; i < numNodes; ++i)
+	{
+		SolveSector(Sector, { PortalNodes[Sector.Nodes[i]].Cell }, LocalDist);
+
+		for (int32 j = 0; j < numNodes; ++j)
+		{
+			const int32 cell = PortalNodes[Sector.Nodes[j]].Cell;
+			Sector.NodeDist[i * numNodes + j] = LocalDist[Sector.LocalIndex(cell / yNum, cell % yNum)];
+		}
+	}
+}
+
+void AFlowField::SolveSector(const FFlowFieldSector& Sector, const TArray<int32>& SeedCells, TArray<int32>& OutDist) const
+{
+	// 与 SolveIntegrationField 相同的分桶队列，只在分区内传播，可在多个线程上同时运行
+	OutDist.Init(FCellStruct().dist, Sector.SizeX * Sector.SizeY);
+
+	TArray<TArray<int32>> Buckets;
+	Buckets.SetNum(NumBuckets);
+
+	int32 pending = 0;
+
+	for (const int32 seedIndex : SeedCells)
+	{
+		OutDist[Sector.LocalIndex(seedIndex / yNum, seedIndex % yNum)] = 0;
+		Buckets[0].Add(seedIndex);
+		++pending;
+	}
+
+	for (int32 dist = 0; pending > 0; ++dist)
+	{
+		TArray<int32>& Bucket = Buckets[dist & (NumBuckets - 1)];
+
+		for (int32 k = 0; k < Bucket.Num(); ++k)
+		{
+			const int32 currentIndex = Bucket[k];
+			--pending;
+
+			if (OutDist[Sector.LocalIndex(currentIndex / yNum, currentIndex % yNum)] != dist) continue;
+
+			for (int32 i = 0; i < 8; ++i)
+			{
+				int32 neighborIndex;
+				if (!CanStep(CurrentCellsArray, Solve, currentIndex, i, neighborIndex)) continue;
+
+				const int32 nx = neighborIndex / yNum;
+				const int32 ny = neighborIndex % yNum;
+
+				if (nx < Sector.MinX || nx >= Sector.MinX + Sector.SizeX || ny < Sector.MinY || ny >= Sector.MinY + Sector.SizeY) continue;
+
+				int32& neighborDist = OutDist[Sector.LocalIndex(nx, ny)];
+				const int32 newDist = CurrentCellsArray[neighborIndex].cost + dist;
+
+				if (newDist < neighborDist)
+				{
+					neighborDist = newDist;
+					Buckets[newDist & (NumBuckets - 1)].Add(neighborIndex);
+					++pending;
+				}
+			}
+		}
+
+		Bucket.Reset();
+	}
+}
+
+void AFlowField::BuildSectorField(const FFlowFieldSector& Sector, int32 ExitNode, int32 GoalIndex, FFlowFieldSectorField& OutField) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("BuildSectorField");
+
+	// 出口门户的整段窗口作为种子，目标分区以目标格为种子
+	TArray<int32> LocalDist;
+	SolveSector(Sector, ExitNode != INDEX_NONE ? PortalNodes[ExitNode].Window : TArray<int32>{ GoalIndex }, LocalDist);
+
+	OutField.Next.Init(INDEX_NONE, Sector.SizeX * Sector.SizeY);
+
+	for (int32 x = Sector.MinX; x < Sector.MinX + Sector.SizeX; ++x)
+	{
+		for (int32 y = Sector.MinY; y < Sector.MinY + Sector.SizeY; ++y)
+		{
+			const int32 currentIndex = x * yNum + y;
+			const FCellStruct& currentCell = CurrentCellsArray[currentIndex];
+			const uint8 steepMask = currentCell.cost != 255 ? Solve.SlopeMask[currentIndex] : 0;
+
+			int32 bestIndex = INDEX_NONE;
+			int32 bestDist = LocalDist[Sector.LocalIndex(x, y)];
+
+			for (int32 i = 0; i < 8; i++)
+			{
+				const int32 nx = x + NeighborDX[i];
+				const int32 ny = y + NeighborDY[i];
+
+				if (nx < Sector.MinX || nx >= Sector.MinX + Sector.SizeX || ny < Sector.MinY || ny >= Sector.MinY + Sector.SizeY) continue;
+
+				const int32 neighborIndex = nx * yNum + ny;
+
+				if (bIgnoreInternalObstacleCells && CurrentCellsArray[neighborIndex].cost == 255) continue;
+				if (i >= 4 && currentCell.cost != 255 && IsBlockedDiagonal(CurrentCellsArray, x, y, i)) continue;
+				if (steepMask & (1 << i)) continue;
+
+				const int32 neighborDist = LocalDist[Sector.LocalIndex(nx, ny)];
+
+				if (neighborDist < bestDist)
+				{
+					bestIndex = neighborIndex;
+					bestDist = neighborDist;
+				}
+			}
+
+			OutField.Next[Sector.LocalIndex(x, y)] = bestIndex;
+		}
+	}
+
+	// 窗口格指向门户另一侧对应的格子
+	if (ExitNode != INDEX_NONE)
+	{
+		const TArray<int32>& Window = PortalNodes[ExitNode].Window;
+		const TArray<int32>& PartnerWindow = PortalNodes[ExitNode ^ 1].Window;
+
+		for (int32 k = 0; k < Window.Num(); ++k)
+		{
+			OutField.Next[Sector.LocalIndex(Window[k] / yNum, Window[k] % yNum)] = PartnerWindow[k];
+		}
+	}
+}
+
+void AFlowField::SolveGoalField(int32 GoalIndex, TArray<FFlowFieldPacked::FDir>& OutDir) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SolveGoalField");
+
+	// 整个网格当作一个分区求解
+	FFlowFieldSector Grid;
+	Grid.SizeX = xNum;
+	Grid.SizeY = yNum;
+
+	FFlowFieldSectorField Field;
+	BuildSectorField(Grid, INDEX_NONE, GoalIndex, Field);
+
+	OutDir.SetNumUninitialized(Field.Next.Num());
+
+	for (int32 index = 0; index < Field.Next.Num(); ++index)
+	{
+		const int32 next = Field.Next[index];
+		OutDir[index] = next != INDEX_NONE ? FFlowFieldPacked::EncodeDir(CurrentCellsArray[next].worldLoc - CurrentCellsArray[index].worldLoc) : FFlowFieldPacked::FDir();
+	}
+}
+
+// 程函方程求解，方向取到达时间的梯度 | Eikonal solver, directions follow the arrival time gradient
+void AFlowField::SolveEikonalField(TArray<FCellStruct>& InCurrentCellsArray, const FFlowFieldSolveState& InState) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SolveEikonalField");
+
+	// 快速迭代法（FIM）：活动列表里的格子并行求解 Godunov 迎风格式，收敛的格子把邻居拉进列表
+	const int32 numCells = InCurrentCellsArray.Num();
+	const int32 goalIndex = CoordToIndex(goalGridCoord);
+	constexpr float Unreached = FLT_MAX;
+	constexpr float Epsilon = 1e-3f;
+
+	FCellStruct& targetCell = InCurrentCellsArray[goalIndex];
+	targetCell.cost = 0;
+
+	TArray<float> Time;
+	Time.Init(Unreached, numCells);
+	Time[goalIndex] = 0.f;
+
+	TArray<uint8> InList;
+	InList.Init(0, numCells);
+
+	// 代价就是穿过该格的耗时，和整数距离场单位一致；陡坡两侧互不传播
+	auto IsOpenEdge = [&](int32 currentIndex, int32 neighborIndex, int32 i) -> bool
+		{
+			if (bIgnoreInternalObstacleCells && InCurrentCellsArray[neighborIndex].cost == 255) return false;
+			if (InCurrentCellsArray[neighborIndex].cost != 255 && (InState.SlopeMask[currentIndex] & (1 << i))) return false;
+			return true;
+		};
+
+	auto SolveCell = [&](int32 currentIndex) -> float
+		{
+			if (currentIndex == goalIndex) return 0.f;
+
+			const FCellStruct& currentCell = InCurrentCellsArray[currentIndex];
+			if (bIgnoreInternalObstacleCells && currentCell.cost == 255) return Unreached;
+
+			const int32 x = currentIndex / yNum;
+			const int32 y = currentIndex % yNum;
+
+			// 每条轴取较小的上游值 | smaller upwind value per axis
+			float axisMin[2] = { Unreached, Unreached };
+
+			for (int32 i = 0; i < 4; ++i)
+			{
+				const int32 nx = x + NeighborDX[i];
+				const int32 ny = y + NeighborDY[i];
+
+				if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) continue;
+
+				const int32 neighborIndex = nx * yNum + ny;
+				if (!IsOpenEdge(currentIndex, neighborIndex, i)) continue;
+
+				float& axis = axisMin[NeighborDX[i] != 0 ? 0 : 1];
+				axis = FMath::Min(axis, Time[neighborIndex]);
+			}
+
+			const float a = FMath::Min(axisMin[0], axisMin[1]);
+			const float b = FMath::Max(axisMin[0], axisMin[1]);
+			const float f = static_cast<float>(currentCell.cost);
+
+			if (a == Unreached) return Unreached;
+
+			// 只有一条轴可用，或两条轴相差太大时退化为一维
+			if (b == Unreached || b - a >= f) return a + f;
+
+			return 0.5f * (a + b + FMath::Sqrt(2.f * f * f - (a - b) * (a - b)));
+		};
+
+	TArray<int32> Active;
+	TArray<int32> NextActive;
+	TArray<float> Solved;
+	TArray<int32> Candidates;
+
+	const int32 goalX = goalIndex / yNum;
+	const int32 goalY = goalIndex % yNum;
+
+	for (int32 i = 0; i < 4; ++i)
+	{
+		const int32 nx = goalX + NeighborDX[i];
+		const int32 ny = goalY + NeighborDY[i];
+
+		if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) continue;
+
+		Active.Add(nx * yNum + ny);
+		InList[nx * yNum + ny] = 1;
+	}
+
+	while (Active.Num() > 0)
+	{
+		const int32 numActive = Active.Num();
+
+		// 1. 读旧值并行求解，写入单独的数组，避免线程间读写同一格
+		Solved.SetNumUninitialized(numActive);
 
-	initialCost = FMath::Clamp(initialCost, 0, 255);
+		ParallelFor(numActive, [&](int32 k)
+			{
+				Solved[k] = SolveCell(Active[k]);
+			});
 
-	// decal
-	Decal_Cells->DecalSize = FVector(halfSize.Z, halfSize.Y, halfSize.X);
-	Decal_Cells->SetRelativeLocation(FVector(0.f, 0.f, halfSize.Z));
+		// 2. 写回，区分已收敛的格子
+		NextActive.Reset();
+		Candidates.Reset();
 
-	// dynamic materials
-	if ((InitMode == EInitMode::Construction) || InitMode == EInitMode::BeginPlay)
-	{
-		if (IsValid(CellBaseMat))// for cell decal
+		for (int32 k = 0; k < numActive; ++k)
 		{
-			CellDMI = UMaterialInstanceDynamic::Create(CellBaseMat, this);
+			const int32 currentIndex = Active[k];
+			const float oldTime = Time[currentIndex];
+			const float newTime = FMath::Min(oldTime, Solved[k]);
+			Time[currentIndex] = newTime;
 
-			if (IsValid(CellDMI))
+			if (oldTime - newTime < Epsilon)
 			{
-				Decal_Cells->SetMaterial(0, CellDMI);
+				InList[currentIndex] = 0;
+				Candidates.Add(currentIndex);
+			}
+			else
+			{
+				NextActive.Add(currentIndex);
 			}
 		}
 
-		if (IsValid(ArrowBaseMat))// for arrow ism
+		// 3. 收敛格子的邻居如果能变小，加入下一轮
+		const int32 numConverged = Candidates.Num();
+		Solved.SetNumUninitialized(numConverged * 4);
+
+		ParallelFor(numConverged, [&](int32 k)
+			{
+				const int32 x = Candidates[k] / yNum;
+				const int32 y = Candidates[k] % yNum;
+
+				for (int32 i = 0; i < 4; ++i)
+				{
+					const int32 nx = x + NeighborDX[i];
+					const int32 ny = y + NeighborDY[i];
+					const int32 neighborIndex = nx * yNum + ny;
+
+					const bool bIsValid = nx >= 0 && nx < xNum && ny >= 0 && ny < yNum && !InList[neighborIndex];
+					Solved[k * 4 + i] = bIsValid ? SolveCell(neighborIndex) : Unreached;
+				}
+			});
+
+		for (int32 k = 0; k < numConverged; ++k)
 		{
-			ArrowDMI = UMaterialInstanceDynamic::Create(ArrowBaseMat, this);
+			const int32 x = Candidates[k] / yNum;
+			const int32 y = Candidates[k] % yNum;
 
-			if (IsValid(ArrowDMI))
+			for (int32 i = 0; i < 4; ++i)
 			{
-				ISM_Arrows->SetMaterial(0, ArrowDMI);
+				const float newTime = Solved[k * 4 + i];
+				if (newTime == Unreached) continue;
+
+				const int32 neighborIndex = (x + NeighborDX[i]) * yNum + (y + NeighborDY[i]);
+
+				if (!InList[neighborIndex] && newTime + Epsilon < Time[neighborIndex])
+				{
+					Time[neighborIndex] = newTime;
+					InList[neighborIndex] = 1;
+					NextActive.Add(neighborIndex);
+				}
 			}
 		}
 
-		//if (IsValid(DigitBaseMat))// for digit ism
-		//{
-		//	DigitDMI = UMaterialInstanceDynamic::Create(DigitBaseMat, this);
-
-		//	if (IsValid(DigitDMI))
-		//	{
-		//		ISM_Digits->SetMaterial(0, DigitDMI);
-		//	}
-		//}
+		Swap(Active, NextActive);
 	}
 
-	if (IsValid(CellDMI))
-	{
-		CellDMI->SetScalarParameterValue("XNum", xNum);
-		CellDMI->SetScalarParameterValue("YNum", yNum);
-		CellDMI->SetScalarParameterValue("CellSize", cellSize);
-		CellDMI->SetScalarParameterValue("OffsetX", offsetLoc.X);
-		CellDMI->SetScalarParameterValue("OffsetY", offsetLoc.Y);
-		CellDMI->SetScalarParameterValue("Yaw", actorRot.Yaw);
-	}
+	// 方向取到达时间的负梯度，每条轴用较小的上游差分
+	float yawSin, yawCos;
+	FMath::SinCos(&yawSin, &yawCos, FMath::DegreesToRadians(actorRot.Yaw));
+	const FVector axisX(yawCos, yawSin, 0);
+	const FVector axisY(-yawSin, yawCos, 0);
 
-	// toggle visibility of arrows, cells and digits
-	if ((InitMode == EInitMode::Construction && drawCellsInEditor) || (InitMode != EInitMode::Construction && drawCellsInGame))
-	{
-		Decal_Cells->SetVisibility(true);
-	}
-	else
-	{
-		Decal_Cells->SetVisibility(false);
-	}
+	ParallelFor(numCells, [&](int32 currentIndex)
+		{
+			FCellStruct& currentCell = InCurrentCellsArray[currentIndex];
+			const float currentTime = Time[currentIndex];
 
-	if ((InitMode == EInitMode::Construction && drawArrowsInEditor) || (InitMode != EInitMode::Construction && drawArrowsInGame))
-	{
-		ISM_Arrows->SetVisibility(true);
-	}
-	else
-	{
-		ISM_Arrows->SetVisibility(false);
-	}
+			currentCell.dist = currentTime == Unreached ? 65535 : FMath::Min(FMath::RoundToInt(currentTime), 65534);
+			currentCell.dir = FVector::ZeroVector;
 
-	//if ((InitMode == EInitMode::Construction && drawDigitsInEditor) || (InitMode != EInitMode::Construction && drawDigitsInGame))
-	//{
-	//	ISM_Digits->SetVisibility(true);
-	//}
-	//else
-	//{
-	//	ISM_Digits->SetVisibility(false);
-	//}
-}
+			if (currentTime == Unreached || currentIndex == goalIndex) return;
 
-void AFlowField::GetGoalLocation()
-{
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("GetGoalLocation");
+			const int32 x = currentIndex / yNum;
+			const int32 y = currentIndex % yNum;
 
-	if (IsValid(goalActor.Get()))
-	{
-		goalLocation = goalActor->GetActorLocation();
-		WorldToGrid(goalLocation, goalGridCoord);
-	}
-	else
-	{
-		WorldToGrid(goalLocation, goalGridCoord);
-	}
-}
+			float gradient[2] = { 0.f, 0.f };
+			float bestTime[2] = { currentTime, currentTime };
 
-void AFlowField::CreateGrid()
-{
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("CreateGrid");
+			for (int32 i = 0; i < 4; ++i)
+			{
+				const int32 nx = x + NeighborDX[i];
+				const int32 ny = y + NeighborDY[i];
 
-	if (!bIsGridDirty) return;
+				if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) continue;
 
-	InitialCellsArray.Empty();
-	CurrentCellsArray.Empty();
+				const int32 neighborIndex = nx * yNum + ny;
+				if (!IsOpenEdge(currentIndex, neighborIndex, i)) continue;
 
-	for (int x = 0; x < xNum; ++x)
-	{
-		for (int y = 0; y < yNum; ++y)
-		{
-			FVector2D gridCoord = FVector2D(x, y);
-			FCellStruct newCell = EnvQuery(gridCoord);
-			InitialCellsArray.Add(newCell);
-		}
-	}
+				const int32 axis = NeighborDX[i] != 0 ? 0 : 1;
+				const float neighborTime = Time[neighborIndex];
 
-	bIsGridDirty = false;
+				if (neighborTime < bestTime[axis])
+				{
+					bestTime[axis] = neighborTime;
+					gradient[axis] = (currentTime - neighborTime) * (axis == 0 ? NeighborDX[i] : NeighborDY[i]);
+				}
+			}
+
+			currentCell.dir = (axisX * gradient[0] + axisY * gradient[1]).GetSafeNormal();
+		});
 }
 
-void AFlowField::CalculateFlowField(TArray<FCellStruct>& InCurrentCellsArray)
+// 原优先队列实现，保留用于对照校验 | Original priority queue solver, kept for verification
+void AFlowField::SolveIntegrationFieldLegacy(TArray<FCellStruct>& InCurrentCellsArray)
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("CalculateFlowField");
-
-	int32 numCells = InCurrentCellsArray.Num();
-
 	auto IsValidCoord = [&](FVector2D gridCoord) -> bool { return gridCoord.X >= 0 && gridCoord.X < xNum && gridCoord.Y >= 0 && gridCoord.Y < yNum; };
 	auto IsValidDiagonal = [&](std::vector<FVector2D> neighborCoords, int32 indexA, int32 indexB) -> bool
 		{
@@ -368,75 +1878,243 @@ void AFlowField::CalculateFlowField(TArray<FCellStruct>& InCurrentCellsArray)
 			}
 		}
 	}
+}
+
+void AFlowField::CalculateDirections(TArray<FCellStruct>& InCurrentCellsArray, const FFlowFieldSolveState& InState) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("CreateFlowField");
+
+	ParallelFor(InCurrentCellsArray.Num(), [&](int32 currentIndex)
+		{
+			UpdateCellDirection(InCurrentCellsArray, InState, currentIndex);
+		});
+}
+
+void AFlowField::UpdateCellDirection(TArray<FCellStruct>& InCurrentCellsArray, const FFlowFieldSolveState& InState, int32 currentIndex) const
+{
+	const int32 x = currentIndex / yNum;
+	const int32 y = currentIndex % yNum;
+	FCellStruct& currentCell = InCurrentCellsArray[currentIndex];
+
+	const uint8 steepMask = currentCell.cost != 255 ? InState.SlopeMask[currentIndex] : 0;
+
+	int32 bestIndex = INDEX_NONE;
+	int32 bestDist = currentCell.dist;
+
+	for (int32 i = 0; i < 8; i++)
+	{
+		const int32 nx = x + NeighborDX[i];
+		const int32 ny = y + NeighborDY[i];
+
+		if (nx < 0 || nx >= xNum || ny < 0 || ny >= yNum) continue;
+
+		const int32 neighborIndex = nx * yNum + ny;
+		const FCellStruct& neighborCell = InCurrentCellsArray[neighborIndex];
+
+		if (bIgnoreInternalObstacleCells && neighborCell.cost == 255) continue;
+		if (i >= 4 && currentCell.cost != 255 && IsBlockedDiagonal(InCurrentCellsArray, x, y, i)) continue;
+		if (steepMask & (1 << i)) continue;
+
+		if (neighborCell.dist < bestDist)
+		{
+			bestIndex = neighborIndex;
+			bestDist = neighborCell.dist;
+		}
+	}
+
+	if (bestIndex != INDEX_NONE)
+	{
+		currentCell.dir = UKismetMathLibrary::GetDirectionUnitVector(currentCell.worldLoc, InCurrentCellsArray[bestIndex].worldLoc);
+	}
+	else
+	{
+		currentCell.dir = FVector::ZeroVector;
+	}
+}
+
+void AFlowField::PackCells(const TArray<FCellStruct>& InCellsArray, FFlowFieldPacked& OutPacked) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("PackCells");
+
+	const int32 numCells = InCellsArray.Num();
+	OutPacked.SetNum(numCells);
+
+	OutPacked.Origin = actorLoc;
+	OutPacked.Offset = offsetLoc;
+	OutPacked.CellSize = cellSize;
+	OutPacked.XNum = xNum;
+	OutPacked.YNum = yNum;
+	FMath::SinCos(&OutPacked.YawSin, &OutPacked.YawCos, FMath::DegreesToRadians(actorRot.Yaw));
+
+	ParallelFor(numCells, [&](int32 currentIndex)
+		{
+			OutPacked.SetCell(currentIndex, InCellsArray[currentIndex]);
+		});
+}
+
+FVector AFlowField::SampleDirection(const FVector& Location) const
+{
+	if (Packed.Num() == 0) return FVector::ZeroVector;
+
+	const FVector2f gridPos = GetGridPosition(Location);
+
+	// 周围四个格子，超出边界时夹到边缘
+	const int32 x0 = FMath::Clamp(FMath::FloorToInt(gridPos.X), 0, Packed.XNum - 1);
+	const int32 y0 = FMath::Clamp(FMath::FloorToInt(gridPos.Y), 0, Packed.YNum - 1);
+	const int32 x1 = FMath::Min(x0 + 1, Packed.XNum - 1);
+	const int32 y1 = FMath::Min(y0 + 1, Packed.YNum - 1);
+	const float tx = FMath::Clamp(gridPos.X - x0, 0.f, 1.f);
+	const float ty = FMath::Clamp(gridPos.Y - y0, 0.f, 1.f);
+
+	const int32 nearestIndex = FMath::Clamp(FMath::RoundToInt(gridPos.X), 0, Packed.XNum - 1) * Packed.YNum + FMath::Clamp(FMath::RoundToInt(gridPos.Y), 0, Packed.YNum - 1);
+
+	if (ActiveSectorSize > 0)
+	{
+		MarkSectorOccupied(nearestIndex);
+	}
+
+	const int32 corners[4] = { x0 * Packed.YNum + y0, x1 * Packed.YNum + y0, x0 * Packed.YNum + y1, x1 * Packed.YNum + y1 };
+	const float weights[4] = { (1.f - tx) * (1.f - ty), tx * (1.f - ty), (1.f - tx) * ty, tx * ty };
+
+	// 站在地面上时不混入障碍和空格子的方向，避免被拉向墙里
+	const bool bOnGround = Packed.Type[nearestIndex] == ECellType::Ground && Packed.Cost[nearestIndex] < 255;
+
+	float sumX = 0.f;
+	float sumY = 0.f;
+
+	for (int32 k = 0; k < 4; ++k)
+	{
+		const int32 index = corners[k];
+
+		if (bOnGround && (Packed.Type[index] != ECellType::Ground || Packed.Cost[index] == 255)) continue;
+
+		sumX += weights[k] * Packed.Dir[index].X;
+		sumY += weights[k] * Packed.Dir[index].Y;
+	}
 
+	// 方向互相抵消时退回最近格子的方向
+	if (FMath::Square(sumX) + FMath::Square(sumY) < 1.f)
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("CreateFlowField");
+		sumX = Packed.Dir[nearestIndex].X;
+		sumY = Packed.Dir[nearestIndex].Y;
+	}
+
+	return FVector(sumX, sumY, 0).GetSafeNormal2D();
+}
+
+bool AFlowField::SampleGround(const FVector& Location, float Radius, FVector& OutLocation, FVector& OutNormal) const
+{
+	if (Packed.Num() == 0) return false;
+
+	const FVector2f gridPos = GetGridPosition(Location);
+	const float gridRadius = FMath::Max(Radius, 0.f) / Packed.CellSize;
+
+	// 圆所覆盖的格子范围，只在网格内部搜索
+	const int32 minX = FMath::Max(FMath::RoundToInt(gridPos.X - gridRadius), 0);
+	const int32 maxX = FMath::Min(FMath::RoundToInt(gridPos.X + gridRadius), Packed.XNum - 1);
+	const int32 minY = FMath::Max(FMath::RoundToInt(gridPos.Y - gridRadius), 0);
+	const int32 maxY = FMath::Min(FMath::RoundToInt(gridPos.Y + gridRadius), Packed.YNum - 1);
+
+	int32 highestIndex = INDEX_NONE;
+	float highestHeight = -FLT_MAX;
 
-		ParallelFor(numCells, [&](int32 j)
+	// 先只比较高度，最后只解码一次位置和法线
+	for (int32 x = minX; x <= maxX; ++x)
+	{
+		const int32 rowStart = x * Packed.YNum;
+
+		for (int32 y = minY; y <= maxY; ++y)
+		{
+			const int32 index = rowStart + y;
+
+			if (Packed.Type[index] == ECellType::Empty) continue;
+
+			const float height = Packed.Height[index].GetFloat();
+
+			if (height > highestHeight)
 			{
-				int32 currentIndex = j;
-				FVector2D currentCoord = FVector2D(currentIndex / yNum, currentIndex % yNum);
-				FCellStruct& currentCell = InCurrentCellsArray[CoordToIndex(currentCoord)];
+				highestHeight = height;
+				highestIndex = index;
+			}
+		}
+	}
 
-				bool hasBestCell = false;
-				FCellStruct bestCell;
-				int32 bestDist = currentCell.dist;
+	if (highestIndex == INDEX_NONE) return false;
 
-				std::vector<FVector2D> neighborCoords =
-				{
-					currentCoord + FVector2D(0,-1),
-					currentCoord + FVector2D(1,0),
-					currentCoord + FVector2D(0,1),
-					currentCoord + FVector2D(-1,0),
-					currentCoord + FVector2D(1,-1),
-					currentCoord + FVector2D(1,1),
-					currentCoord + FVector2D(-1,1),
-					currentCoord + FVector2D(-1,-1),
-				};
+	OutLocation = GetCellLocation(highestIndex);
+	OutNormal = GetCellNormal(highestIndex);
 
-				for (int32 i = 0; i < 8; i++)
-				{
-					FVector2D neighborCoord = neighborCoords[i];
+	return true;
+}
 
-					if (!IsValidCoord(neighborCoord)) continue;
+void FFlowFieldPacked::SetCell(int32 Index, const FCellStruct& Cell)
+{
+	Dir[Index] = EncodeDir(Cell.dir);
 
-					FCellStruct& neighborCell = InCurrentCellsArray[CoordToIndex(neighborCoord)];
+	Height[Index] = Cell.type == ECellType::Empty ? 0.f : Cell.worldLoc.Z - Origin.Z;
+	Normal[Index] = EncodeNormal(Cell.normal);
+	Cost[Index] = static_cast<uint8>(FMath::Clamp(Cell.cost, 0, 255));
+	Type[Index] = Cell.type;
+}
 
-					if (bIgnoreInternalObstacleCells && neighborCell.cost == 255) continue;
+void FFlowFieldPacked::SetNum(int32 NumCells)
+{
+	Dir.SetNumUninitialized(NumCells);
+	Height.SetNumUninitialized(NumCells);
+	Normal.SetNumUninitialized(NumCells);
+	Cost.SetNumUninitialized(NumCells);
+	Type.SetNumUninitialized(NumCells);
+}
 
-					if (currentCell.cost != 255)
-					{
-						if (i == 4 && !IsValidDiagonal(neighborCoords, 0, 1)) continue;
-						if (i == 5 && !IsValidDiagonal(neighborCoords, 1, 2)) continue;
-						if (i == 6 && !IsValidDiagonal(neighborCoords, 2, 3)) continue;
-						if (i == 7 && !IsValidDiagonal(neighborCoords, 3, 0)) continue;
-					}
+void FFlowFieldPacked::Empty()
+{
+	Dir.Empty();
+	Height.Empty();
+	Normal.Empty();
+	Cost.Empty();
+	Type.Empty();
+}
 
-					float heightDifference = FMath::Abs(currentCell.worldLoc.Z - neighborCell.worldLoc.Z);
-					float horizontalDistance = FVector2D::Distance(FVector2D(currentCell.worldLoc.X, currentCell.worldLoc.Y), FVector2D(neighborCell.worldLoc.X, neighborCell.worldLoc.Y));
-					float slopeAngle = FMath::RadiansToDegrees(FMath::Atan(heightDifference / horizontalDistance));
+FFlowFieldPacked::FDir FFlowFieldPacked::EncodeDir(const FVector& Dir)
+{
+	const FVector Dir2D = Dir.GetSafeNormal2D();
+	return { static_cast<int8>(FMath::RoundToInt(Dir2D.X * 127.f)), static_cast<int8>(FMath::RoundToInt(Dir2D.Y * 127.f)) };
+}
 
-					if (slopeAngle > maxWalkableAngle && currentCell.cost != 255) continue;
+uint16 FFlowFieldPacked::EncodeNormal(const FVector& Normal)
+{
+	// 八面体映射：单位向量投影到八面体再展开成正方形
+	const FVector N = Normal.GetSafeNormal(UE_SMALL_NUMBER, FVector::UpVector);
+	const float L1 = FMath::Abs(N.X) + FMath::Abs(N.Y) + FMath::Abs(N.Z);
 
-					if (neighborCell.dist < bestDist)
-					{
-						hasBestCell = true;
-						bestCell = neighborCell;
-						bestDist = neighborCell.dist;
-					}
-				}
+	float U = N.X / L1;
+	float V = N.Y / L1;
 
-				if (hasBestCell)
-				{
-					currentCell.dir = UKismetMathLibrary::GetDirectionUnitVector(currentCell.worldLoc, bestCell.worldLoc);
-				}
-				else
-				{
-					currentCell.dir = FVector::ZeroVector;
-				}
-			});
+	if (N.Z < 0)
+	{
+		const float OldU = U;
+		U = (1.f - FMath::Abs(V)) * (OldU >= 0 ? 1.f : -1.f);
+		V = (1.f - FMath::Abs(OldU)) * (V >= 0 ? 1.f : -1.f);
 	}
 
+	const uint16 QU = static_cast<uint16>(FMath::RoundToInt((U * 0.5f + 0.5f) * 255.f));
+	const uint16 QV = static_cast<uint16>(FMath::RoundToInt((V * 0.5f + 0.5f) * 255.f));
+
+	return static_cast<uint16>((QU << 8) | QV);
+}
+
+FVector FFlowFieldPacked::DecodeNormal(uint16 Encoded)
+{
+	const float U = ((Encoded >> 8) / 255.f) * 2.f - 1.f;
+	const float V = ((Encoded & 0xFF) / 255.f) * 2.f - 1.f;
+
+	FVector N(U, V, 1.f - FMath::Abs(U) - FMath::Abs(V));
+	const float T = FMath::Max(-N.Z, 0.f);
+
+	N.X += N.X >= 0 ? -T : T;
+	N.Y += N.Y >= 0 ? -T : T;
+
+	return N.GetSafeNormal();
 }
 
 void AFlowField::DrawCells(EInitMode InitMode)
@@ -616,38 +2294,46 @@ void AFlowField::UpdateTimer()
 	}
 }
    
-FCellStruct AFlowField::EnvQuery(const FVector2D gridCoord) 
+FVector AFlowField::GetGridCellCenter(const FVector2D gridCoord) const
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("EnvQuery");
+	FVector2D worldLoc2D = FVector2D(gridCoord.X * cellSize + relativeLoc.X + (cellSize / 2.f), gridCoord.Y * cellSize + relativeLoc.Y + (cellSize / 2.f));
+	FVector worldLoc = FVector(worldLoc2D, actorLoc.Z);
+	return (worldLoc - actorLoc).RotateAngleAxis(actorRot.Yaw, FVector(0, 0, 1)) + actorLoc;
+}
 
+// 在工作线程上并行调用，只读取 PrepareEnvQuery 准备好的查询参数
+FCellStruct AFlowField::EnvQuery(const FVector2D gridCoord) const
+{
 	FCellStruct newCell;
 
 	newCell.gridCoord = gridCoord;
 
-	FVector2D worldLoc2D = FVector2D(gridCoord.X * cellSize + relativeLoc.X + (cellSize / 2.f), gridCoord.Y * cellSize + relativeLoc.Y + (cellSize / 2.f));
-	FVector worldLoc = FVector(worldLoc2D, actorLoc.Z);
-	worldLoc = (worldLoc - actorLoc).RotateAngleAxis(actorRot.Yaw, FVector(0, 0, 1)) + actorLoc;
+	FVector worldLoc = GetGridCellCenter(gridCoord);
 
-	// Array of actors for trace to ignore
-	TArray<AActor*> IgnoreActors;
+	const UWorld* World = GetWorld();
+
+	auto TraceObstacle = [&](FHitResult& ObstacleHitResult)
+		{
+			return ObstacleObjectParams.IsValid() && World->SweepSingleByObjectType(
+				ObstacleHitResult,
+				FVector(worldLoc.X, worldLoc.Y, actorLoc.Z + flowFieldSize.Z),
+				FVector(worldLoc.X, worldLoc.Y, actorLoc.Z),
+				FQuat::Identity,
+				ObstacleObjectParams,
+				FCollisionShape::MakeSphere(cellSize / 2.f),
+				EnvQueryParams);
+		};
 
 	if (traceGround)
 	{
 		FHitResult GroundHitResult;
 
-		bool hitGround = UKismetSystemLibrary::LineTraceSingleForObjects(
-			GetWorld(),
+		bool hitGround = GroundObjectParams.IsValid() && World->LineTraceSingleByObjectType(
+			GroundHitResult,
 			FVector(worldLoc.X, worldLoc.Y, actorLoc.Z + flowFieldSize.Z),
 			FVector(worldLoc.X, worldLoc.Y, actorLoc.Z),
-			groundObjectType,
-			true,
-			IgnoreActors,
-			EDrawDebugTrace::None,
-			GroundHitResult,
-			true,
-			FLinearColor::Gray,
-			FLinearColor::Blue,
-			3);
+			GroundObjectParams,
+			EnvQueryParams);
 
 		if (hitGround)
 		{
@@ -667,20 +2353,7 @@ FCellStruct AFlowField::EnvQuery(const FVector2D gridCoord)
 			else if (traceObstacles)
 			{
 				FHitResult ObstacleHitResult;
-				bool hitObstacle = UKismetSystemLibrary::SphereTraceSingleForObjects(
-					GetWorld(),
-					FVector(worldLoc.X, worldLoc.Y, actorLoc.Z + flowFieldSize.Z),
-					FVector(worldLoc.X, worldLoc.Y, actorLoc.Z),
-					cellSize / 2.f,
-					obstacleObjectType,
-					true,
-					IgnoreActors,
-					EDrawDebugTrace::None,
-					ObstacleHitResult,
-					true,
-					FLinearColor::Gray,
-					FLinearColor::Red,
-					1);
+				bool hitObstacle = TraceObstacle(ObstacleHitResult);
 
 				if (hitObstacle)
 				{
@@ -736,20 +2409,7 @@ FCellStruct AFlowField::EnvQuery(const FVector2D gridCoord)
 		if (traceObstacles)
 		{
 			FHitResult ObstacleHitResult;
-			bool hitObstacle = UKismetSystemLibrary::SphereTraceSingleForObjects(
-				GetWorld(),
-				FVector(worldLoc.X, worldLoc.Y, actorLoc.Z + flowFieldSize.Z),
-				FVector(worldLoc.X, worldLoc.Y, actorLoc.Z),
-				cellSize / 2.f,
-				obstacleObjectType,
-				true,
-				IgnoreActors,
-				EDrawDebugTrace::None,
-				ObstacleHitResult,
-				true,
-				FLinearColor::Gray,
-				FLinearColor::Red,
-				1);
+			bool hitObstacle = TraceObstacle(ObstacleHitResult);
 
 			if (hitObstacle)
 			{
@@ -792,4 +2452,73 @@ FCellStruct AFlowField::EnvQuery(const FVector2D gridCoord)
 
 	newCell.worldLoc = worldLoc;
 	return newCell;
-}
\ No newline at end of file
+}
+
+//--------------------------------------------------------Verification-----------------------------------------------------------------
+
+// FFCanvas.VerifySolver
+// 可选的基准：对场景中每个流场分别用分桶队列与原优先队列求解并输出耗时，顺带比较 dist；两者的一致性由自动化测试 FFCanvas.FlowField.SolverEquality 保证
+static FAutoConsoleCommand VerifySolverCommand
+(
+	TEXT("FFCanvas.VerifySolver"),
+	TEXT("Optional benchmark: time the bucket queue and the original priority queue on every loaded flow field and log any cells whose integration values differ. Correctness is covered by the FFCanvas.FlowField.SolverEquality automation test."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		for (TObjectIterator<AFlowField> It; It; ++It)
+		{
+			AFlowField* FlowField = *It;
+
+			if (!IsValid(FlowField) || FlowField->IsTemplate() || FlowField->bIsUpdatePending || FlowField->InitialCellsArray.Num() != FlowField->xNum * FlowField->yNum || FlowField->InitialCellsArray.IsEmpty()) continue;
+
+			TArray<FCellStruct> LegacyCells = FlowField->InitialCellsArray;
+			TArray<FCellStruct> BucketCells = FlowField->InitialCellsArray;
+
+			// 用独立的求解数据，不动流场自己的坡度掩码和分桶队列
+			FFlowFieldSolveState VerifyState;
+			FlowField->BuildSlopeMask(BucketCells, VerifyState);
+
+			const double LegacyStart = FPlatformTime::Seconds();
+			FlowField->SolveIntegrationFieldLegacy(LegacyCells);
+			const double LegacyMs = (FPlatformTime::Seconds() - LegacyStart) * 1000.0;
+
+			const double BucketStart = FPlatformTime::Seconds();
+			FlowField->SolveIntegrationField(BucketCells, VerifyState);
+			const double BucketMs = (FPlatformTime::Seconds() - BucketStart) * 1000.0;
+
+			int32 Mismatches = 0;
+
+			for (int32 i = 0; i < LegacyCells.Num(); ++i)
+			{
+				if (LegacyCells[i].dist != BucketCells[i].dist)
+				{
+					if (Mismatches < 8)
+					{
+						UE_LOG(LogTemp, Warning, TEXT("FFCanvas.VerifySolver: %s cell (%d, %d) legacy %d bucket %d"),
+							*FlowField->GetName(), i / FlowField->yNum, i % FlowField->yNum, LegacyCells[i].dist, BucketCells[i].dist);
+					}
+
+					++Mismatches;
+				}
+			}
+
+			UE_LOG(LogTemp, Log, TEXT("FFCanvas.VerifySolver: %s %dx%d | legacy %.3f ms | bucket %.3f ms | %s"),
+				*FlowField->GetName(), FlowField->xNum, FlowField->yNum, LegacyMs, BucketMs,
+				Mismatches == 0 ? TEXT("identical") : *FString::Printf(TEXT("%d cells differ"), Mismatches));
+		}
+	})
+);
+
+// FFCanvas.ClearGridCache
+// 删除 bCacheGridToDisk 保存的网格，关卡几何改动后需要执行
+static FAutoConsoleCommand ClearGridCacheCommand
+(
+	TEXT("FFCanvas.ClearGridCache"),
+	TEXT("Delete the traced grids saved by bCacheGridToDisk. Run it after editing level geometry."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		const FString CacheDir = FPaths::ProjectSavedDir() / TEXT("FlowFieldCache");
+		const bool bDeleted = IFileManager::Get().DeleteDirectory(*CacheDir, false, true);
+
+		UE_LOG(LogTemp, Log, TEXT("FFCanvas.ClearGridCache: %s %s"), *CacheDir, bDeleted ? TEXT("deleted") : TEXT("not found"));
+	})
+);
@@ -0,0 +1,89 @@
+// LeroyWorks 2024 All Rights Reserved.
+
+#include "FlowFieldBakedGrid.h"
+#include "FlowField.h"
+
+namespace
+{
+	// 每格8字节：高度4 + 法线2 + 代价1 + 类型1，按对齐从大到小排列，格子数为奇数时各通道也保持对齐
+	constexpr int32 BytesPerCell = sizeof(float) + sizeof(uint16) + sizeof(uint8) + sizeof(uint8);
+
+	// 通道布局变化时递增，旧的烘焙数据会被丢弃并重新检测
+	constexpr int32 LayoutVersion = 1;
+}
+
+void UFlowFieldBakedGrid::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	GridData.Serialize(Ar, this);
+}
+
+bool UFlowFieldBakedGrid::Unpack(const AFlowField& FlowField, TArray<FCellStruct>& OutCells) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("UnpackBakedGrid");
+
+	const int32 numCells = XNum * YNum;
+
+	if (Version != LayoutVersion) return false;
+	if (XNum != FlowField.xNum || YNum != FlowField.yNum || SettingsHash != static_cast<int32>(FlowField.GetGridSettingsHash())) return false;
+	if (numCells == 0 || GridData.GetBulkDataSize() != int64(numCells) * BytesPerCell) return false;
+
+	const float* Height = static_cast<const float*>(GridData.LockReadOnly());
+	const uint16* Normal = reinterpret_cast<const uint16*>(Height + numCells);
+	const uint8* Cost = reinterpret_cast<const uint8*>(Normal + numCells);
+	const uint8* Type = Cost + numCells;
+
+	OutCells.SetNum(numCells);
+
+	ParallelFor(numCells, [&](int32 index)
+		{
+			FCellStruct& cell = OutCells[index];
+			cell.gridCoord = FVector2D(index / YNum, index % YNum);
+			cell.worldLoc = FlowField.GetGridCellCenter(cell.gridCoord);
+			cell.worldLoc.Z = Type[index] == uint8(ECellType::Empty) ? -FLT_MAX : Height[index];
+			cell.normal = FFlowFieldPacked::DecodeNormal(Normal[index]);
+			cell.cost = Cost[index];
+			cell.type = static_cast<ECellType>(Type[index]);
+		});
+
+	GridData.Unlock();
+
+	return true;
+}
+
+void UFlowFieldBakedGrid::Store(const AFlowField& FlowField, const TArray<FCellStruct>& Cells)
+{
+	Version = LayoutVersion;
+	XNum = FlowField.xNum;
+	YNum = FlowField.yNum;
+	SettingsHash = static_cast<int32>(FlowField.GetGridSettingsHash());
+
+	const int32 numCells = Cells.Num();
+
+	GridData.Lock(LOCK_READ_WRITE);
+
+	float* Height = static_cast<float*>(GridData.Realloc(int64(numCells) * BytesPerCell));
+	uint16* Normal = reinterpret_cast<uint16*>(Height + numCells);
+	uint8* Cost = reinterpret_cast<uint8*>(Normal + numCells);
+	uint8* Type = Cost + numCells;
+
+	for (int32 index = 0; index < numCells; ++index)
+	{
+		const FCellStruct& cell = Cells[index];
+		Cost[index] = static_cast<uint8>(FMath::Clamp(cell.cost, 0, 255));
+		Type[index] = static_cast<uint8>(cell.type);
+		Height[index] = cell.type == ECellType::Empty ? 0.f : float(cell.worldLoc.Z);
+		Normal[index] = FFlowFieldPacked::EncodeNormal(cell.normal);
+	}
+
+	GridData.Unlock();
+
+	// 数据放在导出之外，加载关卡时不读取
+	GridData.SetBulkDataFlags(BULKDATA_Force_NOT_InlinePayload);
+}
+
+int64 UFlowFieldBakedGrid::GetBakedBytes() const
+{
+	return GridData.GetBulkDataSize();
+}
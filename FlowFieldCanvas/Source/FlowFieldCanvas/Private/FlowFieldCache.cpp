@@ -0,0 +1,212 @@
+// LeroyWorks 2024 All Rights Reserved.
+
+#include "FlowFieldCache.h"
+#include "Async/ParallelFor.h"
+
+void UFlowFieldCache::Tick(float DeltaTime)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("FlowFieldCacheTick");
+
+	struct FSolveJob
+	{
+		FFlowFieldGoalKey Key;
+		const AFlowField* Source = nullptr;
+		FVector GoalLocation = FVector::ZeroVector;
+		int32 GoalIndex = INDEX_NONE;
+		TArray<FFlowFieldPacked::FDir> Dir;
+	};
+
+	TArray<FSolveJob> Jobs;
+
+	DrainRequestQueue();
+
+	// 每帧最多取 MaxSolvesPerTick 个请求，其余留到下一帧
+	for (auto It = PendingRequests.CreateIterator(); It && Jobs.Num() < FMath::Max(MaxSolvesPerTick, 1); ++It)
+	{
+		const AFlowField* Source = It->Value.Source.Get();
+
+		// 源流场正在后台求解时，发布前后的代价网格和坡度掩码会互换，请求留到发布之后
+		if (IsValid(Source) && Source->bIsUpdatePending) continue;
+
+		// 源流场的代价网格和坡度掩码必须已经就绪
+		if (IsValid(Source) && Source->Packed.Num() > 0 && Source->CurrentCellsArray.Num() == Source->Packed.Num() && Source->Solve.SlopeMask.Num() == Source->Packed.Num())
+		{
+			FSolveJob& Job = Jobs.AddDefaulted_GetRef();
+			Job.Key = It->Key;
+			Job.Source = Source;
+			Job.GoalLocation = It->Value.GoalLocation;
+			Source->GetCellIndexAtLocation(Job.GoalLocation, Job.GoalIndex);
+		}
+
+		It.RemoveCurrent();
+	}
+
+	if (Jobs.Num() > 0)
+	{
+		// 不同目标之间互不依赖，并行求解
+		ParallelFor(Jobs.Num(), [&](int32 k)
+			{
+				Jobs[k].Source->SolveGoalField(Jobs[k].GoalIndex, Jobs[k].Dir);
+			});
+
+		for (FSolveJob& Job : Jobs)
+		{
+			FFlowFieldGoalField& Field = Fields.FindOrAdd(Job.Key);
+			Field.Dir = MoveTemp(Job.Dir);
+			Field.GoalLocation = Job.GoalLocation;
+			Field.GoalIndex = Job.GoalIndex;
+			Field.CostVersion = Job.Source->CostVersion;
+			Field.LastUsed = static_cast<uint32>(GFrameCounter);
+		}
+	}
+
+	EvictOverBudget();
+}
+
+TStatId UFlowFieldCache::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UFlowFieldCache, STATGROUP_Tickables);
+}
+
+void UFlowFieldCache::Deinitialize()
+{
+	ClearCache();
+
+	Super::Deinitialize();
+}
+
+const FFlowFieldGoalField* UFlowFieldCache::RequestField(const AFlowField* Source, uint64 GoalId, const FVector& GoalLocation)
+{
+	if (!Source || Source->Packed.Num() == 0) return nullptr;
+
+	const FFlowFieldGoalKey Key{ Source, GoalId };
+
+	// 查找是只读的，缓存只在子系统 Tick 中修改，返回的指针在下一次 Tick 前有效
+	FFlowFieldGoalField* Field = Fields.Find(Key);
+
+	int32 goalIndex = INDEX_NONE;
+	Source->GetCellIndexAtLocation(GoalLocation, goalIndex);
+
+	const bool bIsReady = Field && Field->Dir.Num() == Source->Packed.Num();
+
+	if (Field)
+	{
+		FPlatformAtomics::AtomicStore_Relaxed(reinterpret_cast<volatile int32*>(&Field->LastUsed), static_cast<int32>(GFrameCounter));
+	}
+
+	// 目标换了格子或代价变了，旧流场继续用，同时排队重算；同一目标每帧只入队一次
+	if (!bIsReady || Field->GoalIndex != goalIndex || Field->CostVersion != Source->CostVersion)
+	{
+		const int32 Frame = static_cast<int32>(GFrameCounter);
+		bool bFirstThisFrame = false;
+
+		if (Field)
+		{
+			bFirstThisFrame = FPlatformAtomics::InterlockedExchange(reinterpret_cast<volatile int32*>(&Field->RequestedFrame), Frame) != Frame;
+		}
+		else
+		{
+			// 读锁下表项地址不变，已有表项只做原子交换；没有时才加写锁插入
+			uint32* RequestedFrame = nullptr;
+
+			{
+				FReadScopeLock ReadLock(MissingLock);
+				RequestedFrame = MissingRequestedFrames.Find(Key);
+
+				if (RequestedFrame)
+				{
+					bFirstThisFrame = FPlatformAtomics::InterlockedExchange(reinterpret_cast<volatile int32*>(RequestedFrame), Frame) != Frame;
+				}
+			}
+
+			if (!RequestedFrame)
+			{
+				FWriteScopeLock WriteLock(MissingLock);
+				uint32& Stamp = MissingRequestedFrames.FindOrAdd(Key, 0);
+				bFirstThisFrame = Stamp != static_cast<uint32>(Frame);
+				Stamp = Frame;
+			}
+		}
+
+		if (bFirstThisFrame)
+		{
+			RequestQueue.Enqueue({ Key, { Source, GoalLocation } });
+		}
+	}
+
+	return bIsReady ? Field : nullptr;
+}
+
+void UFlowFieldCache::DrainRequestQueue()
+{
+	// 同一目标的多个请求合并，保留最后一次的位置
+	FQueuedRequest Queued;
+
+	while (RequestQueue.Dequeue(Queued))
+	{
+		PendingRequests.Add(Queued.Key, Queued.Request);
+	}
+
+	// 已经入队的目标留在 PendingRequests 里，下一帧再请求时重新入队一次
+	FWriteScopeLock WriteLock(MissingLock);
+	MissingRequestedFrames.Reset();
+}
+
+void UFlowFieldCache::ClearCache()
+{
+	DrainRequestQueue();
+
+	Fields.Empty();
+	PendingRequests.Empty();
+}
+
+int64 UFlowFieldCache::GetCacheBytes() const
+{
+	int64 Bytes = 0;
+
+	for (const TPair<FFlowFieldGoalKey, FFlowFieldGoalField>& Pair : Fields)
+	{
+		Bytes += Pair.Value.Dir.GetAllocatedSize();
+	}
+
+	return Bytes;
+}
+
+void UFlowFieldCache::EvictOverBudget()
+{
+	// 源流场已销毁的直接丢弃
+	for (auto It = Fields.CreateIterator(); It; ++It)
+	{
+		if (!It->Key.Source.ResolveObjectPtr())
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	const int64 Budget = static_cast<int64>(FMath::Max(MemoryBudgetMB, 1)) * 1024 * 1024;
+	int64 Bytes = GetCacheBytes();
+
+	if (Bytes <= Budget) return;
+
+	// 按最近使用时间从旧到新淘汰
+	TArray<TPair<uint32, FFlowFieldGoalKey>> ByAge;
+	ByAge.Reserve(Fields.Num());
+
+	for (const TPair<FFlowFieldGoalKey, FFlowFieldGoalField>& Pair : Fields)
+	{
+		ByAge.Add({ Pair.Value.LastUsed, Pair.Key });
+	}
+
+	ByAge.Sort([](const TPair<uint32, FFlowFieldGoalKey>& A, const TPair<uint32, FFlowFieldGoalKey>& B) { return A.Key < B.Key; });
+
+	for (const TPair<uint32, FFlowFieldGoalKey>& Entry : ByAge)
+	{
+		if (Bytes <= Budget) break;
+
+		if (const FFlowFieldGoalField* Field = Fields.Find(Entry.Value))
+		{
+			Bytes -= Field->Dir.GetAllocatedSize();
+			Fields.Remove(Entry.Value);
+		}
+	}
+}
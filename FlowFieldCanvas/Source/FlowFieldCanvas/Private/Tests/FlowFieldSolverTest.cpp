@@ -0,0 +1,139 @@
+// LeroyWorks 2024 All Rights Reserved.
+
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Math/RandomStream.h"
+#include "UObject/Package.h"
+#include "FlowField.h"
+
+namespace
+{
+	constexpr int32 TestXNum = 24;
+	constexpr int32 TestYNum = 20;
+	constexpr float TestCellSize = 100.f;
+
+	// 合成网格：随机代价、带缺口的墙、只在对角相接的障碍、散布的障碍、陡坡带和缓坡区
+	void BuildSyntheticGrid(TArray<FCellStruct>& OutCells)
+	{
+		FRandomStream Stream(2024);
+		OutCells.SetNum(TestXNum * TestYNum);
+
+		for (int32 x = 0; x < TestXNum; ++x)
+		{
+			for (int32 y = 0; y < TestYNum; ++y)
+			{
+				FCellStruct& Cell = OutCells[x * TestYNum + y];
+				Cell.gridCoord = FVector2D(x, y);
+				Cell.cost = 1 + Stream.RandHelper(4);
+				Cell.dist = 65535;
+				Cell.type = ECellType::Ground;
+
+				// 8~11列、6~13行沿y方向每格升高120，坡度约50度，超过45度的可行走坡度；16列以后是约22度的缓坡
+				float Height = 0.f;
+
+				if (x >= 8 && x <= 11 && y >= 6 && y <= 13)
+				{
+					Height = (y - 6) * 120.f;
+				}
+				else if (x >= 16)
+				{
+					Height = (x - 16) * 40.f;
+				}
+
+				Cell.worldLoc = FVector(x * TestCellSize, y * TestCellSize, Height);
+
+				const bool bWall = x == 5 && y < 15;
+				const bool bDiagonalPinch = (x == 14 && y == 4) || (x == 15 && y == 5) || (x == 14 && y == 10) || (x == 13 && y == 11);
+				const bool bScattered = Stream.FRand() < 0.05f;
+
+				if (bWall || bDiagonalPinch || bScattered)
+				{
+					Cell.cost = 255;
+					Cell.type = ECellType::Obstacle;
+				}
+			}
+		}
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FFlowFieldSolverEqualityTest, "FFCanvas.FlowField.SolverEquality", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FFlowFieldSolverEqualityTest::RunTest(const FString& Parameters)
+{
+	AFlowField* FlowField = NewObject<AFlowField>(GetTransientPackage());
+	FlowField->xNum = TestXNum;
+	FlowField->yNum = TestYNum;
+	FlowField->cellSize = TestCellSize;
+	FlowField->maxWalkableAngle = 45.f;
+
+	TArray<FCellStruct> InitialCells;
+	BuildSyntheticGrid(InitialCells);
+
+	const FVector2D Goals[] = { FVector2D(2, 2), FVector2D(20, 17), FVector2D(12, 18) };
+
+	for (const EStyle Style : { EStyle::AdjacentFirst, EStyle::DiagonalFirst })
+	{
+		for (const bool bIgnoreInternalObstacleCells : { false, true })
+		{
+			for (const FVector2D& Goal : Goals)
+			{
+				FlowField->Style = Style;
+				FlowField->bIgnoreInternalObstacleCells = bIgnoreInternalObstacleCells;
+				FlowField->goalGridCoord = Goal;
+
+				const FString Case = FString::Printf(TEXT("%s IgnoreInternalObstacles=%d Goal=(%.0f, %.0f)"),
+					Style == EStyle::AdjacentFirst ? TEXT("AdjacentFirst") : TEXT("DiagonalFirst"), bIgnoreInternalObstacleCells ? 1 : 0, Goal.X, Goal.Y);
+
+				TArray<FCellStruct> LegacyCells = InitialCells;
+				TArray<FCellStruct> BucketCells = InitialCells;
+
+				// 坡度掩码只依赖网格，两边的方向都按同一份掩码计算
+				FFlowFieldSolveState State;
+				FlowField->BuildSlopeMask(BucketCells, State);
+
+				FlowField->SolveIntegrationFieldLegacy(LegacyCells);
+				FlowField->SolveIntegrationField(BucketCells, State);
+
+				FlowField->CalculateDirections(LegacyCells, State);
+				FlowField->CalculateDirections(BucketCells, State);
+
+				int32 DistMismatches = 0;
+				int32 DirMismatches = 0;
+				int32 Reached = 0;
+
+				for (int32 i = 0; i < LegacyCells.Num(); ++i)
+				{
+					if (LegacyCells[i].dist != BucketCells[i].dist)
+					{
+						if (DistMismatches == 0)
+						{
+							AddError(FString::Printf(TEXT("%s: cell (%d, %d) legacy dist %d bucket dist %d"),
+								*Case, i / TestYNum, i % TestYNum, LegacyCells[i].dist, BucketCells[i].dist));
+						}
+
+						++DistMismatches;
+					}
+
+					if (!LegacyCells[i].dir.Equals(BucketCells[i].dir, 0.f))
+					{
+						++DirMismatches;
+					}
+
+					Reached += BucketCells[i].dist != 65535;
+				}
+
+				TestEqual(*FString::Printf(TEXT("%s: cells with a different dist"), *Case), DistMismatches, 0);
+				TestEqual(*FString::Printf(TEXT("%s: cells with a different direction"), *Case), DirMismatches, 0);
+
+				// 防止网格被障碍或坡度完全隔断而只比较了一堆未到达的格子
+				TestTrue(*FString::Printf(TEXT("%s: the goal reaches most of the grid"), *Case), Reached > LegacyCells.Num() / 2);
+			}
+		}
+	}
+
+	return true;
+}
+
+#endif
@@ -15,7 +15,9 @@
 
 #include "Engine/World.h"
 #include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
 #include "Templates/Atomic.h"
+#include "Math/Float16.h"
 #include "Components/InstancedStaticMeshComponent.h"
 #include "Components/DecalComponent.h"
 #include "Components/BillboardComponent.h"
@@ -88,6 +90,103 @@ USTRUCT(BlueprintType) struct FCellStruct
 };
 
 
+//--------------------------Packed-----------------------------
+
+// Runtime copy of the solved field with one array per channel, about 8 bytes per cell instead of ~100.
+// Agents sample it every frame, so each lookup only touches the channel it needs.
+struct FLOWFIELDCANVAS_API FFlowFieldPacked
+{
+	struct FDir
+	{
+		int8 X = 0;
+		int8 Y = 0;
+	};
+
+	TArray<FDir> Dir;			// horizontal direction, components scaled by 127
+	TArray<FFloat16> Height;	// ground height relative to the actor
+	TArray<uint16> Normal;		// octahedral encoded, 8 bits per axis
+	TArray<uint8> Cost;
+	TArray<ECellType> Type;
+
+	// Grid layout the buffer was built with. It is swapped together with the data, so lookups never mix two solves.
+	FVector Origin = FVector::ZeroVector;
+	FVector Offset = FVector::ZeroVector;
+	float CellSize = 1.f;
+	float YawSin = 0.f;
+	float YawCos = 1.f;
+	int32 XNum = 0;
+	int32 YNum = 0;
+
+	FORCEINLINE int32 Num() const { return Cost.Num(); }
+
+	void SetNum(int32 NumCells);
+	void Empty();
+	void SetCell(int32 Index, const FCellStruct& Cell);
+
+	static FDir EncodeDir(const FVector& Dir);
+	static uint16 EncodeNormal(const FVector& Normal);
+	static FVector DecodeNormal(uint16 Encoded);
+};
+
+
+class UFlowFieldBakedGrid;
+
+
+//--------------------------Solve-----------------------------
+
+// Scratch buffers and settings of one full solve. The async solve owns a second copy and the two swap when it publishes,
+// so the background task never touches what the game thread repairs or samples.
+struct FFlowFieldSolveState
+{
+	// 坡度过陡的邻居方向，每格8位，网格重建或坡度阈值变化时重算
+	TArray<uint8> SlopeMask;
+	float SlopeMaskAngle = -1.f;
+	uint32 SlopeGridVersion = 0;
+
+	TArray<TArray<int32>> BucketQueue;
+
+	// 求解时的条件，用于判断能否跳过或局部修复
+	int32 SolvedGoalIndex = INDEX_NONE;
+	EStyle SolvedStyle = EStyle::AdjacentFirst;
+	bool bSolvedIgnoreInternalObstacleCells = false;
+	bool bSolvedEikonal = false;
+};
+
+
+//--------------------------Sectors-----------------------------
+
+// Hierarchical mode splits the grid into square sectors. Every run of passable cell pairs along a shared sector edge
+// becomes two portal nodes, one per side. Nodes 2k and 2k+1 are partners.
+struct FFlowFieldPortalNode
+{
+	int32 Sector = INDEX_NONE;
+	int32 Slot = INDEX_NONE;	// position in the sector's node list
+	int32 Cell = INDEX_NONE;	// cheapest crossing of the window, used by the abstract search
+	TArray<int32> Window;		// cells on this side, paired by order with the partner's window
+};
+
+struct FFlowFieldSector
+{
+	int32 MinX = 0;
+	int32 MinY = 0;
+	int32 SizeX = 0;
+	int32 SizeY = 0;
+
+	TArray<int32> Nodes;
+	TArray<int32> NodeDist;			// node to node distances inside the sector, filled the first time the abstract search crosses it
+	int32 AppliedExit = MIN_int32;	// exit whose directions are currently in the packed buffer
+
+	FORCEINLINE int32 LocalIndex(int32 x, int32 y) const { return (x - MinX) * SizeY + (y - MinY); }
+};
+
+// Directions of one sector towards one exit, stored as the cell each cell steps to
+struct FFlowFieldSectorField
+{
+	TArray<int32> Next;
+	uint32 LastUsed = 0;
+};
+
+
 //--------------------------FlowFieldClass-----------------------------
 
 UCLASS()
@@ -101,16 +200,30 @@ public:
 
 	AFlowField();
 	virtual void OnConstruction(const FTransform& Transform) override;
+	virtual void Tick(float DeltaSeconds) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 	UFUNCTION(CallInEditor, BlueprintCallable, Category = "FFCanvas")
 	void DrawDebug();
 
+	UFUNCTION(CallInEditor, Category = "FFCanvas", meta = (ToolTip = "Trace the grid now and store cost, height and normal in BakedGrid. Creates the asset under /Game/FlowFieldBakes if none is set"))
+	void BakeGrid();
+
 	UFUNCTION(BlueprintCallable, Category = "FFCanvas", meta = (ToolTip = "Recalculate flow field"))
 	void UpdateFlowField();
 
 	UFUNCTION(BlueprintCallable, Category = "FFCanvas", meta = (ToolTip = "Recalculate flow field periodically by timer"))
 	void TickFlowField();
 
+	UFUNCTION(BlueprintCallable, Category = "FFCanvas", meta = (ToolTip = "Swap in the result of a finished background solve. Called by Tick and TickFlowField. Returns true if a new field was published"))
+	bool PublishPendingUpdate();
+
+	UFUNCTION(BlueprintCallable, Category = "FFCanvas", meta = (ToolTip = "Change the cost of a few cells (e.g. a gate opening or closing) and repair only the part of the flow field that depends on them. 255 marks the cell as obstacle"))
+	bool SetCellCosts(const TArray<FIntPoint>& Coords, const TArray<uint8>& Costs);
+
+	UFUNCTION(BlueprintCallable, Category = "FFCanvas", meta = (ToolTip = "Hierarchical mode: compute the sectors under these locations on the next update, e.g. right after spawning"))
+	void RequestSectorsAt(const TArray<FVector>& Locations);
+
 	UFUNCTION(BlueprintCallable, Category = "FFCanvas", meta = (ToolTip = "Get the grid coordinate at the given world location"))
 	bool WorldToGridBP(UPARAM(ref) const FVector& Location, FVector2D& gridCoord);
 
@@ -164,15 +277,133 @@ public:
 	};
 
 
+	// Continuous grid coordinate of a world location, cell centers sit on whole numbers
+	FORCEINLINE FVector2f GetGridPosition(const FVector& Location) const
+	{
+		const FVector delta = Location - Packed.Origin;
+
+		// rotate into grid space
+		const float relativeX = delta.X * Packed.YawCos + delta.Y * Packed.YawSin + Packed.Offset.X;
+		const float relativeY = delta.Y * Packed.YawCos - delta.X * Packed.YawSin + Packed.Offset.Y;
+
+		return FVector2f(relativeX / Packed.CellSize - 0.5f, relativeY / Packed.CellSize - 0.5f);
+	};
+
+	// Packed runtime accessors. Index comes from GetCellIndexAtLocation and is always a valid cell when the field is packed.
+	FORCEINLINE bool GetCellIndexAtLocation(const FVector& Location, int32& OutIndex) const
+	{
+		const FVector2f gridPos = GetGridPosition(Location);
+
+		int32 gridCoordX = FMath::RoundToInt(gridPos.X);
+		int32 gridCoordY = FMath::RoundToInt(gridPos.Y);
+
+		bool bIsValidCoord = (gridCoordX >= 0 && gridCoordX < Packed.XNum) && (gridCoordY >= 0 && gridCoordY < Packed.YNum);
+
+		OutIndex = FMath::Clamp(gridCoordX, 0, Packed.XNum - 1) * Packed.YNum + FMath::Clamp(gridCoordY, 0, Packed.YNum - 1);
+
+		return bIsValidCoord && OutIndex < Packed.Num();
+	};
+
+	FORCEINLINE FVector GetCellDir(int32 Index) const
+	{
+		// 分区模式下记录被查询的分区，下次更新只计算这些分区
+		if (ActiveSectorSize > 0)
+		{
+			MarkSectorOccupied(Index);
+		}
+
+		const FFlowFieldPacked::FDir Dir = Packed.Dir[Index];
+		return FVector(Dir.X / 127.f, Dir.Y / 127.f, 0);
+	};
+
+	FORCEINLINE float GetCellHeight(int32 Index) const
+	{
+		return Packed.Type[Index] == ECellType::Empty ? -FLT_MAX : Packed.Origin.Z + Packed.Height[Index].GetFloat();
+	};
+
+	FORCEINLINE FVector GetCellNormal(int32 Index) const
+	{
+		return FFlowFieldPacked::DecodeNormal(Packed.Normal[Index]);
+	};
+
+	FORCEINLINE uint8 GetCellCost(int32 Index) const
+	{
+		return Packed.Cost[Index];
+	};
+
+	FORCEINLINE ECellType GetCellType(int32 Index) const
+	{
+		return Packed.Type[Index];
+	};
+
+	// Cell center in world space at ground height
+	FORCEINLINE FVector GetCellLocation(int32 Index) const
+	{
+		const float localX = (Index / Packed.YNum) * Packed.CellSize + (Packed.CellSize / 2.f) - Packed.Offset.X;
+		const float localY = (Index % Packed.YNum) * Packed.CellSize + (Packed.CellSize / 2.f) - Packed.Offset.Y;
+
+		return FVector(Packed.Origin.X + localX * Packed.YawCos - localY * Packed.YawSin, Packed.Origin.Y + localX * Packed.YawSin + localY * Packed.YawCos, GetCellHeight(Index));
+	};
+
+	// Direction blended bilinearly from the four cells around Location, unit length or zero. Blocked cells are left out of the blend while the agent stands on ground.
+	FVector SampleDirection(const FVector& Location) const;
+
+	// Highest ground cell under a circle of Radius around Location, false when the circle covers no ground
+	bool SampleGround(const FVector& Location, float Radius, FVector& OutLocation, FVector& OutNormal) const;
+
+	FORCEINLINE int32 GetSectorIndex(int32 Index) const
+	{
+		return (Index / Packed.YNum / ActiveSectorSize) * SectorsY + (Index % Packed.YNum) / ActiveSectorSize;
+	};
+
+	FORCEINLINE void MarkSectorOccupied(int32 Index) const
+	{
+		const int32 sector = GetSectorIndex(Index);
+		volatile int8* flag = reinterpret_cast<volatile int8*>(&SectorOccupied[sector]);
+
+		// 多数查询落在已标记的分区，先读再写避免缓存行争用
+		if (!FPlatformAtomics::AtomicRead_Relaxed(flag))
+		{
+			FPlatformAtomics::AtomicStore_Relaxed(flag, 1);
+		}
+	};
+
+	void PackCells(const TArray<FCellStruct>& InCellsArray, FFlowFieldPacked& OutPacked) const;
+
 	void InitFlowField(EInitMode InitMode);
 	void GetGoalLocation();
 	void CreateGrid();
-	void CalculateFlowField(TArray<FCellStruct>& InCurrentCellsArray);
+	void CalculateFlowField(TArray<FCellStruct>& InCurrentCellsArray, FFlowFieldSolveState& InState);
+	void LaunchAsyncSolve();
+	void BuildSlopeMask(const TArray<FCellStruct>& InCellsArray, FFlowFieldSolveState& InState) const;
+	void SolveIntegrationField(TArray<FCellStruct>& InCurrentCellsArray, FFlowFieldSolveState& InState) const;
+	void SolveIntegrationFieldLegacy(TArray<FCellStruct>& InCurrentCellsArray);
+	void SolveEikonalField(TArray<FCellStruct>& InCurrentCellsArray, const FFlowFieldSolveState& InState) const;
+	void CalculateDirections(TArray<FCellStruct>& InCurrentCellsArray, const FFlowFieldSolveState& InState) const;
+	void UpdateCellDirection(TArray<FCellStruct>& InCurrentCellsArray, const FFlowFieldSolveState& InState, int32 currentIndex) const;
+	void RunBucketQueue(TArray<FCellStruct>& InCurrentCellsArray, FFlowFieldSolveState& InState, const TArray<int32>& Seeds, TArray<int32>* OutRelaxed) const;
+	void RepairFlowField(const TArray<int32>& ChangedIndices);
+	bool CanStep(const TArray<FCellStruct>& InCellsArray, const FFlowFieldSolveState& InState, int32 currentIndex, int32 i, int32& OutNeighborIndex) const;
+	void UpdateSectors(EInitMode InitMode, bool bGridRebuilt);
+	void BuildSectors(int32 InSectorSize);
+	void EnsureSectorNodeDist(int32 SectorIndex);
+	void SolveSector(const FFlowFieldSector& Sector, const TArray<int32>& SeedCells, TArray<int32>& OutDist) const;
+	void BuildSectorField(const FFlowFieldSector& Sector, int32 ExitNode, int32 GoalIndex, FFlowFieldSectorField& OutField) const;
+
+	// Directions towards another goal on this field's cost grid, without touching the field's own solve. Safe to run on several threads at once
+	void SolveGoalField(int32 GoalIndex, TArray<FFlowFieldPacked::FDir>& OutDir) const;
+	bool IsBlockedDiagonal(const TArray<FCellStruct>& InCellsArray, int32 x, int32 y, int32 i) const;
 	void DrawCells(EInitMode InitMode);
 	void DrawArrows(EInitMode InitMode);
 	//void DrawDigits(EInitMode InitMode);
 	void UpdateTimer();
-	FCellStruct EnvQuery(const FVector2D gridCoord);
+	FCellStruct EnvQuery(const FVector2D gridCoord) const;
+	FVector GetGridCellCenter(const FVector2D gridCoord) const;
+	void PrepareEnvQuery();
+	uint32 GetGridSettingsHash() const;
+	FString GetGridCachePath() const;
+	bool LoadGridCache();
+	void SaveGridCache() const;
 
 
 	//--------------------------------------------------------Exposed To Instance Settings-----------------------------------------------------------------
@@ -219,6 +450,9 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas", meta = (ToolTip = "Which direction flowfield prefer to go ?"))
 	EStyle Style = EStyle::AdjacentFirst;
 
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas", meta = (ToolTip = "Solve a continuous arrival time field with the fast iterative method and steer along its gradient, so directions are not limited to 45 degree steps. Style is ignored. Not used in hierarchical mode"))
+	bool bEikonalSolver = false;
+
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|EnvQuery", meta = (ToolTip = "If True: Trace all cells for any given Ground Object Type and aligns it to the ground"))
 	bool traceGround = false;
 
@@ -240,6 +474,30 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (ToolTip = "Skip cells inside obstacles during calculation"))
 	bool bIgnoreInternalObstacleCells = false;
 
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (ToolTip = "Solve runtime updates on a background task into a back buffer and swap it in on a later frame. The first solve is always synchronous"))
+	bool bAsyncUpdate = false;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (ToolTip = "Solve the integration field with a bucket queue over cell indices instead of a priority queue. Same result, linear time"))
+	bool bUseBucketQueue = true;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (ToolTip = "Skip the periodic solve when the goal cell and settings are unchanged. Cost changes go through SetCellCosts, which repairs only the affected cells"))
+	bool bIncrementalUpdate = false;
+
+	UPROPERTY(EditAnywhere, Category = "FFCanvas|Performance", meta = (ToolTip = "Baked cost, height and normal grid. Used instead of tracing while its transform and grid settings match this actor"))
+	UFlowFieldBakedGrid* BakedGrid = nullptr;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (ToolTip = "In game, save the traced grid to Saved/FlowFieldCache and load it instead of tracing next time. The key covers the level, transform and grid settings but not the level geometry, run FFCanvas.ClearGridCache after editing it"))
+	bool bCacheGridToDisk = false;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (ToolTip = "Split the grid into sectors joined by portals. Only sectors that agents query get a flow field, computed towards the next portal and cached. Sectors across the exit portal of a queried sector are solved ahead, so agents keep steering when they cross"))
+	bool bHierarchical = false;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (EditCondition = "bHierarchical", ClampMin = "4", ClampMax = "256", ToolTip = "Sector edge length in cells"))
+	int32 SectorSize = 32;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (EditCondition = "bHierarchical", ClampMin = "1", ToolTip = "How many sector fields to keep cached. Fields not used by the latest update are dropped first"))
+	int32 MaxCachedSectorFields = 1024;
+
 
 	//--------------------------------------------------------Not Exposed Settings-----------------------------------------------------------------
 
@@ -274,14 +532,18 @@ public:
 
 	//--------------------------------------------------------ReadOnly-----------------------------------------------------------------
 
-	UPROPERTY(BlueprintReadOnly, VisibleDefaultsOnly, Category = "FFCanvas", meta = (ToolTip = "Store ground info"))
+	// 不再随关卡保存，网格在 OnConstruction/BeginPlay 时重建，或从 BakedGrid 读取
+	UPROPERTY(Transient, BlueprintReadOnly, VisibleDefaultsOnly, Category = "FFCanvas", meta = (ToolTip = "Store ground info"))
 	TArray<FCellStruct> InitialCellsArray;
 	//TArray<FCellStruct> InitialCellsArray;
 
-	UPROPERTY(BlueprintReadOnly, VisibleDefaultsOnly, Category = "FFCanvas", meta = (ToolTip = "Store generated flow field data"))
+	UPROPERTY(Transient, BlueprintReadOnly, VisibleDefaultsOnly, Category = "FFCanvas", meta = (ToolTip = "Store generated flow field data"))
 	TArray<FCellStruct> CurrentCellsArray;
 	//TArray<FCellStruct> CurrentCellsArray;
 
+	UPROPERTY(BlueprintReadOnly, VisibleDefaultsOnly, Category = "FFCanvas", meta = (ToolTip = "A background solve is running or waiting to be published"))
+	bool bIsUpdatePending = false;
+
 	//--------------------------------------------------------Cached-----------------------------------------------------------------
 
 	float nextTickTimeLeft = 0;
@@ -306,6 +568,40 @@ public:
 
 	UTexture2D* TransientTexture;
 
-	TAtomic<int32> TraceRemaining{ 0 };
+	// 建网格时所有格子共用的查询参数
+	FCollisionObjectQueryParams GroundObjectParams;
+	FCollisionObjectQueryParams ObstacleObjectParams;
+	FCollisionQueryParams EnvQueryParams;
+
+	FFlowFieldPacked Packed;
+
+	// 前台求解数据，与 CurrentCellsArray 对应
+	FFlowFieldSolveState Solve;
+
+	// 异步求解的后台缓冲，发布时与前台交换；格子与打包数组只在求解期间存在
+	TArray<FCellStruct> BackCellsArray;
+	FFlowFieldPacked BackPacked;
+	FFlowFieldSolveState BackSolve;
+	FGraphEventRef PendingSolve;
+
+	// 网格每次重建都会递增，坡度掩码据此判断是否过期
+	uint32 GridVersion = 1;
+
+	// 后台求解期间提交的代价修改，发布后再修复
+	TArray<int32> PendingRepairCells;
+
+	// 分区模式，ActiveSectorSize 为0表示打包缓冲来自完整求解
+	int32 ActiveSectorSize = 0;
+	int32 SectorsY = 0;
+	bool bIsSectorGraphDirty = true;
+
+	// 代价网格每次重建或修改都会递增，缓存的目标流场据此判断是否过期
+	uint32 CostVersion = 0;
+	uint32 SectorUpdateSerial = 0;
+
+	TArray<FFlowFieldSector> Sectors;
+	TArray<FFlowFieldPortalNode> PortalNodes;
+	TMap<FIntPoint, FFlowFieldSectorField> SectorFieldCache;// (sector, exit node), the goal sector uses -2 - goal cell
+	mutable TArray<uint8> SectorOccupied;
 
 };
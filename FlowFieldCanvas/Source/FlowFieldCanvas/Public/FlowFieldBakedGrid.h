@@ -0,0 +1,50 @@
+// LeroyWorks 2024 All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "Serialization/BulkData.h"
+#include "FlowFieldBakedGrid.generated.h"
+
+class AFlowField;
+struct FCellStruct;
+
+/**
+ * Baked environment query of one AFlowField: cost, type, height and normal of every cell.
+ * The channels live in a bulk data payload stored outside the export, so loading the level does not
+ * serialize any per-cell struct and the payload is only read when the field builds its grid.
+ */
+UCLASS(BlueprintType)
+class FLOWFIELDCANVAS_API UFlowFieldBakedGrid : public UObject
+{
+	GENERATED_BODY()
+
+public:
+
+	virtual void Serialize(FArchive& Ar) override;
+
+	// Fill OutCells when the bake still matches the field's transform and grid settings
+	bool Unpack(const AFlowField& FlowField, TArray<FCellStruct>& OutCells) const;
+
+	void Store(const AFlowField& FlowField, const TArray<FCellStruct>& Cells);
+
+	int64 GetBakedBytes() const;
+
+	UPROPERTY(VisibleAnywhere, Category = "FFCanvas")
+	int32 Version = 0;
+
+	UPROPERTY(VisibleAnywhere, Category = "FFCanvas")
+	int32 XNum = 0;
+
+	UPROPERTY(VisibleAnywhere, Category = "FFCanvas")
+	int32 YNum = 0;
+
+	UPROPERTY(VisibleAnywhere, Category = "FFCanvas")
+	int32 SettingsHash = 0;
+
+private:
+
+	// [height: float x N][normal: octahedral uint16 x N][cost: uint8 x N][type: uint8 x N]
+	FByteBulkData GridData;
+};
@@ -0,0 +1,108 @@
+// LeroyWorks 2024 All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Containers/Queue.h"
+#include "Misc/ScopeRWLock.h"
+#include "FlowField.h"
+#include "FlowFieldCache.generated.h"
+
+// Direction field towards one goal, solved on the cost grid of a source flow field
+struct FLOWFIELDCANVAS_API FFlowFieldGoalField
+{
+	TArray<FFlowFieldPacked::FDir> Dir;
+	FVector GoalLocation = FVector::ZeroVector;
+	int32 GoalIndex = INDEX_NONE;
+	uint32 CostVersion = 0;
+	uint32 LastUsed = 0;
+	uint32 RequestedFrame = 0;	// frame of the last re-solve request, so one goal is queued once per frame however many agents ask
+
+	// Index comes from the source field's GetCellIndexAtLocation
+	FORCEINLINE FVector GetCellDir(int32 Index) const
+	{
+		const FFlowFieldPacked::FDir CellDir = Dir[Index];
+		return FVector(CellDir.X / 127.f, CellDir.Y / 127.f, 0);
+	};
+};
+
+struct FFlowFieldGoalKey
+{
+	TObjectKey<AFlowField> Source;
+	uint64 GoalId = 0;
+
+	FORCEINLINE bool operator==(const FFlowFieldGoalKey& Other) const
+	{
+		return Source == Other.Source && GoalId == Other.GoalId;
+	}
+
+	FORCEINLINE friend uint32 GetTypeHash(const FFlowFieldGoalKey& Key)
+	{
+		return HashCombine(GetTypeHash(Key.Source), GetTypeHash(Key.GoalId));
+	}
+};
+
+/**
+ * Per-goal flow fields on demand.
+ * One placed AFlowField provides the cost grid (CreateGrid runs once for it), and any number of goals, e.g. heroes or buildings,
+ * get their own direction field without an actor of their own. Requests are collected during the frame,
+ * solved in parallel across goals on the next subsystem tick and kept in an LRU cache under a memory budget.
+ */
+UCLASS()
+class FLOWFIELDCANVAS_API UFlowFieldCache : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+	virtual void Deinitialize() override;
+
+	/**
+	 * Field towards GoalId (any stable id, e.g. a subject hash) on the cost grid of Source. Safe to call from worker threads.
+	 * Returns nullptr until the first solve for this goal has finished. When the goal moved to another cell or the costs changed,
+	 * the previous field keeps being returned until the new one is ready.
+	 */
+	const FFlowFieldGoalField* RequestField(const AFlowField* Source, uint64 GoalId, const FVector& GoalLocation);
+
+	UFUNCTION(BlueprintCallable, Category = "FFCanvas", meta = (ToolTip = "Drop all cached goal fields"))
+	void ClearCache();
+
+	UFUNCTION(BlueprintPure, Category = "FFCanvas", meta = (ToolTip = "Bytes used by cached goal fields"))
+	int64 GetCacheBytes() const;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (ClampMin = "1", ToolTip = "Least recently used goal fields are dropped once the cache grows past this size"))
+	int32 MemoryBudgetMB = 64;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "FFCanvas|Performance", meta = (ClampMin = "1", ToolTip = "Most goal fields solved per frame, in parallel"))
+	int32 MaxSolvesPerTick = 8;
+
+private:
+
+	struct FPendingRequest
+	{
+		TWeakObjectPtr<const AFlowField> Source;
+		FVector GoalLocation = FVector::ZeroVector;
+	};
+
+	struct FQueuedRequest
+	{
+		FFlowFieldGoalKey Key;
+		FPendingRequest Request;
+	};
+
+	void DrainRequestQueue();
+	void EvictOverBudget();
+
+	TMap<FFlowFieldGoalKey, FFlowFieldGoalField> Fields;
+
+	// 工作线程无锁入队，游戏线程在 Tick 中取出并按目标去重
+	TQueue<FQueuedRequest, EQueueMode::Mpsc> RequestQueue;
+
+	// 还没有缓存条目的目标各自的 RequestedFrame，首次请求同样每帧只入队一次，每次 Tick 清空
+	FRWLock MissingLock;
+	TMap<FFlowFieldGoalKey, uint32> MissingRequestedFrames;
+	TMap<FFlowFieldGoalKey, FPendingRequest> PendingRequests;
+};